@@ -16,6 +16,8 @@
     along with this program; if not, write to the Free Software
     Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
 */
+#include <limits>
+#include <vector>
 #include "ObjCryst/CrystVector/CrystVector.h"
 #include "ObjCryst/Quirks/VFNStreamFormat.h"
 #include "ObjCryst/ObjCryst/General.h"
@@ -74,8 +76,8 @@ template<class T> CrystVector<T>::~CrystVector()
 template<class T> void CrystVector<T>::operator=(const CrystVector &old)
 {
    VFN_DEBUG_MESSAGE("CrystVector<T>::operator=()",0)
+   // If this is a reference with the same size, the values are copied in place
    this->resize(old.numElements());
-   mIsAreference=false;
    T *p1=mpData;
    const T *p2=old.data();
    for(long i=0;i<mNumElements;i++) *p1++=*p2++;
@@ -376,7 +378,7 @@ template<class T> long QuickSortSubs(CrystVector<T> &vect,
                                      long last,long first, int depth)
 {
    //assert(depth++ <50);//for up to 2^50 elements
-   static long count=0;
+   static thread_local long count=0;
    long low, high;
    T tmpT, sepValeur ;
    long tmpSubs;
@@ -1218,6 +1220,462 @@ template int    MinAbs(const CrystVector_int &vector);
 template unsigned int    MinAbs(const CrystVector_uint &vector);
 template long   MinAbs(const CrystVector_long &vector);
 
+bool CholeskyDecomposition(CrystMatrix_REAL &a)
+{
+   VFN_DEBUG_ENTRY("CholeskyDecomposition()",2)
+   const long n=a.rows();
+   // Number of columns in each block: the rows of a block of columns below the
+   // diagonal stay in cache while they are used to update the rest of the matrix
+   const long nb=64;
+   REAL *p=a.data();
+   for(long k0=0;k0<n;k0+=nb)
+   {
+      const long k1=(k0+nb)<n ? k0+nb : n;
+      // Diagonal block, already updated by the previous blocks of columns
+      for(long j=k0;j<k1;j++)
+      {
+         REAL *pj=p+j*n;
+         REAL d=pj[j];
+         for(long k=k0;k<j;k++) d-=pj[k]*pj[k];
+         if(!(d>0))
+         {
+            VFN_DEBUG_EXIT("CholeskyDecomposition():not positive definite",2)
+            return false;
+         }
+         d=sqrt(d);
+         pj[j]=d;
+         for(long i=j+1;i<k1;i++)
+         {
+            REAL *pi=p+i*n;
+            REAL v=pi[j];
+            for(long k=k0;k<j;k++) v-=pi[k]*pj[k];
+            pi[j]=v/d;
+         }
+      }
+      // Rows below the diagonal block: solve L21*L11^T=A21
+      for(long i=k1;i<n;i++)
+      {
+         REAL *pi=p+i*n;
+         for(long j=k0;j<k1;j++)
+         {
+            const REAL *pj=p+j*n;
+            REAL v=pi[j];
+            for(long k=k0;k<j;k++) v-=pi[k]*pj[k];
+            pi[j]=v/pj[j];
+         }
+      }
+      // Update the rest of the lower triangle: A22 -= L21*L21^T
+      for(long i=k1;i<n;i++)
+      {
+         REAL *pi=p+i*n;
+         for(long j=k1;j<=i;j++)
+         {
+            const REAL *pj=p+j*n;
+            REAL v=0;
+            for(long k=k0;k<k1;k++) v+=pi[k]*pj[k];
+            pi[j]-=v;
+         }
+      }
+   }
+   for(long i=0;i<n;i++)
+      for(long j=i+1;j<n;j++) p[i*n+j]=0;
+   VFN_DEBUG_EXIT("CholeskyDecomposition()",2)
+   return true;
+}
+
+void CholeskyInverse(const CrystMatrix_REAL &l, CrystMatrix_REAL &inv)
+{
+   VFN_DEBUG_ENTRY("CholeskyInverse()",2)
+   const long n=l.rows();
+   // X=L^-1, computed row by row (X is lower triangular)
+   CrystMatrix_REAL x(n,n);
+   x=0;
+   for(long i=0;i<n;i++)
+   {
+      REAL * RESTRICT pxi=x.data()+i*n;
+      const REAL *pli=l.data()+i*n;
+      pxi[i]=1;
+      for(long k=0;k<i;k++)
+      {
+         const REAL a=pli[k];
+         if(a==0) continue;
+         const REAL * RESTRICT pxk=x.data()+k*n;
+         for(long j=0;j<=k;j++) pxi[j]-=a*pxk[j];
+      }
+      const REAL d=1/pli[i];
+      for(long j=0;j<=i;j++) pxi[j]*=d;
+   }
+   // inv=X^T*X, summing the contribution of each row of X to the lower triangle
+   inv.resize(n,n);
+   inv=0;
+   for(long k=0;k<n;k++)
+   {
+      const REAL * RESTRICT pxk=x.data()+k*n;
+      for(long i=0;i<=k;i++)
+      {
+         const REAL a=pxk[i];
+         if(a==0) continue;
+         REAL * RESTRICT pinv=inv.data()+i*n;
+         for(long j=0;j<=i;j++) pinv[j]+=a*pxk[j];
+      }
+   }
+   for(long i=0;i<n;i++)
+      for(long j=i+1;j<n;j++) inv(i,j)=inv(j,i);
+   VFN_DEBUG_EXIT("CholeskyInverse()",2)
+}
+
+bool BlockCholeskyInverse(const CrystMatrix_REAL &a, const CrystVector_long &block,
+                          CrystMatrix_REAL &inv)
+{
+   VFN_DEBUG_ENTRY("BlockCholeskyInverse()",2)
+   const long n=a.rows();
+   // Rows of each diagonal block, and of the border
+   std::vector<std::vector<long> > vBlock;
+   std::vector<long> vBorder;
+   for(long i=0;i<n;i++)
+   {
+      const long b=block(i);
+      if(b<0) vBorder.push_back(i);
+      else
+      {
+         if((unsigned long)b>=vBlock.size()) vBlock.resize(b+1);
+         vBlock[b].push_back(i);
+      }
+   }
+   const long ng=vBorder.size();
+   // For each diagonal block D, with C the coupling to the border:
+   //   D^-1, and Y=D^-1*C^T (nb x ng)
+   // and the Schur complement S=G-sum(C*D^-1*C^T), with G the border block.
+   std::vector<CrystMatrix_REAL> vDinv(vBlock.size()),vY(vBlock.size());
+   CrystMatrix_REAL s(ng,ng);
+   for(long i=0;i<ng;i++)
+      for(long j=0;j<ng;j++) s(i,j)=a(vBorder[i],vBorder[j]);
+   for(unsigned long ib=0;ib<vBlock.size();ib++)
+   {
+      const std::vector<long> *pRow=&(vBlock[ib]);
+      const long nb=pRow->size();
+      if(nb==0) continue;
+      CrystMatrix_REAL l(nb,nb);
+      for(long i=0;i<nb;i++)
+         for(long j=0;j<nb;j++) l(i,j)=a((*pRow)[i],(*pRow)[j]);
+      if(false==CholeskyDecomposition(l))
+      {
+         VFN_DEBUG_EXIT("BlockCholeskyInverse():not positive definite",2)
+         return false;
+      }
+      CholeskyInverse(l,vDinv[ib]);
+      // y=L^-1*C^T, by forward substitution on the rows
+      CrystMatrix_REAL *y=&(vY[ib]);
+      y->resize(nb,ng);
+      for(long i=0;i<nb;i++)
+      {
+         REAL * RESTRICT pyi=y->data()+i*ng;
+         for(long j=0;j<ng;j++) pyi[j]=a((*pRow)[i],vBorder[j]);
+         for(long k=0;k<i;k++)
+         {
+            const REAL f=l(i,k);
+            if(f==0) continue;
+            const REAL * RESTRICT pyk=y->data()+k*ng;
+            for(long j=0;j<ng;j++) pyi[j]-=f*pyk[j];
+         }
+         const REAL d=1/l(i,i);
+         for(long j=0;j<ng;j++) pyi[j]*=d;
+      }
+      // S-=(L^-1*C^T)^T*(L^-1*C^T)
+      for(long k=0;k<nb;k++)
+      {
+         const REAL * RESTRICT pyk=y->data()+k*ng;
+         for(long i=0;i<ng;i++)
+         {
+            const REAL f=pyk[i];
+            if(f==0) continue;
+            REAL * RESTRICT psi=s.data()+i*ng;
+            for(long j=0;j<ng;j++) psi[j]-=f*pyk[j];
+         }
+      }
+      // y=L^-T*(L^-1*C^T), by backward substitution
+      for(long i=nb-1;i>=0;i--)
+      {
+         REAL * RESTRICT pyi=y->data()+i*ng;
+         for(long k=i+1;k<nb;k++)
+         {
+            const REAL f=l(k,i);
+            if(f==0) continue;
+            const REAL * RESTRICT pyk=y->data()+k*ng;
+            for(long j=0;j<ng;j++) pyi[j]-=f*pyk[j];
+         }
+         const REAL d=1/l(i,i);
+         for(long j=0;j<ng;j++) pyi[j]*=d;
+      }
+   }
+   // X=S^-1
+   CrystMatrix_REAL x;
+   if(false==CholeskyDecomposition(s))
+   {
+      VFN_DEBUG_EXIT("BlockCholeskyInverse():Schur complement not positive definite",2)
+      return false;
+   }
+   CholeskyInverse(s,x);
+   // The inverse is:
+   //   border x border:  X
+   //   block  x border: -Y*X
+   //   block i x block j: Y_i*X*Y_j^T (+D_i^-1 if i==j)
+   inv.resize(n,n);
+   inv=0;
+   for(long i=0;i<ng;i++)
+      for(long j=0;j<ng;j++) inv(vBorder[i],vBorder[j])=x(i,j);
+   std::vector<CrystMatrix_REAL> vP(vBlock.size());
+   for(unsigned long ib=0;ib<vBlock.size();ib++)
+   {
+      const std::vector<long> *pRow=&(vBlock[ib]);
+      const long nb=pRow->size();
+      if(nb==0) continue;
+      // P=Y*X
+      CrystMatrix_REAL *p=&(vP[ib]);
+      p->resize(nb,ng);
+      (*p)=0;
+      for(long i=0;i<nb;i++)
+      {
+         REAL * RESTRICT ppi=p->data()+i*ng;
+         const REAL *pyi=vY[ib].data()+i*ng;
+         for(long k=0;k<ng;k++)
+         {
+            const REAL f=pyi[k];
+            if(f==0) continue;
+            const REAL * RESTRICT pxk=x.data()+k*ng;
+            for(long j=0;j<ng;j++) ppi[j]+=f*pxk[j];
+         }
+         for(long j=0;j<ng;j++)
+         {
+            inv((*pRow)[i],vBorder[j])=-ppi[j];
+            inv(vBorder[j],(*pRow)[i])=-ppi[j];
+         }
+      }
+      for(long jb=0;jb<=(long)ib;jb++)
+      {
+         const std::vector<long> *pCol=&(vBlock[jb]);
+         const long mb=pCol->size();
+         for(long i=0;i<nb;i++)
+         {
+            const REAL *ppi=p->data()+i*ng;
+            for(long j=0;j<mb;j++)
+            {
+               const REAL *pyj=vY[jb].data()+j*ng;
+               REAL v=0;
+               for(long k=0;k<ng;k++) v+=ppi[k]*pyj[k];
+               if(jb==(long)ib) v+=vDinv[ib](i,j);
+               inv((*pRow)[i],(*pCol)[j])=v;
+               inv((*pCol)[j],(*pRow)[i])=v;
+            }
+         }
+      }
+   }
+   VFN_DEBUG_EXIT("BlockCholeskyInverse()",2)
+   return true;
+}
+
+bool SymmetricEigen(const CrystMatrix_REAL &a, CrystVector_REAL &w, CrystMatrix_REAL &v)
+{
+   VFN_DEBUG_ENTRY("SymmetricEigen()",2)
+   // Householder reduction to a tridiagonal matrix (tred2, from EISPACK as in JAMA)
+   const long n=a.rows();
+   v=a;
+   w.resize(n);
+   CrystVector_REAL e(n);
+   if(n==0)
+   {
+      VFN_DEBUG_EXIT("SymmetricEigen()",2)
+      return true;
+   }
+   REAL *d=w.data();
+   for(long j=0;j<n;j++) d[j]=v(n-1,j);
+   for(long i=n-1;i>0;i--)
+   {
+      REAL scale=0,h=0;
+      for(long k=0;k<i;k++) scale+=fabs(d[k]);
+      if(scale==0)
+      {
+         e(i)=d[i-1];
+         for(long j=0;j<i;j++)
+         {
+            d[j]=v(i-1,j);
+            v(i,j)=0;
+            v(j,i)=0;
+         }
+      }
+      else
+      {
+         for(long k=0;k<i;k++)
+         {
+            d[k]/=scale;
+            h+=d[k]*d[k];
+         }
+         REAL f=d[i-1];
+         REAL g=sqrt(h);
+         if(f>0) g=-g;
+         e(i)=scale*g;
+         h-=f*g;
+         d[i-1]=f-g;
+         for(long j=0;j<i;j++) e(j)=0;
+         for(long j=0;j<i;j++)
+         {
+            f=d[j];
+            v(j,i)=f;
+            g=e(j)+v(j,j)*f;
+            for(long k=j+1;k<=i-1;k++)
+            {
+               g+=v(k,j)*d[k];
+               e(k)+=v(k,j)*f;
+            }
+            e(j)=g;
+         }
+         f=0;
+         for(long j=0;j<i;j++)
+         {
+            e(j)/=h;
+            f+=e(j)*d[j];
+         }
+         const REAL hh=f/(h+h);
+         for(long j=0;j<i;j++) e(j)-=hh*d[j];
+         for(long j=0;j<i;j++)
+         {
+            f=d[j];
+            g=e(j);
+            for(long k=j;k<=i-1;k++) v(k,j)-=(f*e(k)+g*d[k]);
+            d[j]=v(i-1,j);
+            v(i,j)=0;
+         }
+      }
+      d[i]=h;
+   }
+   // Accumulate the transformations
+   for(long i=0;i<n-1;i++)
+   {
+      v(n-1,i)=v(i,i);
+      v(i,i)=1;
+      const REAL h=d[i+1];
+      if(h!=0)
+      {
+         for(long k=0;k<=i;k++) d[k]=v(k,i+1)/h;
+         for(long j=0;j<=i;j++)
+         {
+            REAL g=0;
+            for(long k=0;k<=i;k++) g+=v(k,i+1)*v(k,j);
+            for(long k=0;k<=i;k++) v(k,j)-=g*d[k];
+         }
+      }
+      for(long k=0;k<=i;k++) v(k,i+1)=0;
+   }
+   for(long j=0;j<n;j++)
+   {
+      d[j]=v(n-1,j);
+      v(n-1,j)=0;
+   }
+   v(n-1,n-1)=1;
+   e(0)=0;
+
+   // Implicit QL iterations on the tridiagonal matrix (tql2). The rotations are
+   // applied to the rows of z=v^T, which are contiguous in memory.
+   CrystMatrix_REAL z(n,n);
+   for(long i=0;i<n;i++)
+      for(long j=0;j<n;j++) z(j,i)=v(i,j);
+   for(long i=1;i<n;i++) e(i-1)=e(i);
+   e(n-1)=0;
+   REAL f=0,tst1=0;
+   const REAL eps=std::numeric_limits<REAL>::epsilon();
+   for(long l=0;l<n;l++)
+   {
+      // Find a small sub-diagonal element
+      tst1=max(tst1,(REAL)(fabs(d[l])+fabs(e(l))));
+      long m=l;
+      while(m<n)
+      {
+         if(fabs(e(m))<=eps*tst1) break;
+         m++;
+      }
+      if(m==n) m=n-1;
+      // If m==l, d[l] is already an eigenvalue, otherwise iterate
+      if(m>l)
+      {
+         int iter=0;
+         do
+         {
+            if(++iter>30)
+            {
+               VFN_DEBUG_EXIT("SymmetricEigen():no convergence",2)
+               return false;
+            }
+            // Compute the implicit shift
+            REAL g=d[l];
+            REAL p=(d[l+1]-g)/(2*e(l));
+            REAL r=sqrt(p*p+1);
+            if(p<0) r=-r;
+            d[l]=e(l)/(p+r);
+            d[l+1]=e(l)*(p+r);
+            const REAL dl1=d[l+1];
+            REAL h=g-d[l];
+            for(long i=l+2;i<n;i++) d[i]-=h;
+            f+=h;
+            // Implicit QL transformation
+            p=d[m];
+            REAL c=1,c2=c,c3=c;
+            const REAL el1=e(l+1);
+            REAL s=0,s2=0;
+            for(long i=m-1;i>=l;i--)
+            {
+               c3=c2;
+               c2=c;
+               s2=s;
+               g=c*e(i);
+               h=c*p;
+               r=sqrt(p*p+e(i)*e(i));
+               e(i+1)=s*r;
+               s=e(i)/r;
+               c=p/r;
+               p=c*d[i]-s*g;
+               d[i+1]=h+s*(c*g+s*d[i]);
+               REAL * RESTRICT z0=z.data()+i*n;
+               REAL * RESTRICT z1=z.data()+(i+1)*n;
+               for(long k=0;k<n;k++)
+               {
+                  const REAL t=z1[k];
+                  z1[k]=s*z0[k]+c*t;
+                  z0[k]=c*z0[k]-s*t;
+               }
+            }
+            p=-s*s2*c3*el1*e(l)/dl1;
+            e(l)=s*p;
+            d[l]=c*p;
+         }
+         while(fabs(e(l))>eps*tst1);
+      }
+      d[l]+=f;
+      e(l)=0;
+   }
+   // Sort the eigenvalues and eigenvectors by increasing value
+   for(long i=0;i<n-1;i++)
+   {
+      long k=i;
+      REAL p=d[i];
+      for(long j=i+1;j<n;j++)
+         if(d[j]<p)
+         {
+            k=j;
+            p=d[j];
+         }
+      if(k!=i)
+      {
+         d[k]=d[i];
+         d[i]=p;
+         MatrixExchangeRows(z,i,k);
+      }
+   }
+   for(long i=0;i<n;i++)
+      for(long j=0;j<n;j++) v(j,i)=z(i,j);
+   VFN_DEBUG_EXIT("SymmetricEigen()",2)
+   return true;
+}
+
 //######################################################################
 //  CubicSpline
 //######################################################################
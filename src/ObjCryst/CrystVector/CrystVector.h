@@ -137,10 +137,10 @@ template<class T> class CrystVector
       if(mNumElements != old.numElements())
       {
          mNumElements = old.numElements();
-         delete[] mpData;
+         if(!mIsAreference) delete[] mpData;
          mpData=new T[mNumElements];
+         mIsAreference=false;
       };
-      mIsAreference=false;
       T *p1=mpData;
       const U *p2=old.data();
       for(long i=0;i<mNumElements;i++) *p1++ = (T) *p2++;
@@ -557,6 +557,41 @@ template<class T> T MaxAbs(const CrystVector_T &vector);
 ///Minimum absolute value of vector
 template<class T> T MinAbs(const CrystVector_T &vector);
 
+/** Cholesky decomposition of a symmetric positive definite matrix, a=L*L^T,
+* computed by blocks which stay in cache.
+*
+* Only the lower triangle of \b a is used, and it is replaced by L (the upper
+* triangle is set to 0).
+* \return false if the matrix is not positive definite (\b a is then
+* partially modified)
+*/
+bool CholeskyDecomposition(CrystMatrix_REAL &a);
+/// Inverse of a symmetric positive definite matrix, from its Cholesky
+/// decomposition L (see CholeskyDecomposition())
+void CholeskyInverse(const CrystMatrix_REAL &l, CrystMatrix_REAL &inv);
+/** Inverse of a symmetric positive definite matrix with a block structure: the
+* rows (and columns) are either in one of several diagonal blocks, or in a border
+* coupled to all the others. The elements between two different diagonal blocks
+* must be null. Each diagonal block and the border (Schur complement) are
+* decomposed separately with CholeskyDecomposition(), so that the cost is
+* proportional to the size of the border rather than to the size of the matrix.
+*
+* \param block: for each row, the index of its diagonal block, or -1 for the border.
+* The rows of a block do not need to be contiguous.
+* \return false if the matrix is not positive definite
+*/
+bool BlockCholeskyInverse(const CrystMatrix_REAL &a, const CrystVector_long &block,
+                          CrystMatrix_REAL &inv);
+/** Eigenvalues and eigenvectors of a real symmetric matrix, a=v*diag(w)*v^T,
+* using a Householder reduction to a tridiagonal matrix followed by the
+* implicit QL algorithm.
+*
+* \param w: the eigenvalues, sorted by increasing value
+* \param v: the eigenvectors, stored in the columns
+* \return false if the QL iterations did not converge
+*/
+bool SymmetricEigen(const CrystMatrix_REAL &a, CrystVector_REAL &w, CrystMatrix_REAL &v);
+
 //######################################################################
 //  CubicSpline
 //######################################################################
@@ -98,6 +98,21 @@ Atom* Atom::CreateCopy() const
    return new Atom(*this);
 }
 
+Atom* Atom::Clone(std::map<const RefinableObj*,RefinableObj*> &vCopy)const
+{
+   VFN_DEBUG_MESSAGE("Atom::Clone():/Name="<<mName,10)
+   const ScatteringPower *pPow=mpScattPowAtom;
+   if(pPow!=0)
+   {
+      const ScatteringPower *pNewPow=FindCopy(*pPow,vCopy);
+      if(pNewPow!=0) pPow=pNewPow;
+   }
+   Atom *p=new Atom(mXYZ(0),mXYZ(1),mXYZ(2),mName,pPow,mOccupancy);
+   vCopy[this]=p;
+   p->CopyParAndOptions(*this);
+   return p;
+}
+
 
 Atom::~Atom()
 {
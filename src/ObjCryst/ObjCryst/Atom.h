@@ -86,6 +86,7 @@ class Atom: public Scatterer
       /// Copy constructor
       Atom(const Atom &old);
       virtual Atom* CreateCopy() const;
+      virtual Atom* Clone(std::map<const RefinableObj*,RefinableObj*> &vCopy)const;
       /// Destructor...
      ~Atom();
       virtual const string& GetClassName() const;
@@ -1111,16 +1111,7 @@ Crystal* CreateCrystalFromCIF(CIF &cif,const bool verbose,const bool checkSymAsX
          {// Could not use a Hall symbol, but we have a list of symmetry_equiv_pos_as_xyz,
           // so check we have used the best possible origin
             tmp_C_Numeric_locale tmploc;
-            static vector<string> origin_list;
-            if(origin_list.size()==0)
-            {//ugly ?
-               origin_list.resize(5);
-               origin_list[0]="";
-               origin_list[1]=":1";
-               origin_list[2]=":2";
-               origin_list[3]=":R";
-               origin_list[4]=":H";
-            }
+            static const vector<string> origin_list={"",":1",":2",":R",":H"};
             // If we do not have an HM symbol, then use the one generated by cctbx (normally from spg number)
             string hmorig=pos->second.mSpacegroupHermannMauguin;
             if(hmorig=="") hmorig=pCryst->GetSpaceGroup().GetCCTbxSpg().match_tabulated_settings().hermann_mauguin();
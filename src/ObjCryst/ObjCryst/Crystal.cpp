@@ -24,7 +24,9 @@
 #include <cmath>
 #include <set>
 #include <vector>
+#include <algorithm>
 #include <typeinfo>
+#include <mutex>
 #include <boost/format.hpp>
 
 #include "cctbx/sgtbx/space_group.h"
@@ -32,6 +34,8 @@
 #include "ObjCryst/ObjCryst/Crystal.h"
 #include "ObjCryst/ObjCryst/Molecule.h"
 #include "ObjCryst/ObjCryst/Atom.h"
+#include "ObjCryst/RefinableObj/Random.h"
+#include "ObjCryst/RefinableObj/Profiler.h"
 
 #include "ObjCryst/Quirks/VFNStreamFormat.h" //simple formatting of integers, REALs..
 #include "ObjCryst/Quirks/VFNDebug.h"
@@ -52,12 +56,13 @@ long NiftyStaticGlobalObjectsInitializer_Crystal::mCount=0;
 //    CRYSTAL : the crystal (Unit cell, spaceGroup, scatterers)
 //
 ////////////////////////////////////////////////////////////////////////
-ObjRegistry<Crystal> gCrystalRegistry("List of all Crystals");
+ObjRegistry<Crystal> gCrystalRegistry("List of all Crystals",true);
 
 Crystal::Crystal():
 mScattererRegistry("List of Crystal Scatterers"),
 mBumpMergeCost(0.0),mBumpMergeScale(1.0),
-mDistTableMaxDistance(1.0),
+mDistTableMaxDistance(1.0),mDistTableLastMaxDistance(-1),mDistTableVersion(0),
+mBumpMergeCostVersion(0),
 mScatteringPowerRegistry("List of Crystal ScatteringPowers"),
 mBondValenceCost(0.0),mBondValenceCostScale(1.0),mDeleteSubObjInDestructor(1)
 {
@@ -74,7 +79,8 @@ mBondValenceCost(0.0),mBondValenceCostScale(1.0),mDeleteSubObjInDestructor(1)
 Crystal::Crystal(const REAL a, const REAL b, const REAL c, const string &SpaceGroupId):
 mScattererRegistry("List of Crystal Scatterers"),
 mBumpMergeCost(0.0),mBumpMergeScale(1.0),
-mDistTableMaxDistance(1.0),
+mDistTableMaxDistance(1.0),mDistTableLastMaxDistance(-1),mDistTableVersion(0),
+mBumpMergeCostVersion(0),
 mScatteringPowerRegistry("List of Crystal ScatteringPowers"),
 mBondValenceCost(0.0),mBondValenceCostScale(1.0),mDeleteSubObjInDestructor(1)
 {
@@ -92,7 +98,8 @@ Crystal::Crystal(const REAL a, const REAL b, const REAL c, const REAL alpha,
               const REAL beta, const REAL gamma,const string &SpaceGroupId):
 mScattererRegistry("List of Crystal Scatterers"),
 mBumpMergeCost(0.0),mBumpMergeScale(1.0),
-mDistTableMaxDistance(1.0),
+mDistTableMaxDistance(1.0),mDistTableLastMaxDistance(-1),mDistTableVersion(0),
+mBumpMergeCostVersion(0),
 mScatteringPowerRegistry("List of Crystal ScatteringPowers"),
 mBondValenceCost(0.0),mBondValenceCostScale(1.0),mDeleteSubObjInDestructor(1)
 {
@@ -109,7 +116,8 @@ mBondValenceCost(0.0),mBondValenceCostScale(1.0),mDeleteSubObjInDestructor(1)
 Crystal::Crystal(const Crystal &old):
 mScattererRegistry("List of Crystal Scatterers"),
 mBumpMergeCost(0.0),mBumpMergeScale(1.0),
-mDistTableMaxDistance(1.0),
+mDistTableMaxDistance(1.0),mDistTableLastMaxDistance(-1),mDistTableVersion(0),
+mBumpMergeCostVersion(0),
 mScatteringPowerRegistry("List of Crystal ScatteringPowers"),
 mBondValenceCost(0.0),mBondValenceCostScale(1.0),mDeleteSubObjInDestructor(1)
 {
@@ -129,6 +137,40 @@ mBondValenceCost(0.0),mBondValenceCostScale(1.0),mDeleteSubObjInDestructor(1)
    this->XMLInput(sst,tag);
 }
 
+Crystal* Crystal::Clone(std::map<const RefinableObj*,RefinableObj*> &vCopy)const
+{
+   VFN_DEBUG_ENTRY("Crystal::Clone():"<<this->GetName(),5)
+   Crystal *p=new Crystal(this->GetLatticePar(0),this->GetLatticePar(1),this->GetLatticePar(2),
+                          this->GetLatticePar(3),this->GetLatticePar(4),this->GetLatticePar(5),
+                          this->GetSpaceGroup().GetName());
+   p->SetName(this->GetName());
+   vCopy[this]=p;
+   for(long i=0;i<mScatteringPowerRegistry.GetNb();i++)
+      p->AddScatteringPower(mScatteringPowerRegistry.GetObj(i).Clone(vCopy));
+   for(long i=0;i<mScattererRegistry.GetNb();i++)
+      p->AddScatterer(mScattererRegistry.GetObj(i).Clone(vCopy));
+   // Only pairs of this Crystal's scattering powers can be remapped
+   for(VBumpMergePar::const_iterator pos=mvBumpMergePar.begin();pos!=mvBumpMergePar.end();++pos)
+   {
+      const ScatteringPower *pPow1=FindCopy(*(pos->first.first),vCopy);
+      const ScatteringPower *pPow2=FindCopy(*(pos->first.second),vCopy);
+      if((pPow1!=0)&&(pPow2!=0))
+         p->SetBumpMergeDistance(*pPow1,*pPow2,sqrt(pos->second.mDist2),pos->second.mCanOverlap);
+   }
+   map<pair<const ScatteringPower*,const ScatteringPower*>, REAL>::const_iterator pos;
+   for(pos=mvBondValenceRo.begin();pos!=mvBondValenceRo.end();++pos)
+   {
+      const ScatteringPower *pPow1=FindCopy(*(pos->first.first),vCopy);
+      const ScatteringPower *pPow2=FindCopy(*(pos->first.second),vCopy);
+      if((pPow1!=0)&&(pPow2!=0)) p->AddBondValenceRo(*pPow1,*pPow2,pos->second);
+   }
+   p->mBumpMergeScale=mBumpMergeScale;
+   p->mBondValenceCostScale=mBondValenceCostScale;
+   p->CopyParAndOptions(*this);
+   VFN_DEBUG_EXIT("Crystal::Clone():"<<this->GetName(),5)
+   return p;
+}
+
 Crystal::~Crystal()
 {
    VFN_DEBUG_ENTRY("Crystal::~Crystal()",5)
@@ -879,31 +921,57 @@ REAL Crystal::GetBumpMergeCost() const
    if(  (mBumpMergeCostClock>mBumpMergeParClock)
       &&(mBumpMergeCostClock>mDistTableClock)) return mBumpMergeCost*mBumpMergeScale;
    TAU_PROFILE("Crystal::GetBumpMergeCost()","REAL (REAL)",TAU_DEFAULT);
+   OBJCRYST_PROFILE("Crystal::GetBumpMergeCost")
+
+   // Only recompute the cost of the atoms whose list of neighbours changed
+   bool fullUpdate=mvBumpMergeCost.size()!=mvDistTableSq.size();
+   const unsigned long nbPow=mvDistTableScattPow.size();
+   if(  (mBumpMergeParMatrixClock<mBumpMergeParClock)
+      ||(mvBumpMergeParMatrix.size()!=nbPow*nbPow))
+   {// Anti-bump parameters for all pairs of scattering powers
+      BumpMergePar none;
+      none.mDist2=-1;
+      mvBumpMergeParMatrix.assign(nbPow*nbPow,none);
+      for(unsigned long i1=0;i1<nbPow;i1++)
+         for(unsigned long i2=0;i2<nbPow;i2++)
+         {
+            const ScatteringPower *p1=mvDistTableScattPow[i1],*p2=mvDistTableScattPow[i2];
+            VBumpMergePar::const_iterator par;
+            if(p1<p2) par=mvBumpMergePar.find(std::make_pair(p1,p2));
+            else par=mvBumpMergePar.find(std::make_pair(p2,p1));
+            if(par!=mvBumpMergePar.end()) mvBumpMergeParMatrix[i1*nbPow+i2]=par->second;
+         }
+      mBumpMergeParMatrixClock.Click();
+      fullUpdate=true;
+   }
+   mvBumpMergeCost.resize(mvDistTableSq.size());
 
    mBumpMergeCost=0;
 
-   std::vector<NeighbourHood>::const_iterator pos;
    std::vector<Crystal::Neighbour>::const_iterator neigh;
    REAL tmp;
-   const ScatteringPower *i1,*i2;
-   VBumpMergePar::const_iterator par;
-   for(pos=mvDistTableSq.begin();pos<mvDistTableSq.end();pos++)
+   for(unsigned long i=0;i<mvDistTableSq.size();i++)
    {
-      i1=mScattCompList(pos->mIndex).mpScattPow;
-      for(neigh=pos->mvNeighbour.begin();neigh<pos->mvNeighbour.end();neigh++)
+      const NeighbourHood *pos=&(mvDistTableSq[i]);
+      if(fullUpdate || (pos->mVersion>mBumpMergeCostVersion))
       {
-         i2=mScattCompList(neigh->mNeighbourIndex).mpScattPow;
-         if(i1<i2) par=mvBumpMergePar.find(std::make_pair(i1,i2));
-         else par=mvBumpMergePar.find(std::make_pair(i2,i1));
-         if(par==mvBumpMergePar.end()) continue;
-         if(neigh->mDist2 > par->second.mDist2) continue;
-         if(true==par->second.mCanOverlap)
-            tmp = 0.5*sin(M_PI*(1.-sqrt(neigh->mDist2/par->second.mDist2)))/0.1;
-         else
-            tmp = tan(M_PI*0.49999*(1.-sqrt(neigh->mDist2/par->second.mDist2)))/0.1;
-         mBumpMergeCost += tmp*tmp;
+         const BumpMergePar *pPar=&(mvBumpMergeParMatrix[pos->mScattPowIndex*nbPow]);
+         REAL cost=0;
+         for(neigh=pos->mvNeighbour.begin();neigh<pos->mvNeighbour.end();neigh++)
+         {
+            const BumpMergePar *par=pPar+mvDistTableSq[neigh->mNeighbourIndex].mScattPowIndex;
+            if(neigh->mDist2 > par->mDist2) continue;
+            if(true==par->mCanOverlap)
+               tmp = 0.5*sin(M_PI*(1.-sqrt(neigh->mDist2/par->mDist2)))/0.1;
+            else
+               tmp = tan(M_PI*0.49999*(1.-sqrt(neigh->mDist2/par->mDist2)))/0.1;
+            cost += tmp*tmp;
+         }
+         mvBumpMergeCost[i]=cost;
       }
+      mBumpMergeCost+=mvBumpMergeCost[i];
    }
+   mBumpMergeCostVersion=mDistTableVersion;
    mBumpMergeCost *= this->GetSpaceGroup().GetNbSymmetrics();
    mBumpMergeCostClock.Click();
    VFN_DEBUG_EXIT("Crystal::GetBumpMergeCost():"<<mBumpMergeCost,4)
@@ -940,7 +1008,12 @@ void Crystal::RemoveBumpMergeDistance(const ScatteringPower &scatt1,
 }
 
 const Crystal::VBumpMergePar& Crystal::GetBumpMergeParList()const{return mvBumpMergePar;}
-Crystal::VBumpMergePar& Crystal::GetBumpMergeParList(){return mvBumpMergePar;}
+Crystal::VBumpMergePar& Crystal::GetBumpMergeParList()
+{
+   // The list may be modified
+   mBumpMergeParClock.Click();
+   return mvBumpMergePar;
+}
 
 const RefinableObjClock& Crystal::GetClockScattererList()const {return mClockScattererList;}
 
@@ -951,12 +1024,12 @@ void Crystal::GlobalOptRandomMove(const REAL mutationAmplitude,
    VFN_DEBUG_ENTRY("Crystal::GlobalOptRandomMove()",2)
    //Either a random move or a permutation of two scatterers
    const unsigned long nb=(unsigned long)this->GetNbScatterer();
-   if( ((rand()/(REAL)RAND_MAX)<.02) && (nb>1))
+   if( (RandomUniform()<.02) && (nb>1))
    {
       // This is safe even if one scatterer is partially fixed,
       // since we the SetX/SetY/SetZ actually use the MutateTo() function.
-      const unsigned long n1=rand()%nb;
-      const unsigned long n2=(  (rand()%(nb-1)) +n1+1) %nb;
+      const unsigned long n1=RandomInteger(nb);
+      const unsigned long n2=(  RandomInteger(nb-1) +n1+1) %nb;
       const float x1=this->GetScatt(n1).GetX();
       const float y1=this->GetScatt(n1).GetY();
       const float z1=this->GetScatt(n1).GetZ();
@@ -1273,6 +1346,7 @@ REAL Crystal::GetBondValenceCost() const
       &&(mBondValenceCostClock>this->GetMasterClockScatteringPower())) return mBondValenceCost*mBondValenceCostScale;
    VFN_DEBUG_MESSAGE("Crystal::GetBondValenceCost():"<<mvBondValenceCalc.size()<<" valences",4)
    TAU_PROFILE("Crystal::GetBondValenceCost()","REAL ()",TAU_DEFAULT);
+   OBJCRYST_PROFILE("Crystal::GetBondValenceCost")
    mBondValenceCost=0.0;
    std::map<long, REAL>::const_iterator pos;
    for(pos=mvBondValenceCalc.begin();pos!=mvBondValenceCalc.end();++pos)
@@ -1814,9 +1888,9 @@ void Crystal::InitOptions()
    static string DisplayEnantiomername;
    static string DisplayEnantiomerchoices[2];
 
-   static bool needInitNames=true;
-   if(true==needInitNames)
-   {
+   static std::once_flag needInitNames;
+   std::call_once(needInitNames,[]()
+   {// Only once for the class
       UseDynPopCorrname="Use Dynamical Occupancy Correction";
       UseDynPopCorrchoices[0]="No";
       UseDynPopCorrchoices[1]="Yes";
@@ -1824,9 +1898,7 @@ void Crystal::InitOptions()
       DisplayEnantiomername="Display Enantiomer";
       DisplayEnantiomerchoices[0]="No";
       DisplayEnantiomerchoices[1]="Yes";
-
-      needInitNames=false;//Only once for the class
-   }
+   });
    VFN_DEBUG_MESSAGE("Crystal::Init(a,b,c,alpha,beta,gamma,Sg,name):Init options",5)
    mUseDynPopCorr.Init(2,&UseDynPopCorrname,UseDynPopCorrchoices);
    mUseDynPopCorr.SetChoice(1);
@@ -1843,19 +1915,46 @@ Crystal::Neighbour::Neighbour(const unsigned long neighbourIndex,const int sym,
 mNeighbourIndex(neighbourIndex),mNeighbourSymmetryIndex(sym),mDist2(dist2)
 {}
 
-struct DistTableInternalPosition
+/** \internal Index of the cells neighbouring cell c (including c) along one axis of
+* a periodic grid with n cells. Returns the number of neighbour cells (3, or n if n<3).
+*/
+static int NeighbourCells(const int c,const int n,int *v)
 {
-   DistTableInternalPosition(const long atomIndex, const int sym,
-                             const REAL x,const REAL y,const REAL z):
-   mAtomIndex(atomIndex),mSymmetryIndex(sym),mX(x),mY(y),mZ(z)
-   {}
-   /// Index of the atom (order) in the component list
-   long mAtomIndex;
-   /// Which symmetry operation does this symmetric correspond to ?
-   int mSymmetryIndex;
-   /// Fractionnal coordinates
-   REAL mX,mY,mZ;
-};
+   if(n<3)
+   {
+      for(int k=0;k<n;k++) v[k]=k;
+      return n;
+   }
+   v[0]=(c+n-1)%n;
+   v[1]=c;
+   v[2]=(c+1)%n;
+   return 3;
+}
+
+/** \internal Get the list of objects in cell c and its neighbours, for a periodic grid
+* of n0*n1*n2 cells. vFirst gives the index in vIndex of the first object of each cell.
+* If sorted is true, the list is sorted by increasing index.
+*/
+static void GetCellListCandidates(const int c,const int n0,const int n1,const int n2,
+                                  const std::vector<unsigned long> &vFirst,
+                                  const std::vector<unsigned long> &vIndex,
+                                  std::vector<unsigned long> &vCandidate,const bool sorted)
+{
+   vCandidate.clear();
+   int v0[3],v1[3],v2[3];
+   const int nb0=NeighbourCells(c/(n1*n2),n0,v0);
+   const int nb1=NeighbourCells((c/n2)%n1,n1,v1);
+   const int nb2=NeighbourCells(c%n2,n2,v2);
+   for(int k0=0;k0<nb0;k0++)
+      for(int k1=0;k1<nb1;k1++)
+         for(int k2=0;k2<nb2;k2++)
+         {
+            const int cc=(v0[k0]*n1+v1[k1])*n2+v2[k2];
+            vCandidate.insert(vCandidate.end(),vIndex.begin()+vFirst[cc],vIndex.begin()+vFirst[cc+1]);
+         }
+   // Objects are sorted within each cell
+   if(sorted && ((nb0*nb1*nb2)>1)) std::sort(vCandidate.begin(),vCandidate.end());
+}
 
 void Crystal::CalcDistTable(const bool fast) const
 {
@@ -1869,16 +1968,97 @@ void Crystal::CalcDistTable(const bool fast) const
    if(  (mDistTableClock>mClockScattCompList)
       &&(mDistTableClock>this->GetClockMetricMatrix())) return;
    VFN_DEBUG_ENTRY("Crystal::CalcDistTable(fast="<<fast<<"),maxDist="<<mDistTableMaxDistance,4)
+   TAU_PROFILE("Crystal::CalcDistTable(fast=true)","Matrix (string&)",TAU_DEFAULT);
+   OBJCRYST_PROFILE("Crystal::CalcDistTable")
 
    const long nbComponent=mScattCompList.GetNbComponent();
 
+   // Everything is recomputed if the lattice, the spacegroup, the maximum distance
+   // or the number of atoms changed
+   bool fullUpdate=  ((long)mvDistTableSq.size()!=nbComponent)
+                   ||(mDistTableClock<this->GetClockMetricMatrix())
+                   ||(mDistTableClock<this->GetSpaceGroup().GetClockSpaceGroup())
+                   ||(mDistTableLastMaxDistance!=mDistTableMaxDistance);
    mvDistTableSq.resize(nbComponent);
+   // The atoms which moved (or changed their scattering power) since the last update
+   std::vector<long> vChanged;
+   if(!fullUpdate)
+   {
+      for(long i=0;i<nbComponent;i++)
+      {
+         const ScatteringComponent *pComp=&(mScattCompList(i));
+         const NeighbourHood *pN=&(mvDistTableSq[i]);
+         if(  (pComp->mX!=pN->mX)||(pComp->mY!=pN->mY)||(pComp->mZ!=pN->mZ)
+            ||(pComp->mpScattPow!=pN->mpScattPow)) vChanged.push_back(i);
+      }
+      // It is faster to recompute all the table if many atoms moved
+      if((4*vChanged.size())>(unsigned long)nbComponent) fullUpdate=true;
+   }
+   if(fullUpdate)
+   {
+      vChanged.resize(nbComponent);
+      for(long i=0;i<nbComponent;i++) vChanged[i]=i;
+   }
+   if(vChanged.size()==0)
+   {
+      mDistTableClock.Click();
+      VFN_DEBUG_EXIT("Crystal::CalcDistTable():no atom moved",4)
+      return;
+   }
+   std::vector<bool> vIsChanged(nbComponent,false);
+   for(std::vector<long>::const_iterator pos=vChanged.begin();pos!=vChanged.end();++pos)
+      vIsChanged[*pos]=true;
+   mDistTableVersion++;
+   VFN_DEBUG_MESSAGE("Crystal::CalcDistTable():1, updating "<<vChanged.size()<<" atoms",3)
+
+   // Atoms which did not move, but which lost or gained neighbours
+   std::vector<long> vModified;
+   std::vector<bool> vIsModified(nbComponent,false);
+   if(fullUpdate)
    {
-      std::vector<NeighbourHood>::iterator pos;
-      for(pos=mvDistTableSq.begin();pos<mvDistTableSq.end();pos++)
+      for(std::vector<NeighbourHood>::iterator pos=mvDistTableSq.begin();pos!=mvDistTableSq.end();++pos)
+      {
          pos->mvNeighbour.clear();
+         pos->mvNeighbourOf.clear();
+      }
+   }
+   else
+   {// Remove the atoms which moved from the lists of neighbours
+      for(std::vector<long>::const_iterator pos=vChanged.begin();pos!=vChanged.end();++pos)
+      {
+         const long c=*pos;
+         NeighbourHood *pN=&(mvDistTableSq[c]);
+         for(std::vector<Crystal::Neighbour>::const_iterator neigh=pN->mvNeighbour.begin();
+             neigh!=pN->mvNeighbour.end();++neigh)
+         {// The neighbours of an atom are consecutive
+            if(  (neigh!=pN->mvNeighbour.begin())
+               &&((neigh-1)->mNeighbourIndex==neigh->mNeighbourIndex)) continue;
+            std::vector<unsigned long> *pv=&(mvDistTableSq[neigh->mNeighbourIndex].mvNeighbourOf);
+            std::vector<unsigned long>::iterator p=std::find(pv->begin(),pv->end(),(unsigned long)c);
+            if(p!=pv->end())
+            {
+               *p=pv->back();
+               pv->pop_back();
+            }
+         }
+         pN->mvNeighbour.clear();
+         for(std::vector<unsigned long>::const_iterator i=pN->mvNeighbourOf.begin();
+             i!=pN->mvNeighbourOf.end();++i)
+         {
+            if(vIsChanged[*i]) continue;
+            std::vector<Crystal::Neighbour> *pv=&(mvDistTableSq[*i].mvNeighbour);
+            pv->erase(std::remove_if(pv->begin(),pv->end(),
+                                     [c](const Crystal::Neighbour &n){return n.mNeighbourIndex==(unsigned long)c;}),
+                      pv->end());
+            if(!vIsModified[*i])
+            {
+               vIsModified[*i]=true;
+               vModified.push_back(*i);
+            }
+         }
+         pN->mvNeighbourOf.clear();
+      }
    }
-   VFN_DEBUG_MESSAGE("Crystal::CalcDistTable():1",3)
 
    // Get range and origin of the (pseudo) asymmetric unit
       const REAL asux0=this->GetSpaceGroup().GetAsymUnit().Xmin();
@@ -1901,178 +2081,274 @@ void Crystal::CalcDistTable(const bool fast) const
       const REAL maxdy=halfasuyrange+mDistTableMaxDistance/GetLatticePar(1);
       const REAL maxdz=halfasuzrange+mDistTableMaxDistance/GetLatticePar(2);
 
-   // List of all positions within or near the first atom generated
-   std::vector<DistTableInternalPosition> vPos;
-   // index of unique atoms in vPos, which are strictly in the asymmetric unit
-   std::vector<unsigned long> vUniqueIndex(nbComponent);
-
    const REAL asymUnitMargin2 = mDistTableMaxDistance*mDistTableMaxDistance;
 
-   if(true)//(true==fast)
-   {
-      VFN_DEBUG_MESSAGE("Crystal::CalcDistTable(fast):2",3)
-      TAU_PROFILE("Crystal::CalcDistTable(fast=true)","Matrix (string&)",TAU_DEFAULT);
-      TAU_PROFILE_TIMER(timer1,"DiffractionData::CalcDistTable1","", TAU_FIELD);
-      TAU_PROFILE_TIMER(timer2,"DiffractionData::CalcDistTable2","", TAU_FIELD);
+   TAU_PROFILE_TIMER(timer1,"DiffractionData::CalcDistTable1","", TAU_FIELD);
+   TAU_PROFILE_TIMER(timer2,"DiffractionData::CalcDistTable2","", TAU_FIELD);
 
-      TAU_PROFILE_START(timer1);
+   TAU_PROFILE_START(timer1);
 
-      // No need to loop on a,b,c translations if mDistTableMaxDistance is small enough
-      bool loopOnLattice=true;
-      if(  ((this->GetLatticePar(0)*.5)>mDistTableMaxDistance)
-         &&((this->GetLatticePar(1)*.5)>mDistTableMaxDistance)
-         &&((this->GetLatticePar(2)*.5)>mDistTableMaxDistance)) loopOnLattice=false;
+   // No need to loop on a,b,c translations if mDistTableMaxDistance is small enough
+   bool loopOnLattice=true;
+   if(  ((this->GetLatticePar(0)*.5)>mDistTableMaxDistance)
+      &&((this->GetLatticePar(1)*.5)>mDistTableMaxDistance)
+      &&((this->GetLatticePar(2)*.5)>mDistTableMaxDistance)) loopOnLattice=false;
 
-      CrystMatrix_REAL symmetricsCoords;
+   CrystMatrix_REAL symmetricsCoords;
 
-      const int nbSymmetrics=this->GetSpaceGroup().GetNbSymmetrics(false,false);
+   const int nbSymmetrics=this->GetSpaceGroup().GetNbSymmetrics(false,false);
 
-      // Get the list of all atoms within or near the asymmetric unit
-      for(long i=0;i<nbComponent;i++)
+   // Get the list of all symmetrics within or near the asymmetric unit, for the atoms which moved
+   for(std::vector<long>::const_iterator pos=vChanged.begin();pos!=vChanged.end();++pos)
+   {
+      const long i=*pos;
+      VFN_DEBUG_MESSAGE("Crystal::CalcDistTable(fast):3:component "<<i,0)
+      const ScatteringComponent *pComp=&(mScattCompList(i));
+      NeighbourHood *pN=&(mvDistTableSq[i]);
+      pN->mIndex=i;
+      pN->mX=pComp->mX;
+      pN->mY=pComp->mY;
+      pN->mZ=pComp->mZ;
+      pN->mpScattPow=pComp->mpScattPow;
+      pN->mScattPowIndex=std::find(mvDistTableScattPow.begin(),mvDistTableScattPow.end(),pComp->mpScattPow)
+                         -mvDistTableScattPow.begin();
+      if(pN->mScattPowIndex==mvDistTableScattPow.size()) mvDistTableScattPow.push_back(pComp->mpScattPow);
+      pN->mVersion=mDistTableVersion;
+      pN->mvPos.clear();
+      // generate all symmetrics, excluding translations
+      symmetricsCoords=this->GetSpaceGroup().GetAllSymmetrics(pComp->mX,pComp->mY,pComp->mZ,
+                                                              false,false,false);
+      bool hasUnique=false;
+      for(int j=0;j<nbSymmetrics;j++)
       {
-         VFN_DEBUG_MESSAGE("Crystal::CalcDistTable(fast):3:component "<<i,0)
-         // generate all symmetrics, excluding translations
-         symmetricsCoords=this->GetSpaceGroup().GetAllSymmetrics(mScattCompList(i).mX,
-                                                                 mScattCompList(i).mY,
-                                                                 mScattCompList(i).mZ,
-                                                                 false,false,false);
-         mvDistTableSq[i].mIndex=i;//USELESS ?
-         bool hasUnique=false;
-         for(int j=0;j<nbSymmetrics;j++)
+         // take the closest position (using lattice translations) to the center of the ASU
+         REAL x=fmod(symmetricsCoords(j,0)-asuxc,(REAL)1.0);if(x<-.5)x+=1;else if(x>.5)x-=1;
+         REAL y=fmod(symmetricsCoords(j,1)-asuyc,(REAL)1.0);if(y<-.5)y+=1;else if(y>.5)y-=1;
+         REAL z=fmod(symmetricsCoords(j,2)-asuzc,(REAL)1.0);if(z<-.5)z+=1;else if(z>.5)z-=1;
+
+         if( (abs(x)<maxdx) && (abs(y)<maxdy) && (abs(z)<maxdz) )
          {
-            // take the closest position (using lattice translations) to the center of the ASU
-            REAL x=fmod(symmetricsCoords(j,0)-asuxc,(REAL)1.0);if(x<-.5)x+=1;else if(x>.5)x-=1;
-            REAL y=fmod(symmetricsCoords(j,1)-asuyc,(REAL)1.0);if(y<-.5)y+=1;else if(y>.5)y-=1;
-            REAL z=fmod(symmetricsCoords(j,2)-asuzc,(REAL)1.0);if(z<-.5)z+=1;else if(z>.5)z-=1;
-
-            //cout<<i<<","<<j<<":"<<FormatFloat(x,8,5)<<","<<FormatFloat(y,8,5)<<","<<FormatFloat(z,8,5)<<endl;
-            if( (abs(x)<maxdx) && (abs(y)<maxdy) && (abs(z)<maxdz) )
-               vPos.push_back(DistTableInternalPosition(i, j, x+asuxc, y+asuyc, z+asuzc));
-            // Get one reference atom strictly within the pseudo-ASU
-            if(!hasUnique)
-               if( (abs(x)<halfasuxrange) && (abs(y)<halfasuyrange) && (abs(z)<halfasuzrange) )
-               {
-                  hasUnique=true;
-                  vUniqueIndex[i]=vPos.size()-1;
-                  mvDistTableSq[i].mUniquePosSymmetryIndex=j;
-               }
+            DistTablePosition p;
+            p.mSymmetryIndex=j;
+            p.mX=x+asuxc;
+            p.mY=y+asuyc;
+            p.mZ=z+asuzc;
+            pN->mvPos.push_back(p);
          }
+         // Get one reference atom strictly within the pseudo-ASU
          if(!hasUnique)
-         {
-            throw ObjCrystException("One atom did not have any symmetric in the ASU !");
-         }
+            if( (abs(x)<halfasuxrange) && (abs(y)<halfasuyrange) && (abs(z)<halfasuzrange) )
+            {
+               hasUnique=true;
+               pN->mUniquePos=pN->mvPos.size()-1;
+               pN->mUniquePosSymmetryIndex=j;
+            }
       }
-      TAU_PROFILE_STOP(timer1);
-      TAU_PROFILE_START(timer2);
-      // Compute interatomic vectors & distance
-      // between (i) unique atoms and (ii) all remaining atoms
-
-      const CrystMatrix_REAL* pOrthMatrix=&(this->GetOrthMatrix());
-
-      const REAL m00=(*pOrthMatrix)(0,0);
-      const REAL m01=(*pOrthMatrix)(0,1);
-      const REAL m02=(*pOrthMatrix)(0,2);
-      const REAL m11=(*pOrthMatrix)(1,1);
-      const REAL m12=(*pOrthMatrix)(1,2);
-      const REAL m22=(*pOrthMatrix)(2,2);
-
-      for(long i=0;i<nbComponent;i++)
+      if(!hasUnique)
       {
-         VFN_DEBUG_MESSAGE("Crystal::CalcDistTable(fast):4:component "<<i,0)
-         #if 0
-         if(!this->IsBeingRefined()) cout<<endl<<"Unique pos:"<<vUniqueIndex[i]<<":"
-             <<vPos[vUniqueIndex[i]].mAtomIndex<<":"
-             <<mScattCompList(vPos[vUniqueIndex[i]].mAtomIndex).mpScattPow->GetName()<<":"
-             <<vPos[vUniqueIndex[i]].mSymmetryIndex<<":"
-             <<FormatFloat(vPos[vUniqueIndex[i]].mX,8,5)<<","
-             <<FormatFloat(vPos[vUniqueIndex[i]].mY,8,5)<<","
-             <<FormatFloat(vPos[vUniqueIndex[i]].mZ,8,5)<<endl;
-         #endif
-         std::vector<Crystal::Neighbour> * const vnb=&(mvDistTableSq[i].mvNeighbour);
-         const REAL x0i=vPos[vUniqueIndex[i] ].mX;
-         const REAL y0i=vPos[vUniqueIndex[i] ].mY;
-         const REAL z0i=vPos[vUniqueIndex[i] ].mZ;
-         for(unsigned long j=0;j<vPos.size();j++)
+         throw ObjCrystException("One atom did not have any symmetric in the ASU !");
+      }
+   }
+   // Index of all positions, in the order of the neighbours (by atom and symmetric)
+   std::vector<unsigned long> vFirstPos(nbComponent+1);
+   vFirstPos[0]=0;
+   for(long i=0;i<nbComponent;i++) vFirstPos[i+1]=vFirstPos[i]+mvDistTableSq[i].mvPos.size();
+   const unsigned long nbPos=vFirstPos[nbComponent];
+   std::vector<long> vPosAtom(nbPos);
+   std::vector<const DistTablePosition*> vpPos(nbPos);
+   for(long i=0;i<nbComponent;i++)
+      for(unsigned long k=0;k<mvDistTableSq[i].mvPos.size();k++)
+      {
+         vPosAtom[vFirstPos[i]+k]=i;
+         vpPos[vFirstPos[i]+k]=&(mvDistTableSq[i].mvPos[k]);
+      }
+   TAU_PROFILE_STOP(timer1);
+   TAU_PROFILE_START(timer2);
+   // Compute interatomic vectors & distance
+   // between (i) unique atoms and (ii) all remaining atoms
+
+   const CrystMatrix_REAL* pOrthMatrix=&(this->GetOrthMatrix());
+
+   const REAL m00=(*pOrthMatrix)(0,0);
+   const REAL m01=(*pOrthMatrix)(0,1);
+   const REAL m02=(*pOrthMatrix)(0,2);
+   const REAL m11=(*pOrthMatrix)(1,1);
+   const REAL m12=(*pOrthMatrix)(1,2);
+   const REAL m22=(*pOrthMatrix)(2,2);
+
+   // Cell list: the positions are sorted in a periodic grid of n0*n1*n2 cells, each
+   // cell being at least mDistTableMaxDistance wide perpendicular to its faces
+   // (the distance between (100) lattice planes is 1/|a*|, with a* the first line
+   // of the inverse of the orthonormalization matrix). All the positions which have
+   // a lattice translation within mDistTableMaxDistance of a unique atom are then in
+   // the same cell or in one of its neighbours, even for oblique cells.
+   const REAL inv01=-m01/(m00*m11);
+   const REAL inv02=(m01*m12-m02*m11)/(m00*m11*m22);
+   const REAL inv12=-m12/(m11*m22);
+   const REAL cellWidth=mDistTableMaxDistance*(1+1e-4);
+   int n0=(int)(1/(sqrt(1/(m00*m00)+inv01*inv01+inv02*inv02)*cellWidth));
+   int n1=(int)(1/(sqrt(1/(m11*m11)+inv12*inv12)*cellWidth));
+   int n2=(int)(1/(abs(1/m22)*cellWidth));
+   // Avoid a grid much larger than the number of positions
+   while(((long)n0*n1*n2)>(long)(8*nbPos+27))
+   {
+      if((n0>=n1)&&(n0>=n2)) n0/=2;
+      else if(n1>=n2) n1/=2;
+      else n2/=2;
+   }
+   // With less than 27 cells the grid is useless: use a single cell with all positions
+   if(((long)n0*n1*n2)<27) n0=n1=n2=1;
+   const int nbCell=n0*n1*n2;
+   // The cell of each position
+   std::vector<int> vPosCell(nbPos);
+   // For each cell, the index of its first position in vCellPos (last=number of positions)
+   std::vector<unsigned long> vCellFirst(nbCell+1,0);
+   // Index of the positions in each cell, in increasing order
+   std::vector<unsigned long> vCellPos(nbPos);
+   for(unsigned long j=0;j<nbPos;j++)
+   {
+      int i0=(int)((vpPos[j]->mX-floor(vpPos[j]->mX))*n0);if(i0>=n0) i0=n0-1;
+      int i1=(int)((vpPos[j]->mY-floor(vpPos[j]->mY))*n1);if(i1>=n1) i1=n1-1;
+      int i2=(int)((vpPos[j]->mZ-floor(vpPos[j]->mZ))*n2);if(i2>=n2) i2=n2-1;
+      vPosCell[j]=(i0*n1+i1)*n2+i2;
+      vCellFirst[vPosCell[j]+1]++;
+   }
+   for(int c=0;c<nbCell;c++) vCellFirst[c+1]+=vCellFirst[c];
+   {
+      std::vector<unsigned long> vCellNb(vCellFirst.begin(),vCellFirst.end()-1);
+      for(unsigned long j=0;j<nbPos;j++) vCellPos[vCellNb[vPosCell[j]]++]=j;
+   }
+
+   // Add the neighbours of unique atom i corresponding to position j (including
+   // lattice translations). Returns true if any neighbour was added.
+   auto addNeighbours=[&](const long i,const unsigned long j)->bool
+   {
+      const NeighbourHood *pN=&(mvDistTableSq[i]);
+      const bool isSelf=(vFirstPos[i]+pN->mUniquePos)==j;
+      if(isSelf && (!loopOnLattice)) return false;// distance to self !
+      std::vector<Crystal::Neighbour> * const vnb=&(mvDistTableSq[i].mvNeighbour);
+      const size_t nb=vnb->size();
+      const DistTablePosition *pUnique=&(pN->mvPos[pN->mUniquePos]);
+      const DistTablePosition *pPos=vpPos[j];
+      // Start with the smallest absolute coordinates possible
+      REAL x=fmod(pPos->mX - pUnique->mX,(REAL)1.0);if(x<-.5)x+=1;if(x>.5)x-=1;
+      REAL y=fmod(pPos->mY - pUnique->mY,(REAL)1.0);if(y<-.5)y+=1;if(y>.5)y-=1;
+      REAL z=fmod(pPos->mZ - pUnique->mZ,(REAL)1.0);if(z<-.5)z+=1;if(z>.5)z-=1;
+
+      const REAL x0=m00 * x + m01 * y + m02 * z;
+      const REAL y0=          m11 * y + m12 * z;
+      const REAL z0=                    m22 * z;
+
+      if(loopOnLattice)
+      {//Now loop over lattice translations
+         for(int sz=-1;sz<=1;sz+=2)// Sign of translation
          {
-            if((vUniqueIndex[i]==j) && (!loopOnLattice)) continue;// distance to self !
-            // Start with the smallest absolute coordinates possible
-            REAL x=fmod(vPos[j].mX - x0i,(REAL)1.0);if(x<-.5)x+=1;if(x>.5)x-=1;
-            REAL y=fmod(vPos[j].mY - y0i,(REAL)1.0);if(y<-.5)y+=1;if(y>.5)y-=1;
-            REAL z=fmod(vPos[j].mZ - z0i,(REAL)1.0);if(z<-.5)z+=1;if(z>.5)z-=1;
-
-            const REAL x0=m00 * x + m01 * y + m02 * z;
-            const REAL y0=          m11 * y + m12 * z;
-            const REAL z0=                    m22 * z;
-
-            if(loopOnLattice)// distance to self !
-            {//Now loop over lattice translations
-               for(int sz=-1;sz<=1;sz+=2)// Sign of translation
+            for(int nz=(sz+1)/2;;++nz)
+            {
+               const REAL z=z0+sz*nz*m22;
+               if(abs(z)>mDistTableMaxDistance) break;
+               for(int sy=-1;sy<=1;sy+=2)// Sign of translation
                {
-                  for(int nz=(sz+1)/2;;++nz)
+                  for(int ny=(sy+1)/2;;++ny)
                   {
-                     const REAL z=z0+sz*nz*m22;
-                     if(abs(z)>mDistTableMaxDistance) break;
-                     for(int sy=-1;sy<=1;sy+=2)// Sign of translation
+                     const REAL y=y0 + sy*ny*m11 + sz*nz*m12;
+                     if(abs(y)>mDistTableMaxDistance) break;
+                     for(int sx=-1;sx<=1;sx+=2)// Sign of translation
                      {
-                        for(int ny=(sy+1)/2;;++ny)
+                        for(int nx=(sx+1)/2;;++nx)
                         {
-                           const REAL y=y0 + sy*ny*m11 + sz*nz*m12;
-                           if(abs(y)>mDistTableMaxDistance) break;
-                           for(int sx=-1;sx<=1;sx+=2)// Sign of translation
-                           {
-                              for(int nx=(sx+1)/2;;++nx)
-                              {
-                                 if((vUniqueIndex[i]==j) && (nx==0) && (ny==0) && (nz==0)) continue;// distance to self !
-                                 const REAL x=x0 + sx*nx*m00 + sy*ny*m01 + sz*nz*m02;
-                                 if(abs(x)>mDistTableMaxDistance) break;
-                                 const REAL d2=x*x+y*y+z*z;
-                                 if(d2<=asymUnitMargin2)
-                                 {
-                                    Neighbour neigh(vPos[j].mAtomIndex,vPos[j].mSymmetryIndex,d2);
-                                    vnb->push_back(neigh);
-                                    #if 0
-                                    if(!this->IsBeingRefined()) cout<<"    "<<vPos[j].mAtomIndex<<":"
-                                          <<mScattCompList(vPos[j].mAtomIndex).mpScattPow->GetName()<<":"
-                                          <<vPos[j].mSymmetryIndex<<":"
-                                          <<FormatFloat(vPos[j].mX,8,5)<<","
-                                          <<FormatFloat(vPos[j].mY,8,5)<<","<<","
-                                          <<FormatFloat(vPos[j].mZ,8,5)<<","<<" vector="
-                                          <<FormatFloat(x,8,5)<<","
-                                          <<FormatFloat(y,8,5)<<","
-                                          <<FormatFloat(z,8,5)<<":"<<sqrt(d2)<<","
-                                          <<"("<<sx*nx<<","<<sy*ny<<","<<sz*nz<<")"<<endl;
-                                    #endif
-                                 }
-                              }
-                           }
+                           if(isSelf && (nx==0) && (ny==0) && (nz==0)) continue;// distance to self !
+                           const REAL x=x0 + sx*nx*m00 + sy*ny*m01 + sz*nz*m02;
+                           if(abs(x)>mDistTableMaxDistance) break;
+                           const REAL d2=x*x+y*y+z*z;
+                           if(d2<=asymUnitMargin2)
+                              vnb->push_back(Neighbour(vPosAtom[j],pPos->mSymmetryIndex,d2));
                         }
                      }
                   }
                }
             }
-            else
+         }
+      }
+      else
+      {
+         const REAL d2=x0*x0+y0*y0+z0*z0;
+         if(d2<=asymUnitMargin2)
+            vnb->push_back(Neighbour(vPosAtom[j],pPos->mSymmetryIndex,d2));
+      }
+      return vnb->size()>nb;
+   };
+
+   // The neighbour candidates
+   std::vector<unsigned long> vCandidate;
+   for(std::vector<long>::const_iterator pos=vChanged.begin();pos!=vChanged.end();++pos)
+   {
+      const long i=*pos;
+      VFN_DEBUG_MESSAGE("Crystal::CalcDistTable(fast):4:component "<<i,0)
+      NeighbourHood *pN=&(mvDistTableSq[i]);
+      // Test the positions in increasing order, so that the neighbours are sorted
+      GetCellListCandidates(vPosCell[vFirstPos[i]+pN->mUniquePos],n0,n1,n2,vCellFirst,vCellPos,vCandidate,true);
+      for(std::vector<unsigned long>::const_iterator j=vCandidate.begin();j!=vCandidate.end();++j)
+         addNeighbours(i,*j);
+      for(std::vector<Crystal::Neighbour>::const_iterator neigh=pN->mvNeighbour.begin();
+          neigh!=pN->mvNeighbour.end();++neigh)
+         if(  (neigh==pN->mvNeighbour.begin())
+            ||((neigh-1)->mNeighbourIndex!=neigh->mNeighbourIndex))
+            mvDistTableSq[neigh->mNeighbourIndex].mvNeighbourOf.push_back(i);
+   }
+
+   if(!fullUpdate)
+   {// Add the atoms which moved to the lists of neighbours of the other atoms
+      // Cell list of the unique positions
+      std::vector<unsigned long> vCellFirstUnique(nbCell+1,0),vCellAtom(nbComponent);
+      for(long i=0;i<nbComponent;i++)
+         vCellFirstUnique[vPosCell[vFirstPos[i]+mvDistTableSq[i].mUniquePos]+1]++;
+      for(int c=0;c<nbCell;c++) vCellFirstUnique[c+1]+=vCellFirstUnique[c];
+      {
+         std::vector<unsigned long> vCellNb(vCellFirstUnique.begin(),vCellFirstUnique.end()-1);
+         for(long i=0;i<nbComponent;i++)
+            vCellAtom[vCellNb[vPosCell[vFirstPos[i]+mvDistTableSq[i].mUniquePos]]++]=i;
+      }
+      // Last atom which moved added to the list of neighbours of each atom
+      std::vector<long> vLastAdded(nbComponent,-1);
+      for(std::vector<long>::const_iterator pos=vChanged.begin();pos!=vChanged.end();++pos)
+      {
+         const long c=*pos;
+         for(unsigned long j=vFirstPos[c];j<vFirstPos[c+1];j++)
+         {
+            GetCellListCandidates(vPosCell[j],n0,n1,n2,vCellFirstUnique,vCellAtom,vCandidate,false);
+            for(std::vector<unsigned long>::const_iterator i=vCandidate.begin();i!=vCandidate.end();++i)
             {
-               const REAL d2=x0*x0+y0*y0+z0*z0;
-               if(d2<=asymUnitMargin2)
+               if(vIsChanged[*i]) continue;
+               if(!addNeighbours(*i,j)) continue;
+               if(vLastAdded[*i]!=c)
+               {
+                  vLastAdded[*i]=c;
+                  mvDistTableSq[c].mvNeighbourOf.push_back(*i);
+               }
+               if(!vIsModified[*i])
                {
-                  Neighbour neigh(vPos[j].mAtomIndex,vPos[j].mSymmetryIndex,d2);
-                  vnb->push_back(neigh);
-                  #if 0
-                  if(!this->IsBeingRefined()) cout<<vPos[j].mAtomIndex<<":"
-                        <<mScattCompList(vPos[j].mAtomIndex).mpScattPow->GetName()<<":"
-                        <<vPos[j].mSymmetryIndex<<":"
-                        <<vPos[j].mX<<","
-                        <<vPos[j].mY<<","
-                        <<vPos[j].mZ<<" vector="
-                        <<x0<<","<<y0<<","<<z0<<":"<<sqrt(d2)<<","<<asymUnitMargin2<<endl;
-                  #endif
+                  vIsModified[*i]=true;
+                  vModified.push_back(*i);
                }
             }
-
          }
       }
-      TAU_PROFILE_STOP(timer2);
+      // Sort the modified lists of neighbours, as if they had been recomputed
+      for(std::vector<long>::const_iterator pos=vModified.begin();pos!=vModified.end();++pos)
+      {
+         std::stable_sort(mvDistTableSq[*pos].mvNeighbour.begin(),mvDistTableSq[*pos].mvNeighbour.end(),
+                          [](const Crystal::Neighbour &n1,const Crystal::Neighbour &n2)
+                          {
+                             if(n1.mNeighbourIndex!=n2.mNeighbourIndex)
+                                return n1.mNeighbourIndex<n2.mNeighbourIndex;
+                             return n1.mNeighbourSymmetryIndex<n2.mNeighbourSymmetryIndex;
+                          });
+         mvDistTableSq[*pos].mVersion=mDistTableVersion;
+      }
    }
+   TAU_PROFILE_STOP(timer2);
+   mDistTableLastMaxDistance=mDistTableMaxDistance;
    mDistTableClock.Click();
    VFN_DEBUG_EXIT("Crystal::CalcDistTable()",4)
 }
@@ -115,6 +115,15 @@ class Crystal:public UnitCell
 
       /// Crystal copy constructor
       Crystal(const Crystal &oldCryst);
+      /** \brief Create a copy of this Crystal, with copies of all its
+      * ScatteringPower and Scatterer objects.
+      *
+      * Unlike the copy constructor, this does not go through an XML
+      * round-trip.
+      * \param vCopy: the map from original to copied objects, completed
+      * with this Crystal and all its sub-objects.
+      */
+      Crystal* Clone(std::map<const RefinableObj*,RefinableObj*> &vCopy)const;
       /// Crystal destructor
       ~Crystal();
       virtual const string& GetClassName() const;
@@ -426,6 +435,15 @@ class Crystal:public UnitCell
       * integers, thus with a lower precision but faster. Less atoms will also
       * be involved (using the AsymmetricUnit and mDistTableMaxDistance2) to make it even faster.
       *
+      * Neighbours are searched using a periodic cell list: only the positions in the same
+      * or in the adjacent cells (at least mDistTableMaxDistance wide) of each unique atom
+      * are tested, so that the computing time is proportional to the number of atoms.
+      *
+      * If only a few atoms moved since the last calculation (e.g. one Molecule during
+      * an optimization), only their lists of neighbours are recomputed, and they are
+      * removed from or added to the lists of their old and new neighbours. The
+      * modified lists are marked using NeighbourHood::mVersion.
+      *
       * \warning Crystal::GetScatteringComponentList() \b must be called beforehand,
       * since this will not be done here.
       *
@@ -472,6 +490,14 @@ class Crystal:public UnitCell
          /// The squared distance, in square Angstroems
          REAL mDist2;
       };
+      /// A symmetric of an atom, within or near the (pseudo) asymmetric unit
+      struct DistTablePosition
+      {
+         /// The symmetry operation for this position
+         int mSymmetryIndex;
+         /// Fractionnal coordinates
+         REAL mX,mY,mZ;
+      };
       /// Table of neighbours for a given unique atom
       struct NeighbourHood
       {
@@ -480,8 +506,22 @@ class Crystal:public UnitCell
          /// Index of the symmetry operation for the chosen unique position in the
          /// (pseudo) asymmetric unit
          unsigned int mUniquePosSymmetryIndex;
-         /// List of neighbours
+         /// List of neighbours, sorted by atom and symmetry index
          std::vector<Crystal::Neighbour> mvNeighbour;
+         /// Coordinates and scattering power of the atom when this table was computed,
+         /// to find the atoms which moved since
+         REAL mX,mY,mZ;
+         const ScatteringPower *mpScattPow;
+         /// Index of the scattering power in Crystal::mvDistTableScattPow
+         unsigned int mScattPowIndex;
+         /// All the symmetrics of the atom within or near the (pseudo) asymmetric unit
+         std::vector<Crystal::DistTablePosition> mvPos;
+         /// Index of the unique position in mvPos
+         unsigned int mUniquePos;
+         /// Atoms which have this atom in their list of neighbours
+         std::vector<unsigned long> mvNeighbourOf;
+         /// Value of Crystal::mDistTableVersion when mvNeighbour was last modified
+         unsigned long mVersion;
       };
       /** Interatomic distance table for all unique atoms
       *
@@ -491,6 +531,20 @@ class Crystal:public UnitCell
       mutable RefinableObjClock mDistTableClock;
       /// The distance up to which the distance table & neighbours needs to be calculated
       mutable REAL mDistTableMaxDistance;
+      /// The value of mDistTableMaxDistance used for the current distance table
+      mutable REAL mDistTableLastMaxDistance;
+      /// Incremented each time the distance table is updated
+      mutable unsigned long mDistTableVersion;
+      /// All the scattering powers used by the atoms in the distance table
+      mutable std::vector<const ScatteringPower*> mvDistTableScattPow;
+      /// Anti-bump parameters for all pairs of mvDistTableScattPow (mDist2<0 if there are none)
+      mutable std::vector<BumpMergePar> mvBumpMergeParMatrix;
+      /// Last time mvBumpMergeParMatrix was computed
+      mutable RefinableObjClock mBumpMergeParMatrixClock;
+      /// Bump-merge cost for each unique atom (NeighbourHood)
+      mutable std::vector<REAL> mvBumpMergeCost;
+      /// Value of mDistTableVersion when mvBumpMergeCost was computed
+      mutable unsigned long mBumpMergeCostVersion;
 
       /// The list of all scattering components in the crystal
       mutable ScatteringComponentList mScattCompList;
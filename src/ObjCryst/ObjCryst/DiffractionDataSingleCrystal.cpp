@@ -25,8 +25,10 @@
 #include <cstdlib>
 
 #include <typeinfo>
+#include <mutex>
 
 #include "ObjCryst/ObjCryst/DiffractionDataSingleCrystal.h"
+#include "ObjCryst/RefinableObj/Profiler.h"
 #include "ObjCryst/ObjCryst/CIF.h"
 #include "ObjCryst/Quirks/VFNDebug.h"
 #include "ObjCryst/Quirks/VFNStreamFormat.h"
@@ -52,7 +54,7 @@ namespace ObjCryst
 //    DiffractionDataSingleCrystal
 //######################################################################
 ObjRegistry<DiffractionDataSingleCrystal>
-   gDiffractionDataSingleCrystalRegistry("Global DiffractionDataSingleCrystal Registry");
+   gDiffractionDataSingleCrystalRegistry("Global DiffractionDataSingleCrystal Registry",true);
 
 DiffractionDataSingleCrystal::DiffractionDataSingleCrystal(const bool regist):
 mHasObservedData(false),mScaleFactor(1.)
@@ -113,6 +115,28 @@ DiffractionDataSingleCrystal* DiffractionDataSingleCrystal::CreateCopy()const
    return new DiffractionDataSingleCrystal(*this);
 }
 
+DiffractionDataSingleCrystal* DiffractionDataSingleCrystal::Clone
+   (std::map<const RefinableObj*,RefinableObj*> &vCopy,const bool regist)const
+{
+   VFN_DEBUG_ENTRY("DiffractionDataSingleCrystal::Clone():"<<this->GetName(),5)
+   Crystal *pCryst=0;
+   if(this->HasCrystal()) pCryst=FindCopy(this->GetCrystal(),vCopy);
+   if(pCryst==0)
+      throw ObjCrystException("DiffractionDataSingleCrystal::Clone(): the crystal used by "
+                              +this->GetName()+" has not been copied");
+   DiffractionDataSingleCrystal *p=new DiffractionDataSingleCrystal(*pCryst,regist);
+   vCopy[this]=p;
+   p->SetName(mName);
+   p->mRadiation=mRadiation;
+   p->mRadiation.CopyParAndOptions(mRadiation);
+   p->SetIsIgnoringImagScattFact(this->IsIgnoringImagScattFact());
+   p->SetMaxSinThetaOvLambda(mMaxSinThetaOvLambda);
+   p->ShareObservedData(*this);
+   p->CopyParAndOptions(*this);
+   VFN_DEBUG_EXIT("DiffractionDataSingleCrystal::Clone()",5)
+   return p;
+}
+
 const string& DiffractionDataSingleCrystal::GetClassName() const
 {
    const static string className="DiffractionDataSingleCrystal";
@@ -126,6 +150,7 @@ void DiffractionDataSingleCrystal::SetHklIobs(const CrystVector_long &h,
                                               const CrystVector_REAL &sigma)
 {
    VFN_DEBUG_ENTRY("DiffractionDataSingleCrystal::SetHklIobs(h,k,l,i,s)",5)
+   this->UnshareObservedData();
    mNbRefl=h.numElements();
    mH.resize(mNbRefl);
    mK.resize(mNbRefl);
@@ -163,6 +188,77 @@ void DiffractionDataSingleCrystal::SetHklIobs(const CrystVector_long &h,
    VFN_DEBUG_EXIT("DiffractionDataSingleCrystal::SetHklIobs(h,k,l,i,s)",5)
 }
 
+struct DiffractionDataSingleCrystal::SharedObservedData
+{
+   CrystVector_REAL mObs;
+   CrystVector_REAL mSigma;
+};
+
+void DiffractionDataSingleCrystal::ShareObservedData(const DiffractionDataSingleCrystal &orig)
+{
+   VFN_DEBUG_MESSAGE("DiffractionDataSingleCrystal::ShareObservedData():"<<orig.GetName()<<"->"<<this->GetName(),5)
+   if((&orig==this)||(orig.GetNbRefl()==0)) return;
+   if(orig.mpSharedObservedData==0)
+   {// Move the data of the original object to the shared storage. The shared
+    // arrays are never modified, see UnshareObservedData()
+      SharedObservedData *p=new SharedObservedData;
+      p->mObs=orig.mObsIntensity;
+      p->mSigma=orig.mObsSigma;
+      orig.mpSharedObservedData.reset(p);
+      DiffractionDataSingleCrystal &o=const_cast<DiffractionDataSingleCrystal&>(orig);
+      o.mObsIntensity.reference(p->mObs);
+      o.mObsSigma.reference(p->mSigma);
+   }
+   if(mpSharedObservedData!=orig.mpSharedObservedData)
+   {
+      this->UnshareObservedData();
+      mpSharedObservedData=orig.mpSharedObservedData;
+      SharedObservedData *p=const_cast<SharedObservedData*>(mpSharedObservedData.get());
+      mObsIntensity.reference(p->mObs);
+      mObsSigma.reference(p->mSigma);
+   }
+   this->ShareHKL(orig);
+   mWeight=orig.mWeight;
+   mHasObservedData=orig.mHasObservedData;
+   if(orig.mGroupOption.GetChoice()==2)
+   {// User-supplied groups cannot be changed, same as in XMLInput()
+      if(mGroupOption.GetChoice()!=2)
+      {
+         mGroupOption.SetChoice(2);
+         mOptionRegistry.DeRegister(mGroupOption);
+         mClockMaster.RemoveChild(mGroupOption.GetClock());
+      }
+      mNbGroup=orig.mNbGroup;
+      mGroupIndex=orig.mGroupIndex;
+      mGroupIobs=orig.mGroupIobs;
+      mGroupSigma=orig.mGroupSigma;
+      mGroupWeight=orig.mGroupWeight;
+   }
+   // Keep a copy as squared F(hkl), to enable fourier maps
+   mFhklObsSq=mObsIntensity;
+   mClockFhklObsSq.Click();
+   mClockMaster.Click();
+}
+
+bool DiffractionDataSingleCrystal::IsObservedDataShared()const {return mpSharedObservedData!=0;}
+
+void DiffractionDataSingleCrystal::UnshareObservedData()
+{
+   this->UnshareHKL();
+   if(mpSharedObservedData==0) return;
+   VFN_DEBUG_MESSAGE("DiffractionDataSingleCrystal::UnshareObservedData():"<<this->GetName(),5)
+   // resize(0) only drops the reference, without freeing the shared data
+   CrystVector_REAL tmp;
+   tmp=mObsIntensity;
+   mObsIntensity.resize(0);
+   mObsIntensity=tmp;
+   tmp=mObsSigma;
+   mObsSigma.resize(0);
+   mObsSigma=tmp;
+   // The shared data is freed with the last data set using it
+   mpSharedObservedData.reset();
+}
+
 const CrystVector_REAL& DiffractionDataSingleCrystal::GetIcalc()const
 {
    this->CalcIcalc();
@@ -183,6 +279,7 @@ const CrystVector_REAL& DiffractionDataSingleCrystal::GetIobs()const
 
 void DiffractionDataSingleCrystal::SetIobs(const CrystVector_REAL &obs)
 {
+   this->UnshareObservedData();
    mObsIntensity=obs;
    // Keep a copy as squared F(hkl), to enable fourier maps
    // :TODO: stop using mObsIntensity and just keep mFhklObsSq ?
@@ -196,7 +293,11 @@ const CrystVector_REAL& DiffractionDataSingleCrystal::GetSigma()const
    return mObsSigma;
 }
 
-void DiffractionDataSingleCrystal::SetSigma(const CrystVector_REAL& sigma) {mObsSigma=sigma;}
+void DiffractionDataSingleCrystal::SetSigma(const CrystVector_REAL& sigma)
+{
+   this->UnshareObservedData();
+   mObsSigma=sigma;
+}
 
 const CrystVector_REAL& DiffractionDataSingleCrystal::GetWeight()const
 {
@@ -214,6 +315,7 @@ void DiffractionDataSingleCrystal::SetWeight(const CrystVector_REAL& weight)
 void DiffractionDataSingleCrystal::SetIobsToIcalc()
 {
    VFN_DEBUG_MESSAGE("DiffractionDataSingleCrystal::SetIobsToIcalc()",5)
+   this->UnshareObservedData();
    mObsIntensity=this->GetIcalc();
    mObsSigma.resize(mNbRefl);
    mWeight.resize(mNbRefl);
@@ -232,6 +334,7 @@ void DiffractionDataSingleCrystal::ImportHklIobs(const string &fileName,
                                     const long nbRefl,
                                     const int skipLines)
 {
+   this->UnshareObservedData();
    //configure members
       mNbRefl=nbRefl;
       mH.resize(mNbRefl);
@@ -295,6 +398,7 @@ void DiffractionDataSingleCrystal::ImportHklIobsSigma(const string &fileName,
                                          const long nbRefl,
                                          const int skipLines)
 {
+   this->UnshareObservedData();
    //configure members
       mNbRefl=nbRefl;
       mH.resize(mNbRefl);
@@ -359,6 +463,7 @@ Error opening file for input:"+fileName);
 void DiffractionDataSingleCrystal::ImportShelxHKLF4(const string &fileName)
 {
    VFN_DEBUG_ENTRY("DiffractionDataSingleCrystal::ImportShelxHKLF4():"<<fileName,10);
+   this->UnshareObservedData();
    char buf[101];
    //configure members
       mNbRefl=100;
@@ -457,6 +562,7 @@ void DiffractionDataSingleCrystal::ImportCIF(const string &fileName)
 
 void DiffractionDataSingleCrystal::ImportHklIobsSigmaJanaM91(const string &fileName)
 {
+   this->UnshareObservedData();
    //configure members
       mNbRefl=1000;//reasonable beginning value ?
       mH.resize(mNbRefl);
@@ -538,6 +644,7 @@ Error opening file for input:"+fileName);
 
 void DiffractionDataSingleCrystal::ImportHklIobsGroup(const string &fileName,const unsigned int skipLines)
 {
+   this->UnshareObservedData();
    //configure members
       mNbRefl=0;
       mNbGroup=0;
@@ -732,6 +839,7 @@ REAL DiffractionDataSingleCrystal::GetR()const
 
 REAL DiffractionDataSingleCrystal::GetChi2()const
 {
+   OBJCRYST_PROFILE("DiffractionDataSingleCrystal::GetChi2")
    if(mHasObservedData==false)
    {
       mChi2=0;
@@ -904,6 +1012,7 @@ REAL DiffractionDataSingleCrystal::GetBestRFactor() const
 
 void DiffractionDataSingleCrystal::SetSigmaToSqrtIobs()
 {
+   this->UnshareObservedData();
    for(long i=0;i<mObsIntensity.numElements();i++) mObsSigma(i)=sqrt(fabs(mObsIntensity(i)));
    if(1==mGroupOption.GetChoice()) mClockPrepareTwinningCorr.Reset();
    // This is not needed for mGroupOption==2
@@ -1089,6 +1198,7 @@ void DiffractionDataSingleCrystal::SetEnergy(const REAL energy)
 void DiffractionDataSingleCrystal::CalcIcalc() const
 {
    TAU_PROFILE("DiffractionData::CalcIcalc()","void ()",TAU_DEFAULT);
+   OBJCRYST_PROFILE("DiffractionDataSingleCrystal::CalcIcalc")
    VFN_DEBUG_MESSAGE("DiffractionData::CalcIcalc():"<<this->GetName(),3)
    this->GetFhklCalcSq();
    if( (mClockStructFactorSq<mClockIcalc) && (mClockScaleFactor<mClockIcalc)
@@ -1169,6 +1279,7 @@ CrystVector_long DiffractionDataSingleCrystal::SortReflectionBySinThetaOverLambd
 {
    TAU_PROFILE("DiffractionDataSingleCrystal::SortReflectionBySinThetaOverLambda()","void ()",TAU_DEFAULT);
    VFN_DEBUG_ENTRY("DiffractionDataSingleCrystal::SortReflectionBySinThetaOverLambda()",5)
+   this->UnshareObservedData();
    // ScatteringData::SortReflectionBySinThetaOverLambda only sorts H,K,L and multiplicity.
    CrystVector_long index=this->ScatteringData::SortReflectionBySinThetaOverLambda(maxSTOL);
 
@@ -1288,15 +1399,14 @@ void DiffractionDataSingleCrystal::InitOptions()
 {
    static string GroupOption;
    static string GroupOptionChoices[3];
-   static bool needInitNames=true;
-   if(true==needInitNames)
-   {
+   static std::once_flag needInitNames;
+   std::call_once(needInitNames,[]()
+   {// Only once for the class
       GroupOption="Group Reflections";
       GroupOptionChoices[0]="No";
       GroupOptionChoices[1]="Sum equally-spaced reflections";
       GroupOptionChoices[2]="Sum according to user data";
-      needInitNames=false;
-   }
+   });
    mGroupOption.Init(3,&GroupOption,GroupOptionChoices);
    mGroupOption.SetChoice(0);
    this->AddOption(&mGroupOption);
@@ -70,6 +70,18 @@ class DiffractionDataSingleCrystal:public ScatteringData
       DiffractionDataSingleCrystal(const DiffractionDataSingleCrystal &old);
       ~DiffractionDataSingleCrystal();
       virtual DiffractionDataSingleCrystal* CreateCopy()const;
+      /** Create a copy of this data set, using the copy of its crystal.
+      *
+      * The observed data (reflections, intensities and sigmas) is shared with
+      * this object using ShareObservedData().
+      * \param vCopy: map of (original, copy) objects, which must include the copy
+      * of the Crystal used by this object (see Crystal::Clone()). The new object
+      * is added to it.
+      * \param regist: if false, the copy is not registered in the global lists,
+      * as for the constructor.
+      */
+      DiffractionDataSingleCrystal* Clone(std::map<const RefinableObj*,RefinableObj*> &vCopy,
+                                          const bool regist=true)const;
       virtual const string& GetClassName() const;
 
       /**  \brief returns the calculated diffracted intensity.
@@ -113,6 +125,22 @@ class DiffractionDataSingleCrystal:public ScatteringData
                       const CrystVector_long &l,
                       const CrystVector_REAL &iObs,
                       const CrystVector_REAL &sigma);
+      /** \brief Share the observed data of another data set, copy-on-write.
+      *
+      * The reflections (see ScatteringData::ShareHKL()), observed intensities and sigma
+      * arrays of \e orig are moved to a storage owned jointly by all the data sets
+      * sharing it, and used by this object without being duplicated. Each data set
+      * makes its own copy of the data before changing it (new data imported, sigma
+      * recomputed,...). The weights and user-supplied groups of reflections are
+      * copied. This object must already use a crystal with the same spacegroup.
+      *
+      * Sharing is not thread-safe for \e orig: this must not be called while
+      * \e orig is used in another thread.
+      */
+      void ShareObservedData(const DiffractionDataSingleCrystal &orig);
+      /// Is the observed data held in a storage shared (copy-on-write) with other
+      /// data sets ? See ShareObservedData().
+      bool IsObservedDataShared()const;
 
       /** \brief Import h,k,l,I from a file
       *
@@ -308,6 +336,18 @@ class DiffractionDataSingleCrystal:public ScatteringData
       CrystVector_REAL mObsIntensity ;
       /// Sigma for observed intensities (either individual reflections or spectrum)
       CrystVector_REAL mObsSigma ;
+      /** \internal Make a private copy of the observed data (including the reflections),
+      * if it is shared with another data set. This must be called before changing
+      * mObsIntensity, mObsSigma or the H, K, L arrays.
+      */
+      void UnshareObservedData();
+      /// \internal Observed data shared by several data sets, see ShareObservedData()
+      struct SharedObservedData;
+      /// Shared observed data, or null if this object owns its data. If not null,
+      /// mObsIntensity and mObsSigma are references to its arrays.
+      /// This is mutable, since the data of the original object is moved to the
+      /// shared storage (without any change) when it is first shared.
+      mutable std::shared_ptr<const SharedObservedData> mpSharedObservedData;
       /// weight for computing R-Factor, for each observed value.
       CrystVector_REAL mWeight ;
       /// Calculated intensities
@@ -29,6 +29,10 @@
 #include <string>
 #include <cmath>
 #include <utility>
+#include <locale.h>
+#ifdef __APPLE__
+#include <xlocale.h>
+#endif
 
 // Restricted pointers (useful for auto-vectorization)
 #ifdef __GNUG__
@@ -188,13 +192,24 @@ struct CrystalPOVRayOptions
 /// in order to use '.' as the decimal separator.
 /// Just creating one object of type tmp_C_Numeric_locale will switch to the C locale,
 /// and when the object gets destroyed it will restore the old locale.
+///
+/// The locale is only changed for the current thread, so this can be used
+/// by concurrent jobs (e.g. reading CIF or XML files in different threads).
 class tmp_C_Numeric_locale
 {// Implemented in SpaceGroup.cpp
     public:
         tmp_C_Numeric_locale();
         ~tmp_C_Numeric_locale();
     private:
+#ifdef _WIN32
         std::string mLocale;
+        /// Previous per-thread locale setting (_configthreadlocale)
+        int mThreadLocale;
+#else
+        /// The C numeric locale used in this thread, and the previous one.
+        /// mLocale is 0 if it could not be created, and the locale is then left unchanged
+        locale_t mLocale,mOldLocale;
+#endif
 };
 
 }//Namespace
@@ -120,8 +120,14 @@ void XMLCrystFileSaveGlobal(ostream &out)
    out.imbue(std::locale::classic());
    XMLCrystTag tag("ObjCryst");
    time_t date=time(0);
+   struct tm tmDate;
+   #ifdef _WIN32
+   gmtime_s(&tmDate,&date);
+   #else
+   gmtime_r(&date,&tmDate);// gmtime() is not thread-safe
+   #endif
    char strDate[40];
-   strftime(strDate,sizeof(strDate),"%Y-%m-%dT%H:%M:%S%Z",gmtime(&date));//%Y-%m-%dT%H:%M:%S%Z
+   strftime(strDate,sizeof(strDate),"%Y-%m-%dT%H:%M:%S%Z",&tmDate);//%Y-%m-%dT%H:%M:%S%Z
    tag.AddAttribute("Date",strDate);
    tag.AddAttribute("Revision","2021001");
    out<<tag<<endl;
@@ -1435,6 +1441,7 @@ void DiffractionDataSingleCrystal::XMLInput(istream &is,const XMLCrystTag &tagg)
       }
       if("HKLIobsSigmaWeightGROUPList"==tag.GetName())
       {
+         this->UnshareObservedData();
          mNbRefl=0;
          mNbGroup=0;
          // This must NOT be changed with this kind of data.
@@ -2279,6 +2286,7 @@ void PowderPattern::XMLInput(istream &is,const XMLCrystTag &tagg)
             VFN_DEBUG_EXIT("Loading Iobs-Sigma-Weight List...",8);
             continue;
          }
+         this->UnshareObservedData();
          mNbPoint=0;
          mPowderPatternObs.resize(500);
          mPowderPatternObsSigma.resize(500);
@@ -2317,6 +2325,7 @@ void PowderPattern::XMLInput(istream &is,const XMLCrystTag &tagg)
             VFN_DEBUG_EXIT("Loading Iobs-Sigma-Weight List...",8);
             continue;
          }
+         this->UnshareObservedData();
          mNbPoint=0;
          mX.resize(500);
          mPowderPatternObs.resize(500);
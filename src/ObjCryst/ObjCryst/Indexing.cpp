@@ -23,6 +23,7 @@
 #include <iomanip>
 
 #include "ObjCryst/ObjCryst/Indexing.h"
+#include "ObjCryst/RefinableObj/Random.h"
 #include "ObjCryst/Quirks/VFNDebug.h"
 #include "ObjCryst/Quirks/VFNStreamFormat.h"
 #include "ObjCryst/Quirks/Chronometer.h"
@@ -839,7 +840,7 @@ float PeakList::Simulate(float zero, float a, float b, float c,
    if(percentMissing>0.90) percentMissing=0.90;
    for(;pos!=vd2.end();++pos)
    {
-      if((rand()/float(RAND_MAX))<percentMissing) *pos=1e10;
+      if(RandomUniform()<percentMissing) *pos=1e10;
    }
    vd2.sort();
    pos=vd2.begin();
@@ -849,10 +850,10 @@ float PeakList::Simulate(float zero, float a, float b, float c,
 
    for(unsigned int i=0;i<nbspurious;++i)
    {
-      const unsigned int idx=1+i*nb/nbspurious+(rand()%nbspurious);
+      const unsigned int idx=1+i*nb/nbspurious+RandomInteger(nbspurious);
       pos=vd2.begin();
       for(unsigned int j=0;j<idx;++j) pos++;
-      *pos=dmin+rand()/float(RAND_MAX)*(dmax-dmin);
+      *pos=dmin+RandomUniform()*(dmax-dmin);
    }
 
    pos=vd2.begin();
@@ -860,7 +861,7 @@ float PeakList::Simulate(float zero, float a, float b, float c,
    {
       float d=*pos++;
       const float ds=d*sigma;
-      float d1=d+ds*(rand()/float(RAND_MAX)*2-1);
+      float d1=d+ds*(RandomUniform()*2-1);
       //cout<<d<<"  "<<ds<<"  "<<d1<<"   "<<sigma<<endl;
       mvHKL.push_back(hkl(d1,1.0,ds));
    }
@@ -1180,7 +1181,7 @@ void CellExplorer::Evolution(unsigned int ng,const bool randomize,const float f,
       {
          vRUC[i].first.mlattice=mlattice;
          vTrial[i].first.mlattice=mlattice;
-         for(unsigned int k=0;k<mnpar;++k) vRUC[i].first.par[k]=mMin[k]+mAmp[k]*rand()/(float)RAND_MAX;
+         for(unsigned int k=0;k<mnpar;++k) vRUC[i].first.par[k]=mMin[k]+mAmp[k]*RandomUniform();
          vRUC[i].second=Score(*mpPeakList,vRUC[i].first,mNbSpurious);
       }
    }
@@ -1192,11 +1193,11 @@ void CellExplorer::Evolution(unsigned int ng,const bool randomize,const float f,
          if(true)
          {// DE/rand/1/exp
             unsigned int r1=j,r2=j,r3=j;
-            while(r1==j)r1=rand()%np;
-            while((r2==j)||(r1==r2))r2=rand()%np;
-            while((r3==j)||(r3==r1)||(r3==r2))r3=rand()%np;
-            unsigned int ncr=1+(int)(cr*mnpar*rand()/(float)RAND_MAX);
-            unsigned int ncr0=rand()%mnpar;
+            while(r1==j)r1=RandomInteger(np);
+            while((r2==j)||(r1==r2))r2=RandomInteger(np);
+            while((r3==j)||(r3==r1)||(r3==r2))r3=RandomInteger(np);
+            unsigned int ncr=1+(int)(cr*mnpar*RandomUniform());
+            unsigned int ncr0=RandomInteger(mnpar);
             RecUnitCell *t0=&(vTrial[j].first);
             RecUnitCell *c0=&(vRUC[j].first);
             RecUnitCell *c1=&(vRUC[r1].first);
@@ -1215,18 +1216,18 @@ void CellExplorer::Evolution(unsigned int ng,const bool randomize,const float f,
          if(false)
          {// DE/rand-to-best/1/exp
             unsigned int r1=j,r2=j,r3=j;
-            while(r1==j)r1=rand()%np;
-            while((r2==j)||(r1==r2))r2=rand()%np;
-            while((r3==j)||(r3==r1)||(r3==r2))r3=rand()%np;
-            unsigned int ncr=1+(int)(cr*(mnpar-1)*rand()/(float)RAND_MAX);
-            unsigned int ncr0=rand()%mnpar;
+            while(r1==j)r1=RandomInteger(np);
+            while((r2==j)||(r1==r2))r2=RandomInteger(np);
+            while((r3==j)||(r3==r1)||(r3==r2))r3=RandomInteger(np);
+            unsigned int ncr=1+(int)(cr*(mnpar-1)*RandomUniform());
+            unsigned int ncr0=RandomInteger(mnpar);
             RecUnitCell *t0=&(vTrial[j].first);
             RecUnitCell *c0=&(vRUC[j].first);
             //RecUnitCell *c1=&(vRUC[r1].first);
             RecUnitCell *c2=&(vRUC[r2].first);
             RecUnitCell *c3=&(vRUC[r3].first);
             RecUnitCell *best=&(bestpos->first);
-            for(unsigned int k=0;k<6;++k)t0->par[k] = c0->par[k];//mMin[k]+mAmp[k]*rand()/(float)RAND_MAX;
+            for(unsigned int k=0;k<6;++k)t0->par[k] = c0->par[k];//mMin[k]+mAmp[k]*RandomUniform();
             for(unsigned int k=0;k<ncr;++k)
             {
                const unsigned l=(ncr0+k)%mnpar;
@@ -1245,7 +1246,7 @@ void CellExplorer::Evolution(unsigned int ng,const bool randomize,const float f,
             for(unsigned int k=0;k<6;++k)
             {
 
-               t0->par[k] = mMin[k]+ fmod((float)(amp*mAmp[k]*(rand()/(float)RAND_MAX-0.5)+5*mAmp[k]),(float)mAmp[k]);
+               t0->par[k] = mMin[k]+ fmod((float)(amp*mAmp[k]*(RandomUniform()-0.5)+5*mAmp[k]),(float)mAmp[k]);
             }
          }
       }
@@ -1267,7 +1268,7 @@ void CellExplorer::Evolution(unsigned int ng,const bool randomize,const float f,
                float v0=posTrial->first.par[1]*posTrial->first.par[2]*posTrial->first.par[3];
                while(v0<1/mVolumeMax)
                {
-                  const unsigned int i=rand()%3+1;
+                  const unsigned int i=RandomInteger(3)+1;
                   posTrial->first.par[i]*=1/(mVolumeMax*v0)+1e-4;
                   if(posTrial->first.par[i]>(mMin[i]+mAmp[i])) posTrial->first.par[i]=mMin[i]+mAmp[i];
                   v0=posTrial->first.par[1]*posTrial->first.par[2]*posTrial->first.par[3];
@@ -1302,7 +1303,7 @@ void CellExplorer::Evolution(unsigned int ng,const bool randomize,const float f,
          /*
          else
          {
-            if(log(rand()/(float)RAND_MAX)>(-(score-pos->second)))
+            if(log(RandomUniform())>(-(score-pos->second)))
             {
                pos->second=score;
                const float *p0=posTrial->first.par;
@@ -1327,7 +1328,7 @@ void CellExplorer::Evolution(unsigned int ng,const bool randomize,const float f,
          for(vector<pair<RecUnitCell,float> >::iterator pos=vRUC.begin();pos!=vRUC.end();++pos)
          {
             if(pos==bestpos) continue;
-            for(unsigned int k=0;k<mnpar;++k) pos->first.par[k]=mMin[k]+mAmp[k]*rand()/(float)RAND_MAX;
+            for(unsigned int k=0;k<mnpar;++k) pos->first.par[k]=mMin[k]+mAmp[k]*RandomUniform();
          }
       }
    }
@@ -1943,7 +1944,7 @@ unsigned int CellExplorer::RDicVol(RecUnitCell par0,RecUnitCell dpar, unsigned i
       }
    }
    #endif
-   if(false)//(depth==1)&&(rand()%10==0))
+   if(false)//(depth==1)&&(RandomInteger(10)==0))
    {
       RecUnitCell parm=par0,parp=par0;
       for(unsigned int i=0;i<4;++i) {parm.par[i]-=dpar.par[i];parp.par[i]+=dpar.par[i];}
@@ -2076,7 +2077,7 @@ unsigned int CellExplorer::RDicVol(RecUnitCell par0,RecUnitCell dpar, unsigned i
                &&((mvSolution.size()<50)||(score>(mBestScore/3)))
                &&((mvSolution.size()<50)||(score>mMinScoreReport)))
             {
-               if((score>(mBestScore))||((score>(mBestScore*0.8))&&(mvSolution.size()<50)))//||(rand()%100==0))
+               if((score>(mBestScore))||((score>(mBestScore*0.8))&&(mvSolution.size()<50)))//||(RandomInteger(100)==0))
                {
                   char buf[200];
                   {
@@ -2105,7 +2106,7 @@ unsigned int CellExplorer::RDicVol(RecUnitCell par0,RecUnitCell dpar, unsigned i
                mvSolution.push_back(make_pair(mRecUnitCell,score));
                mvSolution.back().first.mNbSpurious = mNbSpurious;
                mvNbSolutionDepth[depth]+=1;
-               if((mvSolution.size()>1100)&&(rand()%1000==0))
+               if((mvSolution.size()>1100)&&(RandomInteger(1000)==0))
                {
                   cout<<mvSolution.size()<<" solutions ! Redparing..."<<endl;
                   this->ReduceSolutions(true);// This will update the min report score
@@ -2705,7 +2706,6 @@ void CellExplorer::Init()
    // Prepare global optimisation
    //for(unsigned int i=0;i<mpPeakList->nb;++i)
    //   cout<<__FILE__<<":"<<__LINE__<<":d*="<<mpPeakList->mvdobs[i]<<", d*^2="<<mpPeakList->mvd2obs[i]<<endl;
-   srand(time(NULL));
    vector<pair<RecUnitCell,float> >::iterator pos;
    const float min_latt=1./mLengthMax;
    const float max_latt=1./mLengthMin;
@@ -25,12 +25,15 @@
 #include <algorithm>
 #include <iomanip>
 #include <ctime>
+#include <mutex>
 #include <boost/format.hpp>
 
 #include "ObjCryst/Quirks/VFNStreamFormat.h"
 #include "ObjCryst/ObjCryst/Molecule.h"
 #include "ObjCryst/ObjCryst/ZScatterer.h"
 #include "ObjCryst/RefinableObj/GlobalOptimObj.h"
+#include "ObjCryst/RefinableObj/Random.h"
+#include "ObjCryst/RefinableObj/Profiler.h"
 
 #ifdef OBJCRYST_GL
    #ifdef __DARWIN__
@@ -1891,7 +1894,7 @@ void StretchModeTwist::RandomStretch(const REAL amplitude,
    const REAL dy=mpAtom2->GetY()-mpAtom1->GetY();
    const REAL dz=mpAtom2->GetZ()-mpAtom1->GetZ();
    if((abs(dx)+abs(dy)+abs(dz))<1e-6) return;// :KLUDGE:
-   const REAL change=(REAL)(2.*rand()-RAND_MAX)/(REAL)RAND_MAX*mBaseAmplitude*amplitude;
+   const REAL change=(2*RandomUniform()-1)*mBaseAmplitude*amplitude;
    mpMol->RotateAtomGroup(*mpAtom1,*mpAtom2,mvRotatedAtomList,change,keepCenter);
 }
 
@@ -2162,6 +2165,67 @@ Molecule* Molecule::CreateCopy() const
    return new Molecule(*this);
 }
 
+Molecule* Molecule::Clone(std::map<const RefinableObj*,RefinableObj*> &vCopy)const
+{
+   VFN_DEBUG_ENTRY("Molecule::Clone():"<<mName,5)
+   Crystal *pCryst=0;
+   if(mpCryst!=0) pCryst=FindCopy(*mpCryst,vCopy);
+   if(pCryst==0)
+      throw ObjCrystException("Molecule::Clone(): the crystal of "+mName+" has not been copied");
+   // :KLUDGE: same as in XMLOutput(), this may be dangerous if the molecule is being refined !
+   this->ResetRigidGroupsPar();
+   Molecule *p=new Molecule(*pCryst,mName);
+   vCopy[this]=p;
+   p->mMDMoveFreq=mMDMoveFreq;
+   p->mMDMoveEnergy=mMDMoveEnergy;
+   p->mLogLikelihoodScale=mLogLikelihoodScale;
+   p->mBaseRotationAmplitude=mBaseRotationAmplitude;
+   p->mQuat=mQuat;
+   map<const MolAtom*,MolAtom*> vAtom;
+   for(vector<MolAtom*>::const_iterator pos=mvpAtom.begin();pos!=mvpAtom.end();++pos)
+   {
+      const ScatteringPower *pPow=0;
+      if(!(*pos)->IsDummy())
+      {
+         pPow=FindCopy((*pos)->GetScatteringPower(),vCopy);
+         if(pPow==0) pPow=&((*pos)->GetScatteringPower());
+      }
+      p->AddAtom((*pos)->X(),(*pos)->Y(),(*pos)->Z(),pPow,(*pos)->GetName(),false);
+      p->mvpAtom.back()->SetOccupancy((*pos)->GetOccupancy());
+      p->mvpAtom.back()->SetNonFlipAtom((*pos)->IsNonFlipAtom());
+      vAtom[*pos]=p->mvpAtom.back();
+   }
+   for(vector<MolBond*>::const_iterator pos=mvpBond.begin();pos!=mvpBond.end();++pos)
+   {
+      p->AddBond(*vAtom[&((*pos)->GetAtom1())],*vAtom[&((*pos)->GetAtom2())],
+                 (*pos)->GetLength0(),(*pos)->GetLengthSigma(),(*pos)->GetLengthDelta(),
+                 (*pos)->GetBondOrder(),false);
+      p->mvpBond.back()->SetFreeTorsion((*pos)->IsFreeTorsion());
+   }
+   for(vector<MolBondAngle*>::const_iterator pos=mvpBondAngle.begin();pos!=mvpBondAngle.end();++pos)
+      p->AddBondAngle(*vAtom[&((*pos)->GetAtom1())],*vAtom[&((*pos)->GetAtom2())],
+                      *vAtom[&((*pos)->GetAtom3())],
+                      (*pos)->GetAngle0(),(*pos)->GetAngleSigma(),(*pos)->GetAngleDelta(),false);
+   for(vector<MolDihedralAngle*>::const_iterator pos=mvpDihedralAngle.begin();
+       pos!=mvpDihedralAngle.end();++pos)
+      p->AddDihedralAngle(*vAtom[&((*pos)->GetAtom1())],*vAtom[&((*pos)->GetAtom2())],
+                          *vAtom[&((*pos)->GetAtom3())],*vAtom[&((*pos)->GetAtom4())],
+                          (*pos)->GetAngle0(),(*pos)->GetAngleSigma(),(*pos)->GetAngleDelta(),false);
+   for(vector<RigidGroup*>::const_iterator pos=mvRigidGroup.begin();pos!=mvRigidGroup.end();++pos)
+   {
+      RigidGroup s;
+      for(set<MolAtom*>::const_iterator at=(*pos)->begin();at!=(*pos)->end();++at)
+         s.insert(vAtom[*at]);
+      p->AddRigidGroup(s,false);
+   }
+   if(mpCenterAtom!=0) p->SetCenterAtom(*vAtom[mpCenterAtom]);
+   p->SetName(mName);
+   p->CopyParAndOptions(*this);
+   p->UpdateDisplay();
+   VFN_DEBUG_EXIT("Molecule::Clone():"<<mName,5)
+   return p;
+}
+
 const string& Molecule::GetClassName() const
 {
    static const string className="Molecule";
@@ -2640,7 +2704,7 @@ void Molecule::RandomizeConfiguration()
       for(list<RotorGroup>::const_iterator pos=mvRotorGroupTorsion.begin();
           pos!=mvRotorGroupTorsion.end();++pos)
       {
-         const REAL angle=(REAL)rand()*2.*M_PI/(REAL)RAND_MAX;
+         const REAL angle=RandomUniform()*2.*M_PI;
          this->RotateAtomGroup(*(pos->mpAtom1),*(pos->mpAtom2),
                                pos->mvRotatedAtomList,angle);
       }
@@ -2648,7 +2712,7 @@ void Molecule::RandomizeConfiguration()
       for(list<RotorGroup>::const_iterator pos=mvRotorGroupTorsionSingleChain.begin();
           pos!=mvRotorGroupTorsionSingleChain.end();++pos)
       {
-         const REAL angle=(REAL)rand()*2.*M_PI/(REAL)RAND_MAX;
+         const REAL angle=RandomUniform()*2.*M_PI;
          this->RotateAtomGroup(*(pos->mpAtom1),*(pos->mpAtom2),
                                pos->mvRotatedAtomList,angle);
       }
@@ -2656,7 +2720,7 @@ void Molecule::RandomizeConfiguration()
       for(list<RotorGroup>::const_iterator pos=mvRotorGroupInternal.begin();
           pos!=mvRotorGroupInternal.end();++pos)
       {
-         const REAL angle=(REAL)rand()*2.*M_PI/(REAL)RAND_MAX;
+         const REAL angle=RandomUniform()*2.*M_PI;
          this->RotateAtomGroup(*(pos->mpAtom1),*(pos->mpAtom2),
                                pos->mvRotatedAtomList,angle);
       }
@@ -2665,7 +2729,7 @@ void Molecule::RandomizeConfiguration()
          pos=mvStretchModeTorsion.begin();
        pos!=mvStretchModeTorsion.end();++pos)
    {
-      const REAL amp=2*M_PI*rand()/(REAL)RAND_MAX;
+      const REAL amp=2*M_PI*RandomUniform();
       this->DihedralAngleRandomChange(*pos,amp,true);
    }
    // Molecular dynamics moves
@@ -2674,7 +2738,7 @@ void Molecule::RandomizeConfiguration()
       // Random initial speed for all atoms
       map<MolAtom*,XYZ> v0;
       for(vector<MolAtom*>::iterator at=this->GetAtomList().begin();at!=this->GetAtomList().end();++at)
-         v0[*at]=XYZ(rand()/(REAL)RAND_MAX+0.5,rand()/(REAL)RAND_MAX+0.5,rand()/(REAL)RAND_MAX+0.5);
+         v0[*at]=XYZ(RandomUniform()+0.5,RandomUniform()+0.5,RandomUniform()+0.5);
 
       const REAL nrj0=mMDMoveEnergy*( this->GetBondList().size()
                                      +this->GetBondAngleList().size()
@@ -2706,10 +2770,10 @@ void Molecule::RandomizeConfiguration()
    #endif
    if(mOptimizeOrientation.GetChoice()==0)
    {//Rotate around an arbitrary vector
-      const REAL amp=M_PI/RAND_MAX;
+      const REAL amp=M_PI;
       mQuat *= Quaternion::RotationQuaternion
-                  ((2.*(REAL)rand()-(REAL)RAND_MAX)*amp,
-                   (REAL)rand(),(REAL)rand(),(REAL)rand());
+                  ((2*RandomUniform()-1)*amp,
+                   RandomUniform(),RandomUniform(),RandomUniform());
       mQuat.Normalize();
       mClockOrientation.Click();
    }
@@ -2728,6 +2792,7 @@ void Molecule::GlobalOptRandomMove(const REAL mutationAmplitude,
       return;
    }
    TAU_PROFILE("Molecule::GlobalOptRandomMove()","void (REAL,RefParType*)",TAU_DEFAULT);
+   OBJCRYST_PROFILE("Molecule::GlobalOptRandomMove")
    TAU_PROFILE_TIMER(timer1,"Molecule::GlobalOptRandomMove 1","", TAU_FIELD);
    TAU_PROFILE_TIMER(timer2,"Molecule::GlobalOptRandomMove 2","", TAU_FIELD);
    TAU_PROFILE_TIMER(timer3,"Molecule::GlobalOptRandomMove 3","", TAU_FIELD);
@@ -2743,12 +2808,12 @@ void Molecule::GlobalOptRandomMove(const REAL mutationAmplitude,
       &&(mFlipModel.GetChoice()==0)
       &&(gpRefParTypeScattConform->IsDescendantFromOrSameAs(type))
       &&(mvFlipGroup.size()>0)
-      &&(((rand()%100)==0)))
+      &&((RandomInteger(100)==0)))
    {
 
       this->SaveParamSet(mLocalParamSet);
       const REAL llk0=this->GetLogLikelihood()/mLogLikelihoodScale;
-      const unsigned long i=rand() % mvFlipGroup.size();
+      const unsigned long i=RandomInteger(mvFlipGroup.size());
       list<FlipGroup>::iterator pos=mvFlipGroup.begin();
       for(unsigned long j=0;j<i;++j)++pos;
       this->FlipAtomGroup(*pos,true);
@@ -2802,12 +2867,12 @@ void Molecule::GlobalOptRandomMove(const REAL mutationAmplitude,
       TAU_PROFILE_START(timer1);
       if(mOptimizeOrientation.GetChoice()==0)
       {//Rotate around an arbitrary vector
-         static const REAL amp=mBaseRotationAmplitude/(REAL)RAND_MAX;
+         const REAL amp=mBaseRotationAmplitude;
          REAL mult=1.0;
          if((1==mFlexModel.GetChoice())||(mvRotorGroupTorsion.size()<2)) mult=2.0;
          mQuat *= Quaternion::RotationQuaternion
-                     ((2.*(REAL)rand()-(REAL)RAND_MAX)*amp*mutationAmplitude*mult,
-                      (REAL)rand(),(REAL)rand(),(REAL)rand());
+                     ((2*RandomUniform()-1)*amp*mutationAmplitude*mult,
+                      RandomUniform(),RandomUniform(),RandomUniform());
          mQuat.Normalize();
          mClockOrientation.Click();
       }
@@ -2825,7 +2890,7 @@ void Molecule::GlobalOptRandomMove(const REAL mutationAmplitude,
          if(mFlexModel.GetChoice()!=1)
          {
             #if 1 // Move as many atoms as possible
-            if((mvMDFullAtomGroup.size()>3)&&(rand()<(RAND_MAX*mMDMoveFreq)))
+            if((mvMDFullAtomGroup.size()>3)&&(RandomUniform()<mMDMoveFreq))
             {
                #if 0
                // Use one center for the position of an impulsion, applied to all atoms with an exponential decrease
@@ -2850,9 +2915,9 @@ void Molecule::GlobalOptRandomMove(const REAL mutationAmplitude,
                if(dx<2) dx=2;
                if(dy<2) dy=2;
                if(dz<2) dz=2;
-               const REAL xc=xmin+rand()/(REAL)RAND_MAX*(xmax-xmin);
-               const REAL yc=ymin+rand()/(REAL)RAND_MAX*(ymax-ymin);
-               const REAL zc=zmin+rand()/(REAL)RAND_MAX*(zmax-zmin);
+               const REAL xc=xmin+RandomUniform()*(xmax-xmin);
+               const REAL yc=ymin+RandomUniform()*(ymax-ymin);
+               const REAL zc=zmin+RandomUniform()*(zmax-zmin);
                map<MolAtom*,XYZ> v0;
                const REAL ax=-4.*log(2.)/(dx*dx);
                const REAL ay=-4.*log(2.)/(dy*dy);
@@ -2867,7 +2932,7 @@ void Molecule::GlobalOptRandomMove(const REAL mutationAmplitude,
                for(set<MolAtom*>::iterator at=this->mvMDFullAtomGroup.begin();at!=this->mvMDFullAtomGroup.end();++at)
                   v0[*at]=XYZ(0,0,0);
                std::map<MolAtom*,unsigned long> pushedAtoms;
-               unsigned long idx=rand()%v0.size();
+               unsigned long idx=RandomInteger(v0.size());
                set<MolAtom*>::iterator at0=this->mvMDFullAtomGroup.begin();
                for(unsigned int i=0;i<idx;i++) at0++;
                const REAL xc=(*at0)->GetX();
@@ -2878,14 +2943,14 @@ void Molecule::GlobalOptRandomMove(const REAL mutationAmplitude,
                REAL ux,uy,uz,n=0;
                while(n<1)
                {
-                  ux=REAL(rand()-RAND_MAX/2);
-                  uy=REAL(rand()-RAND_MAX/2);
-                  uz=REAL(rand()-RAND_MAX/2);
+                  ux=(RandomUniform()-0.5);
+                  uy=(RandomUniform()-0.5);
+                  uz=(RandomUniform()-0.5);
                   n=sqrt(ux*ux+uy*uy+uz*uz);
                }
                ux=ux/n;uy=uy/n;uz=uz/n;
                const REAL a=-4.*log(2.)/(2*2);//FWHM=2 Angstroems
-               if(rand()%2==0)
+               if(RandomInteger(2)==0)
                   for(map<MolAtom*,unsigned long>::iterator at=pushedAtoms.begin() ;at!=pushedAtoms.end();++at)
                      v0[at->first]=XYZ(ux*exp(a*(at->first->GetX()-xc)*(at->first->GetX()-xc)),
                                  uy*exp(a*(at->first->GetY()-yc)*(at->first->GetY()-yc)),
@@ -2909,21 +2974,21 @@ void Molecule::GlobalOptRandomMove(const REAL mutationAmplitude,
                                              vr,nrj0);
             }
             #else // Move atoms belonging to a MD group
-            if((mvMDAtomGroup.size()>0)&&(rand()<(RAND_MAX*mMDMoveFreq)))
+            if((mvMDAtomGroup.size()>0)&&(RandomUniform()<mMDMoveFreq))
             {
-               const unsigned int n=rand()%mvMDAtomGroup.size();
+               const unsigned int n=RandomInteger(mvMDAtomGroup.size());
                list<MDAtomGroup>::iterator pos=mvMDAtomGroup.begin();
                for(unsigned int i=0;i<n;++i)++pos;
                map<MolAtom*,XYZ> v0;
                for(set<MolAtom*>::iterator at=pos->mvpAtom.begin();at!=pos->mvpAtom.end();++at)
-                  v0[*at]=XYZ(rand()/(REAL)RAND_MAX+0.5,rand()/(REAL)RAND_MAX+0.5,rand()/(REAL)RAND_MAX+0.5);
+                  v0[*at]=XYZ(RandomUniform()+0.5,RandomUniform()+0.5,RandomUniform()+0.5);
 
                const REAL nrj0=mMDMoveEnergy*( pos->mvpBond.size()
                                     +pos->mvpBondAngle.size()
                                     +pos->mvpDihedralAngle.size());
                map<RigidGroup*,std::pair<XYZ,XYZ> > vr;
                float nrjMult=1.0+mutationAmplitude*0.2;
-               if((rand()%20)==0) nrjMult=4.0;
+               if(RandomInteger(20)==0) nrjMult=4.0;
                this->MolecularDynamicsEvolve(v0, int(100*sqrt(mutationAmplitude)),0.004,
                                              pos->mvpBond,
                                              pos->mvpBondAngle,
@@ -2944,7 +3009,7 @@ void Molecule::GlobalOptRandomMove(const REAL mutationAmplitude,
             for(list<StretchMode*>::const_iterator mode=mvpStretchModeNotFree.begin();
                 mode!=mvpStretchModeNotFree.end();++mode)
             {
-               //if((rand()%3)==0)
+               //if(RandomInteger(3)==0)
                {
                   // 2) Get the derivative of the overall LLK for this mode
                   (*mode)->CalcDeriv();
@@ -2956,7 +3021,7 @@ void Molecule::GlobalOptRandomMove(const REAL mutationAmplitude,
                   for(map<const MolDihedralAngle*,REAL>::const_iterator pos=(*mode)->mvpBrokenDihedralAngle.begin();
                       pos!=(*mode)->mvpBrokenDihedralAngle.end();++pos) llk+=pos->first->GetLogLikelihood(false,false);
                   // 3) Calculate MD move. base step =0.1 A (accelerated moves may go faster)
-                  REAL change=(2.*(REAL)rand()-(REAL)RAND_MAX)/(REAL)RAND_MAX;
+                  REAL change=(2*RandomUniform()-1);
                   // if llk>100, change has to be in the opposite direction
                   // For a single restraint, sqrt(llk)=dx/sigma, so do not go above 10*sigma
                   if((*mode)->mLLKDeriv>0)
@@ -3012,10 +3077,10 @@ void Molecule::GlobalOptRandomMove(const REAL mutationAmplitude,
             for(list<StretchMode*>::iterator mode=mvpStretchModeFree.begin();
                 mode!=mvpStretchModeFree.end();++mode)
             {
-               if((rand()%2)==0) (*mode)->RandomStretch(mutationAmplitude);
+               if(RandomInteger(2)==0) (*mode)->RandomStretch(mutationAmplitude);
             }
             TAU_PROFILE_STOP(timer2);
-            if((rand()%3)==0)
+            if(RandomInteger(3)==0)
             {
                // Now do an hybrid move for other modes, with a smaller amplitude (<=0.5)
                // 1) Calc LLK and derivatives for restraints
@@ -3034,7 +3099,7 @@ void Molecule::GlobalOptRandomMove(const REAL mutationAmplitude,
                    mode!=mvpStretchModeNotFree.end();++mode)
                {
                   // 2) Choose Stretch modes
-                  if((rand()%3)==0)
+                  if(RandomInteger(3)==0)
                   {
                      // 2) Get the derivative of the overall LLK for this mode
                      (*mode)->CalcDeriv();
@@ -3045,7 +3110,7 @@ void Molecule::GlobalOptRandomMove(const REAL mutationAmplitude,
                          pos!=(*mode)->mvpBrokenBondAngle.end();++pos) llk+=pos->first->GetLogLikelihood(false,false);
                      for(map<const MolDihedralAngle*,REAL>::const_iterator pos=(*mode)->mvpBrokenDihedralAngle.begin();
                          pos!=(*mode)->mvpBrokenDihedralAngle.end();++pos) llk+=pos->first->GetLogLikelihood(false,false);
-                     REAL change=(2.*(REAL)rand()-(REAL)RAND_MAX)/(REAL)RAND_MAX;
+                     REAL change=(2*RandomUniform()-1);
                      // if llk>100, change has to be in the direction minimising the llk
                      if((*mode)->mLLKDeriv>0)
                      {
@@ -3065,7 +3130,7 @@ void Molecule::GlobalOptRandomMove(const REAL mutationAmplitude,
                // Here we do not take mLogLikelihoodScale into account
                // :TODO: take into account cases where the lllk cannot go down to 0 because of
                // combined restraints.
-               if( ((rand()%100)==0) && (mLogLikelihood>(mvpRestraint.size()*10)))
+               if( (RandomInteger(100)==0) && (mLogLikelihood>(mvpRestraint.size()*10)))
                   this->OptimizeConformationSteepestDescent(0.02,5);
                TAU_PROFILE_STOP(timer4);
             }
@@ -3074,11 +3139,11 @@ void Molecule::GlobalOptRandomMove(const REAL mutationAmplitude,
             #if 0
             for(list<MDAtomGroup>::iterator pos=mvMDAtomGroup.begin();pos!=mvMDAtomGroup.end();++pos)
             {
-               if((rand()%100)==0)
+               if(RandomInteger(100)==0)
                {
                   map<MolAtom*,XYZ> v0;
                   for(set<MolAtom*>::iterator at=pos->mvpAtom.begin();at!=pos->mvpAtom.end();++at)
-                     v0[*at]=XYZ(rand()/(REAL)RAND_MAX+0.5,rand()/(REAL)RAND_MAX+0.5,rand()/(REAL)RAND_MAX+0.5);
+                     v0[*at]=XYZ(RandomUniform()+0.5,RandomUniform()+0.5,RandomUniform()+0.5);
 
                   const REAL nrj0=20*(pos->mvpBond.size()+pos->mvpBondAngle.size()+pos->mvpDihedralAngle.size());
                   map<RigidGroup*,std::pair<XYZ,XYZ> > vr;
@@ -3092,14 +3157,14 @@ void Molecule::GlobalOptRandomMove(const REAL mutationAmplitude,
             #endif
             }
             // Do a steepest descent from time to time
-            if((rand()%100)==0) this->OptimizeConformationSteepestDescent(0.02,1);
+            if(RandomInteger(100)==0) this->OptimizeConformationSteepestDescent(0.02,1);
 
             mClockLogLikelihood.Click();
             #endif
          }
       }
    }
-   if((rand()%100)==0)
+   if(RandomInteger(100)==0)
    {// From time to time, bring back average position to 0
       REAL x0=0,y0=0,z0=0;
       for(vector<MolAtom*>::iterator pos=mvpAtom.begin();pos!=mvpAtom.end();++pos)
@@ -3131,6 +3196,7 @@ REAL Molecule::GetLogLikelihood()const
       &&(mClockLogLikelihood>mClockAtomPosition)
       &&(mClockLogLikelihood>mClockScatterer)) return mLogLikelihood*mLogLikelihoodScale;
    TAU_PROFILE("Molecule::GetLogLikelihood()","REAL ()",TAU_DEFAULT);
+   OBJCRYST_PROFILE("Molecule::GetLogLikelihood")
    mLogLikelihood=this->RefinableObj::GetLogLikelihood();
    mClockLogLikelihood.Click();
    return mLogLikelihood*mLogLikelihoodScale;
@@ -4761,7 +4827,7 @@ REAL FlatLorentzianIntegral(const REAL x1,const REAL x2, const REAL sigma, const
 REAL LorentzianBiasedRandomMove(const REAL x0,const REAL sigma,const REAL delta,const REAL amplitude)
 {
    //static const REAL SPI2=0.88622692545275794;//sqrt(pi)/2
-   REAL r=(REAL)rand()/(REAL)RAND_MAX;
+   REAL r=RandomUniform();
    if(sigma<1e-6)
    {
       REAL x=x0+amplitude*(2*r-1.0);
@@ -4850,12 +4916,12 @@ REAL LorentzianBiasedRandomMove(const REAL x0,const REAL sigma,const REAL delta,
          {
             REAL ymin=(abs(xmin)-delta)/sigma;
             ymin=atan(ymin);
-            const REAL y=ymin*(REAL)rand()/(REAL)RAND_MAX;
+            const REAL y=ymin*RandomUniform();
             return -delta-tan(y)*sigma;
          }
          else
          {
-            return -delta+(REAL)rand()/(REAL)RAND_MAX*(xmax+delta);
+            return -delta+RandomUniform()*(xmax+delta);
          }
       }
       else //xmax>delta && xmin <= -delta
@@ -4868,19 +4934,19 @@ REAL LorentzianBiasedRandomMove(const REAL x0,const REAL sigma,const REAL delta,
          {
             REAL ymin=(abs(xmin)-delta)/sigma;
             ymin=atan(ymin);//exp(ymin*ymin);
-            const REAL y=ymin*(REAL)rand()/(REAL)RAND_MAX;
+            const REAL y=ymin*RandomUniform();
             const REAL x=-delta-tan(y)*sigma;
             return x;
          }
          if(r<(p0+p1)/n)
          {
-            const REAL x=-delta+(REAL)rand()/(REAL)RAND_MAX*2*delta;
+            const REAL x=-delta+RandomUniform()*2*delta;
             return x;
          }
 
          REAL ymax=(xmax-delta)/sigma;
          ymax=atan(ymax);
-         const REAL y=ymax*(REAL)rand()/(REAL)RAND_MAX;
+         const REAL y=ymax*RandomUniform();
          const REAL x=delta+tan(y)*sigma;
          return x;
       }
@@ -4896,12 +4962,12 @@ REAL LorentzianBiasedRandomMove(const REAL x0,const REAL sigma,const REAL delta,
       const REAL p1=atan((xmax-delta)/sigma)*sigma;// proba in[delta;xmax]
       if(r<(p0/(p0+p1)))
       {
-         return xmin+(REAL)rand()/(REAL)RAND_MAX*(delta-xmin);
+         return xmin+RandomUniform()*(delta-xmin);
       }
 
       REAL ymax=(xmax-delta)/sigma;
       ymax=atan(ymax);
-      const REAL y=ymax*(REAL)rand()/(REAL)RAND_MAX;
+      const REAL y=ymax*RandomUniform();
       return delta+tan(y)*sigma;
    }
    //xmin>delta
@@ -4915,7 +4981,6 @@ REAL LorentzianBiasedRandomMove(const REAL x0,const REAL sigma,const REAL delta,
 
 void TestLorentzianBiasedRandomMove()
 {
-   srand(time(NULL));
    REAL x=0,sigma=0.1,delta=0.5,amplitude=0.05;
    ofstream f;
    f.open("test.dat");
@@ -4968,7 +5033,7 @@ REAL Molecule::BondLengthRandomChange(const StretchModeBondLength& mode, const R
       const REAL max=delta+sigma*5.0;
       if(sigma<1e-6)
       {
-         REAL d1=d0+(REAL)(2*rand()-RAND_MAX)/(REAL)RAND_MAX*amplitude*0.1;
+         REAL d1=d0+(2*RandomUniform()-1)*amplitude*0.1;
          if(d1> delta)d1= delta;
          if(d1<-delta)d1=-delta;
          change=d1-d0;
@@ -4977,7 +5042,7 @@ REAL Molecule::BondLengthRandomChange(const StretchModeBondLength& mode, const R
       if((d0+change)>max) change=max-d0;
       else if((d0+change)<(-max)) change=-max-d0;
       #if 0
-      if(rand()%10000==0)
+      if(RandomInteger(10000)==0)
       {
          cout<<"BOND LENGTH change("<<change<<"):"
              <<mode.mpAtom0->GetName()<<"-"
@@ -4987,7 +5052,7 @@ REAL Molecule::BondLengthRandomChange(const StretchModeBondLength& mode, const R
       }
       #endif
    }
-   else change=(2.*(REAL)rand()-(REAL)RAND_MAX)/(REAL)RAND_MAX*amplitude*0.1;
+   else change=(2*RandomUniform()-1)*amplitude*0.1;
    dx*=change/l;
    dy*=change/l;
    dz*=change/l;
@@ -5028,7 +5093,7 @@ REAL Molecule::BondAngleRandomChange(const StretchModeBondAngle& mode, const REA
       const REAL delta=mode.mpBondAngle->GetAngleDelta();
       if(sigma<1e-6)
       {
-         REAL a1=a0+(REAL)(2*rand()-RAND_MAX)/(REAL)RAND_MAX*amplitude*mode.mBaseAmplitude;
+         REAL a1=a0+(2*RandomUniform()-1)*amplitude*mode.mBaseAmplitude;
          if(a1> delta)a1= delta;
          if(a1<-delta)a1=-delta;
          change=a1-a0;
@@ -5037,7 +5102,7 @@ REAL Molecule::BondAngleRandomChange(const StretchModeBondAngle& mode, const REA
       if((a0+change)>(delta+sigma*5.0))       change= delta+sigma*5.0-a0;
       else if((a0+change)<(-delta-sigma*5.0)) change=-delta-sigma*5.0-a0;
       #if 0
-      if(rand()%1==0)
+      if(RandomInteger(1)==0)
       {
          cout<<"ANGLE change("<<change*RAD2DEG<<"):"
              <<mode.mpAtom0->GetName()<<"-"
@@ -5048,7 +5113,7 @@ REAL Molecule::BondAngleRandomChange(const StretchModeBondAngle& mode, const REA
       }
       #endif
    }
-   else change=(2.*(REAL)rand()-(REAL)RAND_MAX)/(REAL)RAND_MAX*mode.mBaseAmplitude*amplitude;
+   else change=(2*RandomUniform()-1)*mode.mBaseAmplitude*amplitude;
    this->RotateAtomGroup(*(mode.mpAtom1),vx,vy,vz,mode.mvRotatedAtomList,change,true);
    return change;
 }
@@ -5068,7 +5133,7 @@ REAL Molecule::DihedralAngleRandomChange(const StretchModeTorsion& mode, const R
       const REAL delta=mode.mpDihedralAngle->GetAngleDelta();
       if(sigma<1e-6)
       {
-         REAL a1=a0+(REAL)(2*rand()-RAND_MAX)/(REAL)RAND_MAX*amplitude*mode.mBaseAmplitude;
+         REAL a1=a0+(2*RandomUniform()-1)*amplitude*mode.mBaseAmplitude;
          if(a1> delta)a1= delta;
          if(a1<-delta)a1=-delta;
          change=a1-a0;
@@ -5077,7 +5142,7 @@ REAL Molecule::DihedralAngleRandomChange(const StretchModeTorsion& mode, const R
       if((a0+change)>(delta+sigma*5.0))       change= delta+sigma*5.0-a0;
       else if((a0+change)<(-delta-sigma*5.0)) change=-delta-sigma*5.0-a0;
       #if 0
-      if(rand()%1==0)
+      if(RandomInteger(1)==0)
       {
          cout<<"TORSION change ("
              <<mode.mpAtom1->GetName()<<"-"<<mode.mpAtom2->GetName()<<"):"<<endl
@@ -5088,7 +5153,7 @@ REAL Molecule::DihedralAngleRandomChange(const StretchModeTorsion& mode, const R
       }
       #endif
    }
-   else change=(REAL)(2.*rand()-RAND_MAX)/(REAL)RAND_MAX*mode.mBaseAmplitude*amplitude;
+   else change=(2*RandomUniform()-1)*mode.mBaseAmplitude*amplitude;
    this->RotateAtomGroup(*(mode.mpAtom1),*(mode.mpAtom2),mode.mvRotatedAtomList,change,true);
    return change;
 }
@@ -5746,9 +5811,9 @@ void Molecule::BuildStretchModeBondLength()
       {
          for(vector<MolAtom*>::iterator pos=mvpAtom.begin();pos!=mvpAtom.end();++pos)
          {
-            (*pos)->SetX(100.*rand()/(REAL) RAND_MAX);
-            (*pos)->SetY(100.*rand()/(REAL) RAND_MAX);
-            (*pos)->SetZ(100.*rand()/(REAL) RAND_MAX);
+            (*pos)->SetX(100.*RandomUniform());
+            (*pos)->SetY(100.*RandomUniform());
+            (*pos)->SetZ(100.*RandomUniform());
          }
          paramSetRandom[i]=this->CreateParamSet();
       }
@@ -6064,9 +6129,9 @@ void Molecule::BuildStretchModeBondAngle()
       {
          for(vector<MolAtom*>::iterator pos=mvpAtom.begin();pos!=mvpAtom.end();++pos)
          {
-            (*pos)->SetX(100.*rand()/(REAL) RAND_MAX);
-            (*pos)->SetY(100.*rand()/(REAL) RAND_MAX);
-            (*pos)->SetZ(100.*rand()/(REAL) RAND_MAX);
+            (*pos)->SetX(100.*RandomUniform());
+            (*pos)->SetY(100.*RandomUniform());
+            (*pos)->SetZ(100.*RandomUniform());
          }
          paramSetRandom[i]=this->CreateParamSet();
       }
@@ -6476,9 +6541,9 @@ void Molecule::BuildStretchModeTorsion()
       {
          for(vector<MolAtom*>::iterator pos=mvpAtom.begin();pos!=mvpAtom.end();++pos)
          {
-            (*pos)->SetX(100.*rand()/(REAL) RAND_MAX);
-            (*pos)->SetY(100.*rand()/(REAL) RAND_MAX);
-            (*pos)->SetZ(100.*rand()/(REAL) RAND_MAX);
+            (*pos)->SetX(100.*RandomUniform());
+            (*pos)->SetY(100.*RandomUniform());
+            (*pos)->SetZ(100.*RandomUniform());
          }
          paramSetRandom[i]=this->CreateParamSet();
       }
@@ -6772,9 +6837,9 @@ void Molecule::BuildStretchModeTwist()
       {
          for(vector<MolAtom*>::iterator pos=mvpAtom.begin();pos!=mvpAtom.end();++pos)
          {
-            (*pos)->SetX(100.*rand()/(REAL) RAND_MAX);
-            (*pos)->SetY(100.*rand()/(REAL) RAND_MAX);
-            (*pos)->SetZ(100.*rand()/(REAL) RAND_MAX);
+            (*pos)->SetX(100.*RandomUniform());
+            (*pos)->SetY(100.*RandomUniform());
+            (*pos)->SetZ(100.*RandomUniform());
          }
          paramSetRandom[i]=this->CreateParamSet();
       }
@@ -7003,7 +7068,7 @@ void Molecule::TuneGlobalOptimRotationAmplitude()
       for(unsigned int k=0;k<10;++k)
       {
          Quaternion quat=Quaternion::RotationQuaternion
-                     (mBaseRotationAmplitude,(REAL)rand(),(REAL)rand(),(REAL)rand());
+                     (mBaseRotationAmplitude,RandomUniform(),RandomUniform(),RandomUniform());
          for(long i=0;i<this->GetNbComponent();++i)
          {
             REAL x=x0[i]-xc;
@@ -7742,9 +7807,9 @@ void Molecule::InitOptions()
    static string moleculeCenterName;
    static string moleculeCenterChoices[2];
 
-   static bool needInitNames=true;
-   if(true==needInitNames)
-   {
+   static std::once_flag needInitNames;
+   std::call_once(needInitNames,[]()
+   {// Only once for the class
       Flexname="Flexibility Model";
       Flexchoices[0]="Automatic from Restraints, relaxed - RECOMMENDED";
       Flexchoices[1]="Rigid Body";
@@ -7766,9 +7831,7 @@ void Molecule::InitOptions()
       moleculeCenterName="Rotation Center";
       moleculeCenterChoices[0]="Geometrical center (recommended)";
       moleculeCenterChoices[1]="User-chosen Atom";
-
-      needInitNames=false;
-   }
+   });
    mFlexModel.Init(3,&Flexname,Flexchoices);
    mFlexModel.SetChoice(0);
    this->AddOption(&mFlexModel);
@@ -772,6 +772,7 @@ class Molecule: public Scatterer
       */
       ~Molecule();
       virtual Molecule* CreateCopy() const;
+      virtual Molecule* Clone(std::map<const RefinableObj*,RefinableObj*> &vCopy)const;
       virtual const string& GetClassName() const;
       virtual void SetName(const string &name);
       /// Formula with atoms in alphabetic order
@@ -22,14 +22,17 @@
 */
 
 #include <cstdlib>
+#include <cstring> //for memcmp()
 
 #include <typeinfo>
+#include <mutex>
 #include <stdio.h> //for sprintf()
 #include <boost/format.hpp>
 
 #include "cctbx/sgtbx/space_group.h" // For fullprof export
 
 #include "ObjCryst/ObjCryst/PowderPattern.h"
+#include "ObjCryst/RefinableObj/Profiler.h"
 #include "ObjCryst/ObjCryst/Molecule.h" // For fullprof export
 #include "ObjCryst/ObjCryst/PowderPatternBackgroundBayesianMinimiser.h"
 #include "ObjCryst/RefinableObj/Simplex.h"
@@ -126,7 +129,7 @@ void CylinderAbsCorr::CalcCorr() const
 //
 ////////////////////////////////////////////////////////////////////////
 ObjRegistry<PowderPatternComponent>
-   gPowderPatternComponentRegistry("List of all PowderPattern Components");
+   gPowderPatternComponentRegistry("List of all PowderPattern Components",true);
 
 PowderPatternComponent::PowderPatternComponent():
 mIsScalable(false),mpParentPowderPattern(0)
@@ -159,6 +162,12 @@ const string& PowderPatternComponent::GetClassName() const
    return className;
 }
 
+PowderPatternComponent* PowderPatternComponent::Clone(std::map<const RefinableObj*,RefinableObj*> &vCopy)const
+{
+   throw ObjCrystException("PowderPatternComponent::Clone(): not implemented for "
+                           +this->GetClassName()+":"+this->GetName());
+}
+
 const PowderPattern& PowderPatternComponent::GetParentPowderPattern()const
 {
    return *mpParentPowderPattern;
@@ -274,6 +283,19 @@ const string& PowderPatternBackground::GetClassName() const
    return className;
 }
 
+PowderPatternBackground* PowderPatternBackground::Clone(std::map<const RefinableObj*,RefinableObj*> &vCopy)const
+{
+   VFN_DEBUG_MESSAGE("PowderPatternBackground::Clone():"<<this->GetName(),5)
+   PowderPatternBackground *p=new PowderPatternBackground;
+   vCopy[this]=p;
+   p->SetName(this->GetName());
+   p->mMaxSinThetaOvLambda=mMaxSinThetaOvLambda;
+   p->mModelVariance=mModelVariance;
+   if(mBackgroundNbPoint>1) p->SetInterpPoints(mBackgroundInterpPointX,mBackgroundInterpPointIntensity);
+   p->CopyParAndOptions(*this);
+   return p;
+}
+
 void PowderPatternBackground::SetParentPowderPattern(PowderPattern &s)
 {
    if(mpParentPowderPattern!=0)
@@ -492,6 +514,7 @@ void PowderPatternBackground::CalcPowderPattern() const
        &&(mClockPowderPatternCalc>mpParentPowderPattern->GetClockPowderPatternPar())
        &&(mClockPowderPatternCalc>mInterpolationModel.GetClock())) return;
    TAU_PROFILE("PowderPatternBackground::CalcPowderPattern()","void ()",TAU_DEFAULT);
+   OBJCRYST_PROFILE("PowderPatternBackground::CalcPowderPattern")
    VFN_DEBUG_MESSAGE("PowderPatternBackground::CalcPowderPattern()",3);
 
    const unsigned long nb=mpParentPowderPattern->GetNbPoint();
@@ -502,8 +525,6 @@ void PowderPatternBackground::CalcPowderPattern() const
          case POWDER_BACKGROUND_LINEAR:
          {
             VFN_DEBUG_MESSAGE("PowderPatternBackground::CalcPowderPattern()..Linear",2)
-            REAL p1,p2;
-            REAL b1,b2;
             if(mBackgroundNbPoint==0)
             {
                mPowderPatternCalc=0;
@@ -511,28 +532,7 @@ void PowderPatternBackground::CalcPowderPattern() const
             }
             VFN_DEBUG_MESSAGE("PowderPatternBackground::CalcPowderPattern()"<<nb,2)
             this->InitSpline();
-            REAL *b=mPowderPatternCalc.data();
-            p1=this->GetParentPowderPattern().X2Pixel(mBackgroundInterpPointX(mPointOrder(0)));
-            p2=this->GetParentPowderPattern().X2Pixel(mBackgroundInterpPointX(mPointOrder(1)));
-            b1=mBackgroundInterpPointIntensity(mPointOrder(0));
-            b2=mBackgroundInterpPointIntensity(mPointOrder(1));
-            long point=1;
-            for(unsigned long i=0;i<nb;i++)
-            {
-               if(i >= p2)
-               {
-                  if(point < mBackgroundNbPoint-1)
-                  {
-                     b1=b2;
-                     p1=p2;
-                     b2=mBackgroundInterpPointIntensity(mPointOrder(point+1));
-                     p2=this->GetParentPowderPattern().X2Pixel(mBackgroundInterpPointX(mPointOrder(point+1)));
-                     point++ ;
-                  }
-               }
-               *b = (b1*(p2-i)+b2*(i-p1))/(p2-p1) ;
-               b++;
-            }
+            this->CalcLinearInterp(mBackgroundInterpPointIntensity,mPowderPatternCalc);
             break;
          }
          case POWDER_BACKGROUND_CUBIC_SPLINE:
@@ -567,23 +567,68 @@ void PowderPatternBackground::CalcPowderPattern_FullDeriv(std::set<RefinablePar*
    const unsigned long nb=mpParentPowderPattern->GetNbPoint();
    mPowderPattern_FullDeriv.clear();
    if((nb==0)||(mBackgroundNbPoint==0)) return;
+   this->InitSpline();
+   // The background is linear in the intensities of the interpolation points,
+   // so the derivative for one point is the background computed with a unit
+   // intensity for this point, and zero for all others.
+   CrystVector_REAL unit(mBackgroundNbPoint);
    for(std::set<RefinablePar*>::iterator par=vPar.begin();par!=vPar.end();++par)
    {
-      if((*par)==0) mPowderPattern_FullDeriv[*par]=this->GetPowderPatternCalc();
-      else
-         for(int j = 0; j < mBackgroundNbPoint; j++)
+      if((*par)==0)
+      {
+         mPowderPattern_FullDeriv[*par]=this->GetPowderPatternCalc();
+         continue;
+      }
+      const long j=(*par)->GetPointer()-mBackgroundInterpPointIntensity.data();
+      if((j<0)||(j>=mBackgroundNbPoint)) continue;
+      CrystVector_REAL *pDeriv=&(mPowderPattern_FullDeriv[*par]);
+      unit=0;
+      unit(j)=1;
+      switch(mInterpolationModel.GetChoice())
+      {
+         case POWDER_BACKGROUND_LINEAR:
          {
-            if((*par)->GetPointer()!=mBackgroundInterpPointIntensity.data()+j) continue;
-            const REAL step=(*par)->GetDerivStep();
-            (*par)->Mutate(step);
-            mPowderPattern_FullDeriv[*par] =this->GetPowderPatternCalc();
-            (*par)->Mutate(-2*step);
-            mPowderPattern_FullDeriv[*par]-=this->GetPowderPatternCalc();
-            (*par)->Mutate(step);
-            mPowderPattern_FullDeriv[*par]/= step*2;
-            if(MaxAbs(mPowderPattern_FullDeriv[*par])==0)
-               mPowderPattern_FullDeriv[*par].resize(0);
+            pDeriv->resize(nb);
+            this->CalcLinearInterp(unit,*pDeriv);
+            break;
          }
+         case POWDER_BACKGROUND_CUBIC_SPLINE:
+         {
+            CrystVector_REAL ipixel(mBackgroundNbPoint);
+            for(long i=0;i<mBackgroundNbPoint;++i) ipixel(i)=unit(mPointOrder(i));
+            CubicSpline spline(mvSplinePixel,ipixel);
+            *pDeriv=spline((REAL)0,(REAL)1,nb);
+            break;
+         }
+      }
+   }
+}
+
+void PowderPatternBackground::CalcLinearInterp(const CrystVector_REAL &intensity,
+                                               CrystVector_REAL &result)const
+{
+   const unsigned long nb=result.numElements();
+   REAL *b=result.data();
+   REAL p1=mvSplinePixel(0);
+   REAL p2=mvSplinePixel(1);
+   REAL b1=intensity(mPointOrder(0));
+   REAL b2=intensity(mPointOrder(1));
+   long point=1;
+   for(unsigned long i=0;i<nb;i++)
+   {
+      if(i >= p2)
+      {
+         if(point < mBackgroundNbPoint-1)
+         {
+            b1=b2;
+            p1=p2;
+            b2=intensity(mPointOrder(point+1));
+            p2=mvSplinePixel(point+1);
+            point++ ;
+         }
+      }
+      *b = (b1*(p2-i)+b2*(i-p1))/(p2-p1) ;
+      b++;
    }
 }
 
@@ -632,44 +677,34 @@ void PowderPatternBackground::CalcPowderPatternIntegrated() const
 void PowderPatternBackground::CalcPowderPatternIntegrated_FullDeriv(std::set<RefinablePar*> &vPar)
 {
    TAU_PROFILE("PowderPatternBackground::CalcPowderPatternIntegrated_FullDeriv()","void ()",TAU_DEFAULT);
-   //cout<<"PowderPatternBackground::CalcPowderPatternIntegrated_FullDeriv"<<endl;
    const unsigned long nb=mpParentPowderPattern->GetNbPoint();
    mPowderPatternIntegrated_FullDeriv.clear();
    if((nb==0)||(mBackgroundNbPoint==0)) return;
-   for(std::set<RefinablePar*>::iterator par=vPar.begin();par!=vPar.end();++par)
-   {
-      if((*par)==0) mPowderPattern_FullDeriv[*par]=this->GetPowderPatternCalc();
-      else
-         for(int j = 0; j < mBackgroundNbPoint; j++)
-         {
-            if((*par)->GetPointer()!=mBackgroundInterpPointIntensity.data()+j) continue;
-            const REAL step=(*par)->GetDerivStep();
-            (*par)->Mutate(step);
-            mPowderPatternIntegrated_FullDeriv[*par] =*(this->GetPowderPatternIntegratedCalc().first);
-            (*par)->Mutate(-2*step);
-            mPowderPatternIntegrated_FullDeriv[*par]-=*(this->GetPowderPatternIntegratedCalc().first);
-            (*par)->Mutate(step);
-            mPowderPatternIntegrated_FullDeriv[*par]/= step*2;
-            if(MaxAbs(mPowderPatternIntegrated_FullDeriv[*par])==0)
-               mPowderPatternIntegrated_FullDeriv[*par].resize(0);
-         }
-   }
-   #if 0
-   std::map<RefinablePar*, CrystVector_REAL> newDeriv=mPowderPatternIntegrated_FullDeriv;
-   this->PowderPatternComponent::CalcPowderPatternIntegrated_FullDeriv(vPar);
-   std::vector<const CrystVector_REAL*> v;
-   int n=0;
-   for(std::map<RefinablePar*, CrystVector_REAL>::reverse_iterator pos=mPowderPatternIntegrated_FullDeriv.rbegin();pos!=mPowderPatternIntegrated_FullDeriv.rend();++pos)
+   this->CalcPowderPattern_FullDeriv(vPar);
+   const CrystVector_long *pMin=&(mpParentPowderPattern->GetIntegratedProfileMin());
+   const CrystVector_long *pMax=&(mpParentPowderPattern->GetIntegratedProfileMax());
+   const long numInterval=pMin->numElements();
+   for(std::map<RefinablePar*,CrystVector_REAL>::const_iterator pos=mPowderPattern_FullDeriv.begin();
+       pos!=mPowderPattern_FullDeriv.end();++pos)
    {
-      cout<<pos->first->GetName()<<":"<<pos->second.size()<<","<<newDeriv[pos->first].size()<<endl;
-      if(pos->second.size()==0) continue;
-      v.push_back(&(pos->second));
-      v.push_back(&(newDeriv[pos->first]));
-      if(++n>8) break;
+      if(pos->first==0)
+      {
+         mPowderPatternIntegrated_FullDeriv[pos->first]=*(this->GetPowderPatternIntegratedCalc().first);
+         continue;
+      }
+      CrystVector_REAL *pDeriv=&(mPowderPatternIntegrated_FullDeriv[pos->first]);
+      pDeriv->resize(numInterval);
+      REAL * RESTRICT p2=pDeriv->data();
+      for(int j=0;j<numInterval;j++)
+      {
+         const long max=(*pMax)(j);
+         const REAL * RESTRICT p1=pos->second.data()+(*pMin)(j);
+         *p2=0;
+         for(int k=(*pMin)(j);k<=max;k++) *p2 += *p1++;
+         p2++;
+      }
+      if(MaxAbs(*pDeriv)==0) pDeriv->resize(0);
    }
-   if(v.size()>0) cout<<"PowderPatternBackground::CalcPowderPatternIntegrated_FullDeriv():"<<endl<<FormatVertVector<REAL>(v,12,1,20)<<endl;
-   //exit(0);
-   #endif
 }
 
 void PowderPatternBackground::Prepare()
@@ -727,16 +762,14 @@ void PowderPatternBackground::InitOptions()
    static string InterpolationModelName;
    static string InterpolationModelChoices[2];
 
-   static bool needInitNames=true;
-   if(true==needInitNames)
-   {
+   static std::once_flag needInitNames;
+   std::call_once(needInitNames,[]()
+   {// Only once for the class
       InterpolationModelName="Interpolation Model";
       InterpolationModelChoices[0]="Linear";
       InterpolationModelChoices[1]="Spline";
       //InterpolationModelChoices[2]="Chebyshev";
-
-      needInitNames=false;//Only once for the class
-   }
+   });
    mInterpolationModel.Init(2,&InterpolationModelName,InterpolationModelChoices);
    this->AddOption(&mInterpolationModel);
    mClockMaster.AddChild(mInterpolationModel.GetClock());
@@ -854,6 +887,59 @@ PowderPatternDiffraction* PowderPatternDiffraction::CreateCopy()const
    return new PowderPatternDiffraction(*this);
 }
 
+PowderPatternDiffraction* PowderPatternDiffraction::Clone(std::map<const RefinableObj*,RefinableObj*> &vCopy)const
+{
+   VFN_DEBUG_ENTRY("PowderPatternDiffraction::Clone():"<<this->GetName(),5)
+   Crystal *pCryst=0;
+   if(this->HasCrystal()) pCryst=FindCopy(this->GetCrystal(),vCopy);
+   if(pCryst==0)
+      throw ObjCrystException("PowderPatternDiffraction::Clone(): the crystal used by "
+                              +this->GetName()+" has not been copied");
+   PowderPatternDiffraction *p=new PowderPatternDiffraction;
+   vCopy[this]=p;
+   p->SetName(this->GetName());
+   p->SetIsIgnoringImagScattFact(this->IsIgnoringImagScattFact());
+   p->mMaxSinThetaOvLambda=mMaxSinThetaOvLambda;
+   p->SetProfile(mpReflectionProfile->CreateCopy());
+   p->mpReflectionProfile->CopyParAndOptions(*mpReflectionProfile);
+   // This also gives the copy of the crystal to a double-exponential profile
+   p->SetCrystal(*pCryst);
+   if(mFreezeLatticePar)
+   {
+      p->FreezeLatticePar(true);
+      p->mFrozenLatticePar=mFrozenLatticePar;
+      p->CalcFrozenBMatrix();
+   }
+   for(unsigned int i=0;i<mCorrTextureMarchDollase.GetNbPhase();i++)
+      p->mCorrTextureMarchDollase.AddPhase(mCorrTextureMarchDollase.GetFraction(i),
+                                           mCorrTextureMarchDollase.GetMarchCoeff(i),
+                                           mCorrTextureMarchDollase.GetPhaseH(i),
+                                           mCorrTextureMarchDollase.GetPhaseK(i),
+                                           mCorrTextureMarchDollase.GetPhaseL(i));
+   p->mCorrTextureMarchDollase.CopyParAndOptions(mCorrTextureMarchDollase);
+   p->mCorrTextureEllipsoid.SetParams(mCorrTextureEllipsoid.mEPR[0],mCorrTextureEllipsoid.mEPR[1],
+                                      mCorrTextureEllipsoid.mEPR[2],mCorrTextureEllipsoid.mEPR[3],
+                                      mCorrTextureEllipsoid.mEPR[4],mCorrTextureEllipsoid.mEPR[5]);
+   p->mCorrTextureEllipsoid.CopyParAndOptions(mCorrTextureEllipsoid);
+   if(mpLeBailData!=0) p->mpLeBailData=mpLeBailData->Clone(vCopy,false);
+   p->CopyParAndOptions(*this);
+   // Share the reflections only if they are up to date, see Prepare()
+   if(  (this->GetNbRefl()>0)&&(mpParentPowderPattern!=0)
+      &&(mClockHKL>this->GetCrystal().GetSpaceGroup().GetClockSpaceGroup())
+      &&(mClockHKL>this->GetCrystal().GetClockLatticePar())
+      &&(mClockHKL>this->GetRadiation().GetClockWavelength())
+      &&(mClockHKL>mpParentPowderPattern->GetClockPowderPatternPar()))
+   {
+      p->ShareHKL(*this);
+      p->mGenHKLBMatrix=mGenHKLBMatrix;
+   }
+   p->mExtractionMode=mExtractionMode;
+   p->mFhklObsSq=mFhklObsSq;
+   p->mClockFhklObsSq.Click();
+   VFN_DEBUG_EXIT("PowderPatternDiffraction::Clone()",5)
+   return p;
+}
+
 void PowderPatternDiffraction::SetParentPowderPattern(PowderPattern &s)
 {
    if(mpParentPowderPattern!=0)
@@ -1035,7 +1121,7 @@ void PowderPatternDiffraction::SetCrystal(Crystal &crystal)
       {
          ReflectionProfileDoubleExponentialPseudoVoigt *p
             =dynamic_cast<ReflectionProfileDoubleExponentialPseudoVoigt*>(mpReflectionProfile);
-            p->SetUnitCell((UnitCell)crystal);
+            p->SetUnitCell(crystal);
       }
    mClockHKL.Reset();
    if(reprep) this->Prepare();
@@ -1319,6 +1405,7 @@ void PowderPatternDiffraction::CalcPowderPattern() const
    this->GetNbReflBelowMaxSinThetaOvLambda();
    if(mClockPowderPatternCalc>mClockMaster) return;
    TAU_PROFILE("PowderPatternDiffraction::CalcPowderPattern()-Apply profiles","void (bool)",TAU_DEFAULT);
+   OBJCRYST_PROFILE("PowderPatternDiffraction::CalcPowderPattern")
 
    VFN_DEBUG_ENTRY("PowderPatternDiffraction::CalcPowderPattern():",3)
 
@@ -1427,118 +1514,107 @@ Applying profiles for "<<nbRefl<<" reflections",2)
    VFN_DEBUG_EXIT("PowderPatternDiffraction::CalcPowderPattern: End.",3)
 }
 
+/// Is this one of the parameters of an object (not including its sub-objects) ?
+static bool IsParOfObj(const RefinableObj &obj,const RefinablePar &par)
+{
+   for(long i=0;i<obj.GetNbPar();i++)
+      if(obj.GetPar(i).GetPointer()==par.GetPointer()) return true;
+   return false;
+}
+
 void PowderPatternDiffraction::CalcPowderPattern_FullDeriv(std::set<RefinablePar*> &vPar)
 {
    TAU_PROFILE("PowderPatternDiffraction::CalcPowderPattern_FullDeriv()","void ()",TAU_DEFAULT);
-   //cout<<"PowderPatternDiffraction::CalcPowderPattern_FullDeriv"<<endl;
-   this->CalcPowderPattern();
-   bool notYetDerivProfiles=true;
-   mIhkl_FullDeriv.clear();
-   mvReflProfile_FullDeriv.clear();
-   mPowderPattern_FullDeriv.clear();
+   // Parameters for which the derivatives are computed analytically, either through the
+   // reflection intensities (structure, texture), or through the reflection profiles
+   // (profile, position corrections). Derivatives for all other parameters which can
+   // affect this pattern (lattice, wavelength, temperature factors,...) are numerical.
+   std::set<RefinablePar*> vParIhkl,vParProfile,vParNum;
    for(std::set<RefinablePar*>::iterator par=vPar.begin();par!=vPar.end();++par)
    {
       if(*par==0) continue;
       if((*par)->IsFixed()) continue;
       if((*par)->IsUsed()==false) continue;
-      if(  (*par)->GetType()->IsDescendantFromOrSameAs(gpRefParTypeScatt)
-         ||(*par)->GetType()->IsDescendantFromOrSameAs(gpRefParTypeScattPow))
-      {
-         this->CalcIhkl_FullDeriv(vPar);
-      }
-      if(notYetDerivProfiles)
+      if(  (*par)->GetType()->IsDescendantFromOrSameAs(gpRefParTypeScattDataBackground)
+         ||(*par)->GetType()->IsDescendantFromOrSameAs(gpRefParTypeScattDataScale)) continue;
+      REAL dx;
+      if(this->IsIhklDerivPar(**par)) vParIhkl.insert(*par);
+      else if(  IsParOfObj(*mpReflectionProfile,**par)
+              ||mpParentPowderPattern->X2XCorr_Deriv(1,1,**par,dx)) vParProfile.insert(*par);
+      else vParNum.insert(*par);
+   }
+   // This clears mPowderPattern_FullDeriv
+   this->PowderPatternComponent::CalcPowderPattern_FullDeriv(vParNum);
+   this->CalcPowderPattern();
+   if(vPar.find(0)!=vPar.end()) mPowderPattern_FullDeriv[0]=mPowderPatternCalc;
+   mIhkl_FullDeriv.clear();
+   mvReflProfile_FullDeriv.clear();
+   if(vParIhkl.size()>0) this->CalcIhkl_FullDeriv(vParIhkl);
+   if(vParProfile.size()>0) this->CalcPowderReflProfile_FullDeriv(vParProfile);
+
+   const long nbRefl=this->GetNbRefl();
+   const long  specNbPoints=mpParentPowderPattern->GetNbPoint();
+   for(std::set<RefinablePar*>::iterator par=vParIhkl.begin();par!=vParIhkl.end();++par)
+   {
+      if(mIhkl_FullDeriv[*par].size()==0) continue;
+      long step; // number of reflections at the same place and with the same (assumed) profile
+      CrystVector_REAL *pDeriv=&(mPowderPattern_FullDeriv[*par]);
+      pDeriv->resize(specNbPoints);
+      *pDeriv=0;
+      for(long i=0;i<mNbReflUsed;i += step)
       {
-         if(  (*par)->GetType()->IsDescendantFromOrSameAs(gpRefParTypeRadiation)
-            ||(*par)->GetType()->IsDescendantFromOrSameAs(gpRefParTypeUnitCell)
-            ||(*par)->GetType()->IsDescendantFromOrSameAs(gpRefParTypeScattDataCorrPos)
-            ||(*par)->GetType()->IsDescendantFromOrSameAs(gpRefParTypeScattDataProfile))
+         if(mvReflProfile[i].profile.numElements()==0)
          {
-            this->CalcPowderReflProfile_FullDeriv(vPar);
-            notYetDerivProfiles=false;
+            step=1;
+            continue;
          }
+         REAL intensity=0.;
+         //check if the next reflection is at the same theta. If this is true,
+         //Then assume that the profile is exactly the same, unless it is anisotropic
+         for(step=0; ;)
+         {
+            intensity += mIhkl_FullDeriv[*par](i + step);
+            step++;
+            if(mpReflectionProfile->IsAnisotropic()) break;// Anisotropic profiles
+            if( (i+step) >= nbRefl) break;
+            if(mSinThetaLambda(i+step) > (mSinThetaLambda(i)+1e-5) ) break;
+         }
+         const long first=mvReflProfile[i].first,last=mvReflProfile[i].last;
+         const REAL *p2 = mvReflProfile[i].profile.data();
+         REAL *p3 = pDeriv->data()+first;
+         for(long j=first;j<=last;j++) *p3++ += *p2++ * intensity;
       }
    }
-
-   //this->CalcPowderReflProfile();
-   for(std::set<RefinablePar*>::iterator par=vPar.begin();par!=vPar.end();++par)
+   for(std::set<RefinablePar*>::iterator par=vParProfile.begin();par!=vParProfile.end();++par)
    {
-      if(*par==0) mPowderPattern_FullDeriv[*par]=this->GetPowderPatternCalc();
-      else
+      if(mvReflProfile_FullDeriv[*par].size()==0) continue;
+      const vector<CrystVector_REAL> *pReflDeriv=&(mvReflProfile_FullDeriv[*par]);
+      long step; // number of reflections at the same place and with the same (assumed) profile
+      CrystVector_REAL *pDeriv=&(mPowderPattern_FullDeriv[*par]);
+      pDeriv->resize(specNbPoints);
+      *pDeriv=0;// :TODO: use only the number of points actually used
+      for(long i=0;i<mNbReflUsed;i += step)
       {
-         if((*par)->IsFixed()) continue;
-         if((*par)->IsUsed()==false) continue;
-         if(mIhkl_FullDeriv[*par].size()!=0)
+         if(mvReflProfile[i].profile.numElements()==0)
          {
-            const long nbRefl=this->GetNbRefl();
-            long step; // number of reflections at the same place and with the same (assumed) profile
-            const long  specNbPoints=mpParentPowderPattern->GetNbPoint();
-            mPowderPattern_FullDeriv[*par].resize(specNbPoints);
-            mPowderPattern_FullDeriv[*par]=0;
-
-            for(long i=0;i<mNbReflUsed;i += step)
-            {
-               if(mvReflProfile[i].profile.numElements()==0)
-               {
-                  step=1;
-                  if(i>=mNbReflUsed) break;
-                  else continue;
-               }
-
-               REAL intensity=0.;
-               //check if the next reflection is at the same theta. If this is true,
-               //Then assume that the profile is exactly the same, unless it is anisotropic
-               for(step=0; ;)
-               {
-                  intensity += mIhkl_FullDeriv[*par](i + step);
-                  step++;
-                  if(mpReflectionProfile->IsAnisotropic()) break;// Anisotropic profiles
-                  if( (i+step) >= nbRefl) break;
-                  if(mSinThetaLambda(i+step) > (mSinThetaLambda(i)+1e-5) ) break;
-               }
-               {
-                  const long first=mvReflProfile[i].first,last=mvReflProfile[i].last;
-                  const REAL *p2 = mvReflProfile[i].profile.data();
-                  REAL *p3 = mPowderPattern_FullDeriv[*par].data()+first;
-                  for(long j=first;j<=last;j++) *p3++ += *p2++ * intensity;
-               }
-            }
+            step=1;
+            continue;
+         }
+         REAL intensity=0.;
+         for(step=0; ;)
+         {
+            intensity += mIhklCalc(i + step);
+            step++;
+            if(mpReflectionProfile->IsAnisotropic()) break;// Anisotropic profiles
+            if( (i+step) >= nbRefl) break;
+            if(mSinThetaLambda(i+step) > (mSinThetaLambda(i)+1e-5) ) break;
          }
-         if(mvReflProfile_FullDeriv[*par].size()!=0)
+         if((*pReflDeriv)[i].size()>0)// Some profiles may be unaffected by a given parameter
          {
-            const long nbRefl=this->GetNbRefl();
-            long step; // number of reflections at the same place and with the same (assumed) profile
-            const long  specNbPoints=mpParentPowderPattern->GetNbPoint();
-            mPowderPattern_FullDeriv[*par].resize(specNbPoints);
-            mPowderPattern_FullDeriv[*par]=0;// :TODO: use only the number of points actually used
-            cout<<__FILE__<<":"<<__LINE__<<":PowderPatternDiffraction::CalcPowderPattern_FullDeriv():par="<<(*par)->GetName()<<endl;
-            for(long i=0;i<mNbReflUsed;i += step)
-            {
-               if(mvReflProfile[i].profile.numElements()==0)
-               {
-                  step=1;
-                  if(i>=mNbReflUsed) break;
-                  else continue;
-               }
-
-               REAL intensity=0.;
-               //check if the next reflection is at the same theta. If this is true,
-               //Then assume that the profile is exactly the same, unless it is anisotropic
-               for(step=0; ;)
-               {
-                  intensity += mIhklCalc(i + step);
-                  step++;
-                  if(mpReflectionProfile->IsAnisotropic()) break;// Anisotropic profiles
-                  if( (i+step) >= nbRefl) break;
-                  if(mSinThetaLambda(i+step) > (mSinThetaLambda(i)+1e-5) ) break;
-               }
-               if(mvReflProfile_FullDeriv[*par][i].size()>0)// Some profiles may be unaffected by a given parameter
-               {
-                  const long first=mvReflProfile[i].first,last=mvReflProfile[i].last;
-                  const REAL *p2 = mvReflProfile_FullDeriv[*par][i].data();
-                  REAL *p3 = mPowderPattern_FullDeriv[*par].data()+first;
-                  for(long j=first;j<=last;j++) *p3++ += *p2++ * intensity;
-               }
-            }
+            const long first=mvReflProfile[i].first,last=mvReflProfile[i].last;
+            const REAL *p2 = (*pReflDeriv)[i].data();
+            REAL *p3 = pDeriv->data()+first;
+            for(long j=first;j<=last;j++) *p3++ += *p2++ * intensity;
          }
       }
    }
@@ -1566,6 +1642,7 @@ void PowderPatternDiffraction::CalcPowderPatternIntegrated() const
    this->GetNbReflBelowMaxSinThetaOvLambda();
    if(mClockPowderPatternIntegratedCalc>mClockMaster) return;
    TAU_PROFILE("PowderPatternDiffraction::CalcPowderPatternIntegrated()","void (bool)",TAU_DEFAULT);
+   OBJCRYST_PROFILE("PowderPatternDiffraction::CalcPowderPatternIntegrated")
    TAU_PROFILE_TIMER(timer1,"PowderPatternDiffraction::CalcPowderPatternIntegrated()1","", TAU_FIELD);
    TAU_PROFILE_TIMER(timer2,"PowderPatternDiffraction::CalcPowderPatternIntegrated()2","", TAU_FIELD);
 
@@ -1666,26 +1743,39 @@ void PowderPatternDiffraction::CalcPowderPatternIntegrated() const
 void PowderPatternDiffraction::CalcPowderPatternIntegrated_FullDeriv(std::set<RefinablePar*> &vPar)
 {
    TAU_PROFILE("PowderPatternDiffraction::CalcPowderPatternIntegrated_FullDeriv()","void ()",TAU_DEFAULT);
-   //cout<<"PowderPatternDiffraction::CalcPowderPatternIntegrated_FullDeriv"<<endl;
-   //this->PowderPatternComponent::CalcPowderPatternIntegrated_FullDeriv(vPar);
-   //return;
-
+   // Only the derivatives through the reflection intensities are analytical. Profile
+   // and other parameters should not be refined using integrated profiles, but can
+   // still affect the integration intervals: use numerical derivatives.
+   std::set<RefinablePar*> vParIhkl,vParNum;
+   for(std::set<RefinablePar*>::iterator par=vPar.begin();par!=vPar.end();++par)
+   {
+      if(*par==0) continue;
+      if(  (*par)->GetType()->IsDescendantFromOrSameAs(gpRefParTypeScattDataBackground)
+         ||(*par)->GetType()->IsDescendantFromOrSameAs(gpRefParTypeScattDataScale)) continue;
+      if(this->IsIhklDerivPar(**par)) vParIhkl.insert(*par);
+      else vParNum.insert(*par);
+   }
+   // This clears mPowderPatternIntegrated_FullDeriv
+   this->PowderPatternComponent::CalcPowderPatternIntegrated_FullDeriv(vParNum);
    this->CalcPowderPatternIntegrated();
-   this->CalcIhkl_FullDeriv(vPar);
+   mIhkl_FullDeriv.clear();
+   if(vParIhkl.size()>0) this->CalcIhkl_FullDeriv(vParIhkl);
    const long nbRefl=this->GetNbRefl();
    //#define PowderPatternDiffraction_CalcPowderPatternIntegrated_FullDerivDEBUG
    #ifdef PowderPatternDiffraction_CalcPowderPatternIntegrated_FullDerivDEBUG
+   std::map<RefinablePar*, CrystVector_REAL> newNumDeriv=mPowderPatternIntegrated_FullDeriv;
    this->PowderPatternComponent::CalcPowderPatternIntegrated_FullDeriv(vPar);
    std::map<RefinablePar*, CrystVector_REAL> oldDeriv=mPowderPatternIntegrated_FullDeriv;
+   mPowderPatternIntegrated_FullDeriv=newNumDeriv;
    #endif
    const long  nbprof=mpParentPowderPattern->GetIntegratedProfileMin().size();
    long ctpar=0;
-   mPowderPatternIntegrated_FullDeriv.clear();
    for(std::set<RefinablePar*>::iterator par=vPar.begin();par!=vPar.end();++par)
    {
       if(*par==0) mPowderPatternIntegrated_FullDeriv[*par]=mPowderPatternIntegratedCalc;
       else
       {
+         if(vParIhkl.find(*par)==vParIhkl.end()) continue;
          if(mIhkl_FullDeriv[*par].size()==0) continue;
          if(mPowderPatternIntegrated_FullDeriv[*par].size()==0)
          {
@@ -1694,8 +1784,6 @@ void PowderPatternDiffraction::CalcPowderPatternIntegrated_FullDeriv(std::set<Re
          }
          const REAL * RESTRICT psith=mSinThetaLambda.data();
          const REAL * RESTRICT pI=mIhkl_FullDeriv[*par].data();
-         // :TODO: also handle derivatives of profile parameters ? Though one should not
-         // refine profiles using integrated profiles !
          vector< pair<unsigned long, CrystVector_REAL> >::const_iterator pos=mIntegratedProfileFactor.begin();
 
          for(long i=0;i<mNbReflUsed;)
@@ -1761,6 +1849,7 @@ void PowderPatternDiffraction::CalcPowderReflProfile()const
       &&(mClockProfileCalc>mpParentPowderPattern->GetClockNbPointUsed())) return;
 
    TAU_PROFILE("PowderPatternDiffraction::CalcPowderReflProfile()","void (bool)",TAU_DEFAULT);
+   OBJCRYST_PROFILE("PowderPatternDiffraction::CalcPowderReflProfile")
    VFN_DEBUG_ENTRY("PowderPatternDiffraction::CalcPowderReflProfile()",5)
 
    //Calc all profiles
@@ -1926,7 +2015,6 @@ Computing all Profiles: Reflection #"<<i,5)
 void PowderPatternDiffraction::CalcPowderReflProfile_FullDeriv(std::set<RefinablePar *> &vPar)
 {
    TAU_PROFILE("PowderPatternDiffraction::CalcPowderReflProfile_FullDeriv()","void (bool)",TAU_DEFAULT);
-   cout<<__FILE__<<":"<<__LINE__<<":PowderPatternDiffraction::CalcPowderReflProfile_FullDeriv()"<<endl;
    this->CalcPowderReflProfile();
    unsigned int nbLine=1;
    CrystVector_REAL spectrumDeltaLambdaOvLambda;
@@ -1968,108 +2056,76 @@ void PowderPatternDiffraction::CalcPowderReflProfile_FullDeriv(std::set<Refinabl
       default: throw ObjCrystException("PowderPatternDiffraction::CalcPowderReflProfile_FullDeriv():\
 Radiation must be either monochromatic, from an X-Ray Tube, or neutron TOF !!");
    }
-   REAL center,// center of current reflection (depends on line if several)
-        x0;    // theoretical (uncorrected for zero's, etc..) position of center of line
-   long first,last;// first & last point of the stored profile
-   CrystVector_REAL vx,reflProfile,tmpV;
-
-   // Derivative vs the shift of the reflection center
-   vector<CrystVector_REAL> vReflProfile_DerivCenter(mNbReflUsed);
-
-   mvReflProfile_FullDeriv.clear();
+   // Parameters of the reflection profile, and of the position corrections
+   std::set<RefinablePar*> vParProfile;
+   std::vector<RefinablePar*> vParPos;
    for(std::set<RefinablePar*>::iterator par=vPar.begin();par!=vPar.end();++par)
    {
       if(*par==0) continue;
-      if(  (*par)->GetType()->IsDescendantFromOrSameAs(gpRefParTypeRadiation)
-         ||(*par)->GetType()->IsDescendantFromOrSameAs(gpRefParTypeUnitCell)
-         ||(*par)->GetType()->IsDescendantFromOrSameAs(gpRefParTypeScattDataCorrPos)
-         ||(*par)->GetType()->IsDescendantFromOrSameAs(gpRefParTypeScattDataProfile))
-      {
-         mvReflProfile_FullDeriv[*par].resize(mNbReflUsed);
+      REAL dx;
+      if(IsParOfObj(*mpReflectionProfile,**par)) vParProfile.insert(*par);
+      else if(mpParentPowderPattern->X2XCorr_Deriv(1,1,**par,dx)) vParPos.push_back(*par);
+   }
+   mvReflProfile_FullDeriv.clear();
+   if((vParProfile.size()==0)&&(vParPos.size()==0)) return;
+   for(std::set<RefinablePar*>::iterator par=vParProfile.begin();par!=vParProfile.end();++par)
+      mvReflProfile_FullDeriv[*par].resize(mNbReflUsed);
+   for(std::vector<RefinablePar*>::iterator par=vParPos.begin();par!=vParPos.end();++par)
+      mvReflProfile_FullDeriv[*par].resize(mNbReflUsed);
 
-         for(unsigned int line=0;line<nbLine;line++)
+   REAL center,// center of current reflection (depends on line if several)
+        x0,    // theoretical (uncorrected for zero's, etc..) position of center of line
+        x1;    // same, for the current line
+   CrystVector_REAL vx,dcenter;
+   std::map<RefinablePar*,CrystVector_REAL> vReflDeriv;
+   const bool anisotropic=mpReflectionProfile->IsAnisotropic();
+   for(unsigned int line=0;line<nbLine;line++)
+   {
+      long group=0;// First reflection at the same position
+      for(long i=0;i<mNbReflUsed;i++)
+      {
+         const long first=mvReflProfile[i].first,last=mvReflProfile[i].last;
+         if((last<0)||(first>=(long)(mpParentPowderPattern->GetNbPoint()))) continue;
+         if(mvReflProfile[i].profile.numElements()==0) continue;
+         // Only the profile of the first reflection at a given position is used,
+         // unless profiles are anisotropic (see CalcPowderPattern())
+         if((!anisotropic)&&(i>group)&&(mSinThetaLambda(i)<=(mSinThetaLambda(group)+1e-5))) continue;
+         group=i;
+         x0=mpParentPowderPattern->STOL2X(mSinThetaLambda(i));
+         if(nbLine>1) x1=x0+2*tan(x0/2.0)*spectrumDeltaLambdaOvLambda(line);
+         else x1=x0;
+         center=mpParentPowderPattern->X2XCorr(x1);
+         vx.resize(last-first+1);
          {
-            for(long i=0;i<mNbReflUsed;i++)
+            const REAL *p0=mpParentPowderPattern->GetPowderPatternX().data()+first;
+            REAL *p1=vx.data();
+            for(long j=first;j<=last;j++) *p1++ = *p0++;
+         }
+         mpReflectionProfile->GetProfile_FullDeriv(vx,center,mH(i),mK(i),mL(i),vParProfile,vReflDeriv,
+                                                   (vParPos.size()>0) ? &dcenter : 0);
+         for(std::map<RefinablePar*,CrystVector_REAL>::iterator pos=vReflDeriv.begin();pos!=vReflDeriv.end();++pos)
+         {
+            if(nbLine>1) pos->second*=spectrumFactor(line);
+            CrystVector_REAL *pDeriv=&(mvReflProfile_FullDeriv[pos->first][i]);
+            if(pDeriv->size()==0) *pDeriv=pos->second;
+            else *pDeriv+=pos->second;
+         }
+         for(std::vector<RefinablePar*>::iterator par=vParPos.begin();par!=vParPos.end();++par)
+         {
+            REAL dx;
+            if(!mpParentPowderPattern->X2XCorr_Deriv(x1,mSinThetaLambda(i),**par,dx)) continue;
+            if(nbLine>1) dx*=spectrumFactor(line);
+            CrystVector_REAL *pDeriv=&(mvReflProfile_FullDeriv[*par][i]);
+            if(pDeriv->size()==0)
             {
-               x0=mpParentPowderPattern->STOL2X(mSinThetaLambda(i));
-
-               if(nbLine>1)
-               {// we have several lines, not centered on the profile range
-                  center = mpParentPowderPattern->X2XCorr(
-                              x0+2*tan(x0/2.0)*spectrumDeltaLambdaOvLambda(line));
-               }
-               else center=mpParentPowderPattern->X2XCorr(x0);
-
-               first=mvReflProfile[i].first;
-               last=mvReflProfile[i].last;
-               if((last>=0)&&(first<(long)(mpParentPowderPattern->GetNbPoint())))
-                  vx.resize(last-first+1);
-               else vx.resize(0);
-               vx.resize(last-first+1);
-               if((last>=0)&&(first<(long)(mpParentPowderPattern->GetNbPoint())))
-               {
-                  {
-                     const REAL *p0=mpParentPowderPattern->GetPowderPatternX().data()+first;
-                     REAL *p1=vx.data();
-                     for(long i=first;i<=last;i++) *p1++ = *p0++;
-                  }
-
-                  if((*par)->GetType()->IsDescendantFromOrSameAs(gpRefParTypeScattDataProfile))
-                  {// Parameter only affects profile
-                     //if(i==0) cout<<"PowderPatternDiffraction::CalcPowderReflProfile_FullDeriv()par="<<(*par)->GetName()<<":refl #"<<i<<endl;
-                     //:TODO: analytical derivatives
-                     const REAL step=(*par)->GetDerivStep();
-                     (*par)->Mutate(step);
-                     reflProfile=mpReflectionProfile->GetProfile(vx,center,mH(i),mK(i),mL(i));
-                     (*par)->Mutate(-2*step);
-                     reflProfile-=mpReflectionProfile->GetProfile(vx,center,mH(i),mK(i),mL(i));
-                     (*par)->Mutate(step);
-                     reflProfile/=2*step;
-                  }
-                  else
-                  {// Parameter affects reflection center
-                     REAL dcenter=0;
-                     {
-                        //:TODO: analytical derivatives
-                        const REAL step=(*par)->GetDerivStep();
-                        (*par)->Mutate(step);
-                        REAL x1=mpParentPowderPattern->STOL2X(this->CalcSinThetaLambda(mH(i),mK(i),mL(i)));
-                        if(nbLine>1) dcenter = mpParentPowderPattern->X2XCorr(x1+2*tan(x1/2.0)*spectrumDeltaLambdaOvLambda(line));
-                        else         dcenter = mpParentPowderPattern->X2XCorr(x1);
-                        (*par)->Mutate(-2*step);
-                        x1=mpParentPowderPattern->STOL2X(this->CalcSinThetaLambda(mH(i),mK(i),mL(i)));
-                        if(nbLine>1) dcenter-= mpParentPowderPattern->X2XCorr(x1+2*tan(x1/2.0)*spectrumDeltaLambdaOvLambda(line));
-                        else         dcenter-= mpParentPowderPattern->X2XCorr(x1);
-                        (*par)->Mutate(step);
-                        dcenter/=2*step;
-                     }
-
-                     if(dcenter!=0)
-                     {
-                        //if(i==0) cout<<"PowderPatternDiffraction::CalcPowderReflProfile_FullDeriv()par="<<(*par)->GetName()<<":refl #"<<i<<", dcenter="<<setw(8)<<dcenter<<endl;
-                        if(vReflProfile_DerivCenter[i].size()==0)
-                        {
-                           const REAL step=1e-4;//:TODO: adapt for TOF
-                           vReflProfile_DerivCenter[i] =mpReflectionProfile->GetProfile(vx,center+step,mH(i),mK(i),mL(i));
-                           vReflProfile_DerivCenter[i]-=mpReflectionProfile->GetProfile(vx,center-step,mH(i),mK(i),mL(i));
-                           vReflProfile_DerivCenter[i]/=2*step;
-                        }
-                        reflProfile=vReflProfile_DerivCenter[i];
-                        reflProfile*=dcenter;
-                     }
-                     else
-                     {
-                        //if(i==0) cout<<"PowderPatternDiffraction::CalcPowderReflProfile_FullDeriv()par="<<(*par)->GetName()<<":refl #"<<i<<" => Parameter affects nothing ?"<<endl;
-                        reflProfile.resize(0);
-                     }
-                  }
-                  if(reflProfile.size()>0)
-                  {
-                     if(nbLine>1) reflProfile *=spectrumFactor(line);
-                     if(line==0) mvReflProfile_FullDeriv[*par][i] = reflProfile;
-                     else mvReflProfile_FullDeriv[*par][i] += reflProfile;
-                  }
-               }
+               *pDeriv=dcenter;
+               *pDeriv*=dx;
+            }
+            else
+            {
+               const REAL *p1=dcenter.data();
+               REAL *p2=pDeriv->data();
+               for(long j=dcenter.size();j>0;j--) *p2++ += dx * *p1++;
             }
          }
       }
@@ -2122,6 +2178,7 @@ void PowderPatternDiffraction::CalcIntensityCorr()const
    if(needRecalc==false) return;
 
    TAU_PROFILE("PowderPatternDiffraction::CalcIntensityCorr()","void ()",TAU_DEFAULT);
+   OBJCRYST_PROFILE("PowderPatternDiffraction::CalcIntensityCorr")
    VFN_DEBUG_MESSAGE("PowderPatternDiffraction::CalcIntensityCorr()",2)
    mIntensityCorr.resize(mNbRefl);
    REAL *pCorr=mIntensityCorr.data();
@@ -2185,6 +2242,7 @@ void PowderPatternDiffraction::CalcIhkl() const
 
    VFN_DEBUG_MESSAGE("PowderPatternDiffraction::CalcIhkl()",3)
    TAU_PROFILE("PowderPatternDiffraction::CalcIhkl()","void ()",TAU_DEFAULT);
+   OBJCRYST_PROFILE("PowderPatternDiffraction::CalcIhkl")
    const REAL * RESTRICT pr,* RESTRICT pi,* RESTRICT pcorr;
    const int * RESTRICT mult;
    REAL * RESTRICT p;
@@ -2266,8 +2324,29 @@ void PowderPatternDiffraction::CalcIhkl_FullDeriv(std::set<RefinablePar*> &vPar)
 {
    TAU_PROFILE("PowderPatternDiffraction::CalcIhkl_FullDeriv()","void ()",TAU_DEFAULT);
    //cout<<"PowderPatternDiffraction::CalcIhkl_FullDeriv()"<<endl;
-   this->CalcIntensityCorr();//:TODO: derivatives of intensity corrections (Texture, displacement parameters,...)
+   this->CalcIntensityCorr();
    mIhkl_FullDeriv.clear();
+   this->CalcIhkl();
+   // Texture: dI/dp = I * dT/dp / T
+   const ScatteringCorr *vpTexture[2]={&mCorrTextureMarchDollase,&mCorrTextureEllipsoid};
+   for(unsigned int t=0;t<2;t++)
+   {
+      const std::map<RefinablePar*,CrystVector_REAL> *pCorrDeriv=&(vpTexture[t]->GetCorr_FullDeriv(vPar));
+      const CrystVector_REAL *pCorr=&(vpTexture[t]->GetCorr());
+      for(std::map<RefinablePar*,CrystVector_REAL>::const_iterator pos=pCorrDeriv->begin();
+          pos!=pCorrDeriv->end();++pos)
+      {
+         if(pos->second.size()==0) continue;
+         CrystVector_REAL *pDeriv=&(mIhkl_FullDeriv[pos->first]);
+         pDeriv->resize(mNbRefl);
+         *pDeriv=0;
+         for(long i=0;i<mNbReflUsed;i++)
+         {
+            const REAL c=(pCorr->numElements()>0) ? (*pCorr)(i) : 1;
+            if(c!=0) (*pDeriv)(i)=mIhklCalc(i)*pos->second(i)/c;
+         }
+      }
+   }
    if(mExtractionMode==true)
    {
       //:TODO: handle Pawley refinements of I(hkl)
@@ -2289,7 +2368,7 @@ void PowderPatternDiffraction::CalcIhkl_FullDeriv(std::set<RefinablePar*> &vPar)
          pi=mFhklCalcImag.data();
          prd=mFhklCalcReal_FullDeriv[*par].data();
          pid=mFhklCalcImag_FullDeriv[*par].data();
-         pcorr=mIntensityCorr.data();//:TODO: derivatives of intensity corrections (Texture, displacement parameters,...)
+         pcorr=mIntensityCorr.data();
 
          mult=mMultiplicity.data();
          mIhkl_FullDeriv[*par].resize(mNbRefl);
@@ -2336,6 +2415,14 @@ void PowderPatternDiffraction::CalcIhkl_FullDeriv(std::set<RefinablePar*> &vPar)
    #endif
 }
 
+bool PowderPatternDiffraction::IsIhklDerivPar(const RefinablePar &par)const
+{
+   if(par.GetType()->IsDescendantFromOrSameAs(gpRefParTypeScatt)) return true;
+   if(IsParOfObj(mCorrTextureMarchDollase,par)) return true;
+   if(IsParOfObj(mCorrTextureEllipsoid,par)) return true;
+   return false;
+}
+
 void PowderPatternDiffraction::Prepare()
 {
    if(  (this->GetCrystal().GetSpaceGroup().GetClockSpaceGroup()>mClockHKL)
@@ -2352,16 +2439,14 @@ void PowderPatternDiffraction::InitOptions()
    static string ReflectionProfileTypeName;
    static string ReflectionProfileTypeChoices[3];
 
-   static bool needInitNames=true;
-   if(true==needInitNames)
-   {
+   static std::once_flag needInitNames;
+   std::call_once(needInitNames,[]()
+   {// Only once for the class
       ReflectionProfileTypeName="Profile Type";
       ReflectionProfileTypeChoices[0]="Gaussian";
       ReflectionProfileTypeChoices[1]="Lorentzian";
       ReflectionProfileTypeChoices[2]="Pseudo-Voigt";
-
-      needInitNames=false;//Only once for the class
-   }
+   });
    mReflectionProfileType.Init(3,&ReflectionProfileTypeName,ReflectionProfileTypeChoices);
    this->AddOption(&mReflectionProfileType);
    #endif
@@ -2511,7 +2596,7 @@ WXCrystObjBasic* PowderPatternDiffraction::WXCreate(wxWindow* parent)
 //
 ////////////////////////////////////////////////////////////////////////
 ObjRegistry<PowderPattern>
-   gPowderPatternRegistry("List of all PowderPattern objects");
+   gPowderPatternRegistry("List of all PowderPattern objects",true);
 
 PowderPattern::PowderPattern():
 mIsXAscending(true),mNbPoint(0),
@@ -2577,6 +2662,32 @@ const string& PowderPattern::GetClassName() const
    return className;
 }
 
+PowderPattern* PowderPattern::Clone(std::map<const RefinableObj*,RefinableObj*> &vCopy)const
+{
+   VFN_DEBUG_ENTRY("PowderPattern::Clone():"<<this->GetName(),5)
+   PowderPattern *p=new PowderPattern;
+   vCopy[this]=p;
+   p->SetName(mName);
+   p->SetRadiation(mRadiation);
+   p->mRadiation.CopyParAndOptions(mRadiation);
+   p->mMaxSinThetaOvLambda=mMaxSinThetaOvLambda;
+   // The observed data must be set before the components are added, so that
+   // the reflections shared by PowderPatternDiffraction::Clone() remain valid.
+   p->ShareObservedData(*this);
+   for(long i=0;i<mExcludedRegionMinX.numElements();i++)
+      p->AddExcludedRegion(mExcludedRegionMinX(i),mExcludedRegionMaxX(i));
+   for(int i=0;i<mPowderPatternComponentRegistry.GetNb();i++)
+   {
+      p->AddPowderPatternComponent(*(mPowderPatternComponentRegistry.GetObj(i).Clone(vCopy)));
+      p->mScaleFactor(i)=mScaleFactor(i);
+   }
+   p->CopyParAndOptions(*this);
+   // Generate the reflections which are not shared, so that the copy can be used immediately
+   if(p->GetNbPoint()>0) p->Prepare();
+   VFN_DEBUG_EXIT("PowderPattern::Clone()",5)
+   return p;
+}
+
 void PowderPattern::AddPowderPatternComponent(PowderPatternComponent &comp)
 {
    VFN_DEBUG_ENTRY("PowderPattern::AddPowderPatternComponent():"<<comp.GetName(),5)
@@ -2702,6 +2813,7 @@ void PowderPattern::SetPowderPatternPar(const REAL min,
                                         unsigned long nbPoint)
 {
    VFN_DEBUG_MESSAGE("PowderPattern::SetPowderPatternPar():"<<min<<","<<step<<","<<nbPoint,3)
+   this->UnshareObservedData();
    mNbPoint=nbPoint;
    mX.resize(mNbPoint);
    for(unsigned long i=0;i<mNbPoint;i++) mX(i)=min+step*i;
@@ -2712,6 +2824,7 @@ void PowderPattern::SetPowderPatternPar(const REAL min,
 }
 void PowderPattern::SetPowderPatternX(const CrystVector_REAL &x)
 {
+   this->UnshareObservedData();
    mNbPoint=x.numElements();
    if(&x != &mX) mX=x;
    mPowderPatternObs.resizeAndPreserve(mNbPoint);
@@ -2723,6 +2836,67 @@ void PowderPattern::SetPowderPatternX(const CrystVector_REAL &x)
    VFN_DEBUG_MESSAGE("PowderPattern::SetPowderPatternX() is ascending="<<mIsXAscending,5)
 }
 
+struct PowderPattern::SharedObservedData
+{
+   CrystVector_REAL mX;
+   CrystVector_REAL mObs;
+   CrystVector_REAL mSigma;
+};
+
+void PowderPattern::ShareObservedData(const PowderPattern &orig)
+{
+   VFN_DEBUG_MESSAGE("PowderPattern::ShareObservedData():"<<orig.GetName()<<"->"<<this->GetName(),5)
+   if((&orig==this)||(orig.mNbPoint==0)) return;
+   if(orig.mpSharedObservedData==0)
+   {// Move the data of the original pattern to the shared storage. The shared
+    // arrays are never modified, see UnshareObservedData()
+      SharedObservedData *p=new SharedObservedData;
+      p->mX=orig.mX;
+      p->mObs=orig.mPowderPatternObs;
+      p->mSigma=orig.mPowderPatternObsSigma;
+      orig.mpSharedObservedData.reset(p);
+      PowderPattern &o=const_cast<PowderPattern&>(orig);
+      o.mX.reference(p->mX);
+      o.mPowderPatternObs.reference(p->mObs);
+      o.mPowderPatternObsSigma.reference(p->mSigma);
+   }
+   if(mpSharedObservedData!=orig.mpSharedObservedData)
+   {
+      this->UnshareObservedData();
+      mpSharedObservedData=orig.mpSharedObservedData;
+      SharedObservedData *p=const_cast<SharedObservedData*>(mpSharedObservedData.get());
+      mX.reference(p->mX);
+      mPowderPatternObs.reference(p->mObs);
+      mPowderPatternObsSigma.reference(p->mSigma);
+   }
+   mNbPoint=orig.mNbPoint;
+   mPowderPatternWeight=orig.mPowderPatternWeight;
+   mIsXAscending=orig.mIsXAscending;
+   mClockPowderPatternPar.Click();
+   mClockIntegratedFactorsPrep.Reset();
+}
+
+bool PowderPattern::IsObservedDataShared()const {return mpSharedObservedData!=0;}
+
+void PowderPattern::UnshareObservedData()
+{
+   if(mpSharedObservedData==0) return;
+   VFN_DEBUG_MESSAGE("PowderPattern::UnshareObservedData():"<<this->GetName(),5)
+   // resize(0) only drops the reference, without freeing the shared data
+   CrystVector_REAL tmp;
+   tmp=mX;
+   mX.resize(0);
+   mX=tmp;
+   tmp=mPowderPatternObs;
+   mPowderPatternObs.resize(0);
+   mPowderPatternObs=tmp;
+   tmp=mPowderPatternObsSigma;
+   mPowderPatternObsSigma.resize(0);
+   mPowderPatternObsSigma=tmp;
+   // The shared data is freed with the last pattern using it
+   mpSharedObservedData.reset();
+}
+
 unsigned long PowderPattern::GetNbPoint()const {return mNbPoint;}
 
 unsigned long PowderPattern::GetNbPointUsed()const
@@ -2918,6 +3092,44 @@ REAL PowderPattern::X2XCorr(const REAL x0)const
    return x+mXZero;
 }
 
+bool PowderPattern::X2XCorr_Deriv(const REAL x,const REAL stol,const RefinablePar &par,REAL &dx)const
+{
+   const REAL *p=par.GetPointer();
+   if(p==&mXZero)
+   {
+      dx=1;
+      return true;
+   }
+   if(  (mRadiation.GetWavelengthType()==WAVELENGTH_MONOCHROMATIC)
+      ||(mRadiation.GetWavelengthType()==WAVELENGTH_ALPHA12))
+   {
+      if(p==&m2ThetaDisplacement)
+      {
+         dx=cos(x/2);
+         return true;
+      }
+      if(p==&m2ThetaTransparency)
+      {
+         dx=sin(x);
+         return true;
+      }
+   }
+   if((mRadiation.GetWavelengthType()==WAVELENGTH_TOF)&&(stol>0))
+   {
+      if(p==&mDIFC)
+      {
+         dx=1.0/(2*stol);
+         return true;
+      }
+      if(p==&mDIFA)
+      {
+         dx=1.0/(4*stol*stol);
+         return true;
+      }
+   }
+   return false;
+}
+
 REAL PowderPattern::X2PixelCorr(const REAL x0)const
 {
    return this->X2Pixel(this->X2XCorr(x0));
@@ -3010,6 +3222,7 @@ REAL PowderPattern::X2Pixel(const REAL x)const
 
 void PowderPattern::ImportPowderPatternFullprof(const string &filename)
 {
+   this->UnshareObservedData();
    //15.000   0.030  70.000 LANI4FE#1 REC 800 4JRS
    //2447.   2418.   2384.   2457.   2398.   2374.   2378.   2383.
    //...
@@ -3057,6 +3270,7 @@ void PowderPattern::ImportPowderPatternPSI_DMC(const string &filename)
 {
    VFN_DEBUG_MESSAGE("PowderPattern::ImportPowderPatternPSI_DMC() : \
 from file : "+filename,5)
+   this->UnshareObservedData();
    ifstream fin(filename.c_str());
    if(!fin)
    {
@@ -3102,6 +3316,7 @@ void PowderPattern::ImportPowderPatternILL_D1A5(const string &filename)
 {
    VFN_DEBUG_MESSAGE("PowderPattern::ImportPowderPatternILL_D1AD2B() : \
 from file : "+filename,5)
+   this->UnshareObservedData();
    ifstream fin(filename.c_str());
    if(!fin)
    {
@@ -3150,6 +3365,7 @@ void PowderPattern::ImportPowderPatternXdd(const string &filename)
 {
    VFN_DEBUG_MESSAGE("PowderPattern::ImportPowderPatternXdd():from file :" \
                            +filename,5)
+   this->UnshareObservedData();
    ifstream fin (filename.c_str());
    if(!fin)
    {
@@ -3193,6 +3409,7 @@ void PowderPattern::ImportPowderPatternSietronicsCPI(const string &filename)
 {
    VFN_DEBUG_ENTRY("PowderPattern::ImportPowderPatternSietronicsCPI():from file :" \
                            +filename,5)
+   this->UnshareObservedData();
    ifstream fin (filename.c_str());
    if(!fin)
    {
@@ -3241,6 +3458,7 @@ void PowderPattern::ImportPowderPattern2ThetaObsSigma(const string &filename,con
 {
    VFN_DEBUG_MESSAGE("DiffractionDataPowder::ImportPowderPattern2ThetaObsSigma():from:" \
                            +filename,5)
+   this->UnshareObservedData();
    ifstream fin (filename.c_str());
    if(!fin)
    {
@@ -3301,6 +3519,7 @@ void PowderPattern::ImportPowderPattern2ThetaObs(const string &filename,const in
 {
    VFN_DEBUG_MESSAGE("PowderPattern::ImportPowderPattern2ThetaObs():from:" \
                            +filename,5)
+   this->UnshareObservedData();
    ifstream fin (filename.c_str());
    if(!fin)
    {
@@ -3357,6 +3576,7 @@ Error opening file for input:"+filename);
 
 void PowderPattern::ImportPowderPatternMultiDetectorLLBG42(const string &filename)
 {
+   this->UnshareObservedData();
 
    //Sample 4: NaY + CF2=CCL2 T=20K, Lambda: 2.343 A.
    //     100       0   0.100      70       0       0
@@ -3439,6 +3659,7 @@ Error opening file for input:"+filename);
 
 void PowderPattern::ImportPowderPatternFullprof4(const string &filename)
 {
+   this->UnshareObservedData();
    //1.550   0.005  66.000
    // 213.135 193.243 208.811 185.873 231.607 200.995 196.792 187.516 215.977 199.634
    //  17.402  16.570  12.180  11.491  18.141  11.950  11.824  11.542  17.518  11.909
@@ -3504,6 +3725,7 @@ void PowderPattern::ImportPowderPatternTOF_ISIS_XYSigma(const string &filename)
 {
    VFN_DEBUG_MESSAGE("DiffractionDataPowder::ImportPowderPatternTOF_ISIS_XYSigma():from:" \
                            +filename,5)
+   this->UnshareObservedData();
    ifstream fin (filename.c_str());
    if(!fin)
    {
@@ -3580,6 +3802,7 @@ Error opening file for input:"+filename);
 void PowderPattern::ImportPowderPatternGSAS(const string &filename)
 {
    VFN_DEBUG_ENTRY("PowderPattern::ImportPowderPatternGSAS():file:"<<filename,5)
+   this->UnshareObservedData();
    ifstream fin (filename.c_str());
    if(!fin)
    {
@@ -3810,6 +4033,7 @@ this type of format is not handled yet (send an example file to the Fox author)!
 void PowderPattern::ImportPowderPatternCIF(const CIF &cif)
 {
    VFN_DEBUG_ENTRY("PowderPattern::ImportPowderPatternCIF():file:",5)
+   this->UnshareObservedData();
    for(map<string,CIFData>::const_iterator pos=cif.mvData.begin();pos!=cif.mvData.end();++pos)
       if(pos->second.mPowderPatternObs.size()>10)
       {
@@ -3841,6 +4065,7 @@ void PowderPattern::ImportPowderPatternCIF(const CIF &cif)
 void PowderPattern::SetPowderPatternObs(const CrystVector_REAL& obs)
 {
    VFN_DEBUG_MESSAGE("PowderPattern::SetPowderPatternObs()",5)
+   this->UnshareObservedData();
    if((unsigned long)obs.numElements() != mNbPoint)
    {
       throw(ObjCrystException("PowderPattern::SetPowderPatternObs(vect): The \
@@ -3906,111 +4131,13 @@ REAL PowderPattern::GetR()const
    }
    this->CalcPowderPattern();
    TAU_PROFILE("PowderPattern::GetR()","void ()",TAU_DEFAULT);
+   this->CalcStatistics();
 
-   REAL tmp1=0.;
-   REAL tmp2=0.;
-
-   unsigned long maxPoints=mNbPointUsed;
-   if(  (true==mStatisticsExcludeBackground)
-      &&(mPowderPatternBackgroundCalc.numElements()>0))
-   {
-      const REAL *p1, *p2, *p3;
-      p1=mPowderPatternCalc.data();
-      p2=mPowderPatternObs.data();
-      p3=mPowderPatternBackgroundCalc.data();
-      const long nbExclude=mExcludedRegionMinX.numElements();
-      if(0==nbExclude)
-      {
-         VFN_DEBUG_MESSAGE("PowderPattern::GetR():Exclude Backgd",4);
-         for(unsigned long i=0;i<maxPoints;i++)
-         {
-            tmp1 += ((*p1)-(*p2)) * ((*p1)-(*p2));
-            tmp2 += ((*p2)-(*p3)) * ((*p2)-(*p3));
-            p1++;p2++;p3++;
-         }
-      }
-      else
-      {
-         VFN_DEBUG_MESSAGE("PowderPattern::GetR():Exclude Backgd,Exclude regions",4);
-         unsigned long min,max;
-         unsigned long i=0;
-         for(int j=0;j<nbExclude;j++)
-         {
-            min=(unsigned long)floor(this->X2Pixel(mExcludedRegionMinX(j)));
-            max=(unsigned long)ceil (this->X2Pixel(mExcludedRegionMaxX(j)));
-            if(min>maxPoints) break;
-            if(max>maxPoints)max=maxPoints;
-            for(;i<min;i++)//! min is the *beginning* of the excluded region !
-            {
-               tmp1 += ((*p1)-(*p2)) * ((*p1)-(*p2));
-               tmp2 += ((*p2)-(*p3)) * ((*p2)-(*p3));
-               p1++;p2++;p3++;
-            }
-            p1 += max-i;
-            p2 += max-i;
-            p3 += max-i;
-            i  += max-i;
-         }
-         for(;i<maxPoints;i++)
-         {
-            tmp1 += ((*p1)-(*p2)) * ((*p1)-(*p2));
-            tmp2 += ((*p2)-(*p3)) * ((*p2)-(*p3));
-            p1++;p2++;p3++;
-         }
-
-      }
-   } // Exclude Background ?
-   else
-   {
-      const REAL *p1, *p2;
-      p1=mPowderPatternCalc.data();
-      p2=mPowderPatternObs.data();
-      const long nbExclude=mExcludedRegionMinX.numElements();
-      if(0==nbExclude)
-      {
-         VFN_DEBUG_MESSAGE("PowderPattern::GetR()",4);
-         for(unsigned long i=0;i<maxPoints;i++)
-         {
-            tmp1 += ((*p1)-(*p2))*((*p1)-(*p2));
-            tmp2 += (*p2) * (*p2);
-            //cout <<i<<":"<< tmp1 << " "<<tmp2 << " " << *p1 <<" "<<*p2<<endl;
-            p1++;p2++;
-         }
-      }
-      else
-      {
-         VFN_DEBUG_MESSAGE("PowderPattern::GetR(),Exclude regions",4);
-         unsigned long min,max;
-         unsigned long i=0;
-         for(int j=0;j<nbExclude;j++)
-         {
-            min=(unsigned long)floor(this->X2Pixel(mExcludedRegionMinX(j)));
-            max=(unsigned long)ceil (this->X2Pixel(mExcludedRegionMaxX(j)));
-            if(min>maxPoints) break;
-            if(max>maxPoints)max=maxPoints;
-            for(;i<min;i++)//! min is the *beginning* of the excluded region !
-            {
-               tmp1 += ((*p1)-(*p2))*((*p1)-(*p2));
-               tmp2 += (*p2) * (*p2);
-               p1++;p2++;
-            }
-            p1 += max-i;
-            p2 += max-i;
-            i  += max-i;
-         }
-         for(;i<maxPoints;i++)
-         {
-            tmp1 += ((*p1)-(*p2))*((*p1)-(*p2));
-            tmp2 += (*p2) * (*p2);
-            p1++;p2++;
-         }
-      }
-   }
-
+   const bool excludeBackgd=  (true==mStatisticsExcludeBackground)
+                            &&(mPowderPatternBackgroundCalc.numElements()>0);
+   const REAL tmp1=mStatistics.mR;
+   const REAL tmp2=excludeBackgd ? mStatistics.mObsBackgd2 : mStatistics.mObs2;
    VFN_DEBUG_MESSAGE("PowderPattern::GetR()="<<sqrt(tmp1/tmp2),4);
-   //cout << FormatVertVector<REAL>(mPowderPatternCalc,mPowderPatternObs);
-   //this->SavePowderPattern("refinedPattern.out");
-   //abort();
    return sqrt(tmp1/tmp2);
 }
 
@@ -4025,34 +4152,17 @@ REAL PowderPattern::GetIntegratedR()const
    this->PrepareIntegratedRfactor();
    VFN_DEBUG_ENTRY("PowderPattern::GetIntegratedR()",4);
    TAU_PROFILE("PowderPattern::GetIntegratedR()","void ()",TAU_DEFAULT);
+   this->CalcStatistics(true);
 
    REAL tmp1=0.;
    REAL tmp2=0.;
-   const long numInterval=mIntegratedPatternMin.numElements();
+   const long numInterval=mStatisticsIntegratedCalc.numElements();
+   const REAL *p1=mStatisticsIntegratedCalc.data();
+   const REAL *p2=mIntegratedObs.data();
    if(  (true==mStatisticsExcludeBackground)
-      &&(mPowderPatternBackgroundCalc.numElements()>0))
-   {
-      const REAL *p1, *p2, *p3;
-      CrystVector_REAL integratedCalc(numInterval);
-      integratedCalc=0;
-      CrystVector_REAL backgdCalc(numInterval);
-      backgdCalc=0;
-      REAL *pp1=integratedCalc.data();
-      REAL *pp2=backgdCalc.data();
-      for(int i=0;i<numInterval;i++)
-      {
-         const long max=mIntegratedPatternMax(i);
-         p1=mPowderPatternCalc.data()+mIntegratedPatternMin(i);
-         for(int j=mIntegratedPatternMin(i);j<=max;j++) *pp1 += *p1++;
-         pp1++;
-         p1=mPowderPatternBackgroundCalc.data()+mIntegratedPatternMin(i);
-         for(int j=mIntegratedPatternMin(i);j<=max;j++) *pp2 += *p1++;
-         pp2++;
-      }
-
-      p1=integratedCalc.data();
-      p2=mIntegratedObs.data();
-      p3=backgdCalc.data();
+      &&(mStatisticsIntegratedBackgd.numElements()>0))
+   {
+      const REAL *p3=mStatisticsIntegratedBackgd.data();
       VFN_DEBUG_MESSAGE("PowderPattern::GetIntegratedR():Exclude Backgd",2);
       for(long i=0;i<numInterval;i++)
       {
@@ -4063,25 +4173,11 @@ REAL PowderPattern::GetIntegratedR()const
    } // Exclude Background ?
    else
    {
-      const REAL *p1, *p2;
-      CrystVector_REAL integratedCalc(numInterval);
-      integratedCalc=0;
-      REAL *pp1=integratedCalc.data();
-      for(int i=0;i<numInterval;i++)
-      {
-         const long max=mIntegratedPatternMax(i);
-         p1=mPowderPatternCalc.data()+mIntegratedPatternMin(i);
-         for(int j=mIntegratedPatternMin(i);j<=max;j++) *pp1 += *p1++;
-         pp1++;
-      }
-      p1=integratedCalc.data();
-      p2=mIntegratedObs.data();
       VFN_DEBUG_MESSAGE("PowderPattern::GetIntegratedR()",2);
       for(long i=0;i<numInterval;i++)
       {
          tmp1 += ((*p1)-(*p2))*((*p1)-(*p2));
          tmp2 += (*p2) * (*p2);
-         //cout <<i<<":"<< tmp1 << " "<<tmp2 << " " << *p1 <<" "<<*p2<<endl;
          p1++;p2++;
       }
    }
@@ -4100,112 +4196,12 @@ REAL PowderPattern::GetRw()const
    this->CalcPowderPattern();
    TAU_PROFILE("PowderPattern::GetRw()","void ()",TAU_DEFAULT);
    VFN_DEBUG_MESSAGE("PowderPattern::GetRw()",3);
+   this->CalcStatistics();
 
-
-   //cout <<FormatVertVector<REAL>(mPowderPatternObs,
-   //                               mPowderPatternCalc,
-   //                               mPowderPatternWeight);
-   REAL tmp1=0.;
-   REAL tmp2=0.;
-
-   unsigned long maxPoints=mNbPointUsed;
-
-   if(  (true==mStatisticsExcludeBackground)
-      &&(mPowderPatternBackgroundCalc.numElements()>0))
-   {
-      VFN_DEBUG_MESSAGE("PowderPattern::GetRw():Exclude Backgd",3);
-      const REAL *p1, *p2, *p3, *p4;
-      p1=mPowderPatternCalc.data();
-      p2=mPowderPatternObs.data();
-      p3=mPowderPatternBackgroundCalc.data();
-      p4=mPowderPatternWeight.data();
-      const long nbExclude=mExcludedRegionMinX.numElements();
-      if(0==nbExclude)
-      {
-         for(unsigned long i=0;i<maxPoints;i++)
-         {
-            tmp1 += *p4   * ((*p1)-(*p2)) * ((*p1)-(*p2));
-            tmp2 += *p4++ * ((*p2)-(*p3)) * ((*p2)-(*p3));
-            p1++;p2++;p3++;
-         }
-      }
-      else
-      {
-         unsigned long min,max;
-         unsigned long i=0;
-         for(int j=0;j<nbExclude;j++)
-         {
-            min=(unsigned long)floor(this->X2Pixel(mExcludedRegionMinX(j)));
-            max=(unsigned long)ceil (this->X2Pixel(mExcludedRegionMaxX(j)));
-            if(min>maxPoints) break;
-            if(max>maxPoints)max=maxPoints;
-            for(;i<min;i++)//! min is the *beginning* of the excluded region !
-            {
-               tmp1 += *p4   * ((*p1)-(*p2)) * ((*p1)-(*p2));
-               tmp2 += *p4++ * ((*p2)-(*p3)) * ((*p2)-(*p3));
-               p1++;p2++;p3++;
-            }
-            p1 += max-i;
-            p2 += max-i;
-            p3 += max-i;
-            p4 += max-i;
-            i  += max-i;
-         }
-         for(;i<maxPoints;i++)
-         {
-            tmp1 += *p4   * ((*p1)-(*p2)) * ((*p1)-(*p2));
-            tmp2 += *p4++ * ((*p2)-(*p3)) * ((*p2)-(*p3));
-            p1++;p2++;p3++;
-         }
-
-      }
-   }
-   else
-   {
-      VFN_DEBUG_MESSAGE("PowderPattern::GetRw()",3);
-      const REAL *p1, *p2, *p4;
-      p1=mPowderPatternCalc.data();
-      p2=mPowderPatternObs.data();
-      p4=mPowderPatternWeight.data();
-      const long nbExclude=mExcludedRegionMinX.numElements();
-      if(0==nbExclude)
-      {
-         for(unsigned long i=0;i<maxPoints;i++)
-         {
-            tmp1 += *p4   * ((*p1)-(*p2))*((*p1)-(*p2));
-            tmp2 += *p4++ * (*p2) * (*p2);
-            p1++;p2++;
-         }
-      }
-      else
-      {
-         unsigned long min,max;
-         unsigned long i=0;
-         for(int j=0;j<nbExclude;j++)
-         {
-            min=(unsigned long)floor(this->X2Pixel(mExcludedRegionMinX(j)));
-            max=(unsigned long)ceil (this->X2Pixel(mExcludedRegionMaxX(j)));
-            if(min>maxPoints) break;
-            if(max>maxPoints)max=maxPoints;
-            for(;i<min;i++)//! min is the *beginning* of the excluded region !
-            {
-               tmp1 += *p4   * ((*p1)-(*p2))*((*p1)-(*p2));
-               tmp2 += *p4++ * (*p2) * (*p2);
-               p1++;p2++;
-            }
-            p1 += max-i;
-            p2 += max-i;
-            p4 += max-i;
-            i  += max-i;
-         }
-         for(;i<maxPoints;i++)
-         {
-            tmp1 += *p4   * ((*p1)-(*p2))*((*p1)-(*p2));
-            tmp2 += *p4++ * (*p2) * (*p2);
-            p1++;p2++;
-         }
-      }
-   }
+   const bool excludeBackgd=  (true==mStatisticsExcludeBackground)
+                            &&(mPowderPatternBackgroundCalc.numElements()>0);
+   const REAL tmp1=mStatistics.mChi2;
+   const REAL tmp2=excludeBackgd ? mStatistics.mWeightObsBackgd2 : mStatistics.mWeightObs2;
    VFN_DEBUG_MESSAGE("PowderPattern::GetRw()="<<sqrt(tmp1/tmp2),3);
    return sqrt(tmp1/tmp2);
 }
@@ -4219,77 +4215,40 @@ REAL PowderPattern::GetIntegratedRw()const
    this->CalcPowderPattern();
    this->PrepareIntegratedRfactor();
    TAU_PROFILE("PowderPattern::GetIntegratedRw()","void ()",TAU_DEFAULT);
+   this->CalcStatistics(true);
 
    REAL tmp1=0.;
    REAL tmp2=0.;
-   const long numInterval=mIntegratedPatternMin.numElements();
+   const long numInterval=mStatisticsIntegratedCalc.numElements();
+   const REAL *p1=mStatisticsIntegratedCalc.data();
+   const REAL *p2=mIntegratedObs.data();
+   const REAL *p4;
+   if(mIntegratedWeight.numElements()==0) p4=mIntegratedWeightObs.data();
+   else p4=mIntegratedWeight.data();
    if(  (true==mStatisticsExcludeBackground)
-      &&(mPowderPatternBackgroundCalc.numElements()>0))
-   {
-      const REAL *p1, *p2, *p3, *p4;
-      CrystVector_REAL integratedCalc(numInterval);
-      integratedCalc=0;
-      CrystVector_REAL backgdCalc(numInterval);
-      backgdCalc=0;
-      REAL *pp1=integratedCalc.data();
-      REAL *pp2=backgdCalc.data();
-      for(int i=0;i<numInterval;i++)
-      {
-         const long max=mIntegratedPatternMax(i);
-         p1=mPowderPatternCalc.data()+mIntegratedPatternMin(i);
-         for(int j=mIntegratedPatternMin(i);j<=max;j++) *pp1 += *p1++;
-         pp1++;
-         p1=mPowderPatternBackgroundCalc.data()+mIntegratedPatternMin(i);
-         for(int j=mIntegratedPatternMin(i);j<=max;j++) *pp2 += *p1++;
-         pp2++;
-      }
-
-      p1=integratedCalc.data();
-      p2=mIntegratedObs.data();
-      p3=backgdCalc.data();
-      if(mIntegratedWeight.numElements()==0) p4=mIntegratedWeightObs.data();
-      else p4=mIntegratedWeight.data();
+      &&(mStatisticsIntegratedBackgd.numElements()>0))
+   {
+      const REAL *p3=mStatisticsIntegratedBackgd.data();
       VFN_DEBUG_MESSAGE("PowderPattern::GetIntegratedRw():Exclude Backgd",4);
       for(long i=0;i<numInterval;i++)
       {
          tmp1 += *p4   * ((*p1)-(*p2)) * ((*p1)-(*p2));
          tmp2 += *p4++ * ((*p2)-(*p3)) * ((*p2)-(*p3));
-         //cout <<i<<": " <<mIntegratedPatternMin(i)<<"->"<<mIntegratedPatternMax(i)
-         //     <<" "<< tmp1 << " "<<tmp2 << " " << *p1 <<" "<<*p2<<" "<<*p3<<" "<<*(p4-1) <<endl;
          p1++;p2++;p3++;
       }
    } // Exclude Background ?
    else
    {
-      const REAL *p1, *p2, *p4;
-      CrystVector_REAL integratedCalc(numInterval);
-      integratedCalc=0;
-      REAL *pp1=integratedCalc.data();
-      for(int i=0;i<numInterval;i++)
-      {
-         const long max=mIntegratedPatternMax(i);
-         p1=mPowderPatternCalc.data()+mIntegratedPatternMin(i);
-         for(int j=mIntegratedPatternMin(i);j<=max;j++) *pp1 += *p1++;
-         pp1++;
-      }
-      p1=integratedCalc.data();
-      p2=mIntegratedObs.data();
-      if(mIntegratedWeight.numElements()==0) p4=mIntegratedWeightObs.data();
-      else p4=mIntegratedWeight.data();
       VFN_DEBUG_MESSAGE("PowderPattern::GetIntegratedRw()",4);
       for(long i=0;i<numInterval;i++)
       {
          tmp1 += *p4   * ((*p1)-(*p2))*((*p1)-(*p2));
          tmp2 += *p4++ * (*p2) * (*p2);
-         //cout <<i<<":"<< tmp1 << " "<<tmp2 << " " << *p1 <<" "<<*p2<<endl;
          p1++;p2++;
       }
    }
 
    VFN_DEBUG_MESSAGE("PowderPattern::GetIntegratedRw()="<<sqrt(tmp1/tmp2),4);
-   //cout << FormatVertVector<REAL>(mPowderPatternCalc,mPowderPatternObs);
-   //this->SavePowderPattern("refinedPattern.out");
-   //abort();
    return sqrt(tmp1/tmp2);
 }
 
@@ -4312,60 +4271,13 @@ REAL PowderPattern::GetChi2()const
    this->FitScaleFactorForRw();
 
    TAU_PROFILE("PowderPattern::GetChi2()","void ()",TAU_DEFAULT);
+   OBJCRYST_PROFILE("PowderPattern::GetChi2")
 
    VFN_DEBUG_ENTRY("PowderPattern::GetChi2()",3);
 
-   const unsigned long maxPoints=mNbPointUsed;
-
-   mChi2=0.;
-   mChi2LikeNorm=0.;
-   VFN_DEBUG_MESSAGE("PowderPattern::GetChi2()Integrated profiles",3);
-   const REAL * RESTRICT p1, * RESTRICT p2, * RESTRICT p3;
-   p1=mPowderPatternCalc.data();
-   p2=mPowderPatternObs.data();
-   p3=mPowderPatternWeight.data();
-   const long nbExclude=mExcludedRegionMinX.numElements();
-   if(0==nbExclude)
-   {
-      for(unsigned long i=0;i<maxPoints;i++)
-      {
-         mChi2 += *p3 * ((*p1)-(*p2))*((*p1)-(*p2));
-         if(*p3<=0) p3++;
-         else mChi2LikeNorm -= log(*p3++);
-         p1++;p2++;
-      }
-   }
-   else
-   {
-      unsigned long min,max;
-      unsigned long i=0;
-      for(int j=0;j<nbExclude;j++)
-      {
-         min=(unsigned long)floor(this->X2Pixel(mExcludedRegionMinX(j)));
-         max=(unsigned long)ceil (this->X2Pixel(mExcludedRegionMaxX(j)));
-         if(min>maxPoints) break;
-         if(max>maxPoints)max=maxPoints;
-         for(;i<min;i++)//! min is the *beginning* of the excluded region !
-         {
-            mChi2 += *p3 * ((*p1)-(*p2))*((*p1)-(*p2));
-            if(*p3<=0) p3++;
-            else mChi2LikeNorm -= log(*p3++);
-            p1++;p2++;
-         }
-         p1 += max-i;
-         p2 += max-i;
-         p3 += max-i;
-         i  += max-i;
-      }
-      for(;i<maxPoints;i++)
-      {
-         mChi2 += *p3 * ((*p1)-(*p2))*((*p1)-(*p2));
-         if(*p3<=0) p3++;
-         else mChi2LikeNorm -= log(*p3++);
-         p1++;p2++;
-      }
-   }
-   mChi2LikeNorm/=2;
+   this->CalcStatistics();
+   mChi2=mStatistics.mChi2;
+   mChi2LikeNorm=mStatistics.mLogWeight/2;
    VFN_DEBUG_MESSAGE("Chi^2="<<mChi2<<", log(norm)="<<mChi2LikeNorm,3)
    mClockChi2.Click();
    VFN_DEBUG_EXIT("PowderPattern::GetChi2()="<<mChi2,3);
@@ -5186,12 +5098,14 @@ void PowderPattern::FitScaleFactorForIntegratedRw()const
 void PowderPattern::SetSigmaToSqrtIobs()
 {
    VFN_DEBUG_MESSAGE("PowderPattern::SetSigmaToSqrtIobs()",5);
+   this->UnshareObservedData();
    for(long i=0;i<mPowderPatternObs.numElements();i++)
       mPowderPatternObsSigma(i)=sqrt(fabs(mPowderPatternObs(i)));
 }
 void PowderPattern::SetWeightToInvSigmaSq(const REAL minRelatSigma)
 {
    VFN_DEBUG_MESSAGE("PowderPattern::SetWeightToInvSigmaSq()",5);
+   mClockStatistics.Reset();
    //:KLUDGE: If less than 1e-4*max, set to 0.... Do not give weight to unobserved points
    const REAL min=MaxAbs(mPowderPatternObsSigma)*minRelatSigma;
    //mPowderPatternWeight.resize(mPowderPatternObsSigma.numElements());
@@ -5206,6 +5120,7 @@ void PowderPattern::SetWeightToInvSigmaSq(const REAL minRelatSigma)
 void PowderPattern::SetWeightToUnit()
 {
    VFN_DEBUG_MESSAGE("PowderPattern::SetWeightToSinTheta()",5);
+   mClockStatistics.Reset();
    //mPowderPatternWeight.resize(mPowderPatternObs.numElements());
    mPowderPatternWeight=1;
 }
@@ -5214,6 +5129,7 @@ void PowderPattern::SetWeightPolynomial(const REAL a, const REAL b,
                                          const REAL minRelatIobs)
 {
    VFN_DEBUG_MESSAGE("PowderPattern::SetWeightPolynomial()",5);
+   mClockStatistics.Reset();
    const REAL min=MaxAbs(mPowderPatternObs)*minRelatIobs;
    REAL tmp;
    for(long i=0;i<mPowderPatternWeight.numElements();i++)
@@ -5391,6 +5307,13 @@ std::map<RefinablePar*, CrystVector_REAL>& PowderPattern::GetLSQ_FullDeriv(const
    return mPowderPattern_FullDeriv;
 }
 
+bool PowderPattern::IsLSQDerivStepIndependent(const unsigned int,const RefinablePar &par)const
+{
+   const long i=par.GetPointer()-mScaleFactor.data();
+   if((i>=0)&&(i<mScaleFactor.numElements())) return true;
+   return par.GetType()->IsDescendantFromOrSameAs(gpRefParTypeScattDataBackground);
+}
+
 void PowderPattern::Prepare()
 {
    VFN_DEBUG_MESSAGE("PowderPattern::Prepare()",5);
@@ -5996,6 +5919,7 @@ void PowderPattern::CalcPowderPattern() const
    if(mClockPowderPatternCalc>mClockMaster) return;
 
    TAU_PROFILE("PowderPattern::CalcPowderPattern()","void ()",TAU_DEFAULT);
+   OBJCRYST_PROFILE("PowderPattern::CalcPowderPattern")
    VFN_DEBUG_ENTRY("PowderPattern::CalcPowderPattern()",3);
    if(mPowderPatternComponentRegistry.GetNb()==0)
    {
@@ -6820,21 +6744,142 @@ void PowderPattern::CalcNbPointUsed()const
 
 }
 
+PowderPattern::Statistics::Statistics():
+mChi2(0),mLogWeight(0),mR(0),mObs2(0),mObsBackgd2(0),mWeightObs2(0),mWeightObsBackgd2(0)
+{}
+
+void PowderPattern::CalcStatistics(const bool integrated)const
+{
+   TAU_PROFILE("PowderPattern::CalcStatistics()","void (bool)",TAU_DEFAULT);
+   VFN_DEBUG_ENTRY("PowderPattern::CalcStatistics()",3);
+   const unsigned long nbPoint=mNbPointUsed;
+   const bool hasBackgd=mPowderPatternBackgroundCalc.numElements()>0;
+
+   // Excluded regions, as pixel ranges
+   const long nbExclude=mExcludedRegionMinX.numElements();
+   CrystVector_long exclMin(nbExclude),exclMax(nbExclude);
+   for(long j=0;j<nbExclude;j++)
+   {
+      long min=(long)floor(this->X2Pixel(mExcludedRegionMinX(j)));
+      long max=(long)ceil (this->X2Pixel(mExcludedRegionMaxX(j)));
+      if(min<0) min=0;
+      if(min>(long)nbPoint) min=nbPoint;
+      if(max>(long)nbPoint) max=nbPoint;
+      if(max<min) max=min;
+      exclMin(j)=min;
+      exclMax(j)=max;
+   }
+   bool newExclude=(nbExclude!=mStatisticsExcludedMin.numElements());
+   if(!newExclude)
+      for(long j=0;j<nbExclude;j++)
+         if((exclMin(j)!=mStatisticsExcludedMin(j))||(exclMax(j)!=mStatisticsExcludedMax(j)))
+         {
+            newExclude=true;
+            break;
+         }
+   if(  newExclude
+      ||(mClockStatistics<mClockPowderPatternCalc)
+      ||(mClockStatistics<mClockPowderPatternPar)
+      ||(mClockStatistics<mClockNbPointUsed))
+   {
+      VFN_DEBUG_MESSAGE("PowderPattern::CalcStatistics():compute sums",3);
+      mStatisticsExcludedMin=exclMin;
+      mStatisticsExcludedMax=exclMax;
+      // Fused accumulation of all statistics
+      REAL chi2=0,logw=0,r=0,obs2=0,obsb2=0,wobs2=0,wobsb2=0;
+      const REAL * RESTRICT pcalc=mPowderPatternCalc.data();
+      const REAL * RESTRICT pobs=mPowderPatternObs.data();
+      const REAL * RESTRICT pw=mPowderPatternWeight.data();
+      const REAL * RESTRICT pb=hasBackgd ? mPowderPatternBackgroundCalc.data() : 0;
+      unsigned long i=0;
+      for(long j=0;j<=nbExclude;j++)
+      {
+         // Points up to the beginning of the next excluded region
+         const unsigned long end=(j<nbExclude) ? exclMin(j) : nbPoint;
+         for(;i<end;i++)
+         {
+            const REAL w=pw[i];
+            const REAL d=pcalc[i]-pobs[i];
+            const REAL o2=pobs[i]*pobs[i];
+            chi2 += w*d*d;
+            if(w>0) logw -= log(w);
+            r += d*d;
+            obs2 += o2;
+            wobs2 += w*o2;
+            if(hasBackgd)
+            {
+               const REAL ob=pobs[i]-pb[i];
+               obsb2 += ob*ob;
+               wobsb2 += w*ob*ob;
+            }
+         }
+         if((j<nbExclude)&&((unsigned long)exclMax(j)>i)) i=exclMax(j);
+      }
+      mStatistics.mChi2=chi2;
+      mStatistics.mLogWeight=logw;
+      mStatistics.mR=r;
+      mStatistics.mObs2=obs2;
+      mStatistics.mObsBackgd2=obsb2;
+      mStatistics.mWeightObs2=wobs2;
+      mStatistics.mWeightObsBackgd2=wobsb2;
+      mClockStatistics.Click();
+   }
+
+   if(!integrated)
+   {
+      VFN_DEBUG_EXIT("PowderPattern::CalcStatistics()",3);
+      return;
+   }
+   // Sums over the integration intervals
+   const long numInterval=mIntegratedPatternMin.numElements();
+   if(  (mClockStatisticsIntegrated>mClockStatistics)
+      &&(mClockStatisticsIntegrated>mClockIntegratedFactorsPrep)
+      &&(mStatisticsIntegratedCalc.numElements()==numInterval)
+      &&(hasBackgd == (mStatisticsIntegratedBackgd.numElements()>0)))
+   {
+      VFN_DEBUG_EXIT("PowderPattern::CalcStatistics()",3);
+      return;
+   }
+   mStatisticsIntegratedCalc.resize(numInterval);
+   if(hasBackgd) mStatisticsIntegratedBackgd.resize(numInterval);
+   else mStatisticsIntegratedBackgd.resize(0);
+   for(long i=0;i<numInterval;i++)
+   {
+      const unsigned long min=mIntegratedPatternMin(i);
+      unsigned long max=mIntegratedPatternMax(i);
+      if(max>=nbPoint) max=nbPoint-1;
+      if((0==nbPoint)||(min>max))
+      {
+         mStatisticsIntegratedCalc(i)=0;
+         if(hasBackgd) mStatisticsIntegratedBackgd(i)=0;
+         continue;
+      }
+      REAL calc=0,backgd=0;
+      for(unsigned long j=min;j<=max;j++) calc += mPowderPatternCalc(j);
+      mStatisticsIntegratedCalc(i)=calc;
+      if(hasBackgd)
+      {
+         for(unsigned long j=min;j<=max;j++) backgd += mPowderPatternBackgroundCalc(j);
+         mStatisticsIntegratedBackgd(i)=backgd;
+      }
+   }
+   mClockStatisticsIntegrated.Click();
+   VFN_DEBUG_EXIT("PowderPattern::CalcStatistics()",3);
+}
+
 void PowderPattern::InitOptions()
 {
    VFN_DEBUG_MESSAGE("PowderPattern::InitOptions()",5)
    static string OptProfileIntegrationName;
    static string OptProfileIntegrationChoices[2];
 
-   static bool needInitNames=true;
-   if(true==needInitNames)
-   {
+   static std::once_flag needInitNames;
+   std::call_once(needInitNames,[]()
+   {// Only once for the class
       OptProfileIntegrationName="Use Integrated Profiles";
       OptProfileIntegrationChoices[0]="Yes (recommended)";
       OptProfileIntegrationChoices[1]="No";
-
-      needInitNames=false;//Only once for the class
-   }
+   });
    mOptProfileIntegration.Init(2,&OptProfileIntegrationName,OptProfileIntegrationChoices);
    this->AddOption(&mOptProfileIntegration);
 }
@@ -22,6 +22,7 @@
 #include <utility>
 #include <list>
 #include <string>
+#include <memory>
 
 #include "ObjCryst/CrystVector/CrystVector.h"
 #include "ObjCryst/ObjCryst/General.h"
@@ -76,6 +77,15 @@ class PowderPatternComponent : virtual public RefinableObj
       PowderPatternComponent(const PowderPatternComponent&);
       virtual ~PowderPatternComponent();
       virtual const string& GetClassName() const;
+      /** \brief Create a copy of this component, to be used in a copy of its
+      * PowderPattern (see PowderPattern::Clone()).
+      *
+      * The parent PowderPattern is not set. The default implementation
+      * throws an exception.
+      * \param vCopy: map of (original, copy) objects, which must include the copies
+      * of the Crystal objects used by this component. The new component is added to it.
+      */
+      virtual PowderPatternComponent* Clone(std::map<const RefinableObj*,RefinableObj*> &vCopy)const;
 
       /// Get the PowderPattern object which uses this component.
       /// This allows to know the observed powder pattern to evaluate
@@ -226,6 +236,7 @@ class PowderPatternBackground : public PowderPatternComponent
       PowderPatternBackground(const PowderPatternBackground&);
       virtual ~PowderPatternBackground();
       virtual const string& GetClassName() const;
+      virtual PowderPatternBackground* Clone(std::map<const RefinableObj*,RefinableObj*> &vCopy)const;
 
       virtual void SetParentPowderPattern(PowderPattern&);
       virtual const CrystVector_REAL& GetPowderPatternCalc()const;
@@ -277,6 +288,14 @@ class PowderPatternBackground : public PowderPatternComponent
       void InitRefParList();
       void InitOptions();
       void InitSpline()const;
+      /** Compute the linear interpolation of the background, for all points of the
+      * pattern (result must already have the correct size).
+      *
+      * \param intensity: the intensities of the interpolation points, in the same
+      * order as mBackgroundInterpPointIntensity. The pixel positions of the points
+      * are taken from mvSplinePixel, so InitSpline() must be called before.
+      */
+      void CalcLinearInterp(const CrystVector_REAL &intensity,CrystVector_REAL &result)const;
       /// Number of fitting points for background
       int mBackgroundNbPoint;
       /// Vector of 2theta values for the fitting points of the background
@@ -334,6 +353,11 @@ class PowderPatternDiffraction : virtual public PowderPatternComponent,public Sc
       PowderPatternDiffraction(const PowderPatternDiffraction&);
       virtual ~PowderPatternDiffraction();
       virtual PowderPatternDiffraction* CreateCopy()const;
+      /** Create a copy of this component, using the copy of its Crystal. The
+      * reflections are shared with this component (see ScatteringData::ShareHKL())
+      * if they are up to date.
+      */
+      virtual PowderPatternDiffraction* Clone(std::map<const RefinableObj*,RefinableObj*> &vCopy)const;
       virtual const string& GetClassName() const;
 
       virtual void SetParentPowderPattern(PowderPattern&);
@@ -439,8 +463,13 @@ class PowderPatternDiffraction : virtual public PowderPatternComponent,public Sc
       /// \internal Calc reflection profiles for ALL reflections (powder diffraction)
       void CalcPowderReflProfile()const;
       /// \internal Calc derivatives of reflection profiles for all used reflections,
-      /// for a given list of refinable parameters
+      /// for a given list of refinable parameters. Only the parameters of the
+      /// reflection profile and of the position corrections (zero, displacement,...)
+      /// are taken into account.
       void CalcPowderReflProfile_FullDeriv(std::set<RefinablePar *> &vPar);
+      /// \internal Is this a parameter for which the derivatives of the reflection
+      /// intensities are computed by CalcIhkl_FullDeriv() (structure and texture parameters) ?
+      bool IsIhklDerivPar(const RefinablePar &par)const;
       /// \internal Calc Lorentz-Polarisation-Aperture correction
       void CalcIntensityCorr()const;
       /// \internal Compute the intensity for all reflections (taking into account
@@ -583,6 +612,17 @@ class PowderPattern : public RefinableObj
       PowderPattern();
       PowderPattern(const PowderPattern&);
       ~PowderPattern();
+      /** \brief Create a copy of this pattern and of its components, using the
+      * copies of the crystals.
+      *
+      * The observed data is shared with this pattern (see ShareObservedData()),
+      * as well as the reflections of its PowderPatternDiffraction components.
+      * The copy is registered like any new object.
+      * \param vCopy: map of (original, copy) objects, which must include the copies
+      * of the Crystal objects used by this pattern (see Crystal::Clone()). The new
+      * pattern and its components are added to it.
+      */
+      PowderPattern* Clone(std::map<const RefinableObj*,RefinableObj*> &vCopy)const;
       virtual const string& GetClassName() const;
       /** Add a component (phase, backround) to this pattern.
       *
@@ -899,10 +939,31 @@ class PowderPattern : public RefinableObj
          virtual const CrystVector_REAL& GetLSQObs(const unsigned int) const;
          virtual const CrystVector_REAL& GetLSQWeight(const unsigned int) const;
          virtual std::map<RefinablePar*, CrystVector_REAL>& GetLSQ_FullDeriv(const unsigned int,std::set<RefinablePar *> &vPar);
+         /// True for the scale factors and background intensities, on which the
+         /// calculated pattern depends linearly.
+         virtual bool IsLSQDerivStepIndependent(const unsigned int,const RefinablePar &par)const;
       // I/O
          virtual void XMLOutput(ostream &os,int indent=0)const;
          virtual void XMLInput(istream &is,const XMLCrystTag &tag);
          //virtual void XMLInputOld(istream &is,const IOCrystTag &tag);
+         /** \brief Share the observed data of another powder pattern, copy-on-write.
+         *
+         * The x coordinates, observed intensities and sigma arrays of \e orig are
+         * moved to a storage owned jointly by all the patterns sharing it, and used
+         * by this pattern without being duplicated. A pattern (this one or \e orig)
+         * makes its own copy of the data before changing it (new pattern imported,
+         * sigma recomputed,...), so that each pattern is independent of the others
+         * and can be modified or destroyed at any time.
+         * The weights are copied, since they can be recomputed with the calculated
+         * pattern. This is used by Clone().
+         *
+         * Sharing is not thread-safe for \e orig: this must not be called while
+         * \e orig is used in another thread.
+         */
+         void ShareObservedData(const PowderPattern &orig);
+         /// Is the observed data held in a storage shared (copy-on-write) with other
+         /// patterns ? See ShareObservedData().
+         bool IsObservedDataShared()const;
          void Prepare();
       virtual void GetGeneGroup(const RefinableObj &obj,
                                 CrystVector_uint & groupIndex,
@@ -926,6 +987,18 @@ class PowderPattern : public RefinableObj
       /// \param ttheta: the theoretical x (2theta, tof) value.
       /// \return the x (2theta, tof) value as it appears on the pattern.
       REAL X2XCorr(const REAL x)const;
+      /** Get the derivative of the experimental x (2theta, tof) of a reflection
+      * with respect to one of the parameters of the x corrections (zero,
+      * displacement, transparency, DIFC, DIFA).
+      * \internal
+      * \param x: the theoretical x (2theta, tof) value.
+      * \param stol: sin(theta)/lambda for the reflection.
+      * \param par: the parameter
+      * \param dx: the derivative
+      * \return false if the experimental x does not depend on this parameter,
+      * or if it is not a correction parameter.
+      */
+      bool X2XCorr_Deriv(const REAL x,const REAL stol,const RefinablePar &par,REAL &dx)const;
       /// Get the pixel number on the experimental pattern, from the
       /// theoretical (uncorrected) x coordinate, taking into account all corrections.
       /// (zero, transparency,..).
@@ -998,6 +1071,16 @@ class PowderPattern : public RefinableObj
       /// Calculate the number of points of the pattern actually used, from the maximum
       /// value of sin(theta)/lambda
       void CalcNbPointUsed()const;
+      /** \internal Update the sums used for Chi^2, R, Rw and the integrated R-factors,
+      * in a single sweep over the calc/obs/weight/background arrays.
+      *
+      * The sums are only recomputed if the calculated pattern, the weights, the
+      * excluded regions or the number of points used changed since the last call,
+      * as given by their clocks. If \e integrated is true, the interval sums of the
+      * calculated (and background) pattern used by GetIntegratedR() and GetIntegratedRw()
+      * are also updated if needed.
+      */
+      void CalcStatistics(const bool integrated=false)const;
       /// Initialize options
       virtual void InitOptions();
 
@@ -1046,6 +1129,18 @@ class PowderPattern : public RefinableObj
       CrystVector_REAL mX;
       /// Is the mX vector sorted in ascending order ? (true for 2theta, false for TOF)
       bool mIsXAscending;
+      /** \internal Make a private copy of the observed data, if it is shared with another
+      * pattern. This must be called before changing mX, mPowderPatternObs or
+      * mPowderPatternObsSigma.
+      */
+      void UnshareObservedData();
+      /// \internal Observed data shared by several patterns, see ShareObservedData()
+      struct SharedObservedData;
+      /// Shared observed data, or null if this pattern owns its data. If not null,
+      /// mX, mPowderPatternObs and mPowderPatternObsSigma are references to its arrays.
+      /// This is mutable, since the data of the original pattern is moved to the
+      /// shared storage (without any change) when it is first shared.
+      mutable std::shared_ptr<const SharedObservedData> mpSharedObservedData;
       /// Number of points in the pattern
       unsigned long mNbPoint;
 
@@ -1149,6 +1244,34 @@ class PowderPattern : public RefinableObj
       /// Clock recording the last time the number of points used (PowderPattern::mNbPointUsed)
       /// was changed.
       mutable RefinableObjClock mClockNbPointUsed;
+      // Cached statistics, see PowderPattern::CalcStatistics()
+         /// \internal Sums over all the points used, excluding the excluded regions.
+         struct Statistics
+         {
+            Statistics();
+            /// Sum of w*(calc-obs)^2, i.e. the Chi^2 and numerator of Rw
+            REAL mChi2;
+            /// Sum of -log(w) for all w>0
+            REAL mLogWeight;
+            /// Sum of (calc-obs)^2
+            REAL mR;
+            /// Sums of obs^2 and (obs-backgd)^2
+            REAL mObs2,mObsBackgd2;
+            /// Sums of w*obs^2 and w*(obs-backgd)^2
+            REAL mWeightObs2,mWeightObsBackgd2;
+         };
+         /// The statistics computed by CalcStatistics()
+         mutable Statistics mStatistics;
+         /// Last time the statistics were computed. This is reset when the weights
+         /// are changed.
+         mutable RefinableObjClock mClockStatistics;
+         /// Pixel ranges [min;max[ of the excluded regions used for the statistics
+         mutable CrystVector_long mStatisticsExcludedMin,mStatisticsExcludedMax;
+         /// Integrated calc & background from the full profile, for each
+         /// integration interval (for GetIntegratedR() and GetIntegratedRw())
+         mutable CrystVector_REAL mStatisticsIntegratedCalc,mStatisticsIntegratedBackgd;
+         /// Last time the integrated sums were computed
+         mutable RefinableObjClock mClockStatisticsIntegrated;
    #ifdef __WX__CRYST__
    public:
       virtual WXCrystObjBasic* WXCreate(wxWindow*);
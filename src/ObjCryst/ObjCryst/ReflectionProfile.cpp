@@ -68,7 +68,50 @@ extern const RefParType *gpRefParTypeScattDataProfileWidth;
 extern const RefParType *gpRefParTypeScattDataProfileAsym;
 
 ObjRegistry<ReflectionProfile>
-   gReflectionProfileRegistry("List of all ReflectionProfile types");;
+   gReflectionProfileRegistry("List of all ReflectionProfile types",true);
+
+/** Derivatives of a Gaussian (or Lorentzian) profile computed by PowderProfileGauss()
+* (or PowderProfileLorentz()), with respect to its fwhm, center and asymmetry.
+*
+* \param prof: the profile, as returned by PowderProfileGauss() or PowderProfileLorentz()
+* \param lorentz: true for a Lorentzian profile, false for a Gaussian
+*/
+static void PowderProfileDeriv(const CrystVector_REAL &x,const CrystVector_REAL &prof,
+                               const REAL fw,const REAL center,const REAL asym,
+                               const bool lorentz,CrystVector_REAL &dfwhm,
+                               CrystVector_REAL &dcenter,CrystVector_REAL &dasym)
+{
+   const long nb=x.numElements();
+   dfwhm.resize(nb);
+   dcenter.resize(nb);
+   dasym.resize(nb);
+   // A null or negative width is replaced by a constant value
+   const bool fixedWidth=(fw<=0);
+   const REAL fwhm=fixedWidth ? 1e-6 : fw;
+   const REAL invf2=1/(fwhm*fwhm);
+   const REAL ln2=log(2.);
+   // Toraya asymmetry: width factor and its derivative vs asym, below and above the center
+   const REAL k1=(1+asym)/asym,dk1=-1/(asym*asym);
+   const REAL k2=1+asym,dk2=1;
+   const REAL *px=x.data(),*pp=prof.data();
+   REAL *pf=dfwhm.data(),*pc=dcenter.data(),*pa=dasym.data();
+   bool below=true;
+   for(long i=0;i<nb;i++)
+   {
+      // Same switch between the two sides as in PowderProfileGauss()
+      const REAL k=below ? k1 : k2, dk=below ? dk1 : dk2;
+      if(*px>center) below=false;
+      const REAL u=*px++ -center;
+      const REAL q=k*k*u*u*invf2;
+      // derivative of log(profile) vs q
+      const REAL g= lorentz ? -1/(1+q) : -ln2;
+      *pf++ = fixedWidth ? 0 : *pp * (-1-2*g*q)/fwhm;
+      *pc++ = *pp * (-2*g*k*k*u*invf2);
+      *pa++ = *pp * (2*g*k*u*u*invf2*dk);
+      pp++;
+   }
+}
+
 ////////////////////////////////////////////////////////////////////////
 //
 //    ReflectionProfile
@@ -83,6 +126,35 @@ ReflectionProfile::~ReflectionProfile()
 {}
 bool ReflectionProfile::IsAnisotropic()const
 {return false;}
+void ReflectionProfile::GetProfile_FullDeriv(const CrystVector_REAL &x, const REAL xcenter,
+                                             const REAL h, const REAL k, const REAL l,
+                                             std::set<RefinablePar*> &vPar,
+                                             std::map<RefinablePar*,CrystVector_REAL> &vDeriv,
+                                             CrystVector_REAL *pDerivCenter)
+{
+   vDeriv.clear();
+   for(std::set<RefinablePar*>::iterator par=vPar.begin();par!=vPar.end();++par)
+   {
+      if(*par==0) continue;
+      if(this->FindPar((*par)->GetPointer())<0) continue;
+      const REAL step=(*par)->GetDerivStep();
+      const REAL v0=(*par)->GetValue();
+      CrystVector_REAL *pDeriv=&(vDeriv[*par]);
+      (*par)->Mutate(step);
+      *pDeriv =this->GetProfile(x,xcenter,h,k,l);
+      (*par)->Mutate(-2*step);
+      *pDeriv-=this->GetProfile(x,xcenter,h,k,l);
+      (*par)->SetValue(v0);
+      *pDeriv/=2*step;
+   }
+   if(pDerivCenter!=0)
+   {
+      const REAL step=1e-3*this->GetFullProfileWidth(0.5,xcenter,h,k,l);
+      *pDerivCenter =this->GetProfile(x,xcenter+step,h,k,l);
+      *pDerivCenter-=this->GetProfile(x,xcenter-step,h,k,l);
+      *pDerivCenter/=2*step;
+   }
+}
 ////////////////////////////////////////////////////////////////////////
 //
 //    ReflectionProfilePseudoVoigt
@@ -168,6 +240,89 @@ CrystVector_REAL ReflectionProfilePseudoVoigt::GetProfile(const CrystVector_REAL
    return profile;
 }
 
+void ReflectionProfilePseudoVoigt::GetProfile_FullDeriv(const CrystVector_REAL &x,
+                            const REAL center,const REAL h, const REAL k, const REAL l,
+                            std::set<RefinablePar*> &vPar,
+                            std::map<RefinablePar*,CrystVector_REAL> &vDeriv,
+                            CrystVector_REAL *pDerivCenter)
+{
+   TAU_PROFILE("ReflectionProfilePseudoVoigt::GetProfile_FullDeriv()","void (...)",TAU_DEFAULT);
+   vDeriv.clear();
+   const REAL tantheta=tan(center/2.0);
+   REAL fwhm=mCagliotiW+mCagliotiV*tantheta+mCagliotiU*tantheta*tantheta;
+   // derivative of the fwhm vs the fwhm**2 (null if the width is constant)
+   REAL dfwhm2=0;
+   if(fwhm<=0) fwhm=1e-6;
+   else
+   {
+      fwhm=sqrt(fwhm);
+      dfwhm2=0.5/fwhm;
+   }
+   const REAL sin2theta=sin(center);
+   const REAL asym=mAsym0+mAsym1/sin2theta+mAsym2/(sin2theta*sin2theta);
+   REAL eta=mPseudoVoigtEta0+center*mPseudoVoigtEta1;
+   // derivative of the profile vs eta (null if eta is outside [0,1])
+   const bool etaFree=(eta>=0)&&(eta<=1);
+   if(eta>1) eta=1;
+   if(eta<0) eta=0;
+
+   CrystVector_REAL gauss,lorentz,dGf,dGc,dGa,dLf,dLc,dLa;
+   gauss=PowderProfileGauss(x,fwhm,center,asym);
+   lorentz=PowderProfileLorentz(x,fwhm,center,asym);
+   PowderProfileDeriv(x,gauss,fwhm,center,asym,false,dGf,dGc,dGa);
+   PowderProfileDeriv(x,lorentz,fwhm,center,asym,true,dLf,dLc,dLa);
+   // Derivatives vs fwhm, asym and eta
+   CrystVector_REAL dPf,dPa,dPeta;
+   dPf=dGf;
+   dPf*=1-eta;
+   dLf*=eta;
+   dPf+=dLf;
+   dPa=dGa;
+   dPa*=1-eta;
+   dLa*=eta;
+   dPa+=dLa;
+   dPeta=lorentz;
+   dPeta-=gauss;
+   if(!etaFree) dPeta=0;
+
+   for(std::set<RefinablePar*>::iterator par=vPar.begin();par!=vPar.end();++par)
+   {
+      if(*par==0) continue;
+      const REAL *p=(*par)->GetPointer();
+      const CrystVector_REAL *pV;
+      REAL f;
+      if(p==&mCagliotiU)            {pV=&dPf;f=dfwhm2*tantheta*tantheta;}
+      else if(p==&mCagliotiV)       {pV=&dPf;f=dfwhm2*tantheta;}
+      else if(p==&mCagliotiW)       {pV=&dPf;f=dfwhm2;}
+      else if(p==&mPseudoVoigtEta0) {pV=&dPeta;f=1;}
+      else if(p==&mPseudoVoigtEta1) {pV=&dPeta;f=center;}
+      else if(p==&mAsym0)           {pV=&dPa;f=1;}
+      else if(p==&mAsym1)           {pV=&dPa;f=1/sin2theta;}
+      else if(p==&mAsym2)           {pV=&dPa;f=1/(sin2theta*sin2theta);}
+      else continue;
+      CrystVector_REAL *pDeriv=&(vDeriv[*par]);
+      *pDeriv=*pV;
+      *pDeriv*=f;
+   }
+   if(pDerivCenter!=0)
+   {
+      const REAL cos2theta=cos(center);
+      // fwhm, asym and eta also depend on the position of the reflection
+      const REAL dfwhm=dfwhm2*(mCagliotiV+2*mCagliotiU*tantheta)*(1+tantheta*tantheta)/2;
+      const REAL dasym=-cos2theta/(sin2theta*sin2theta)*(mAsym1+2*mAsym2/sin2theta);
+      *pDerivCenter=dGc;
+      *pDerivCenter*=1-eta;
+      dLc*=eta;
+      *pDerivCenter+=dLc;
+      dPf*=dfwhm;
+      *pDerivCenter+=dPf;
+      dPa*=dasym;
+      *pDerivCenter+=dPa;
+      dPeta*=mPseudoVoigtEta1;
+      *pDerivCenter+=dPeta;
+   }
+}
+
 void ReflectionProfilePseudoVoigt::SetProfilePar(const REAL fwhmCagliotiW,
                    const REAL fwhmCagliotiU,
                    const REAL fwhmCagliotiV,
@@ -555,6 +710,105 @@ CrystVector_REAL ReflectionProfilePseudoVoigtAnisotropic::GetProfile(const Cryst
    return profile;
 }
 
+void ReflectionProfilePseudoVoigtAnisotropic::GetProfile_FullDeriv(const CrystVector_REAL &x,
+                            const REAL center,const REAL h, const REAL k, const REAL l,
+                            std::set<RefinablePar*> &vPar,
+                            std::map<RefinablePar*,CrystVector_REAL> &vDeriv,
+                            CrystVector_REAL *pDerivCenter)
+{
+   TAU_PROFILE("ReflectionProfilePseudoVoigtAnisotropic::GetProfile_FullDeriv()","void (...)",TAU_DEFAULT);
+   vDeriv.clear();
+   const REAL tantheta=tan(center/2.0);
+   const REAL costheta=cos(center/2.0);
+   const REAL sintheta=sin(center/2.0);
+   const REAL fwhmG2=mCagliotiW+mCagliotiV*tantheta+mCagliotiU*tantheta*tantheta+mScherrerP/(costheta*costheta);
+   const REAL fwhmG=sqrt(abs(fwhmG2));
+   const REAL gam=mLorentzGammaHH*h*h+mLorentzGammaKK*k*k+mLorentzGammaLL*l*l+2*mLorentzGammaHK*h*k+2*mLorentzGammaHL*h*l+2*mLorentzGammaKL*k*l;
+   const REAL fwhmL= mLorentzX/costheta+(mLorentzY+gam/(sintheta*sintheta))*tantheta;
+   REAL eta=mPseudoVoigtEta0+center*mPseudoVoigtEta1;
+   const bool etaFree=(eta>=0)&&(eta<=1);
+   if(eta>1) eta=1;
+   if(eta<0) eta=0;
+   const REAL sin2theta=sin(center);
+   const REAL asym=mAsym0+mAsym1/sin2theta+mAsym2/(sin2theta*sin2theta);
+
+   const long nb=x.numElements();
+   // Derivatives vs the gaussian and lorentzian fwhm, asym and eta
+   CrystVector_REAL dPfG(nb),dPfL(nb),dPa(nb),dPc(nb),dPeta(nb);
+   dPfG=0;dPfL=0;dPa=0;dPc=0;dPeta=0;
+   // derivative of fwhmG vs fwhmG**2
+   REAL dfwhmG2=0;
+   CrystVector_REAL prof,df,dc,da;
+   if(fwhmG>0)
+   {
+      dfwhmG2=(fwhmG2>0 ? 0.5 : -0.5)/fwhmG;
+      prof=PowderProfileGauss(x,fwhmG,center,asym);
+      PowderProfileDeriv(x,prof,fwhmG,center,asym,false,df,dc,da);
+      df*=1-eta;dPfG+=df;
+      dc*=1-eta;dPc+=dc;
+      da*=1-eta;dPa+=da;
+      dPeta-=prof;
+   }
+   if(fwhmL>0)
+   {
+      prof=PowderProfileLorentz(x,fwhmL,center,asym);
+      PowderProfileDeriv(x,prof,fwhmL,center,asym,true,df,dc,da);
+      df*=eta;dPfL+=df;
+      dc*=eta;dPc+=dc;
+      da*=eta;dPa+=da;
+      dPeta+=prof;
+   }
+   if(!etaFree) dPeta=0;
+
+   for(std::set<RefinablePar*>::iterator par=vPar.begin();par!=vPar.end();++par)
+   {
+      if(*par==0) continue;
+      const REAL *p=(*par)->GetPointer();
+      const CrystVector_REAL *pV;
+      REAL f;
+      if(p==&mCagliotiU)            {pV=&dPfG;f=dfwhmG2*tantheta*tantheta;}
+      else if(p==&mCagliotiV)       {pV=&dPfG;f=dfwhmG2*tantheta;}
+      else if(p==&mCagliotiW)       {pV=&dPfG;f=dfwhmG2;}
+      else if(p==&mScherrerP)       {pV=&dPfG;f=dfwhmG2/(costheta*costheta);}
+      else if(p==&mLorentzX)        {pV=&dPfL;f=1/costheta;}
+      else if(p==&mLorentzY)        {pV=&dPfL;f=tantheta;}
+      else if(p==&mLorentzGammaHH)  {pV=&dPfL;f=h*h*tantheta/(sintheta*sintheta);}
+      else if(p==&mLorentzGammaKK)  {pV=&dPfL;f=k*k*tantheta/(sintheta*sintheta);}
+      else if(p==&mLorentzGammaLL)  {pV=&dPfL;f=l*l*tantheta/(sintheta*sintheta);}
+      else if(p==&mLorentzGammaHK)  {pV=&dPfL;f=2*h*k*tantheta/(sintheta*sintheta);}
+      else if(p==&mLorentzGammaHL)  {pV=&dPfL;f=2*h*l*tantheta/(sintheta*sintheta);}
+      else if(p==&mLorentzGammaKL)  {pV=&dPfL;f=2*k*l*tantheta/(sintheta*sintheta);}
+      else if(p==&mPseudoVoigtEta0) {pV=&dPeta;f=1;}
+      else if(p==&mPseudoVoigtEta1) {pV=&dPeta;f=center;}
+      else if(p==&mAsym0)           {pV=&dPa;f=1;}
+      else if(p==&mAsym1)           {pV=&dPa;f=1/sin2theta;}
+      else if(p==&mAsym2)           {pV=&dPa;f=1/(sin2theta*sin2theta);}
+      else continue;
+      CrystVector_REAL *pDeriv=&(vDeriv[*par]);
+      *pDeriv=*pV;
+      *pDeriv*=f;
+   }
+   if(pDerivCenter!=0)
+   {
+      const REAL cos2theta=cos(center);
+      // widths, asym and eta also depend on the position of the reflection
+      const REAL dfwhmG=dfwhmG2*( (mCagliotiV+2*mCagliotiU*tantheta)*(1+tantheta*tantheta)/2
+                                 +mScherrerP*sintheta/(costheta*costheta*costheta));
+      const REAL dfwhmL=(mLorentzX*sintheta+mLorentzY)/(2*costheta*costheta)
+                        -2*gam*cos2theta/(sin2theta*sin2theta);
+      const REAL dasym=-cos2theta/(sin2theta*sin2theta)*(mAsym1+2*mAsym2/sin2theta);
+      *pDerivCenter=dPc;
+      dPfG*=dfwhmG;
+      *pDerivCenter+=dPfG;
+      dPfL*=dfwhmL;
+      *pDerivCenter+=dPfL;
+      dPa*=dasym;
+      *pDerivCenter+=dPa;
+      dPeta*=mPseudoVoigtEta1;
+      *pDerivCenter+=dPeta;
+   }
+}
+
 void ReflectionProfilePseudoVoigtAnisotropic::SetProfilePar(const REAL fwhmCagliotiW,
                    const REAL fwhmCagliotiU,
                    const REAL fwhmCagliotiV,
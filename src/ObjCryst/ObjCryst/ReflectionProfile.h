@@ -79,6 +79,24 @@ class ReflectionProfile:public RefinableObj
       */
       virtual CrystVector_REAL GetProfile(const CrystVector_REAL &x, const REAL xcenter,
                                   const REAL h, const REAL k, const REAL l)const=0;
+      /** Get the derivatives of the reflection profile with respect to its parameters,
+      * and to the position of the center of the reflection.
+      *
+      *\param x,xcenter,h,k,l: see GetProfile()
+      *\param vPar: the parameters for which the derivatives are wanted. Parameters
+      * which do not belong to this profile are ignored.
+      *\param vDeriv: on return, the derivative of the profile for each parameter of
+      * this profile in vPar
+      *\param pDerivCenter: if not null, the derivative of the profile with respect
+      * to xcenter is stored in this vector
+      *
+      * The default implementation uses numerical derivatives.
+      */
+      virtual void GetProfile_FullDeriv(const CrystVector_REAL &x, const REAL xcenter,
+                                        const REAL h, const REAL k, const REAL l,
+                                        std::set<RefinablePar*> &vPar,
+                                        std::map<RefinablePar*,CrystVector_REAL> &vDeriv,
+                                        CrystVector_REAL *pDerivCenter=0);
       /// Get the (approximate) full profile width at a given percentage
       /// of the profile maximum (e.g. FWHM=GetFullProfileWidth(0.5)).
       virtual REAL GetFullProfileWidth(const REAL relativeIntensity, const REAL xcenter,
@@ -107,6 +125,12 @@ class ReflectionProfilePseudoVoigt:public ReflectionProfile
       virtual const string& GetClassName()const;
       CrystVector_REAL GetProfile(const CrystVector_REAL &x, const REAL xcenter,
                                   const REAL h, const REAL k, const REAL l)const;
+      /// Analytical derivatives of the profile, see ReflectionProfile::GetProfile_FullDeriv()
+      virtual void GetProfile_FullDeriv(const CrystVector_REAL &x, const REAL xcenter,
+                                        const REAL h, const REAL k, const REAL l,
+                                        std::set<RefinablePar*> &vPar,
+                                        std::map<RefinablePar*,CrystVector_REAL> &vDeriv,
+                                        CrystVector_REAL *pDerivCenter=0);
       /** Set reflection profile parameters
       *
       * \param fwhmCagliotiW,fwhmCagliotiU,fwhmCagliotiV : these are the U,V and W
@@ -170,6 +194,12 @@ class ReflectionProfilePseudoVoigtAnisotropic:public ReflectionProfile
       virtual const string& GetClassName()const;
       CrystVector_REAL GetProfile(const CrystVector_REAL &x, const REAL xcenter,
                                   const REAL h, const REAL k, const REAL l)const;
+      /// Analytical derivatives of the profile, see ReflectionProfile::GetProfile_FullDeriv()
+      virtual void GetProfile_FullDeriv(const CrystVector_REAL &x, const REAL xcenter,
+                                        const REAL h, const REAL k, const REAL l,
+                                        std::set<RefinablePar*> &vPar,
+                                        std::map<RefinablePar*,CrystVector_REAL> &vDeriv,
+                                        CrystVector_REAL *pDerivCenter=0);
       /** Set reflection profile parameters
        *
        * if only W is given, the width is constant
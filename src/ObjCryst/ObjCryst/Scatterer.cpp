@@ -64,7 +64,7 @@ long NiftyStaticGlobalObjectsInitializer_Scatterer::mCount=0;
 //
 //
 ////////////////////////////////////////////////////////////////////////
-ObjRegistry<Scatterer> gScattererRegistry("Global Scatterer Registry");
+ObjRegistry<Scatterer> gScattererRegistry("Global Scatterer Registry",true);
 
 Scatterer::Scatterer():mXYZ(3),mOccupancy(1.0),mColourName("White"),mpCryst(0)
 {
@@ -94,6 +94,12 @@ Scatterer::~Scatterer()
    gScattererRegistry.DeRegister(*this);
 }
 
+Scatterer* Scatterer::Clone(std::map<const RefinableObj*,RefinableObj*> &vCopy)const
+{
+   throw ObjCrystException("Scatterer::Clone(): not implemented for "
+                           +this->GetClassName()+":"+this->GetName());
+}
+
 const string& Scatterer::GetClassName() const
 {
    const static string className="Scatterer";
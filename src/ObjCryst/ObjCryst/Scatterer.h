@@ -139,6 +139,14 @@ class Scatterer:virtual public RefinableObj
       /// \internal so-called Virtual copy constructor, needed to make copies
       /// of arrays of Scatterers
       virtual Scatterer* CreateCopy() const=0;
+      /** Create a copy of this scatterer, using the copies of its crystal and
+      * scattering powers (see Crystal::Clone()). The copy is not added to the crystal.
+      *
+      * \param vCopy: map of (original, copy) objects, to which the new object is added.
+      * \note this is implemented for Atom, ZScatterer and Molecule. An exception is
+      * thrown for other classes.
+      */
+      virtual Scatterer* Clone(std::map<const RefinableObj*,RefinableObj*> &vCopy)const;
       virtual const string& GetClassName() const;
 
       /// Number of components in the scatterer (eg number of point scatterers)
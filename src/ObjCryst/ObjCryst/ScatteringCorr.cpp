@@ -17,6 +17,7 @@
     Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
 */
 #include "ObjCryst/ObjCryst/ScatteringCorr.h"
+#include "ObjCryst/RefinableObj/Random.h"
 #include "ObjCryst/Quirks/VFNStreamFormat.h"
 #include <stdio.h> //for sprintf()
 #include <cstdlib>
@@ -52,7 +53,20 @@ const CrystVector_REAL& ScatteringCorr::GetCorr() const
    return mCorr;
 }
 
+const std::map<RefinablePar*,CrystVector_REAL>&
+   ScatteringCorr::GetCorr_FullDeriv(std::set<RefinablePar*> &vPar) const
+{
+   this->CalcCorr();
+   this->CalcCorr_FullDeriv(vPar);
+   return mCorr_FullDeriv;
+}
+
 const RefinableObjClock& ScatteringCorr::GetClockCorr()const {return mClockCorrCalc;}
+
+void ScatteringCorr::CalcCorr_FullDeriv(std::set<RefinablePar*> &vPar) const
+{
+   mCorr_FullDeriv.clear();
+}
 ////////////////////////////////////////////////////////////////////////
 //
 //        LorentzCorr
@@ -430,7 +444,7 @@ void TextureMarchDollase::GlobalOptRandomMove(const REAL mutationAmplitude,
       mRandomMoveIsDone=true;
       return;
    }
-   //if((rand()/(REAL)RAND_MAX)<.3)//only 30% proba to make a random move
+   //if(RandomUniform()<.3)//only 30% proba to make a random move
    {
       VFN_DEBUG_MESSAGE("TextureMarchDollase::GlobalOptRandomMove()",1)
       for(unsigned int i=0;i<this->GetNbPhase();i++)
@@ -453,7 +467,7 @@ void TextureMarchDollase::GlobalOptRandomMove(const REAL mutationAmplitude,
 
             ymax=.5+1/M_PI*atan((y+delta-y0)/(2.*sig));
             ymin=.5+1/M_PI*atan((y-delta-y0)/(2.*sig));
-            y=ymin+rand()/(REAL)RAND_MAX*(ymax-ymin);
+            y=ymin+RandomUniform()*(ymax-ymin);
             y-=.5;
             if(y<-.499)y=-.499;//Should not happen but make sure we remain in [-pi/2;pi/2]
             if(y> .499)y= .499;
@@ -476,7 +490,7 @@ void TextureMarchDollase::GlobalOptRandomMove(const REAL mutationAmplitude,
 
                ymax=.5+1/M_PI*atan((tx+delta-tx0)/(2.*sig));
                ymin=.5+1/M_PI*atan((tx-delta-tx0)/(2.*sig));
-               y=ymin+rand()/(REAL)RAND_MAX*(ymax-ymin);
+               y=ymin+RandomUniform()*(ymax-ymin);
                y-=.5;
                if(y<-.499)y=-.499;
                if(y> .499)y= .499;
@@ -484,7 +498,7 @@ void TextureMarchDollase::GlobalOptRandomMove(const REAL mutationAmplitude,
 
                ymax=.5+1/M_PI*atan((ty+delta-ty0)/(2.*sig));
                ymin=.5+1/M_PI*atan((ty-delta-ty0)/(2.*sig));
-               y=ymin+rand()/(REAL)RAND_MAX*(ymax-ymin);
+               y=ymin+RandomUniform()*(ymax-ymin);
                y-=.5;
                if(y<-.499)y=-.499;
                if(y> .499)y= .499;
@@ -492,7 +506,7 @@ void TextureMarchDollase::GlobalOptRandomMove(const REAL mutationAmplitude,
 
                ymax=.5+1/M_PI*atan((tz+delta-tz0)/(2.*sig));
                ymin=.5+1/M_PI*atan((tz-delta-tz0)/(2.*sig));
-               y=ymin+rand()/(REAL)RAND_MAX*(ymax-ymin);
+               y=ymin+RandomUniform()*(ymax-ymin);
                y-=.5;
                if(y<-.499)y=-.499;
                if(y> .499)y= .499;
@@ -518,7 +532,7 @@ void TextureMarchDollase::GlobalOptRandomMove(const REAL mutationAmplitude,
 
             ymin=.5+1/M_PI*atan((y-delta-y0)/(2.*sig));
             ymax=.5+1/M_PI*atan((y+delta-y0)/(2.*sig));
-            y=ymin+rand()/(REAL)RAND_MAX*(ymax-ymin);
+            y=ymin+RandomUniform()*(ymax-ymin);
                y-=.5;
                if(y<-.499)y=-.499;
                if(y> .499)y= .499;
@@ -721,6 +735,149 @@ void TextureMarchDollase::CalcCorr() const
    mClockCorrCalc.Click();
    VFN_DEBUG_EXIT("TextureMarchDollase::CalcCorr()",3)
 }
+void TextureMarchDollase::CalcCorr_FullDeriv(std::set<RefinablePar*> &vPar) const
+{
+   mCorr_FullDeriv.clear();
+   const unsigned int nbPhase=this->GetNbPhase();
+   if(nbPhase==0) return;
+   TAU_PROFILE("TextureMarchDollase::CalcCorr_FullDeriv()","void ()",TAU_DEFAULT);
+   // Texture directions: numerical derivatives
+   bool needCorr=false;
+   for(std::set<RefinablePar*>::iterator par=vPar.begin();par!=vPar.end();++par)
+   {
+      if(*par==0) continue;
+      for(unsigned int i=0;i<nbPhase;i++)
+      {
+         const TexturePhaseMarchDollase *phase=&(mPhaseRegistry.GetObj(i));
+         if(  ((*par)->GetPointer()!=&(phase->mH))&&((*par)->GetPointer()!=&(phase->mK))
+            &&((*par)->GetPointer()!=&(phase->mL))) continue;
+         const REAL step=(*par)->GetDerivStep();
+         const REAL v0=(*par)->GetValue();
+         CrystVector_REAL *pDeriv=&(mCorr_FullDeriv[*par]);
+         (*par)->Mutate(step);
+         this->CalcCorr();
+         *pDeriv=mCorr;
+         (*par)->Mutate(-2*step);
+         this->CalcCorr();
+         *pDeriv-=mCorr;
+         (*par)->SetValue(v0);
+         *pDeriv/=2*step;
+         needCorr=true;
+      }
+   }
+   if(needCorr) this->CalcCorr();
+   // Fractions and March coefficients
+   std::vector<RefinablePar*> vFraction(nbPhase,(RefinablePar*)0),vMarch(nbPhase,(RefinablePar*)0);
+   bool needDeriv=false;
+   for(std::set<RefinablePar*>::iterator par=vPar.begin();par!=vPar.end();++par)
+   {
+      if(*par==0) continue;
+      for(unsigned int i=0;i<nbPhase;i++)
+      {
+         const TexturePhaseMarchDollase *phase=&(mPhaseRegistry.GetObj(i));
+         if((*par)->GetPointer()==&(phase->mFraction)) {vFraction[i]=*par;needDeriv=true;}
+         if((*par)->GetPointer()==&(phase->mMarchCoeff)) {vMarch[i]=*par;needDeriv=true;}
+      }
+   }
+   if(!needDeriv) return;
+   const long nbReflUsed=mpData->GetNbReflBelowMaxSinThetaOvLambda();
+   const long nbRefl=mpData->GetNbRefl();
+   REAL fractionSum=0;
+   for(unsigned int i=0;i<nbPhase;i++) fractionSum+=this->GetFraction(i);
+   const REAL fractionNorm=(fractionSum<1) ? 1. : fractionSum;
+   CrystVector_REAL reflNorm(nbReflUsed);
+   {
+      const REAL *xx=mpData->GetReflX().data();
+      const REAL *yy=mpData->GetReflY().data();
+      const REAL *zz=mpData->GetReflZ().data();
+      for(long i=0;i<nbReflUsed;i++)
+      {
+         reflNorm(i)= sqrt(*xx * *xx + *yy * *yy + *zz * *zz);
+         xx++;yy++;zz++;
+      }
+   }
+   // For each phase, the correction for a unit fraction and its derivative
+   // vs the March coefficient, as in CalcCorr()
+   std::vector<CrystVector_REAL> vCorr(nbPhase),vCorrMarch(nbPhase);
+   CrystMatrix_REAL hkl;
+   for(unsigned int i=0;i<nbPhase;i++)
+   {
+      hkl=mpData->GetCrystal().GetSpaceGroup()
+            .GetAllEquivRefl(this->GetPhaseH(i),this->GetPhaseK(i),this->GetPhaseL(i),true);
+      const REAL coeff=this->GetMarchCoeff(i);
+      const REAL march=1./(coeff+1e-6);
+      const REAL march2=coeff*coeff-march;
+      const REAL dmarch=-march*march;
+      const REAL dmarch2=2*coeff+march*march;
+      const REAL norm=1./hkl.rows();
+      vCorr[i].resize(nbRefl);
+      vCorrMarch[i].resize(nbRefl);
+      vCorr[i]=0;
+      vCorrMarch[i]=0;
+      for(long j=0;j<hkl.rows();j++)
+      {
+         REAL tx=hkl(j,0),ty=hkl(j,1),tz=hkl(j,2);
+         {
+            mpData->GetCrystal().MillerToOrthonormalCoords(tx,ty,tz);
+            const REAL n=sqrt(tx*tx+ty*ty+tz*tz);
+            tx/=(n+1e-6);
+            ty/=(n+1e-6);
+            tz/=(n+1e-6);
+         }
+         const REAL *xx=mpData->GetReflX().data();
+         const REAL *yy=mpData->GetReflY().data();
+         const REAL *zz=mpData->GetReflZ().data();
+         const REAL *xyznorm=reflNorm.data();
+         REAL *pCorr=vCorr[i].data();
+         REAL *pCorrMarch=vCorrMarch[i].data();
+         for(long k=0;k<nbReflUsed;k++)
+         {
+            REAL c=(tx * (*xx++) + ty * (*yy++) + tz * (*zz++))/ (*xyznorm++);
+            c*=c;
+            const REAL tmp=march+march2*c;
+            if(tmp>0)
+            {
+               const REAL p=pow(tmp,(REAL)-1.5);
+               *pCorr += norm*p;
+               *pCorrMarch += -1.5*norm*p/tmp*(dmarch+dmarch2*c);
+            }
+            pCorr++;
+            pCorrMarch++;
+         }
+      }
+   }
+   for(unsigned int i=0;i<nbPhase;i++)
+   {
+      if(vMarch[i]!=0)
+      {
+         CrystVector_REAL *pDeriv=&(mCorr_FullDeriv[vMarch[i]]);
+         *pDeriv=vCorrMarch[i];
+         *pDeriv*=this->GetFraction(i)/(fractionNorm+1e-6);
+      }
+      if(vFraction[i]!=0)
+      {
+         CrystVector_REAL *pDeriv=&(mCorr_FullDeriv[vFraction[i]]);
+         *pDeriv=vCorr[i];
+         *pDeriv/=fractionNorm+1e-6;
+         if(fractionSum<1)
+         {// Fraction of non-textured sample
+            REAL *p=pDeriv->data();
+            for(long k=0;k<nbReflUsed;k++) *p++ -= 1;
+         }
+         else
+         {// Normalization of the sum of fractions
+            for(unsigned int l=0;l<nbPhase;l++)
+            {
+               const REAL f=this->GetFraction(l)/((fractionNorm+1e-6)*(fractionNorm+1e-6));
+               REAL *p=pDeriv->data();
+               const REAL *p1=vCorr[l].data();
+               for(long k=0;k<nbReflUsed;k++) *p++ -= f * *p1++;
+            }
+         }
+      }
+   }
+}
+
 void TextureMarchDollase::DeleteAllPhase()
 {
 }
@@ -810,7 +967,7 @@ void TextureEllipsoid::GlobalOptRandomMove(const REAL mutationAmplitude,
       {
          pEPR[i] = &(this->GetPar(&(mEPR[i])));
          if (pEPR[i]->IsFixed()==false)
-            pEPR[i]->Mutate(pEPR[i]->GetGlobalOptimStep()*2*(rand()/(REAL)RAND_MAX-0.5)*mutationAmplitude);
+            pEPR[i]->Mutate(pEPR[i]->GetGlobalOptimStep()*2*(RandomUniform()-0.5)*mutationAmplitude);
       }
       UpdateEllipsoidPar();
    }
@@ -934,8 +1091,8 @@ void TextureEllipsoid::CalcCorr() const
    REAL sum=0;
    REAL *pCorr=mCorr.data();
    const REAL *pH=mpData->GetH().data();
-   const REAL *pK=mpData->GetH().data();
-   const REAL *pL=mpData->GetH().data();
+   const REAL *pK=mpData->GetK().data();
+   const REAL *pL=mpData->GetL().data();
    const REAL *pstol=mpData->GetSinThetaOverLambda().data();
    for(long i=0;i<nbReflUsed;i++)
    {
@@ -965,6 +1122,84 @@ void TextureEllipsoid::CalcCorr() const
    VFN_DEBUG_EXIT("TextureEllipsoid::CalcCorr()",3)
 }
 
+void TextureEllipsoid::CalcCorr_FullDeriv(std::set<RefinablePar*> &vPar) const
+{
+   mCorr_FullDeriv.clear();
+   std::vector<std::pair<RefinablePar*,int> > vEPR;
+   for(std::set<RefinablePar*>::iterator par=vPar.begin();par!=vPar.end();++par)
+   {
+      if(*par==0) continue;
+      for(int j=0;j<6;j++)
+         if((*par)->GetPointer()==mEPR+j) vEPR.push_back(std::make_pair(*par,j));
+   }
+   if(vEPR.size()==0) return;
+   TAU_PROFILE("TextureEllipsoid::CalcCorr_FullDeriv()","void ()",TAU_DEFAULT)
+   const long nbReflUsed=mpData->GetNbReflBelowMaxSinThetaOvLambda();
+   const long nbRefl=mpData->GetNbRefl();
+   // Uncorrected values as in CalcCorr(), and their derivative vs the ellipsoid term
+   CrystVector_REAL corr(nbReflUsed),dcorr(nbReflUsed);
+   REAL sum=0;
+   {
+      const REAL *pH=mpData->GetH().data();
+      const REAL *pK=mpData->GetK().data();
+      const REAL *pL=mpData->GetL().data();
+      const REAL *pstol=mpData->GetSinThetaOverLambda().data();
+      for(long i=0;i<nbReflUsed;i++)
+      {
+         REAL dhkl=1.0/(2* (*pstol++));
+         dhkl=0.001*dhkl*dhkl;
+         REAL tmp=(mEPR[0]* (*pH) * (*pH) +
+                   mEPR[1]* (*pK) * (*pK) +
+                   mEPR[2]* (*pL) * (*pL) +
+                   mEPR[3]*2* (*pH) * (*pK) +
+                   mEPR[4]*2* (*pH) * (*pL) +
+                   mEPR[5]*2* (*pK) * (*pL)) *
+                  dhkl;
+         if(tmp<0)
+         {
+            corr(i)=1;
+            dcorr(i)=0;
+         }
+         else
+         {
+            corr(i)=pow(1.0+tmp,-1.5);
+            dcorr(i)=-1.5*corr(i)/(1.0+tmp)*dhkl;
+         }
+         sum+=corr(i);
+         pH++;pK++;pL++;
+      }
+   }
+   const REAL *pH=mpData->GetH().data();
+   const REAL *pK=mpData->GetK().data();
+   const REAL *pL=mpData->GetL().data();
+   CrystVector_REAL deriv(nbReflUsed);
+   for(std::vector<std::pair<RefinablePar*,int> >::const_iterator pos=vEPR.begin();pos!=vEPR.end();++pos)
+   {
+      REAL dsum=0;
+      for(long i=0;i<nbReflUsed;i++)
+      {
+         REAL m;
+         switch(pos->second)
+         {
+            case 0: m=pH[i]*pH[i];break;
+            case 1: m=pK[i]*pK[i];break;
+            case 2: m=pL[i]*pL[i];break;
+            case 3: m=2*pH[i]*pK[i];break;
+            case 4: m=2*pH[i]*pL[i];break;
+            default: m=2*pK[i]*pL[i];break;
+         }
+         deriv(i)=dcorr(i)*m;
+         dsum+=deriv(i);
+      }
+      // Derivative of the normalized correction nbReflUsed*corr/sum
+      CrystVector_REAL *pDeriv=&(mCorr_FullDeriv[pos->first]);
+      pDeriv->resize(nbRefl);
+      *pDeriv=0;
+      const REAL norm=nbReflUsed/sum;
+      for(long i=0;i<nbReflUsed;i++) (*pDeriv)(i)=norm*(deriv(i)-corr(i)*dsum/sum);
+   }
+}
+
 void TextureEllipsoid::UpdateEllipsoidPar()
 {
    VFN_DEBUG_ENTRY("TextureEllipsoid::UpdateEllipsoidPar().",3)
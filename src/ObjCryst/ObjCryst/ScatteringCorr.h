@@ -46,16 +46,27 @@ class ScatteringCorr
       /// be multiplied by these values.
       /// If the vector is empty (size==0), then no correction should be applied
       const CrystVector_REAL& GetCorr() const;
+      /** Get the derivatives of the correction with respect to some parameters.
+      *
+      * Only the parameters on which the correction depends have an entry in the
+      * returned map.
+      */
+      const std::map<RefinablePar*,CrystVector_REAL>& GetCorr_FullDeriv(std::set<RefinablePar*> &vPar) const;
       /// Get the value of the clock corresponding to the last time the correction
       /// was actually computed
       const RefinableObjClock& GetClockCorr()const;
    protected:
       /// Do the computation of corrected intensities
       virtual void CalcCorr() const=0;
+      /// Compute the derivatives of the correction. The default implementation
+      /// is for a correction which does not depend on any parameter.
+      virtual void CalcCorr_FullDeriv(std::set<RefinablePar*> &vPar) const;
       /// The associated ScatteringData object
       const ScatteringData *mpData;
       /// The vector of correction to intensities.
       mutable CrystVector_REAL mCorr;
+      /// The derivatives of the correction
+      mutable std::map<RefinablePar*,CrystVector_REAL> mCorr_FullDeriv;
       /// The clock marking the last time the correction was calculated
       mutable RefinableObjClock mClockCorrCalc;
 };
@@ -186,6 +197,9 @@ class TextureMarchDollase:public ScatteringCorr,public RefinableObj
       virtual void TagNewBestConfig()const;
    protected:
       virtual void CalcCorr() const;
+      /// Analytical derivatives for the fractions and March coefficients, numerical
+      /// derivatives for the texture directions.
+      virtual void CalcCorr_FullDeriv(std::set<RefinablePar*> &vPar) const;
       void DeleteAllPhase();
       ObjRegistry<TexturePhaseMarchDollase> mPhaseRegistry;
       RefinableObjClock mClockTexturePar;
@@ -227,6 +241,7 @@ class TextureEllipsoid:public ScatteringCorr,public RefinableObj
       void UpdateEllipsoidPar();
    protected:
       virtual void CalcCorr() const;
+      virtual void CalcCorr_FullDeriv(std::set<RefinablePar*> &vPar) const;
       RefinableObjClock mClockTextureEllipsoidPar;
       /// Number of reflexion for which the calculation is actually done.
       /// This is automaticaly updated during CalcCorr, from the parent
@@ -24,6 +24,7 @@
 #include <cmath>
 
 #include <typeinfo>
+#include <mutex>
 
 #include "cctbx/sgtbx/space_group.h"
 #include "cctbx/miller/index_generator.h"
@@ -31,6 +32,7 @@
 #include "cctbx/eltbx/wavelengths.h"
 
 #include "ObjCryst/ObjCryst/ScatteringData.h"
+#include "ObjCryst/RefinableObj/Profiler.h"
 #include "ObjCryst/Quirks/VFNDebug.h"
 #include "ObjCryst/Quirks/VFNStreamFormat.h"
 #include "ObjCryst/Quirks/Chronometer.h"
@@ -208,6 +210,7 @@ void Radiation::operator=(const Radiation &old)
    mXRayTubeName              =old.mXRayTubeName;
    mXRayTubeDeltaLambda       =old.mXRayTubeDeltaLambda;
    mXRayTubeAlpha2Alpha1Ratio =old.mXRayTubeAlpha2Alpha1Ratio;
+   mLinearPolarRate           =old.mLinearPolarRate;
    mClockWavelength.Click();
    mRadiationType.SetChoice(old.mRadiationType.GetChoice());
    this->SetWavelengthType((WavelengthType) old.mWavelengthType.GetChoice());
@@ -391,9 +394,9 @@ void Radiation::InitOptions()
    static string WavelengthTypeName;
    static string WavelengthTypeChoices[3];
 
-   static bool needInitNames=true;
-   if(true==needInitNames)
-   {
+   static std::once_flag needInitNames;
+   std::call_once(needInitNames,[]()
+   {// Only once for the class
       RadiationTypeName="Radiation";
       RadiationTypeChoices[0]="Neutron";
       RadiationTypeChoices[1]="X-Ray";
@@ -406,9 +409,7 @@ void Radiation::InitOptions()
       //WavelengthTypeChoices[2]="MAD";
       //WavelengthTypeChoices[3]="DAFS";
       //WavelengthTypeChoices[4]="LAUE";
-
-      needInitNames=false;//Only once for the class
-   }
+   });
    mRadiationType.Init(3,&RadiationTypeName,RadiationTypeChoices);
    mWavelengthType.Init(3,&WavelengthTypeName,WavelengthTypeChoices);
    this->AddOption(&mRadiationType);
@@ -522,6 +523,7 @@ void ScatteringData::SetHKL(const CrystVector_REAL &h,
                             const CrystVector_REAL &l) const
 {
    VFN_DEBUG_ENTRY("ScatteringData::SetHKL(h,k,l)",5)
+   this->UnshareHKL();
    mNbRefl=h.numElements();
    mH=h;
    mK=k;
@@ -546,6 +548,7 @@ void ScatteringData::GenHKLFullSpace2(const REAL maxSTOL,const bool unique) cons
       throw ObjCrystException("ScatteringData::GenHKLFullSpace2() \
       no crystal assigned yet to this ScatteringData object.");
    }
+   this->UnshareHKL();
    cctbx::uctbx::unit_cell uc=cctbx::uctbx::unit_cell(scitbx::af::double6(mpCrystal->GetLatticePar(0),
                                                                           mpCrystal->GetLatticePar(1),
 						                          mpCrystal->GetLatticePar(2),
@@ -1014,10 +1017,77 @@ long ScatteringData::GetNbReflBelowMaxSinThetaOvLambda()const
 const RefinableObjClock& ScatteringData::GetClockNbReflBelowMaxSinThetaOvLambda()const
 {return mClockNbReflUsed;}
 
+struct ScatteringData::SharedHKL
+{
+   CrystVector_REAL mH;
+   CrystVector_REAL mK;
+   CrystVector_REAL mL;
+   CrystVector_int mMultiplicity;
+};
+
+void ScatteringData::ShareHKL(const ScatteringData &orig)
+{
+   VFN_DEBUG_MESSAGE("ScatteringData::ShareHKL():"<<orig.GetName()<<"->"<<this->GetName(),5)
+   if((&orig==this)||(orig.mNbRefl==0)) return;
+   if(orig.mpSharedHKL==0)
+   {// Move the reflections of the original object to the shared storage. The shared
+    // arrays are never modified, see UnshareHKL()
+      SharedHKL *p=new SharedHKL;
+      p->mH=orig.mH;
+      p->mK=orig.mK;
+      p->mL=orig.mL;
+      p->mMultiplicity=orig.mMultiplicity;
+      orig.mpSharedHKL.reset(p);
+      orig.mH.reference(p->mH);
+      orig.mK.reference(p->mK);
+      orig.mL.reference(p->mL);
+      orig.mMultiplicity.reference(p->mMultiplicity);
+   }
+   if(mpSharedHKL!=orig.mpSharedHKL)
+   {
+      this->UnshareHKL();
+      mpSharedHKL=orig.mpSharedHKL;
+      SharedHKL *p=const_cast<SharedHKL*>(mpSharedHKL.get());
+      mH.reference(p->mH);
+      mK.reference(p->mK);
+      mL.reference(p->mL);
+      mMultiplicity.reference(p->mMultiplicity);
+   }
+   mNbRefl=orig.mNbRefl;
+   mClockHKL.Click();
+   this->PrepareHKLarrays();
+}
+
+bool ScatteringData::IsHKLShared()const {return mpSharedHKL!=0;}
+
+void ScatteringData::UnshareHKL()const
+{
+   if(mpSharedHKL==0) return;
+   VFN_DEBUG_MESSAGE("ScatteringData::UnshareHKL():"<<this->GetName(),5)
+   // resize(0) only drops the reference, without freeing the shared data
+   CrystVector_REAL tmp;
+   tmp=mH;
+   mH.resize(0);
+   mH=tmp;
+   tmp=mK;
+   mK.resize(0);
+   mK=tmp;
+   tmp=mL;
+   mL.resize(0);
+   mL=tmp;
+   CrystVector_int tmpMult;
+   tmpMult=mMultiplicity;
+   mMultiplicity.resize(0);
+   mMultiplicity=tmpMult;
+   // The shared reflections are freed with the last object using them
+   mpSharedHKL.reset();
+}
+
 CrystVector_long ScatteringData::SortReflectionBySinThetaOverLambda(const REAL maxSTOL) const
 {
    TAU_PROFILE("ScatteringData::SortReflectionBySinThetaOverLambda()","void ()",TAU_DEFAULT);
    VFN_DEBUG_ENTRY("ScatteringData::SortReflectionBySinThetaOverLambda()",5)
+   this->UnshareHKL();
    this->CalcSinThetaLambda();
    CrystVector_long sortedSubs;
    sortedSubs=SortSubs(mSinThetaLambda);
@@ -1091,6 +1161,7 @@ CrystVector_long ScatteringData::EliminateExtinctReflections()
 {
    TAU_PROFILE("ScatteringData::EliminateExtinctReflections()","void ()",TAU_DEFAULT);
    VFN_DEBUG_ENTRY("ScatteringData::EliminateExtinctReflections()",7)
+   this->UnshareHKL();
 
    long nbKeptRefl=0;
    CrystVector_long subscriptKeptRefl(mNbRefl);
@@ -1148,6 +1219,7 @@ void ScatteringData::CalcSinThetaLambda()const
 
    VFN_DEBUG_ENTRY("ScatteringData::CalcSinThetaLambda()",3)
    TAU_PROFILE("ScatteringData::CalcSinThetaLambda()","void (bool)",TAU_DEFAULT);
+   OBJCRYST_PROFILE("ScatteringData::CalcSinThetaLambda")
    mSinThetaLambda.resize(mNbRefl);
 
    const CrystMatrix_REAL bMatrix= this->GetBMatrix();
@@ -1248,6 +1320,7 @@ void ScatteringData::CalcScattFactor()const
       &&(mClockScattFactor>mpCrystal->GetClockLatticePar())
       &&(mClockThermicFact>mpCrystal->GetMasterClockScatteringPower())) return;
    TAU_PROFILE("ScatteringData::CalcScattFactor()","void (bool)",TAU_DEFAULT);
+   OBJCRYST_PROFILE("ScatteringData::CalcScattFactor")
    VFN_DEBUG_ENTRY("ScatteringData::CalcScattFactor()",4)
    this->CalcResonantScattFactor();
    mvScatteringFactor.clear();
@@ -1274,6 +1347,7 @@ void ScatteringData::CalcTemperatureFactor()const
       &&(mClockThermicFact>mpCrystal->GetClockLatticePar())
       &&(mClockThermicFact>mpCrystal->GetMasterClockScatteringPower())) return;
    TAU_PROFILE("ScatteringData::CalcTemperatureFactor()","void (bool)",TAU_DEFAULT);
+   OBJCRYST_PROFILE("ScatteringData::CalcTemperatureFactor")
    VFN_DEBUG_ENTRY("ScatteringData::CalcTemperatureFactor()",4)
    mvTemperatureFactor.clear();
    for(int i=mpCrystal->GetScatteringPowerRegistry().GetNb()-1;i>=0;i--)
@@ -1383,6 +1457,7 @@ void ScatteringData::CalcStructFactor() const
       &&(mClockStructFactor>mClockLuzzatiFactor)) return;
    VFN_DEBUG_ENTRY("ScatteringData::CalcStructFactor()",3)
    TAU_PROFILE("ScatteringData::CalcStructFactor()","void ()",TAU_DEFAULT);
+   OBJCRYST_PROFILE("ScatteringData::CalcStructFactor")
    //TAU_PROFILE_START(timer4);
    //reset Fcalc
       mFhklCalcReal.resize(nbRefl);
@@ -1657,6 +1732,7 @@ void ScatteringData::CalcGeomStructFactor() const
       &&(mClockGeomStructFact>mpCrystal->GetSpaceGroup().GetClockSpaceGroup())
       &&(mClockGeomStructFact>mpCrystal->GetMasterClockScatteringPower())) return;
    TAU_PROFILE("ScatteringData::GeomStructFactor()","void (Vx,Vy,Vz,data,M,M,bool)",TAU_DEFAULT);
+   OBJCRYST_PROFILE("ScatteringData::GeomStructFactor")
    VFN_DEBUG_ENTRY("ScatteringData::GeomStructFactor(Vx,Vy,Vz,...)",3)
    VFN_DEBUG_MESSAGE("-->Using fast functions:"<<mUseFastLessPreciseFunc,2)
    VFN_DEBUG_MESSAGE("-->Number of translation vectors:"
@@ -30,6 +30,7 @@
 
 //#include <stdlib.h>
 #include <string>
+#include <memory>
 //#include <iomanip>
 //#include <cmath>
 //#include <typeinfo>
@@ -476,6 +477,23 @@ class ScatteringData: virtual public RefinableObj
       virtual long GetNbReflBelowMaxSinThetaOvLambda()const;
       /// Clock the last time the number of reflections used was changed
       const RefinableObjClock& GetClockNbReflBelowMaxSinThetaOvLambda()const;
+      /** \brief Use the same list of reflections as another data object, copy-on-write.
+      *
+      * The H, K, L and multiplicity arrays of \e orig are moved to a storage owned
+      * jointly by all the objects sharing it, and used by this object without being
+      * duplicated. An object (this one or \e orig) makes its own copy of the arrays
+      * before changing them (reflections re-generated, sorted,...).
+      * This is used by DiffractionDataSingleCrystal::Clone() and
+      * PowderPatternDiffraction::Clone(), for copies which use a copy of the
+      * same crystal structure and the same radiation.
+      *
+      * Sharing is not thread-safe for \e orig: this must not be called while
+      * \e orig is used in another thread.
+      */
+      void ShareHKL(const ScatteringData &orig);
+      /// Are the H, K, L arrays held in a storage shared (copy-on-write) with other
+      /// objects ? See ShareHKL().
+      bool IsHKLShared()const;
    protected:
       /** \brief \internal input H,K,L
       *
@@ -537,6 +555,11 @@ class ScatteringData: virtual public RefinableObj
       ///
       /// \return an array with the subscript of the kept reflections (for inherited classes)
       CrystVector_long EliminateExtinctReflections();
+      /** \internal Make a private copy of the H, K, L and multiplicity arrays, if they are
+      * shared with another object. This must be called before changing mH, mK, mL
+      * or mMultiplicity.
+      */
+      void UnshareHKL()const;
 
       //The following functions are used during the calculation of structure factors,
          /// \internal Compute sin(theta)/lambda as well a orthonormal coordinates
@@ -603,6 +626,11 @@ class ScatteringData: virtual public RefinableObj
 
       ///Multiplicity for each reflections (mostly for powder diffraction)
       mutable CrystVector_int mMultiplicity ;
+      /// \internal Reflection list shared by several objects, see ShareHKL()
+      struct SharedHKL;
+      /// Shared reflection list, or null if this object owns its H, K, L and
+      /// multiplicity arrays. If not null, these are references to its arrays.
+      mutable std::shared_ptr<const SharedHKL> mpSharedHKL;
 
       /** Expected intensity factor for all reflections.
       *
@@ -85,7 +85,7 @@ CrystMatrix_REAL Bij2Betaij(const CrystVector_REAL &Bij, const UnitCell &cell)
 //      SCATTERING POWER
 //
 //######################################################################
-ObjRegistry<ScatteringPower> gScatteringPowerRegistry("Global ScatteringPower Registry");
+ObjRegistry<ScatteringPower> gScatteringPowerRegistry("Global ScatteringPower Registry",true);
 
 ScatteringPower::ScatteringPower():mDynPopCorrIndex(0),mBiso(1.0),mIsIsotropic(true),
 mMaximumLikelihoodNbGhost(0),mFormalCharge(0.0)
@@ -150,6 +150,12 @@ bool ScatteringPower::operator!=(const ScatteringPower& rhs) const
    return !(*this == rhs);
 }
 
+ScatteringPower* ScatteringPower::Clone(std::map<const RefinableObj*,RefinableObj*> &vCopy)const
+{
+   throw ObjCrystException("ScatteringPower::Clone(): not implemented for "
+                           +this->GetClassName()+":"+this->GetName());
+}
+
 bool ScatteringPower::IsScatteringFactorAnisotropic()const{return false;}
 bool ScatteringPower::IsTemperatureFactorAnisotropic()const{return false;}
 bool ScatteringPower::IsResonantScatteringAnisotropic()const{return false;}
@@ -298,7 +304,7 @@ void ScatteringPower::InitRGBColour()
 //
 //######################################################################
 ObjRegistry<ScatteringPowerAtom>
-   gScatteringPowerAtomRegistry("Global ScatteringPowerAtom Registry");
+   gScatteringPowerAtomRegistry("Global ScatteringPowerAtom Registry",true);
 
 ScatteringPowerAtom::ScatteringPowerAtom():
 ScatteringPower(),mSymbol(""),mAtomicNumber(0),mpGaussian(0)
@@ -341,6 +347,17 @@ const string& ScatteringPowerAtom::GetClassName() const
    return className;
 }
 
+ScatteringPowerAtom* ScatteringPowerAtom::Clone(std::map<const RefinableObj*,RefinableObj*> &vCopy)const
+{
+   VFN_DEBUG_MESSAGE("ScatteringPowerAtom::Clone():"<<mName,5)
+   ScatteringPowerAtom *p=new ScatteringPowerAtom(mName,mSymbol,mBiso);
+   vCopy[this]=p;
+   p->CopyParAndOptions(*this);
+   p->mIsIsotropic=mIsIsotropic;
+   p->SetColour(mColourRGB[0],mColourRGB[1],mColourRGB[2]);
+   return p;
+}
+
 // Disable the base-class function.
 void ScatteringPowerAtom::Init()
 {
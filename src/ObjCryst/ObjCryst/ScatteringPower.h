@@ -123,6 +123,14 @@ class ScatteringPower:virtual public RefinableObj
       * displacement parameter, correspond to same element, and are of the same class.
       */
       virtual bool operator!=(const ScatteringPower& rhs) const;
+      /** Create a copy of this scattering power, for the copy of a Crystal
+      * (see Crystal::Clone()).
+      *
+      * \param vCopy: map of (original, copy) objects, to which the new object is added.
+      * \note this is implemented for ScatteringPowerAtom and ScatteringPowerSphere.
+      * An exception is thrown for other classes.
+      */
+      virtual ScatteringPower* Clone(std::map<const RefinableObj*,RefinableObj*> &vCopy)const;
       /** \brief Get the Scattering factor for all reflections of a given
       * ScatteringData object.
       *
@@ -360,6 +368,7 @@ class ScatteringPowerAtom:virtual public ScatteringPower
       ScatteringPowerAtom(const ScatteringPowerAtom& old);
       ~ScatteringPowerAtom();
       virtual const string& GetClassName() const;
+      virtual ScatteringPowerAtom* Clone(std::map<const RefinableObj*,RefinableObj*> &vCopy)const;
       /// Re-initialize parameters (after using the default constructor).
       void Init(const string &name,const string &symbol,const REAL bIso=1.0);
       virtual CrystVector_REAL GetScatteringFactor(const ScatteringData &data,
@@ -77,6 +77,17 @@ void ScatteringPowerSphere::Init(const string &name,
    if(this->GetNbPar()==0) this->InitRefParList();
 }
 
+ScatteringPowerSphere* ScatteringPowerSphere::Clone(std::map<const RefinableObj*,RefinableObj*> &vCopy)const
+{
+   VFN_DEBUG_MESSAGE("ScatteringPowerSphere::Clone():"<<mName,5)
+   ScatteringPowerSphere *p=new ScatteringPowerSphere(mName,mRadius,mBiso);
+   vCopy[this]=p;
+   p->CopyParAndOptions(*this);
+   p->mIsIsotropic=mIsIsotropic;
+   p->SetColour(mColourRGB[0],mColourRGB[1],mColourRGB[2]);
+   return p;
+}
+
 const string& ScatteringPowerSphere::GetClassName() const
 {
    const static string className="ScatteringPowerSphere";
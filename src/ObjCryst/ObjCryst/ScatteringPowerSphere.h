@@ -58,6 +58,7 @@ class ScatteringPowerSphere: public ScatteringPower
       ~ScatteringPowerSphere();
       void Init(const string &name,const REAL radius,const REAL bIso=1.0);
       virtual const string& GetClassName() const;
+      virtual ScatteringPowerSphere* Clone(std::map<const RefinableObj*,RefinableObj*> &vCopy)const;
       virtual CrystVector_REAL GetScatteringFactor(const ScatteringData &data,
                                                      const int spgSymPosIndex=0) const;
       virtual REAL GetForwardScatteringFactor(const RadiationType) const;
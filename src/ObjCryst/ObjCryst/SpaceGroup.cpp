@@ -46,8 +46,10 @@ namespace ObjCryst
 #include "ObjCryst/Quirks/VFNDebug.h"
 
 // We need to force the C locale when using cctbx (when interpreting xyz strings)
+#ifdef _WIN32
 tmp_C_Numeric_locale::tmp_C_Numeric_locale()
 {
+   mThreadLocale=_configthreadlocale(_ENABLE_PER_THREAD_LOCALE);
    char *old;
    old=setlocale(LC_NUMERIC,NULL);
    mLocale=old;
@@ -57,7 +59,35 @@ tmp_C_Numeric_locale::tmp_C_Numeric_locale()
 tmp_C_Numeric_locale::~tmp_C_Numeric_locale()
 {
    setlocale(LC_NUMERIC,mLocale.c_str());
+   _configthreadlocale(mThreadLocale);
 }
+#else
+tmp_C_Numeric_locale::tmp_C_Numeric_locale()
+{// Use a per-thread locale - setlocale() would affect all threads
+   mOldLocale=(locale_t)0;
+   locale_t dup=duplocale(uselocale((locale_t)0));
+   if(dup==(locale_t)0)
+   {
+      mLocale=(locale_t)0;
+      return;
+   }
+   // On failure newlocale() leaves dup unchanged and does not free it
+   mLocale=newlocale(LC_NUMERIC_MASK,"C",dup);
+   if(mLocale==(locale_t)0)
+   {// Leave the locale unchanged
+      freelocale(dup);
+      return;
+   }
+   mOldLocale=uselocale(mLocale);
+}
+
+tmp_C_Numeric_locale::~tmp_C_Numeric_locale()
+{
+   if(mLocale==(locale_t)0) return;
+   uselocale(mOldLocale);
+   freelocale(mLocale);
+}
+#endif
 
 ////////////////////////////////////////////////////////////////////////
 //
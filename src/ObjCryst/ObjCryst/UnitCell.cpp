@@ -20,6 +20,7 @@
 *  source file ObjCryst++ Crystal class
 *
 */
+#include <mutex>
 #include "ObjCryst/ObjCryst/UnitCell.h"
 #include "ObjCryst/Quirks/VFNStreamFormat.h"
 
@@ -171,7 +172,7 @@ REAL UnitCell::GetLatticePar(int whichPar)const
    {
       const int num = mSpaceGroup.GetSpaceGroupNumber();
 
-      static CrystVector_REAL cellDim;
+      CrystVector_REAL cellDim;
       cellDim=mCellDim;
       if((num <=2)||(mConstrainLatticeToSpaceGroup.GetChoice()!=0))
          return cellDim(whichPar);
@@ -382,15 +383,13 @@ void UnitCell::InitOptions()
    static string ConstrainLatticeToSpaceGroupName;
    static string ConstrainLatticeToSpaceGroupChoices[2];
 
-   static bool needInitNames=true;
-   if(true==needInitNames)
-   {
+   static std::once_flag needInitNames;
+   std::call_once(needInitNames,[]()
+   {// Only once for the class
       ConstrainLatticeToSpaceGroupName="Constrain Lattice to SpaceGroup Symmetry";
       ConstrainLatticeToSpaceGroupChoices[0]="Yes (Default)";
       ConstrainLatticeToSpaceGroupChoices[1]="No (Allow Crystallographic Pseudo-Symmetry)";
-
-      needInitNames=false;//Only once for the class
-   }
+   });
    VFN_DEBUG_MESSAGE("UnitCell::Init(a,b,c,alpha,beta,gamma,Sg,name):Init options",5)
    mConstrainLatticeToSpaceGroup.Init(2,&ConstrainLatticeToSpaceGroupName,
                                         ConstrainLatticeToSpaceGroupChoices);
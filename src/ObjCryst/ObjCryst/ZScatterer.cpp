@@ -31,6 +31,7 @@
 //#include "ObjCryst/ObjCryst/Atom.h"
 #include "ObjCryst/ObjCryst/ZScatterer.h"
 #include "ObjCryst/ObjCryst/ScatteringData.h"
+#include "ObjCryst/RefinableObj/Random.h"
 
 #include "ObjCryst/Quirks/VFNStreamFormat.h" //simple formatting of integers, REALs..
 
@@ -308,6 +309,38 @@ ZScatterer* ZScatterer::CreateCopy() const
    VFN_DEBUG_MESSAGE("ZScatterer::CreateCopy()"<<mName<<")",5)
    return new ZScatterer(*this);
 }
+
+ZScatterer* ZScatterer::Clone(std::map<const RefinableObj*,RefinableObj*> &vCopy)const
+{
+   VFN_DEBUG_ENTRY("ZScatterer::Clone():("<<mName<<")",5)
+   Crystal *pCryst=0;
+   if(mpCryst!=0) pCryst=FindCopy(*mpCryst,vCopy);
+   if(pCryst==0)
+      throw ObjCrystException("ZScatterer::Clone(): the crystal of "+mName+" has not been copied");
+   ZScatterer *p=new ZScatterer(mName,*pCryst,mXYZ(0),mXYZ(1),mXYZ(2),mPhi,mChi,mPsi);
+   vCopy[this]=p;
+   for(long i=0;i<mZAtomRegistry.GetNb();i++)
+   {
+      const ZAtom *pAtom=&(mZAtomRegistry.GetObj(i));
+      const ScatteringPower *pPow=pAtom->GetScatteringPower();
+      if(pPow!=0)
+      {
+         const ScatteringPower *pNewPow=FindCopy(*pPow,vCopy);
+         if(pNewPow!=0) pPow=pNewPow;
+      }
+      p->AddAtom(pAtom->GetName(),pPow,
+                 pAtom->GetZBondAtom(),pAtom->GetZBondLength(),
+                 pAtom->GetZAngleAtom(),pAtom->GetZAngle(),
+                 pAtom->GetZDihedralAngleAtom(),pAtom->GetZDihedralAngle(),
+                 pAtom->GetOccupancy());
+   }
+   p->SetUseGlobalScatteringPower(mUseGlobalScattPow);
+   p->mCenterAtomIndex=mCenterAtomIndex;
+   p->m3DDisplayIndex=m3DDisplayIndex;
+   p->CopyParAndOptions(*this);
+   VFN_DEBUG_EXIT("ZScatterer::Clone():("<<mName<<")",5)
+   return p;
+}
 const string& ZScatterer::GetClassName() const
 {
    const static string className="ZScatterer";
@@ -1554,7 +1587,7 @@ void ZScatterer::GlobalOptRandomMove(const REAL mutationAmplitude,
    // give a 2% chance of either moving a single atom, or move
    // all atoms before a given torsion angle.
    // Only try this if there are more than 10 atoms (else it's not worth the speed cost)
-   if((mNbAtom>=10) && ((rand()/(REAL)RAND_MAX)<.02)
+   if((mNbAtom>=10) && (RandomUniform()<.02)
       && (gpRefParTypeScattConform->IsDescendantFromOrSameAs(type)))//.01
    {
       TAU_PROFILE_TIMER(timer1,\
@@ -1595,7 +1628,7 @@ void ZScatterer::GlobalOptRandomMove(const REAL mutationAmplitude,
       // Pick one to move and get the relevant parameter
       // (maybe we should random-move also the associated bond lengths an angles,
       // but for now we'll concentrate on dihedral (torsion) angles.
-         const int atom=dihed((int) (rand()/((REAL)RAND_MAX+1)*nbDihed));
+         const int atom=dihed((int)RandomInteger(nbDihed));
          //cout<<endl;
          VFN_DEBUG_MESSAGE("ZScatterer::GlobalOptRandomMove(): Changing atom #"<<atom ,3)
          if(atom==2)
@@ -1606,7 +1639,7 @@ void ZScatterer::GlobalOptRandomMove(const REAL mutationAmplitude,
       // Record the current conformation
          mpZMoveMinimizer->RecordConformation();
       // Set up
-         const int moveType= rand()%3;
+         const int moveType= RandomInteger(3);
          mpZMoveMinimizer->FixAllPar();
          REAL x0,y0,z0;
          //cout << " Move Type:"<<moveType<<endl;
@@ -1709,9 +1742,9 @@ void ZScatterer::GlobalOptRandomMove(const REAL mutationAmplitude,
       // not-so-random angles., and then minimize the conformation change
          mpZMoveMinimizer->SetZAtomWeight(weight);
          REAL change;
-         if( (rand()%5)==0)
+         if( RandomInteger(5)==0)
          {
-            switch(rand()%5)
+            switch(RandomInteger(5))
             {
                case 0: change=-120*DEG2RAD;break;
                case 1: change= -90*DEG2RAD;break;
@@ -1723,7 +1756,7 @@ void ZScatterer::GlobalOptRandomMove(const REAL mutationAmplitude,
          else
          {
             change= par->GetGlobalOptimStep()
-                         *2*(rand()/(REAL)RAND_MAX-0.5)*mutationAmplitude*16;
+                         *2*(RandomUniform()-0.5)*mutationAmplitude*16;
          }
       TAU_PROFILE_STOP(timer1);
          VFN_DEBUG_MESSAGE("ZScatterer::GlobalOptRandomMove(): mutation:"<<change*RAD2DEG,3)
@@ -1774,7 +1807,7 @@ void ZScatterer::GlobalOptRandomMove(const REAL mutationAmplitude,
       if(nbDihed<2) //Can't play :-(
          this->RefinableObj::GlobalOptRandomMove(mutationAmplitude);
       // Pick one
-      const int atom=dihed((int) (rand()/((REAL)RAND_MAX+1)*nbDihed));
+      const int atom=dihed((int)RandomInteger(nbDihed));
       VFN_DEBUG_MESSAGE("ZScatterer::GlobalOptRandomMove(): "<<FormatHorizVector<long>(dihed) ,10)
       VFN_DEBUG_MESSAGE("ZScatterer::GlobalOptRandomMove(): Changing atom #"<<atom ,10)
       if(atom==2)
@@ -1784,9 +1817,9 @@ void ZScatterer::GlobalOptRandomMove(const REAL mutationAmplitude,
       // Get the old value
       const REAL old=par->GetValue();
       // Move it, with a max amplitude 8x greater than usual
-      if( (rand()/(REAL)RAND_MAX)<.1)
+      if( (RandomUniform())<.1)
       {// give some probability to use certain angles: -120,-90,90,120,180
-         switch(rand()%5)
+         switch(RandomInteger(5))
          {
             case 0: par->Mutate(-120*!DEG2RAD);break;
             case 1: par->Mutate( -90*!DEG2RAD);break;
@@ -1797,7 +1830,7 @@ void ZScatterer::GlobalOptRandomMove(const REAL mutationAmplitude,
       }
       else
          par->Mutate( par->GetGlobalOptimStep()
-                      *2*(rand()/(REAL)RAND_MAX-0.5)*mutationAmplitude*8);
+                      *2*(RandomUniform()-0.5)*mutationAmplitude*8);
       const REAL change=mZAtomRegistry.GetObj(atom).GetZDihedralAngle()-old;
       // Now move all atoms using this changed bond as a reference
       //const int atom2=   mZAtomRegistry.GetObj(atom).GetZAngleAtom();
@@ -209,6 +209,8 @@ class ZScatterer: public Scatterer
       /// \internal so-called Virtual copy constructor, needed to make copies
       /// of arrays of Scatterers
       virtual ZScatterer* CreateCopy() const;
+      /// Clone the ZScatterer. A ZPolyhedron is copied as a ZScatterer, as in XMLOutput().
+      virtual ZScatterer* Clone(std::map<const RefinableObj*,RefinableObj*> &vCopy)const;
       virtual const string& GetClassName() const;
       /// Add an atom to the Zscatterer. If &ScatteringPower=0, then it is a 'dummy'
       /// atom and will be ignored for any scattering analysis. The 'name' supplied may
@@ -28,6 +28,7 @@
 #include "ObjCryst/ObjCryst/PowderPattern.h"
 #include "ObjCryst/RefinableObj/GlobalOptimObj.h"
 #include "ObjCryst/Quirks/VFNStreamFormat.h"
+#include "ObjCryst/Quirks/Chronometer.h"
 
 namespace ObjCryst
 {
@@ -172,4 +173,31 @@ SpeedTestReport SpeedTest(const unsigned int nbAtom, const int nbAtomType,const
    delete pData;
    return report;
 }
+
+REAL DistTableSpeedTest(const unsigned int nbAtom,const string spacegroup,
+                        const REAL bumpDistance,const REAL time)
+{
+   const REAL a=pow(20.*nbAtom*SpaceGroup(spacegroup).GetNbSymmetrics(),1./3.);
+   Crystal cryst(a*.9,a,a*1.1,spacegroup);
+   ScatteringPowerAtom *pScattPow=new ScatteringPowerAtom("O","O",1.5);
+   cryst.AddScatteringPower(pScattPow);
+   for(unsigned int i = 0; i < nbAtom; ++i)
+      cryst.AddScatterer(new Atom((REAL)rand()/RAND_MAX,(REAL)rand()/RAND_MAX,(REAL)rand()/RAND_MAX,
+                                  "O",pScattPow,1.));
+   cryst.SetBumpMergeDistance(*pScattPow,*pScattPow,bumpDistance);
+   cryst.BeginOptimization();
+   Chronometer chrono;
+   chrono.start();
+   unsigned long nb=0;
+   while(chrono.seconds()<time)
+   {
+      for(unsigned int i = 0; i < nbAtom; ++i)
+         cryst.GetScatt(i).GetPar("x").Mutate((nb%2)?0.001:-0.001);
+      cryst.GetBumpMergeCost();
+      ++nb;
+   }
+   const REAL t=chrono.seconds();
+   cryst.EndOptimization();
+   return nb/t;
+}
 }
@@ -67,5 +67,21 @@ SpeedTestReport SpeedTest(const unsigned int nbAtom, const int nbAtomType,const
                           const RadiationType radiation, const unsigned long nbReflections,
                           const unsigned int dataType,const REAL time);
 
+/** Speed test for the computation of the interatomic distance table of a Crystal,
+* which is used by the bump-merge and bond valence costs, and the dynamical
+* occupancy correction.
+*
+* Atoms are placed randomly in a cell with a volume of 20 A^3 per atom (including
+* symmetrics), and moved before each evaluation of the bump-merge cost.
+* \param nbAtom: total number of unique atoms.
+* \param spacegroup: the symbol or spacegroup number for the spacegroup to be tested.
+* \param bumpDistance: the anti-bump distance, which is also the maximum distance
+* in the distance table.
+* \param time: duration of the test.
+* \return the number of distance tables computed per second.
+*/
+REAL DistTableSpeedTest(const unsigned int nbAtom,const string spacegroup,
+                        const REAL bumpDistance,const REAL time);
+
 }
 #endif
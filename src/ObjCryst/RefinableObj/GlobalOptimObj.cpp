@@ -24,6 +24,8 @@
 
 #include "ObjCryst/RefinableObj/GlobalOptimObj.h"
 #include "ObjCryst/ObjCryst/Crystal.h"
+#include "ObjCryst/ObjCryst/DiffractionDataSingleCrystal.h"
+#include "ObjCryst/ObjCryst/PowderPattern.h"
 #include "ObjCryst/Quirks/VFNStreamFormat.h"
 #include "ObjCryst/Quirks/VFNDebug.h"
 #include "ObjCryst/Quirks/Chronometer.h"
@@ -41,8 +43,27 @@
 #include <fstream>
 #include <sstream>
 #include <stdio.h>
+#include <limits>
+#include <memory>
+#include <thread>
+#include <mutex>
+#include <chrono>
+#include <exception>
+#include <cstdint>
 #include <boost/format.hpp>
 
+#if defined(__unix__) || defined(__APPLE__)
+   #define OBJCRYST_FORK
+   #include <unistd.h>
+   #include <sys/mman.h>
+   #include <sys/wait.h>
+   #if defined(__linux__)
+      #include <dirent.h>
+   #elif defined(__APPLE__)
+      #include <mach/mach.h>
+   #endif
+#endif
+
 namespace ObjCryst
 {
 void CompareWorlds(const CrystVector_long &idx,const CrystVector_long &swap, const RefinableObj &obj)
@@ -63,7 +84,34 @@ void CompareWorlds(const CrystVector_long &idx,const CrystVector_long &swap, con
 //       OptimizationObj
 //
 //#################################################################################
-ObjRegistry<OptimizationObj> gOptimizationObjRegistry("List of all Optimization objects");
+ObjRegistry<OptimizationObj> gOptimizationObjRegistry("List of all Optimization objects",true);
+
+/** Enable the Profiler during an optimization if the "Profiling" option is set,
+* and store the recorded statistics when the optimization ends.
+*/
+class OptimizationProfileScope
+{
+   public:
+      OptimizationProfileScope(const RefObjOpt &opt,std::vector<ProfileStats> &vStats):
+      mpStats(0)
+      {
+         if(opt.GetChoice()==0) return;
+         Profiler::Begin();
+         mpStats=&vStats;
+      }
+      ~OptimizationProfileScope()
+      {
+         if(mpStats==0) return;
+         *mpStats=Profiler::GetStats();
+         Profiler::End();
+      }
+   private:
+      std::vector<ProfileStats> *mpStats;
+};
+
+OptimizationProgress::OptimizationProgress():
+mRun(0),mNbTrial(0),mBestCost(-1),mRunBestCost(-1),mCurrentCost(-1),mAcceptRate(-1),mElapsedTime(0)
+{}
 
 OptimizationObj::OptimizationObj():
 mName(""),mSaveFileName("GlobalOptim.save"),
@@ -73,19 +121,13 @@ mContext(0),
 mIsOptimizing(false),mStopAfterCycle(false),
 mRefinedObjList("OptimizationObj: "+mName+" RefinableObj registry"),
 mRecursiveRefinedObjList("OptimizationObj: "+mName+" recursive RefinableObj registry"),
-mLastOptimTime(0)
+mLastOptimTime(0),mRandomIsSeeded(false),mProgressInterval(1),mpAsyncOptimization(0)
 {
    VFN_DEBUG_ENTRY("OptimizationObj::OptimizationObj()",5)
    // This must be done in a real class to avoid calling a pure virtual method
    // if a graphical representation is automatically called upon registration.
    //  gOptimizationObjRegistry.Register(*this);
 
-   static bool need_initRandomSeed=true;
-   if(need_initRandomSeed==true)
-   {
-      srand(time(NULL));
-      need_initRandomSeed=false;
-   }
    // We only copy parameters, so do not delete them !
    mRefParList.SetDeleteRefParInDestructor(false);
    VFN_DEBUG_EXIT("OptimizationObj::OptimizationObj()",5)
@@ -99,19 +141,13 @@ mContext(0),
 mIsOptimizing(false),mStopAfterCycle(false),
 mRefinedObjList("OptimizationObj: "+mName+" RefinableObj registry"),
 mRecursiveRefinedObjList("OptimizationObj: "+mName+" recursive RefinableObj registry"),
-mLastOptimTime(0)
+mLastOptimTime(0),mRandomIsSeeded(false),mProgressInterval(1),mpAsyncOptimization(0)
 {
    VFN_DEBUG_ENTRY("OptimizationObj::OptimizationObj()",5)
    // This must be done in a real class to avoid calling a pure virtual method
    // if a graphical representation is automatically called upon registration.
    //  gOptimizationObjRegistry.Register(*this);
 
-   static bool need_initRandomSeed=true;
-   if(need_initRandomSeed==true)
-   {
-      srand(time(NULL));
-      need_initRandomSeed=false;
-   }
    // We only copy parameters, so do not delete them !
    mRefParList.SetDeleteRefParInDestructor(false);
    VFN_DEBUG_EXIT("OptimizationObj::OptimizationObj()",5)
@@ -125,19 +161,13 @@ mContext(0),
 mIsOptimizing(false),mStopAfterCycle(false),
 mRefinedObjList("OptimizationObj: "+mName+" RefinableObj registry"),
 mRecursiveRefinedObjList("OptimizationObj: "+mName+" recursive RefinableObj registry"),
-mLastOptimTime(0)
+mLastOptimTime(0),mRandomIsSeeded(false),mProgressInterval(1),mpAsyncOptimization(0)
 {
    VFN_DEBUG_ENTRY("OptimizationObj::OptimizationObj(&old)",5)
    // This must be done in a real class to avoid calling a pure virtual method
    // if a graphical representation is automatically called upon registration.
    //  gOptimizationObjRegistry.Register(*this);
 
-   static bool need_initRandomSeed=true;
-   if(need_initRandomSeed==true)
-   {
-      srand(time(NULL));
-      need_initRandomSeed=false;
-   }
    // We only copy parameters, so do not delete them !
    mRefParList.SetDeleteRefParInDestructor(false);
 
@@ -157,6 +187,8 @@ OptimizationObj::~OptimizationObj()
 void OptimizationObj::RandomizeStartingConfig()
 {
    VFN_DEBUG_ENTRY("OptimizationObj::RandomizeStartingConfig()",5)
+   this->InitRandomGenerator();
+   RandomGenerator::Scope randomScope(mRandom);
    this->PrepareRefParList();
    for(int j=0;j<mRefParList.GetNbParNotFixed();j++)
    {
@@ -164,11 +196,11 @@ void OptimizationObj::RandomizeStartingConfig()
       {
          const REAL min=mRefParList.GetParNotFixed(j).GetMin();
          const REAL max=mRefParList.GetParNotFixed(j).GetMax();
-         mRefParList.GetParNotFixed(j).MutateTo(min+(max-min)*(rand()/(REAL)RAND_MAX) );
+         mRefParList.GetParNotFixed(j).MutateTo(min+(max-min)*RandomUniform() );
       }
       else if(true==mRefParList.GetParNotFixed(j).IsPeriodic())
              mRefParList.GetParNotFixed(j).
-                Mutate(mRefParList.GetParNotFixed(j).GetPeriod()*rand()/(REAL)RAND_MAX);
+                Mutate(mRefParList.GetParNotFixed(j).GetPeriod()*RandomUniform());
    }
       //else cout << mRefParList.GetParNotFixed(j).Name() <<" Not limited :-(" <<endl;
    VFN_DEBUG_EXIT("OptimizationObj::RandomizeStartingConfig()",5)
@@ -249,7 +281,12 @@ REAL OptimizationObj::GetLogLikelihood() const
    REAL cost =0.;
    for(int i=0;i<mRecursiveRefinedObjList.GetNb();i++)
    {
-      const REAL tmp=mRecursiveRefinedObjList.GetObj(i).GetLogLikelihood();
+      static const unsigned int profileRegion=Profiler::RegisterRegion("GetLogLikelihood");
+      REAL tmp;
+      {
+         ProfileScope profileScope(profileRegion,&(mRecursiveRefinedObjList.GetObj(i)));
+         tmp=mRecursiveRefinedObjList.GetObj(i).GetLogLikelihood();
+      }
       if(tmp!=0.)
       {
          LogLikelihoodStats* st=&((mvContextObjStats[mContext])
@@ -327,6 +364,16 @@ REAL OptimizationObj::GetLastOptimElapsedTime()const
    return mLastOptimTime;
 }
 
+const std::vector<ProfileStats>& OptimizationObj::GetProfileStats()const
+{
+   return mvProfileStats;
+}
+
+void OptimizationObj::ProfileJSONOutput(ostream &os)const
+{
+   ProfileStatsJSONOutput(os,mvProfileStats,mLastOptimTime);
+}
+
 MainTracker& OptimizationObj::GetMainTracker(){return mMainTracker;}
 
 const MainTracker& OptimizationObj::GetMainTracker()const{return mMainTracker;}
@@ -438,6 +485,93 @@ void OptimizationObj::RestoreParamSet(const unsigned int i, const bool update_di
    if(update_display) this->UpdateDisplay();
 }
 
+void OptimizationObj::SetSeed(const unsigned long seed)
+{
+   mRandom.Seed(seed);
+   mRandomIsSeeded=true;
+}
+
+unsigned long OptimizationObj::GetSeed()const {return mRandom.GetSeed();}
+
+RandomGenerator& OptimizationObj::GetRandomGenerator() {return mRandom;}
+
+void OptimizationObj::InitRandomGenerator()
+{
+   if(!mRandomIsSeeded) this->SetSeed(RandomSeed());
+}
+
+void OptimizationObj::SetProgressCallback(const OptimizationProgressCallback &callback,
+                                          const REAL interval)
+{
+   mProgressCallback=callback;
+   mProgressInterval=interval;
+}
+
+void OptimizationObj::InitProgress()
+{
+   mProgressStart=std::chrono::steady_clock::now();
+   mLastProgressTime=mProgressStart;
+}
+
+void OptimizationObj::ReportProgress(const REAL runBestCost,const REAL currentCost,
+                                     const REAL acceptRate)
+{
+   if(!mProgressCallback) return;
+   const std::chrono::steady_clock::time_point now=std::chrono::steady_clock::now();
+   if(std::chrono::duration<REAL>(now-mLastProgressTime).count()<mProgressInterval) return;
+   mLastProgressTime=now;
+   OptimizationProgress p;
+   p.mRun=mRun;
+   p.mNbTrial=mNbTrial;
+   p.mBestCost=mBestCost;
+   p.mRunBestCost=runBestCost;
+   p.mCurrentCost=currentCost;
+   p.mAcceptRate=acceptRate;
+   p.mElapsedTime=std::chrono::duration<REAL>(now-mProgressStart).count();
+   mProgressCallback(p);
+}
+
+std::unique_ptr<AsyncOptimization> OptimizationObj::OptimizeAsync(const long nbSteps,const bool silent,
+                                                                  const REAL finalcost,const REAL maxTime,
+                                                                  const OptimizationProgressCallback &callback,
+                                                                  const REAL interval)
+{
+   VFN_DEBUG_MESSAGE("OptimizationObj::OptimizeAsync()",5)
+   std::unique_ptr<AsyncOptimization> pAsync(new AsyncOptimization(*this,callback,interval));
+   pAsync->Start([this,nbSteps,silent,finalcost,maxTime]()
+   {
+      long nbStep=nbSteps;
+      this->Optimize(nbStep,silent,finalcost,maxTime);
+      OptimizationResult r;
+      r.mBestCost=mBestCost;
+      r.mNbTrial=nbSteps-nbStep;
+      r.mNbRun=1;
+      return r;
+   });
+   return pAsync;
+}
+
+std::unique_ptr<AsyncOptimization> OptimizationObj::MultiRunOptimizeAsync(const long nbCycle,const long nbSteps,
+                                                                          const bool silent,const REAL finalcost,
+                                                                          const REAL maxTime,
+                                                                          const OptimizationProgressCallback &callback,
+                                                                          const REAL interval)
+{
+   VFN_DEBUG_MESSAGE("OptimizationObj::MultiRunOptimizeAsync()",5)
+   std::unique_ptr<AsyncOptimization> pAsync(new AsyncOptimization(*this,callback,interval));
+   pAsync->Start([this,nbCycle,nbSteps,silent,finalcost,maxTime]()
+   {
+      long nbCycle1=nbCycle,nbStep=nbSteps;
+      this->MultiRunOptimize(nbCycle1,nbStep,silent,finalcost,maxTime);
+      OptimizationResult r;
+      r.mBestCost=mBestCost;
+      r.mNbTrial=mNbTrial;
+      r.mNbRun=nbCycle-nbCycle1;
+      return r;
+   });
+   return pAsync;
+}
+
 void OptimizationObj::PrepareRefParList()
 {
    VFN_DEBUG_ENTRY("OptimizationObj::PrepareRefParList()",6)
@@ -499,10 +633,12 @@ void OptimizationObj::InitOptions()
    VFN_DEBUG_MESSAGE("OptimizationObj::InitOptions()",5)
    static string xmlAutoSaveName;
    static string xmlAutoSaveChoices[6];
+   static string profilingName;
+   static string profilingChoices[2];
 
-   static bool needInitNames=true;
-   if(true==needInitNames)
-   {
+   static std::once_flag needInitNames;
+   std::call_once(needInitNames,[]()
+   {// Only once for the class
       xmlAutoSaveName="Save Best Config Regularly";
       xmlAutoSaveChoices[0]="No";
       xmlAutoSaveChoices[1]="Every day";
@@ -511,10 +647,14 @@ void OptimizationObj::InitOptions()
       xmlAutoSaveChoices[4]="Every new best config (a lot ! Not Recommended !)";
       xmlAutoSaveChoices[5]="Every Run (Recommended)";
 
-      needInitNames=false;//Only once for the class
-   }
+      profilingName="Profiling";
+      profilingChoices[0]="No";
+      profilingChoices[1]="Yes (time per object and region)";
+   });
    mXMLAutoSave.Init(6,&xmlAutoSaveName,xmlAutoSaveChoices);
    this->AddOption(&mXMLAutoSave);
+   mProfiling.Init(2,&profilingName,profilingChoices);
+   this->AddOption(&mProfiling);
    VFN_DEBUG_MESSAGE("OptimizationObj::InitOptions():End",5)
 }
 
@@ -549,17 +689,370 @@ void OptimizationObj::AddOption(RefObjOpt *opt)
    VFN_DEBUG_EXIT("OptimizationObj::AddOption()",5)
 }
 
+//#################################################################################
+//
+//       AsyncOptimization
+//
+//#################################################################################
+OptimizationResult::OptimizationResult():
+mBestCost(-1),mNbTrial(0),mNbRun(0),mElapsedTime(0),mCancelled(false)
+{}
+
+AsyncOptimization::AsyncOptimization(OptimizationObj &opt,const OptimizationProgressCallback &callback,
+                                     const REAL interval):
+mpOptObj(&opt),mCallback(callback),mPreviousCallback(opt.mProgressCallback),
+mPreviousInterval(opt.mProgressInterval),mCancelled(false),mFinished(false),
+mFuture(mPromise.get_future().share())
+{
+   if(opt.IsOptimizing()||(opt.mpAsyncOptimization!=0))
+      throw ObjCrystException("OptimizationObj::OptimizeAsync(): an optimization is already running for "
+                              +opt.GetName());
+   opt.mpAsyncOptimization=this;
+   opt.SetProgressCallback([this](const OptimizationProgress &p){this->OnProgress(p);},interval);
+}
+
+AsyncOptimization::~AsyncOptimization()
+{
+   if(mThread.joinable())
+   {
+      this->Cancel();
+      mThread.join();
+   }
+}
+
+void AsyncOptimization::Cancel()
+{
+   mCancelled.store(true);
+   // Ignored if the optimization has not begun yet, in which case mCancelled
+   // is checked when it begins.
+   mpOptObj->StopAfterCycle();
+}
+
+bool AsyncOptimization::IsCancelled()const {return mCancelled.load();}
+
+bool AsyncOptimization::IsFinished()const {return mFinished.load();}
+
+OptimizationProgress AsyncOptimization::GetProgress()const
+{
+   std::lock_guard<std::mutex> lock(mMutex);
+   return mProgress;
+}
+
+std::shared_future<OptimizationResult> AsyncOptimization::GetFuture()const {return mFuture;}
+
+OptimizationResult AsyncOptimization::Wait()
+{
+   if(mThread.joinable()) mThread.join();
+   return mFuture.get();
+}
+
+OptimizationObj& AsyncOptimization::GetOptimizationObj() {return *mpOptObj;}
+
+void AsyncOptimization::Start(const std::function<OptimizationResult()> &f)
+{
+   mThread=std::thread([this,f]()
+   {
+      const std::chrono::steady_clock::time_point t0=std::chrono::steady_clock::now();
+      try
+      {
+         OptimizationResult r;
+         if(!mCancelled.load()) r=f();
+         r.mElapsedTime=std::chrono::duration<REAL>(std::chrono::steady_clock::now()-t0).count();
+         r.mCancelled=mCancelled.load();
+         {
+            std::lock_guard<std::mutex> lock(mMutex);
+            mProgress.mBestCost=r.mBestCost;
+            mProgress.mElapsedTime=r.mElapsedTime;
+         }
+         mpOptObj->SetProgressCallback(mPreviousCallback,mPreviousInterval);
+         mpOptObj->mpAsyncOptimization=0;
+         mFinished.store(true);
+         mPromise.set_value(r);
+      }
+      catch(...)
+      {
+         mpOptObj->SetProgressCallback(mPreviousCallback,mPreviousInterval);
+         mpOptObj->mpAsyncOptimization=0;
+         mFinished.store(true);
+         mPromise.set_exception(std::current_exception());
+      }
+   });
+}
+
+void AsyncOptimization::OnProgress(const OptimizationProgress &p)
+{
+   {
+      std::lock_guard<std::mutex> lock(mMutex);
+      mProgress=p;
+   }
+   if(mCallback) mCallback(p);
+}
+
 //#################################################################################
 //
 //       MonteCarloObj
 //
 //#################################################################################
+/** \internal Duplicate the Crystal, DiffractionDataSingleCrystal and PowderPattern objects
+* from a list of objects, for MonteCarloObj::CloneGraph().
+*
+* The objects are copied using their Clone() methods. The crystals are copied first,
+* so that the copies of the diffraction data use the copied crystals. A crystal which
+* is used by the diffraction data but is not in the list is also copied.
+* The observed data and reflections are shared with the original objects.
+*
+* \param vObj: the list of objects to copy (other types of objects are ignored)
+* \param vCopy: for each copied object (and its scatterers, scattering powers and
+* powder pattern components), the new object
+* \param vNew: the list of new objects, in the order they were created
+*/
+static void DuplicateRefinedObjects(const ObjRegistry<RefinableObj> &vObj,
+                                    map<const RefinableObj*,RefinableObj*> &vCopy,
+                                    vector<RefinableObj*> &vNew)
+{
+   VFN_DEBUG_ENTRY("DuplicateRefinedObjects()",5)
+   for(int i=0;i<vObj.GetNb();i++)
+   {
+      const Crystal *pCryst=dynamic_cast<const Crystal*>(&(vObj.GetObj(i)));
+      if((pCryst==0)||(vCopy.find(pCryst)!=vCopy.end())) continue;
+      vNew.push_back(pCryst->Clone(vCopy));
+   }
+   for(int i=0;i<vObj.GetNb();i++)
+   {
+      const RefinableObj *pObj=&(vObj.GetObj(i));
+      if(vCopy.find(pObj)!=vCopy.end()) continue;
+      const DiffractionDataSingleCrystal *pData=dynamic_cast<const DiffractionDataSingleCrystal*>(pObj);
+      if(pData!=0)
+      {
+         if(pData->HasCrystal()&&(vCopy.find(&(pData->GetCrystal()))==vCopy.end()))
+            vNew.push_back(pData->GetCrystal().Clone(vCopy));
+         vNew.push_back(pData->Clone(vCopy));
+         continue;
+      }
+      const PowderPattern *pPowder=dynamic_cast<const PowderPattern*>(pObj);
+      if(pPowder==0) continue;
+      for(unsigned int j=0;j<pPowder->GetNbPowderPatternComponent();j++)
+      {
+         const PowderPatternDiffraction *pDiff
+            =dynamic_cast<const PowderPatternDiffraction*>(&(pPowder->GetPowderPatternComponent(j)));
+         if((pDiff!=0)&&pDiff->HasCrystal()&&(vCopy.find(&(pDiff->GetCrystal()))==vCopy.end()))
+            vNew.push_back(pDiff->GetCrystal().Clone(vCopy));
+      }
+      vNew.push_back(pPowder->Clone(vCopy));
+   }
+   // The copies must not appear in the global lists (e.g. when saving all objects)
+   for(vector<RefinableObj*>::iterator pos=vNew.begin();pos!=vNew.end();++pos)
+   {
+      if((*pos)->GetClassName()=="Crystal") gCrystalRegistry.DeRegister(*dynamic_cast<Crystal*>(*pos));
+      if((*pos)->GetClassName()=="PowderPattern") gPowderPatternRegistry.DeRegister(*dynamic_cast<PowderPattern*>(*pos));
+      if((*pos)->GetClassName()=="DiffractionDataSingleCrystal")
+         gDiffractionDataSingleCrystalRegistry.DeRegister(*dynamic_cast<DiffractionDataSingleCrystal*>(*pos));
+      gTopRefinableObjRegistry.DeRegister(**pos);
+   }
+   VFN_DEBUG_EXIT("DuplicateRefinedObjects()",5)
+}
+
+/// \internal Are the two lists of parameters identical (same number and names) ?
+static bool SameParList(const RefinableObj &a,const RefinableObj &b)
+{
+   if(a.GetNbPar()!=b.GetNbPar()) return false;
+   for(long i=0;i<a.GetNbPar();i++) if(a.GetPar(i).GetName()!=b.GetPar(i).GetName()) return false;
+   return true;
+}
+
+/** \internal Copy of the refined objects and of the optimization object,
+* used by one thread for multi-threaded optimizations.
+*/
+struct MonteCarloObj::ThreadCopy
+{
+   ThreadCopy():mpOptObj(0),mOptimizationBegun(false),mParSetIndex(-1){}
+   ~ThreadCopy()
+   {
+      if(mpOptObj!=0)
+      {
+         if(mOptimizationBegun) mpOptObj->EndOptimization();
+         delete mpOptObj;
+      }
+   }
+   /** Copy the objects refined by an optimization object, and create an (unregistered)
+   * optimization object with the same settings, using the copies (see CloneGraph()).
+   *
+   * Files are never saved automatically by the new optimization object, and it
+   * only uses one thread.
+   * \throw ObjCrystException if one of the refined objects cannot be copied.
+   */
+   void Init(const MonteCarloObj &opt)
+   {
+      mpOptObj=opt.CloneGraph();
+      mpOptObj->mXMLAutoSave.SetChoice(0);
+      mpOptObj->mSaveTrackedData.SetChoice(0);
+      mpOptObj->mNbThread=1;
+      mpOptObj->mNbParallelRun=1;
+      mpOptObj->mNbProcess=1;
+      mpOptObj->mDelayedAcceptance.SetChoice(0);
+      mpOptObj->mProfiling.SetChoice(0);
+   }
+   /// Optimization object, using the copied objects (which it owns)
+   MonteCarloObj *mpOptObj;
+   /// Has BeginOptimization() been called for mpOptObj ?
+   bool mOptimizationBegun;
+   /// Index of a parameter set used by the thread
+   long mParSetIndex;
+   /// Exception thrown by the thread, if any
+   std::exception_ptr mException;
+};
+
+/** \internal Content of a binary checkpoint: a list of named arrays of values,
+* all stored in double precision (integers are stored exactly up to 2^53).
+*
+* File format (native byte order): the "ObjCrystCkpt" magic string, the format
+* version and a byte order mark (uint32), the number of arrays (uint64), then for
+* each array the length of its name (uint64), its name, the number of values
+* (uint64) and the values.
+*/
+struct MonteCarloObj::Checkpoint
+{
+   void Set(const string &name,const double v) {mData[name].assign(1,v);}
+   void Set(const string &name,const double *p,const long nb) {mData[name].assign(p,p+nb);}
+   void Set(const string &name,const int *p,const long nb) {mData[name].assign(p,p+nb);}
+   template<class T> void Set(const string &name,const CrystVector<T> &v)
+   {
+      vector<double> *d=&(mData[name]);
+      d->resize(v.numElements());
+      for(long i=0;i<v.numElements();i++) (*d)[i]=v(i);
+   }
+   /// Get an array, which must have nb values if nb>0
+   /// \throw ObjCrystException if the array is missing or has the wrong size
+   const vector<double>& Get(const string &name,const long nb=0)const
+   {
+      map<string,vector<double> >::const_iterator pos=mData.find(name);
+      if(pos==mData.end())
+         throw ObjCrystException("MonteCarloObj::Checkpoint: missing value: "+name);
+      if((nb>0)&&(pos->second.size()!=(size_t)nb))
+         throw ObjCrystException("MonteCarloObj::Checkpoint: wrong number of values for: "+name);
+      return pos->second;
+   }
+   double GetValue(const string &name)const {return this->Get(name,1)[0];}
+   /// Store the state of a random number generator, as 32-bit halves (exactly
+   /// represented by doubles). If append=true, add it after the previously stored ones.
+   void SetRandomState(const string &name,const RandomGenerator &gen,const bool append=false)
+   {
+      uint64_t state[4];
+      gen.GetState(state);
+      vector<double> *d=&(mData[name]);
+      if(!append) d->clear();
+      for(int k=0;k<4;k++)
+      {
+         d->push_back((double)(state[k]>>32));
+         d->push_back((double)(state[k]&0xffffffffULL));
+      }
+   }
+   /// Restore the state of the i-th random number generator stored under a name
+   /// \throw ObjCrystException if it is missing
+   void GetRandomState(const string &name,RandomGenerator &gen,const unsigned int i=0)const
+   {
+      const vector<double> *d=&(this->Get(name));
+      if(d->size()<8*(size_t)(i+1))
+         throw ObjCrystException("MonteCarloObj::Checkpoint: wrong number of values for: "+name);
+      uint64_t state[4];
+      for(int k=0;k<4;k++)
+         state[k]=(((uint64_t)(*d)[8*i+2*k])<<32)|((uint64_t)(*d)[8*i+2*k+1]);
+      gen.SetState(state);
+   }
+   void Get(const string &name,double *p,const long nb)const
+   {
+      const vector<double> *d=&(this->Get(name,nb));
+      for(long i=0;i<nb;i++) p[i]=(*d)[i];
+   }
+   void Get(const string &name,int *p,const long nb)const
+   {
+      const vector<double> *d=&(this->Get(name,nb));
+      for(long i=0;i<nb;i++) p[i]=(int)(*d)[i];
+   }
+   template<class T> void Get(const string &name,CrystVector<T> &v,const long nb=0)const
+   {
+      const vector<double> *d=&(this->Get(name,nb));
+      v.resize(d->size());
+      for(long i=0;i<v.numElements();i++) v(i)=(T)(*d)[i];
+   }
+   /// Write the checkpoint to a temporary file, then rename it.
+   void Save(const string &fileName)const
+   {
+      const string tmpName=fileName+".tmp";
+      ofstream out(tmpName.c_str(),ios::out|ios::binary|ios::trunc);
+      if(!out) throw ObjCrystException("MonteCarloObj::Checkpoint: cannot open file: "+tmpName);
+      out.write(mMagic,sizeof(mMagic));
+      const uint32_t version=mVersion,bom=mByteOrderMark;
+      out.write((const char*)&version,sizeof(version));
+      out.write((const char*)&bom,sizeof(bom));
+      const uint64_t nbArray=mData.size();
+      out.write((const char*)&nbArray,sizeof(nbArray));
+      for(map<string,vector<double> >::const_iterator pos=mData.begin();pos!=mData.end();++pos)
+      {
+         const uint64_t nameLength=pos->first.size(),nb=pos->second.size();
+         out.write((const char*)&nameLength,sizeof(nameLength));
+         out.write(pos->first.c_str(),nameLength);
+         out.write((const char*)&nb,sizeof(nb));
+         if(nb>0) out.write((const char*)&(pos->second[0]),nb*sizeof(double));
+      }
+      out.close();
+      if(out.fail()) throw ObjCrystException("MonteCarloObj::Checkpoint: error writing file: "+tmpName);
+      #ifdef _WIN32
+      remove(fileName.c_str());
+      #endif
+      if(rename(tmpName.c_str(),fileName.c_str())!=0)
+         throw ObjCrystException("MonteCarloObj::Checkpoint: cannot rename "+tmpName+" to "+fileName);
+   }
+   void Load(const string &fileName)
+   {
+      ifstream in(fileName.c_str(),ios::in|ios::binary);
+      if(!in) throw ObjCrystException("MonteCarloObj::Checkpoint: cannot open file: "+fileName);
+      char magic[sizeof(mMagic)];
+      uint32_t version=0,bom=0;
+      in.read(magic,sizeof(magic));
+      in.read((char*)&version,sizeof(version));
+      in.read((char*)&bom,sizeof(bom));
+      if(in.fail()||(string(magic,sizeof(magic))!=string(mMagic,sizeof(mMagic))))
+         throw ObjCrystException("MonteCarloObj::Checkpoint: not a checkpoint file: "+fileName);
+      if(version!=mVersion)
+         throw ObjCrystException("MonteCarloObj::Checkpoint: unsupported checkpoint version: "+fileName);
+      if(bom!=mByteOrderMark)
+         throw ObjCrystException("MonteCarloObj::Checkpoint: file written with a different byte order: "+fileName);
+      mData.clear();
+      uint64_t nbArray=0;
+      in.read((char*)&nbArray,sizeof(nbArray));
+      for(uint64_t i=0;(i<nbArray)&&in.good();i++)
+      {
+         uint64_t nameLength=0,nb=0;
+         in.read((char*)&nameLength,sizeof(nameLength));
+         if(!in.good()||(nameLength>4096)) break;
+         string name(nameLength,' ');
+         in.read(&name[0],nameLength);
+         in.read((char*)&nb,sizeof(nb));
+         if(!in.good()) break;
+         vector<double> *d=&(mData[name]);
+         d->resize(nb);
+         if(nb>0) in.read((char*)&((*d)[0]),nb*sizeof(double));
+      }
+      if(in.fail()||(mData.size()!=nbArray))
+         throw ObjCrystException("MonteCarloObj::Checkpoint: truncated or corrupted file: "+fileName);
+   }
+   map<string,vector<double> > mData;
+   static const char mMagic[12];
+   static const uint32_t mVersion=1;
+   static const uint32_t mByteOrderMark=0x01020304;
+};
+const char MonteCarloObj::Checkpoint::mMagic[12]={'O','b','j','C','r','y','s','t','C','k','p','t'};
+
 MonteCarloObj::MonteCarloObj():
 OptimizationObj(""),
 mCurrentCost(-1),
 mTemperatureMax(1e6),mTemperatureMin(.001),mTemperatureGamma(1.0),
 mMutationAmplitudeMax(8.),mMutationAmplitudeMin(.125),mMutationAmplitudeGamma(1.0),
-mNbTrialRetry(0),mMinCostRetry(0),mParticles(160),mFormerSpeed(0.721),mFormerMinima(1.193),mNeighbourhood(3) //// doladit pocet castic
+mNbTrialRetry(0),mMinCostRetry(0),mNbWorld(30),mNbTrialPerWorld(10),mNbThread(1),mNbParallelRun(1),mNbProcess(1),
+mDelayedAcceptanceMaxSinThetaOvLambda(0.25),
+mCheckpointInterval(600),mCheckpointNbTrial(0),mpCheckpoint(0),
+mParticles(160),mFormerSpeed(0.721),mFormerMinima(1.193),mNeighbourhood(3) //// doladit pocet castic
 #ifdef __WX__CRYST__
 ,mpWXCrystObj(0)
 #endif
@@ -580,7 +1073,10 @@ OptimizationObj(name),
 mCurrentCost(-1),
 mTemperatureMax(1e6),mTemperatureMin(.001),mTemperatureGamma(1.0),
 mMutationAmplitudeMax(8.),mMutationAmplitudeMin(.125),mMutationAmplitudeGamma(1.0),
-mNbTrialRetry(0),mMinCostRetry(0), mParticles(160), mFormerSpeed(0.721), mFormerMinima(1.193), mNeighbourhood(3)
+mNbTrialRetry(0),mMinCostRetry(0),mNbWorld(30),mNbTrialPerWorld(10),mNbThread(1),mNbParallelRun(1),mNbProcess(1),
+mDelayedAcceptanceMaxSinThetaOvLambda(0.25),
+mCheckpointInterval(600),mCheckpointNbTrial(0),mpCheckpoint(0),
+mParticles(160), mFormerSpeed(0.721), mFormerMinima(1.193), mNeighbourhood(3)
 #ifdef __WX__CRYST__
 ,mpWXCrystObj(0)
 #endif
@@ -603,7 +1099,12 @@ mTemperatureMax(old.mTemperatureMax),mTemperatureMin(old.mTemperatureMin),
 mTemperatureGamma(old.mTemperatureGamma),
 mMutationAmplitudeMax(old.mMutationAmplitudeMax),mMutationAmplitudeMin(old.mMutationAmplitudeMin),
 mMutationAmplitudeGamma(old.mMutationAmplitudeGamma),
-mNbTrialRetry(old.mNbTrialRetry),mMinCostRetry(old.mMinCostRetry), mParticles(old.mParticles), mFormerSpeed(old.mFormerSpeed), mFormerMinima(old.mFormerMinima), mNeighbourhood(old.mNeighbourhood)
+mNbTrialRetry(old.mNbTrialRetry),mMinCostRetry(old.mMinCostRetry),
+mNbWorld(old.mNbWorld),mNbTrialPerWorld(old.mNbTrialPerWorld),mNbThread(old.mNbThread),
+mNbParallelRun(old.mNbParallelRun),mNbProcess(old.mNbProcess),
+mDelayedAcceptanceMaxSinThetaOvLambda(old.mDelayedAcceptanceMaxSinThetaOvLambda),
+mCheckpointInterval(old.mCheckpointInterval),mCheckpointNbTrial(old.mCheckpointNbTrial),mpCheckpoint(0),
+mParticles(old.mParticles), mFormerSpeed(old.mFormerSpeed), mFormerMinima(old.mFormerMinima), mNeighbourhood(old.mNeighbourhood)
 #ifdef __WX__CRYST__
 ,mpWXCrystObj(0)
 #endif
@@ -622,7 +1123,10 @@ OptimizationObj(""),
 mCurrentCost(-1),
 mTemperatureMax(.03),mTemperatureMin(.003),mTemperatureGamma(1.0),
 mMutationAmplitudeMax(16.),mMutationAmplitudeMin(.125),mMutationAmplitudeGamma(1.0),
-mNbTrialRetry(0),mMinCostRetry(0), mParticles(160), mFormerSpeed(0.721), mFormerMinima(1.193), mNeighbourhood(3)
+mNbTrialRetry(0),mMinCostRetry(0),mNbWorld(30),mNbTrialPerWorld(10),mNbThread(1),mNbParallelRun(1),mNbProcess(1),
+mDelayedAcceptanceMaxSinThetaOvLambda(0.25),
+mCheckpointInterval(600),mCheckpointNbTrial(0),mpCheckpoint(0),
+mParticles(160), mFormerSpeed(0.721), mFormerMinima(1.193), mNeighbourhood(3)
 #ifdef __WX__CRYST__
 ,mpWXCrystObj(0)
 #endif
@@ -642,6 +1146,14 @@ MonteCarloObj::~MonteCarloObj()
 {
    VFN_DEBUG_ENTRY("MonteCarloObj::~MonteCarloObj()",5)
    gOptimizationObjRegistry.DeRegister(*this);
+   delete mpCheckpoint;
+   if(mvClonedObj.size()>0)
+   {
+      mRefinedObjList.DeRegisterAll();
+      mRecursiveRefinedObjList.DeRegisterAll();
+      for(vector<RefinableObj*>::reverse_iterator pos=mvClonedObj.rbegin();pos!=mvClonedObj.rend();++pos)
+         delete *pos;
+   }
    VFN_DEBUG_EXIT ("MonteCarloObj::~MonteCarloObj()",5)
 }
 void MonteCarloObj::SetAlgorithmSimulAnnealing(const AnnealingSchedule scheduleTemp,
@@ -683,18 +1195,410 @@ void MonteCarloObj::SetAlgorithmParallTempering(const AnnealingSchedule schedule
    //mMinCostRetry=minCostRetry;
    VFN_DEBUG_MESSAGE("MonteCarloObj::SetAlgorithmParallTempering():End",3)
 }
+
+void MonteCarloObj::SetNbWorld(const unsigned int nb)
+{
+   if(nb<2) throw ObjCrystException("MonteCarloObj::SetNbWorld(): at least 2 worlds are needed");
+   mNbWorld=nb;
+}
+
+unsigned int MonteCarloObj::GetNbWorld()const {return mNbWorld;}
+
+void MonteCarloObj::SetNbTrialPerWorld(const unsigned int nb)
+{
+   if(nb<1) throw ObjCrystException("MonteCarloObj::SetNbTrialPerWorld(): need at least 1 trial");
+   mNbTrialPerWorld=nb;
+}
+
+unsigned int MonteCarloObj::GetNbTrialPerWorld()const {return mNbTrialPerWorld;}
+
+void MonteCarloObj::SetNbThread(const unsigned int nb) {mNbThread=nb;}
+
+unsigned int MonteCarloObj::GetNbThread()const {return mNbThread;}
+
+void MonteCarloObj::SetNbParallelRun(const unsigned int nb) {mNbParallelRun=nb;}
+
+unsigned int MonteCarloObj::GetNbParallelRun()const {return mNbParallelRun;}
+
+void MonteCarloObj::SetNbProcess(const unsigned int nb) {mNbProcess=nb;}
+
+unsigned int MonteCarloObj::GetNbProcess()const {return mNbProcess;}
+
+MonteCarloObj::RunStats::RunStats():
+mRun(0),mSeed(0),mBestCost(0),mNbTrial(0),mTime(0),mParamSetIndex(-1)
+{}
+
+const vector<MonteCarloObj::RunStats>& MonteCarloObj::GetRunStats()const {return mvRunStats;}
+
+MonteCarloObj* MonteCarloObj::CloneGraph(map<const RefinableObj*,RefinableObj*> *pCopyMap)const
+{
+   VFN_DEBUG_ENTRY("MonteCarloObj::CloneGraph()",5)
+   TAU_PROFILE("MonteCarloObj::CloneGraph()","void ()",TAU_DEFAULT);
+   map<const RefinableObj*,RefinableObj*> vCopy;
+   MonteCarloObj *pOpt=new MonteCarloObj(true);
+   try
+   {
+      DuplicateRefinedObjects(mRecursiveRefinedObjList,vCopy,pOpt->mvClonedObj);
+      for(int i=0;i<mRefinedObjList.GetNb();i++)
+      {
+         map<const RefinableObj*,RefinableObj*>::const_iterator pos=vCopy.find(&(mRefinedObjList.GetObj(i)));
+         if(pos==vCopy.end())
+            throw ObjCrystException("MonteCarloObj::CloneGraph(): cannot copy object "
+                                    +mRefinedObjList.GetObj(i).GetClassName()+":"
+                                    +mRefinedObjList.GetObj(i).GetName());
+         pOpt->AddRefinableObj(*(pos->second));
+      }
+   }
+   catch(const ObjCrystException &except)
+   {
+      delete pOpt;
+      VFN_DEBUG_EXIT("MonteCarloObj::CloneGraph():cannot copy objects",5)
+      throw;
+   }
+   pOpt->SetName(this->GetName());
+   pOpt->mSaveFileName=mSaveFileName;
+   pOpt->mNbTrialPerRun=mNbTrialPerRun;
+   for(unsigned int i=0;i<this->GetNbOption();i++)
+      pOpt->GetOption(i).SetChoice(this->GetOption(i).GetChoice());
+   pOpt->mTemperatureMax=mTemperatureMax;
+   pOpt->mTemperatureMin=mTemperatureMin;
+   pOpt->mTemperatureGamma=mTemperatureGamma;
+   pOpt->mMutationAmplitudeMax=mMutationAmplitudeMax;
+   pOpt->mMutationAmplitudeMin=mMutationAmplitudeMin;
+   pOpt->mMutationAmplitudeGamma=mMutationAmplitudeGamma;
+   pOpt->mNbTrialRetry=mNbTrialRetry;
+   pOpt->mMinCostRetry=mMinCostRetry;
+   pOpt->mNbWorld=mNbWorld;
+   pOpt->mNbTrialPerWorld=mNbTrialPerWorld;
+   pOpt->mNbThread=mNbThread;
+   pOpt->mNbParallelRun=mNbParallelRun;
+   pOpt->mNbProcess=mNbProcess;
+   pOpt->mParticles=mParticles;
+   pOpt->mFormerSpeed=mFormerSpeed;
+   pOpt->mFormerMinima=mFormerMinima;
+   pOpt->mNeighbourhood=mNeighbourhood;
+   pOpt->mDelayedAcceptanceMaxSinThetaOvLambda=mDelayedAcceptanceMaxSinThetaOvLambda;
+   if(pCopyMap!=0) pCopyMap->insert(vCopy.begin(),vCopy.end());
+   VFN_DEBUG_EXIT("MonteCarloObj::CloneGraph()",5)
+   return pOpt;
+}
+
+/// Hash (FNV-1a) of the names of all parameters, used to check that a checkpoint
+/// corresponds to the refined parameters
+static double RefParListNameHash(const RefinableObj &obj)
+{
+   uint32_t h=2166136261u;
+   for(long i=0;i<obj.GetNbPar();i++)
+   {
+      const string &name=obj.GetPar(i).GetName();
+      for(string::const_iterator c=name.begin();c!=name.end();++c)
+      {
+         h^=(unsigned char)(*c);
+         h*=16777619u;
+      }
+      h^=0xff;
+      h*=16777619u;
+   }
+   return h;
+}
+
+void MonteCarloObj::SetCheckpoint(const string &fileName,const REAL interval,const long nbTrial)
+{
+   mCheckpointFileName=fileName;
+   mCheckpointInterval=interval;
+   mCheckpointNbTrial=nbTrial;
+}
+
+const string& MonteCarloObj::GetCheckpointFileName()const {return mCheckpointFileName;}
+
+void MonteCarloObj::LoadCheckpoint(const string &fileName)
+{
+   VFN_DEBUG_ENTRY("MonteCarloObj::LoadCheckpoint():"<<fileName,5)
+   unique_ptr<Checkpoint> pCheckpoint(new Checkpoint);
+   pCheckpoint->Load(fileName);
+   pCheckpoint->GetValue("algorithm");
+   delete mpCheckpoint;
+   mpCheckpoint=pCheckpoint.release();
+   VFN_DEBUG_EXIT("MonteCarloObj::LoadCheckpoint()",5)
+}
+
+bool MonteCarloObj::IsCheckpointDue(const REAL time,const REAL lastTime,const long lastTrial)const
+{
+   if(mCheckpointFileName=="") return false;
+   if((mCheckpointInterval>0)&&((time-lastTime)>=mCheckpointInterval)) return true;
+   if((mCheckpointNbTrial>0)&&((mNbTrial-lastTrial)>=mCheckpointNbTrial)) return true;
+   return false;
+}
+
+void MonteCarloObj::WriteCheckpoint(Checkpoint &c,const long nbStep)
+{
+   TAU_PROFILE("MonteCarloObj::WriteCheckpoint()","void ()",TAU_DEFAULT);
+   VFN_DEBUG_MESSAGE("MonteCarloObj::WriteCheckpoint():"<<mCheckpointFileName,5)
+   c.Set("algorithm",mGlobalOptimType.GetChoice());
+   c.Set("nbPar",mRefParList.GetNbPar());
+   c.Set("parNameHash",RefParListNameHash(mRefParList));
+   c.Set("nbTrial",mNbTrial);
+   c.Set("nbStep",nbStep);
+   c.Set("run",mRun);
+   c.Set("bestCost",mBestCost);
+   c.Set("currentCost",mCurrentCost);
+   c.Set("temperature",mTemperature);
+   c.Set("mutationAmplitude",mMutationAmplitude);
+   c.Set("bestPar",mRefParList.GetParamSet(mBestParSavedSetIndex));
+   // Tracked values, as (trial,value) pairs
+   for(set<Tracker*>::const_iterator pos=mMainTracker.GetTrackerList().begin();
+       pos!=mMainTracker.GetTrackerList().end();++pos)
+   {
+      vector<pair<long,REAL> > vValues;
+      (*pos)->GetLatestValues(vValues,(*pos)->GetCapacity());
+      vector<double> *d=&(c.mData["tracker:"+(*pos)->GetName()]);
+      d->clear();
+      d->reserve(2*vValues.size());
+      for(vector<pair<long,REAL> >::const_iterator p=vValues.begin();p!=vValues.end();++p)
+      {
+         d->push_back(p->first);
+         d->push_back(p->second);
+      }
+   }
+   // Statistics of the adaptive moves
+   c.Set("nbAdaptiveMoveBlock",mvAdaptiveMoveBlock.size());
+   for(unsigned int i=0;i<mvAdaptiveMoveBlock.size();i++)
+   {
+      const AdaptiveMoveBlock *b=&(mvAdaptiveMoveBlock[i]);
+      vector<double> *d=&(c.mData["adaptiveMove:"+to_string(i)]);
+      d->clear();
+      d->push_back(b->mNbAccepted);
+      d->push_back(b->mNbAcceptedChol);
+      for(long k=0;k<b->mMean.numElements();k++) d->push_back(b->mMean(k));
+      for(long k=0;k<b->mCovar.numElements();k++) d->push_back(b->mCovar.data()[k]);
+      for(long k=0;k<b->mChol.numElements();k++) d->push_back(b->mChol.data()[k]);
+   }
+   c.SetRandomState("randomState",mRandom);
+   try {c.Save(mCheckpointFileName);}
+   catch(const ObjCrystException &except)
+   {
+      cout<<"MonteCarloObj::WriteCheckpoint(): could not write checkpoint "<<mCheckpointFileName<<endl;
+   }
+}
+
+MonteCarloObj::Checkpoint* MonteCarloObj::ResumeCheckpoint(long &nbStep)
+{
+   if(mpCheckpoint==0) return 0;
+   Checkpoint *c=mpCheckpoint;
+   mpCheckpoint=0;
+   VFN_DEBUG_MESSAGE("MonteCarloObj::ResumeCheckpoint()",5)
+   mNbTrial=(long)c->GetValue("nbTrial");
+   nbStep=(long)c->GetValue("nbStep");
+   mRun=(long)c->GetValue("run");
+   mBestCost=c->GetValue("bestCost");
+   mCurrentCost=c->GetValue("currentCost");
+   mTemperature=c->GetValue("temperature");
+   mMutationAmplitude=c->GetValue("mutationAmplitude");
+   c->Get("bestPar",mRefParList.GetParamSet(mBestParSavedSetIndex),mRefParList.GetNbPar());
+   for(set<Tracker*>::const_iterator pos=mMainTracker.GetTrackerList().begin();
+       pos!=mMainTracker.GetTrackerList().end();++pos)
+   {
+      map<string,vector<double> >::const_iterator p=c->mData.find("tracker:"+(*pos)->GetName());
+      if(p==c->mData.end()) continue;
+      (*pos)->Clear();
+      for(size_t i=0;(i+1)<p->second.size();i+=2)
+         (*pos)->AppendValue((long)p->second[i],p->second[i+1]);
+   }
+   if(  (c->mData.count("nbAdaptiveMoveBlock")>0)
+      &&(c->GetValue("nbAdaptiveMoveBlock")==mvAdaptiveMoveBlock.size()))
+      for(unsigned int i=0;i<mvAdaptiveMoveBlock.size();i++)
+      {
+         AdaptiveMoveBlock *b=&(mvAdaptiveMoveBlock[i]);
+         const long d=b->mMean.numElements();
+         map<string,vector<double> >::const_iterator p=c->mData.find("adaptiveMove:"+to_string(i));
+         if((p==c->mData.end())||(p->second.size()!=(size_t)(2+d+2*d*d))) continue;
+         const double *v=p->second.data();
+         b->mNbAccepted=(long)*v++;
+         b->mNbAcceptedChol=(long)*v++;
+         for(long k=0;k<d;k++) b->mMean(k)=*v++;
+         for(long k=0;k<d*d;k++) b->mCovar.data()[k]=*v++;
+         for(long k=0;k<d*d;k++) b->mChol.data()[k]=*v++;
+      }
+   c->GetRandomState("randomState",mRandom);
+   return c;
+}
+
+void MonteCarloObj::SetDelayedAcceptanceMaxSinThetaOvLambda(const REAL max)
+{mDelayedAcceptanceMaxSinThetaOvLambda=max;}
+
+REAL MonteCarloObj::GetDelayedAcceptanceMaxSinThetaOvLambda()const
+{return mDelayedAcceptanceMaxSinThetaOvLambda;}
+
+struct MonteCarloObj::DelayedAcceptance
+{
+   /** Create a copy of the objects refined by an optimization object, with the
+   * diffraction data limited to the delayed acceptance resolution.
+   *
+   * \throw ObjCrystException if the refined objects cannot be copied.
+   */
+   DelayedAcceptance(MonteCarloObj &opt,const unsigned int nbChain):
+   mOpt(opt),mvCurrentCost(nbChain,-1),mvCurrentSurrogateCost(nbChain,0),
+   mTrialSurrogateCost(0),mNbScreened(0),mNbRejected(0)
+   {
+      mCopy.Init(opt);
+      MonteCarloObj *pOpt=mCopy.mpOptObj;
+      const REAL max=opt.mDelayedAcceptanceMaxSinThetaOvLambda;
+      pOpt->BuildRecursiveRefObjList();
+      for(int i=0;i<pOpt->mRecursiveRefinedObjList.GetNb();i++)
+      {
+         RefinableObj *pObj=&(pOpt->mRecursiveRefinedObjList.GetObj(i));
+         PowderPattern *pPowder=dynamic_cast<PowderPattern*>(pObj);
+         if(pPowder!=0)
+         {
+            if(pPowder->GetMaxSinThetaOvLambda()>max) pPowder->SetMaxSinThetaOvLambda(max);
+            continue;
+         }
+         DiffractionDataSingleCrystal *pSingle=dynamic_cast<DiffractionDataSingleCrystal*>(pObj);
+         if((pSingle!=0)&&(pSingle->GetMaxSinThetaOvLambda()>max)) pSingle->SetMaxSinThetaOvLambda(max);
+      }
+      pOpt->BeginOptimization(true);
+      mCopy.mOptimizationBegun=true;
+      pOpt->PrepareRefParList();
+      if(!SameParList(pOpt->mRefParList,opt.mRefParList))
+         throw ObjCrystException("MonteCarloObj::DelayedAcceptance(): parameters differ in copied objects");
+      mCopy.mParSetIndex=pOpt->mRefParList.CreateParamSet("Delayed acceptance: low resolution parameters");
+      mTrialSetIndex=opt.mRefParList.CreateParamSet("Delayed acceptance: trial parameters");
+   }
+   ~DelayedAcceptance()
+   {
+      mOpt.mRefParList.ClearParamSet(mTrialSetIndex);
+   }
+   /// Low resolution cost for a set of parameters
+   REAL GetSurrogateCost(const CrystVector_REAL &par)
+   {
+      MonteCarloObj *pOpt=mCopy.mpOptObj;
+      pOpt->mRefParList.GetParamSet(mCopy.mParSetIndex)=par;
+      pOpt->mRefParList.RestoreParamSet(mCopy.mParSetIndex);
+      return pOpt->GetLogLikelihood();
+   }
+   /** Evaluate the trial configuration (the current parameters of the optimization
+   * object) for one chain, in two stages.
+   *
+   * The trial is first rejected with the Metropolis probability computed from the
+   * low resolution costs of the trial and current configurations. Otherwise, the full
+   * cost is computed, and the Metropolis test must be made using testCost instead of
+   * the full cost, which corrects for the first stage.
+   * \param currentSetIndex: index of the parameter set holding the current configuration
+   * of the chain
+   * \param currentCost: full cost of the current configuration. If it has changed
+   * since the last accepted trial (first trial, least squares, swap of worlds...), the
+   * low resolution cost of the current configuration is recomputed.
+   * \param testCost: the cost to use in the Metropolis test, or +infinity if the trial
+   * was rejected at the first stage.
+   * \return the full cost of the trial configuration, or +infinity if the trial was
+   * rejected at the first stage.
+   */
+   REAL GetTrialCost(const unsigned int chain,const long currentSetIndex,const REAL currentCost,
+                     const REAL temperature,REAL &testCost)
+   {
+      TAU_PROFILE("MonteCarloObj::DelayedAcceptance::GetTrialCost()","REAL (...)",TAU_DEFAULT);
+      if(mvCurrentCost[chain]!=currentCost)
+      {
+         mvCurrentSurrogateCost[chain]=this->GetSurrogateCost(mOpt.mRefParList.GetParamSet(currentSetIndex));
+         mvCurrentCost[chain]=currentCost;
+      }
+      mOpt.mRefParList.SaveParamSet(mTrialSetIndex);
+      mTrialSurrogateCost=this->GetSurrogateCost(mOpt.mRefParList.GetParamSet(mTrialSetIndex));
+      const REAL deltaSurrogate=mTrialSurrogateCost-mvCurrentSurrogateCost[chain];
+      mNbScreened++;
+      if(  (deltaSurrogate>0)
+         &&(log(RandomUniform())>=(-deltaSurrogate/temperature)))
+      {
+         mNbRejected++;
+         testCost=numeric_limits<REAL>::infinity();
+         return testCost;
+      }
+      const REAL cost=mOpt.GetLogLikelihood();
+      testCost=cost-deltaSurrogate;
+      return cost;
+   }
+   /// The last trial configuration has been accepted for this chain, with a full cost
+   void Accepted(const unsigned int chain,const REAL cost)
+   {
+      mvCurrentCost[chain]=cost;
+      mvCurrentSurrogateCost[chain]=mTrialSurrogateCost;
+   }
+   /// The optimization object using this
+   MonteCarloObj &mOpt;
+   /// Low resolution copy of the refined objects
+   ThreadCopy mCopy;
+   /// Index of the parameter set used to hold the trial configuration
+   long mTrialSetIndex;
+   /// Full cost of the current configuration of each chain, for which the low
+   /// resolution cost was computed
+   vector<REAL> mvCurrentCost;
+   /// Low resolution cost of the current configuration of each chain
+   vector<REAL> mvCurrentSurrogateCost;
+   /// Low resolution cost of the last trial configuration
+   REAL mTrialSurrogateCost;
+   /// Number of trials screened, and rejected at the first stage
+   long mNbScreened,mNbRejected;
+};
+
+MonteCarloObj::DelayedAcceptance* MonteCarloObj::CreateDelayedAcceptance(const unsigned int nbChain,
+                                                                        const bool silent)
+{
+   if(mDelayedAcceptance.GetChoice()==0) return 0;
+   VFN_DEBUG_ENTRY("MonteCarloObj::CreateDelayedAcceptance()",5)
+   DelayedAcceptance *p=0;
+   try
+   {
+      p=new DelayedAcceptance(*this,nbChain);
+   }
+   catch(const ObjCrystException &except)
+   {
+      if(!silent) cout<<"Delayed acceptance: cannot copy the refined objects, trials will not be screened"<<endl;
+   }
+   VFN_DEBUG_EXIT("MonteCarloObj::CreateDelayedAcceptance()",5)
+   return p;
+}
+
 void MonteCarloObj::Optimize(long &nbStep,const bool silent,const REAL finalcost,
                              const REAL maxTime)
 {
    //:TODO: Other algorithms !
    TAU_PROFILE("MonteCarloObj::Optimize()","void (long)",TAU_DEFAULT);
    VFN_DEBUG_ENTRY("MonteCarloObj::Optimize()",5)
+   this->InitRandomGenerator();
+   RandomGenerator::Scope randomScope(mRandom);
+   OptimizationProfileScope profileScope(mProfiling,mvProfileStats);
+   this->InitProgress();
    this->BeginOptimization(true);
    this->PrepareRefParList();
+   if(mpCheckpoint!=0)
+   {// Check that the loaded checkpoint can be used to resume this optimization
+      bool match=false;
+      try
+      {
+         match=   (mpCheckpoint->GetValue("algorithm")==mGlobalOptimType.GetChoice())
+                &&(mpCheckpoint->GetValue("nbPar")==mRefParList.GetNbPar())
+                &&(mpCheckpoint->GetValue("parNameHash")==RefParListNameHash(mRefParList))
+                &&(  (mpCheckpoint->mData.count("nbWorld")==0)
+                   ||(mpCheckpoint->GetValue("nbWorld")==mNbWorld))
+                &&(  (mpCheckpoint->mData.count("nbParticle")==0)
+                   ||(mpCheckpoint->GetValue("nbParticle")==(int)mParticles));
+      }
+      catch(const ObjCrystException &except){}
+      if(!match)
+      {
+         delete mpCheckpoint;
+         mpCheckpoint=0;
+         this->EndOptimization();
+         VFN_DEBUG_EXIT("MonteCarloObj::Optimize():checkpoint does not match",5)
+         throw ObjCrystException("MonteCarloObj::Optimize(): the checkpoint does not match the refined parameters or the algorithm");
+      }
+   }
 
    this->InitLSQ(false);
 
    mIsOptimizing=true;
+   // AsyncOptimization::Cancel() is ignored by StopAfterCycle() until mIsOptimizing is set
+   if((mpAsyncOptimization!=0)&&mpAsyncOptimization->IsCancelled()) mStopAfterCycle=true;
    if(mTemperatureGamma<0.1) mTemperatureGamma= 0.1;
    if(mTemperatureGamma>10.0)mTemperatureGamma=10.0;
    if(mMutationAmplitudeGamma<0.1) mMutationAmplitudeGamma= 0.1;
@@ -775,14 +1679,26 @@ void MonteCarloObj::MultiRunOptimize(long &nbCycle,long &nbStep,const bool silen
    //:TODO: Other algorithms !
    TAU_PROFILE("MonteCarloObj::MultiRunOptimize()","void (long)",TAU_DEFAULT);
    VFN_DEBUG_ENTRY("MonteCarloObj::MultiRunOptimize()",5)
+   this->InitRandomGenerator();
+   RandomGenerator::Scope randomScope(mRandom);
+   OptimizationProfileScope profileScope(mProfiling,mvProfileStats);
+   this->InitProgress();
    //Keep a copy of the total number of steps, and decrement nbStep
    const long nbStep0=nbStep;
+   if(mpCheckpoint!=0)
+   {
+      if(!silent) cout<<"MonteCarloObj::MultiRunOptimize(): checkpoints can only be resumed by Optimize(), ignoring it"<<endl;
+      delete mpCheckpoint;
+      mpCheckpoint=0;
+   }
    this->BeginOptimization(true);
    this->PrepareRefParList();
 
    this->InitLSQ(false);
 
    mIsOptimizing=true;
+   // AsyncOptimization::Cancel() is ignored by StopAfterCycle() until mIsOptimizing is set
+   if((mpAsyncOptimization!=0)&&mpAsyncOptimization->IsCancelled()) mStopAfterCycle=true;
    if(mTemperatureGamma<0.1) mTemperatureGamma= 0.1;
    if(mTemperatureGamma>10.0)mTemperatureGamma=10.0;
    if(mMutationAmplitudeGamma<0.1) mMutationAmplitudeGamma= 0.1;
@@ -799,9 +1715,31 @@ void MonteCarloObj::MultiRunOptimize(long &nbCycle,long &nbStep,const bool silen
 
    const long paramsFirstStructure = mRefParList.CreateParamSet();
 
-   while(nbCycle!=0)
+   mvRunStats.clear();
+   unsigned int nbParallelRun=mNbParallelRun;
+   if(nbParallelRun==0) nbParallelRun=std::thread::hardware_concurrency();
+   if((nbCycle>0)&&(nbParallelRun>nbCycle)) nbParallelRun=nbCycle;
+   unsigned int nbProcess=mNbProcess;
+   if(nbProcess==0) nbProcess=std::thread::hardware_concurrency();
+   if((nbCycle>0)&&(nbProcess>nbCycle)) nbProcess=nbCycle;
+   bool finished=false;
+   const bool concurrent=(mGlobalOptimType.GetChoice()==GLOBAL_OPTIM_SIMULATED_ANNEALING)
+                       ||(mGlobalOptimType.GetChoice()==GLOBAL_OPTIM_PARALLEL_TEMPERING);
+   if(concurrent&&(nbProcess>1))
+      finished=this->MultiRunOptimizeFork(nbCycle,nbStep0,silent,finalcost,maxTime,
+                                          nbProcess,nbTrialCumul);
+   if(concurrent&&(!finished)&&(nbParallelRun>1))
+      finished=this->MultiRunOptimizeThread(nbCycle,nbStep0,silent,finalcost,maxTime,
+                                            nbParallelRun,nbTrialCumul);
+
+   while((false==finished)&&(nbCycle!=0))
    {
       if(!silent) cout <<"MonteCarloObj::MultiRunOptimize: Starting Run#"<<abs(nbCycle)<<endl;
+      RunStats stats;
+      stats.mRun=nbCycle0-nbCycle;
+      // Each run starts a new sequence of random numbers, from a recorded seed
+      stats.mSeed=(unsigned int)(mRandom.Next()>>32);
+      mRandom.Seed(stats.mSeed);
       nbStep=nbStep0;
       for(int i=0;i<mRefinedObjList.GetNb();i++) mRefinedObjList.GetObj(i).RandomizeConfiguration();
       mMainTracker.ClearValues();
@@ -837,12 +1775,17 @@ void MonteCarloObj::MultiRunOptimize(long &nbCycle,long &nbStep,const bool silen
          }
       }
       nbTrialCumul+=(nbStep0-nbStep);
-      if(finalcost>1)
-         (*fpObjCrystInformUser)((boost::format("Finished Run #%d, final cost=%12.2f, nbTrial=%d (dt=%.1fs), so far <nbTrial>=%d")
-                                  % (nbCycle0-nbCycle) % this->GetLogLikelihood() % (nbStep0-nbStep) % chrono.seconds() % (nbTrialCumul/(nbCycle0-nbCycle+1))).str());
-      else
-         (*fpObjCrystInformUser)((boost::format("Finished Run #%d, final cost=%12.2f, nbTrial=%d (dt=%.1fs)")
-                                  % (nbCycle0-nbCycle) % this->GetLogLikelihood() % (nbStep0-nbStep) % chrono.seconds()).str());
+      stats.mNbTrial=nbStep0-nbStep;
+      stats.mTime=chrono.seconds();
+      if(!silent)
+      {
+         if(finalcost>1)
+            (*fpObjCrystInformUser)((boost::format("Finished Run #%d, final cost=%12.2f, nbTrial=%d (dt=%.1fs), so far <nbTrial>=%d")
+                                     % (nbCycle0-nbCycle) % this->GetLogLikelihood() % (nbStep0-nbStep) % chrono.seconds() % (nbTrialCumul/(nbCycle0-nbCycle+1))).str());
+         else
+            (*fpObjCrystInformUser)((boost::format("Finished Run #%d, final cost=%12.2f, nbTrial=%d (dt=%.1fs)")
+                                     % (nbCycle0-nbCycle) % this->GetLogLikelihood() % (nbStep0-nbStep) % chrono.seconds()).str());
+      }
 
 
       nbStep=nbStep0;
@@ -850,6 +1793,9 @@ void MonteCarloObj::MultiRunOptimize(long &nbCycle,long &nbStep,const bool silen
       stringstream s;
       s<<"Run #"<<abs(nbCycle);
       mvSavedParamSet.push_back(make_pair(mRefParList.CreateParamSet(s.str()),mCurrentCost));
+      stats.mBestCost=mCurrentCost;
+      stats.mParamSetIndex=mvSavedParamSet.back().first;
+      mvRunStats.push_back(stats);
       if(!silent) cout <<"MonteCarloObj::MultiRunOptimize: Finished Run#"
                        <<abs(nbCycle)<<", Run Best Cost:"<<mCurrentCost
                        <<", Overall Best Cost:"<<mBestCost<<endl;
@@ -926,11 +1872,454 @@ void MonteCarloObj::MultiRunOptimize(long &nbCycle,long &nbStep,const bool silen
    VFN_DEBUG_EXIT("MonteCarloObj::MultiRunOptimize()",5)
 }
 
+bool MonteCarloObj::MultiRunOptimizeThread(long &nbCycle,const long nbStep,const bool silent,
+                                           const REAL finalcost,const REAL maxTime,
+                                           const unsigned int nbThread,long &nbTrialCumul)
+{
+   VFN_DEBUG_ENTRY("MonteCarloObj::MultiRunOptimizeThread()",5)
+   // Copies of the refined objects for each thread
+   vector<unique_ptr<ThreadCopy> > vCopy;
+   try
+   {
+      for(unsigned int t=0;t<nbThread;++t)
+      {
+         vCopy.push_back(unique_ptr<ThreadCopy>(new ThreadCopy));
+         ThreadCopy *pCopy=vCopy.back().get();
+         pCopy->Init(*this);
+         pCopy->mpOptObj->BeginOptimization(true);
+         pCopy->mpOptObj->PrepareRefParList();
+         pCopy->mpOptObj->EndOptimization();
+         if(!SameParList(pCopy->mpOptObj->mRefParList,mRefParList))
+            throw ObjCrystException("MonteCarloObj::MultiRunOptimize(): parameters differ in copied objects");
+      }
+   }
+   catch(const ObjCrystException &except)
+   {
+      if(!silent) cout<<"MonteCarloObj::MultiRunOptimize: cannot copy the refined objects, runs will not be concurrent"<<endl;
+      VFN_DEBUG_EXIT("MonteCarloObj::MultiRunOptimizeThread():cannot copy objects",5)
+      return false;
+   }
+   if(!silent) cout<<"MonteCarloObj::MultiRunOptimize: "<<nbThread<<" concurrent runs"<<endl;
+   const long nbCycle0=nbCycle;
+   // Shared between the threads, and protected by the mutex
+   std::mutex mutex;
+   long nextRun=0;
+   bool stop=false;
+   unsigned int nbThreadFinished=0;
+   // Statistics and best configuration for each finished run
+   vector<pair<RunStats,CrystVector_REAL> > vResult;
+   auto runThread=[&](const unsigned int t)
+   {
+      ThreadCopy &copy=*vCopy[t];
+      try
+      {
+         while(true)
+         {
+            RunStats stats;
+            {
+               std::lock_guard<std::mutex> lock(mutex);
+               if(stop || ((nbCycle0>0)&&(nextRun>=nbCycle0))) break;
+               stats.mRun=nextRun++;
+               copy.mpOptObj->SetSeed((unsigned int)(mRandom.Next()>>32));
+            }
+            Chronometer chrono;
+            chrono.start();
+            long nbCycle1=1,nbStep1=nbStep;
+            copy.mpOptObj->MultiRunOptimize(nbCycle1,nbStep1,true,finalcost,maxTime);
+            const RunStats &stats1=copy.mpOptObj->mvRunStats.back();
+            stats.mSeed=stats1.mSeed;
+            stats.mBestCost=stats1.mBestCost;
+            stats.mNbTrial=stats1.mNbTrial;
+            stats.mTime=chrono.seconds();
+            if(mSaveTrackedData.GetChoice()==1)
+            {
+               ofstream outTracker;
+               outTracker.imbue(std::locale::classic());
+               const string outTrackerName=this->GetName()
+                  +(boost::format("-Tracker-Run#%ld.dat")%abs(nbCycle0-stats.mRun)).str();
+               outTracker.open(outTrackerName.c_str());
+               copy.mpOptObj->mMainTracker.SaveAll(outTracker);
+               outTracker.close();
+            }
+            std::lock_guard<std::mutex> lock(mutex);
+            vResult.push_back(make_pair(stats,copy.mpOptObj->mRefParList.GetParamSet(stats1.mParamSetIndex)));
+            copy.mpOptObj->mRefParList.ClearParamSet(stats1.mParamSetIndex);
+            copy.mpOptObj->mvSavedParamSet.clear();
+         }
+      }
+      catch(...)
+      {
+         copy.mException=std::current_exception();
+      }
+      std::lock_guard<std::mutex> lock(mutex);
+      nbThreadFinished++;
+   };
+   vector<std::thread> vThread;
+   for(unsigned int t=0;t<nbThread;++t) vThread.push_back(std::thread(runThread,t));
+   // Collect the results as the runs finish
+   size_t nbResult=0;
+   bool needUpdateDisplay=false;
+   Chronometer chrono;
+   float lastUpdateDisplayTime=chrono.seconds();
+   while(true)
+   {
+      vector<pair<RunStats,CrystVector_REAL> > vNewResult;
+      bool allFinished;
+      {
+         std::lock_guard<std::mutex> lock(mutex);
+         vNewResult.assign(vResult.begin()+nbResult,vResult.end());
+         nbResult=vResult.size();
+         allFinished=(nbThreadFinished==nbThread);
+      }
+      for(vector<pair<RunStats,CrystVector_REAL> >::iterator pos=vNewResult.begin();pos!=vNewResult.end();++pos)
+         this->AddRunResult(pos->first,pos->second,nbCycle0,silent,needUpdateDisplay,nbTrialCumul);
+      if(allFinished) break;
+      this->ReportProgress(mBestCost,mBestCost,-1);
+      if(needUpdateDisplay&&(lastUpdateDisplayTime<(chrono.seconds()-1)))
+      {
+         this->UpdateDisplay();
+         needUpdateDisplay=false;
+         lastUpdateDisplayTime=chrono.seconds();
+      }
+      #ifdef __WX__CRYST__
+      mMutexStopAfterCycle.Lock();
+      #endif
+      if(mStopAfterCycle)
+      {
+         {
+            std::lock_guard<std::mutex> lock(mutex);
+            stop=true;
+         }
+         for(unsigned int t=0;t<nbThread;++t) vCopy[t]->mpOptObj->StopAfterCycle();
+      }
+      #ifdef __WX__CRYST__
+      mMutexStopAfterCycle.Unlock();
+      #endif
+      std::this_thread::sleep_for(std::chrono::milliseconds(50));
+   }
+   for(unsigned int t=0;t<nbThread;++t) vThread[t].join();
+   nbCycle=nbCycle0-(long)nbResult;
+   for(unsigned int t=0;t<nbThread;++t)
+      if(vCopy[t]->mException) std::rethrow_exception(vCopy[t]->mException);
+   VFN_DEBUG_EXIT("MonteCarloObj::MultiRunOptimizeThread()",5)
+   return true;
+}
+
+void MonteCarloObj::AddRunResult(RunStats &stats,const CrystVector_REAL &par,const long nbCycle0,
+                                 const bool silent,bool &needUpdateDisplay,long &nbTrialCumul)
+{
+   const long runNum=abs(nbCycle0-stats.mRun);
+   stringstream s;
+   s<<"Run #"<<runNum;
+   stats.mParamSetIndex=mRefParList.CreateParamSet(s.str());
+   mRefParList.GetParamSet(stats.mParamSetIndex)=par;
+   mvSavedParamSet.push_back(make_pair(stats.mParamSetIndex,stats.mBestCost));
+   mvRunStats.push_back(stats);
+   nbTrialCumul+=stats.mNbTrial;
+   if(stats.mBestCost<mBestCost)
+   {
+      mBestCost=stats.mBestCost;
+      mRefParList.GetParamSet(mBestParSavedSetIndex)=par;
+      mRefParList.RestoreParamSet(mBestParSavedSetIndex);
+      this->TagNewBestConfig();
+      needUpdateDisplay=true;
+   }
+   if(!silent)
+      (*fpObjCrystInformUser)((boost::format("Finished Run #%d, final cost=%12.2f, nbTrial=%d (dt=%.1fs)")
+                               % stats.mRun % stats.mBestCost % stats.mNbTrial % stats.mTime).str());
+   if(!silent) cout <<"MonteCarloObj::MultiRunOptimize: Finished Run#"
+                    <<runNum<<", Run Best Cost:"<<stats.mBestCost
+                    <<", Overall Best Cost:"<<mBestCost<<endl;
+   if(mXMLAutoSave.GetChoice()==5)
+   {
+      mRefParList.RestoreParamSet(stats.mParamSetIndex);
+      string saveFileName=this->GetName();
+      time_t date=time(0);
+      char strDate[40];
+      strftime(strDate,sizeof(strDate),"%Y-%m-%d_%H-%M-%S",localtime(&date));//%Y-%m-%dT%H:%M:%S%Z
+      saveFileName=saveFileName+(string)strDate
+                   +(boost::format("-Run#%ld-Cost-%f")%runNum%this->GetLogLikelihood()).str()+".xml";
+      XMLCrystFileSaveGlobal(saveFileName);
+      mRefParList.RestoreParamSet(mBestParSavedSetIndex);
+   }
+   mRun++;
+}
+
+/** \internal Board in shared memory, used to distribute the runs of MultiRunOptimize()
+* between worker processes and to collect their results.
+*
+* The board is created (anonymous shared mapping) before the workers are forked. Each
+* worker has a slot where it publishes the statistics and best configuration of a run,
+* which the main process reads before the worker can publish the next one.
+*/
+struct MonteCarloObj::ForkBoard
+{
+   /// Shared state of the board
+   struct Header
+   {
+      /// Number of the next run to perform
+      std::atomic<long> mNextRun;
+      /// Set to 1 to stop all workers
+      std::atomic<int> mStop;
+   };
+   /// Result slot of a worker
+   struct Slot
+   {
+      /// 1 if the slot holds a result not yet read by the main process, 0 otherwise
+      std::atomic<int> mState;
+      /// Statistics of the run
+      RunStats mStats;
+   };
+   ForkBoard(const unsigned int nbWorker,const long nbPar):
+   mpMemory(0),mNbWorker(nbWorker),mNbPar(nbPar)
+   {
+      #ifdef OBJCRYST_FORK
+      mSlotOffset=(sizeof(Header)+15)/16*16;
+      mParOffset=mSlotOffset+(nbWorker*sizeof(Slot)+15)/16*16;
+      mSize=mParOffset+nbWorker*nbPar*sizeof(REAL);
+      void *p=mmap(0,mSize,PROT_READ|PROT_WRITE,MAP_SHARED|MAP_ANONYMOUS,-1,0);
+      if(p==MAP_FAILED) throw ObjCrystException("MonteCarloObj::ForkBoard: cannot create shared memory");
+      mpMemory=(char*)p;
+      Header *h=new(mpMemory) Header;
+      h->mNextRun.store(0);
+      h->mStop.store(0);
+      for(unsigned int i=0;i<nbWorker;i++)
+      {
+         Slot *slot=new(mpMemory+mSlotOffset+i*sizeof(Slot)) Slot;
+         slot->mState.store(0);
+      }
+      #else
+      throw ObjCrystException("MonteCarloObj::ForkBoard: worker processes are not supported on this system");
+      #endif
+   }
+   ~ForkBoard()
+   {
+      #ifdef OBJCRYST_FORK
+      if(mpMemory!=0) munmap(mpMemory,mSize);
+      #endif
+   }
+   Header& GetHeader(){return *((Header*)mpMemory);}
+   Slot& GetSlot(const unsigned int i){return *((Slot*)(mpMemory+mSlotOffset+i*sizeof(Slot)));}
+   /// Best configuration for the run in the slot of worker i
+   REAL* GetPar(const unsigned int i){return (REAL*)(mpMemory+mParOffset+i*mNbPar*sizeof(REAL));}
+   /// Shared memory
+   char *mpMemory;
+   /// Size of the shared memory, and offsets of the slots and configurations
+   size_t mSize,mSlotOffset,mParOffset;
+   unsigned int mNbWorker;
+   long mNbPar;
+};
+
+#ifdef OBJCRYST_FORK
+/// \internal Number of threads in the current process, or 0 if it cannot be determined
+static unsigned int GetNbProcessThread()
+{
+   #if defined(__linux__)
+   DIR *dir=opendir("/proc/self/task");
+   if(dir==0) return 0;
+   unsigned int nb=0;
+   while(const struct dirent *entry=readdir(dir))
+      if(entry->d_name[0]!='.') nb++;
+   closedir(dir);
+   return nb;
+   #elif defined(__APPLE__)
+   thread_act_array_t vThread;
+   mach_msg_type_number_t nb=0;
+   if(task_threads(mach_task_self(),&vThread,&nb)!=KERN_SUCCESS) return 0;
+   for(mach_msg_type_number_t i=0;i<nb;i++) mach_port_deallocate(mach_task_self(),vThread[i]);
+   vm_deallocate(mach_task_self(),(vm_address_t)vThread,nb*sizeof(thread_act_t));
+   return nb;
+   #else
+   return 0;
+   #endif
+}
+#endif
+
+bool MonteCarloObj::MultiRunOptimizeFork(long &nbCycle,const long nbStep,const bool silent,
+                                         const REAL finalcost,const REAL maxTime,
+                                         const unsigned int nbProcess,long &nbTrialCumul)
+{
+   #ifndef OBJCRYST_FORK
+   if(!silent) cout<<"MonteCarloObj::MultiRunOptimize: worker processes are not supported on this system"<<endl;
+   return false;
+   #else
+   // Only the calling thread exists in the worker processes: any other thread (holding
+   // a lock, or expected to complete some work) would be missing there.
+   if(GetNbProcessThread()!=1)
+   {
+      if(!silent) cout<<"MonteCarloObj::MultiRunOptimize: other threads are running (or cannot be counted), no worker process is used"<<endl;
+      return false;
+   }
+   VFN_DEBUG_ENTRY("MonteCarloObj::MultiRunOptimizeFork()",5)
+   const long nbPar=mRefParList.GetNbPar();
+   unique_ptr<ForkBoard> pBoard;
+   try {pBoard.reset(new ForkBoard(nbProcess,nbPar));}
+   catch(const ObjCrystException &except)
+   {
+      if(!silent) cout<<"MonteCarloObj::MultiRunOptimize: cannot create the shared memory board, no worker process is used"<<endl;
+      VFN_DEBUG_EXIT("MonteCarloObj::MultiRunOptimizeFork():cannot create board",5)
+      return false;
+   }
+   ForkBoard::Header *header=&(pBoard->GetHeader());
+   const long nbCycle0=nbCycle;
+   // The seed of each run is derived from its number, so that the result of a run
+   // does not depend on the worker performing it
+   const unsigned long seed0=(unsigned long)(mRandom.Next()>>32);
+   const pid_t parentPid=getpid();
+   cout.flush();
+   fflush(stdout);
+   vector<pid_t> vPid;
+   for(unsigned int w=0;w<nbProcess;++w)
+   {
+      const pid_t pid=fork();
+      if(pid<0)
+      {
+         if(!silent) cout<<"MonteCarloObj::MultiRunOptimize: could not create worker process #"<<w<<endl;
+         break;
+      }
+      if(pid>0)
+      {
+         vPid.push_back(pid);
+         continue;
+      }
+      // Worker process: perform runs until there are none left, or all workers must stop.
+      // The objects are the (copy-on-write) objects of the main process.
+      mNbProcess=1;
+      mNbParallelRun=1;
+      mXMLAutoSave.SetChoice(0);
+      mProfiling.SetChoice(0);
+      mProgressCallback=OptimizationProgressCallback();
+      int status=0;
+      std::atomic<bool> done(false);
+      // Interrupt the current run when all workers must stop, or the main process is gone
+      std::thread watcher([&]()
+      {
+         while(!done.load())
+         {
+            if(getppid()!=parentPid) header->mStop.store(1);
+            if(header->mStop.load()!=0) this->StopAfterCycle();
+            std::this_thread::sleep_for(std::chrono::milliseconds(20));
+         }
+      });
+      try
+      {
+         ForkBoard::Slot *slot=&(pBoard->GetSlot(w));
+         REAL *par=pBoard->GetPar(w);
+         while(header->mStop.load()==0)
+         {
+            const long run=header->mNextRun.fetch_add(1);
+            if((nbCycle0>0)&&(run>=nbCycle0)) break;
+            this->SetSeed((unsigned long)(RandomGenerator(seed0+run).Next()>>32));
+            Chronometer chrono;
+            chrono.start();
+            long nbCycle1=1,nbStep1=nbStep;
+            this->MultiRunOptimize(nbCycle1,nbStep1,true,finalcost,maxTime);
+            RunStats stats=mvRunStats.back();
+            stats.mRun=run;
+            stats.mTime=chrono.seconds();
+            if(mRefParList.GetNbPar()!=nbPar)
+               throw ObjCrystException("MonteCarloObj::MultiRunOptimizeFork(): number of parameters changed in worker");
+            if(mSaveTrackedData.GetChoice()==1)
+            {
+               ofstream outTracker;
+               outTracker.imbue(std::locale::classic());
+               const string outTrackerName=this->GetName()
+                  +(boost::format("-Tracker-Run#%ld.dat")%abs(nbCycle0-stats.mRun)).str();
+               outTracker.open(outTrackerName.c_str());
+               mMainTracker.SaveAll(outTracker);
+               outTracker.close();
+            }
+            // Wait until the main process has read the previous result
+            while(slot->mState.load(std::memory_order_acquire)!=0)
+            {
+               if(getppid()!=parentPid) throw ObjCrystException("MonteCarloObj::MultiRunOptimizeFork(): main process is gone");
+               std::this_thread::sleep_for(std::chrono::milliseconds(5));
+            }
+            slot->mStats=stats;
+            const CrystVector_REAL *p=&(mRefParList.GetParamSet(stats.mParamSetIndex));
+            for(long i=0;i<nbPar;i++) par[i]=(*p)(i);
+            slot->mState.store(1,std::memory_order_release);
+            mRefParList.ClearParamSet(stats.mParamSetIndex);
+            mvSavedParamSet.clear();
+            if(stats.mBestCost<finalcost) header->mStop.store(1);
+         }
+      }
+      catch(...)
+      {
+         status=1;
+      }
+      done.store(true);
+      watcher.join();
+      cout.flush();
+      _exit(status);
+   }
+   if(vPid.size()==0)
+   {
+      VFN_DEBUG_EXIT("MonteCarloObj::MultiRunOptimizeFork():no worker",5)
+      return false;
+   }
+   if(!silent) cout<<"MonteCarloObj::MultiRunOptimize: "<<vPid.size()<<" worker processes"<<endl;
+   // Collect the results as the runs finish
+   vector<bool> vRunning(vPid.size(),true);
+   unsigned int nbRunning=vPid.size();
+   long nbResult=0;
+   CrystVector_REAL par(nbPar);
+   bool needUpdateDisplay=false;
+   Chronometer chrono;
+   float lastUpdateDisplayTime=chrono.seconds();
+   while(true)
+   {
+      // Check for finished workers before reading the slots, so that the last result
+      // of a worker is always read
+      for(unsigned int w=0;w<vPid.size();++w)
+      {
+         if(!vRunning[w]) continue;
+         int status;
+         if(waitpid(vPid[w],&status,WNOHANG)!=vPid[w]) continue;
+         vRunning[w]=false;
+         nbRunning--;
+         if((!WIFEXITED(status)||(WEXITSTATUS(status)!=0))&&(!silent))
+            cout<<"MonteCarloObj::MultiRunOptimize: worker process #"<<w<<" failed"<<endl;
+      }
+      for(unsigned int w=0;w<vPid.size();++w)
+      {
+         ForkBoard::Slot *slot=&(pBoard->GetSlot(w));
+         if(slot->mState.load(std::memory_order_acquire)!=1) continue;
+         RunStats stats=slot->mStats;
+         const REAL *p=pBoard->GetPar(w);
+         for(long i=0;i<nbPar;i++) par(i)=p[i];
+         slot->mState.store(0,std::memory_order_release);
+         this->AddRunResult(stats,par,nbCycle0,silent,needUpdateDisplay,nbTrialCumul);
+         nbResult++;
+      }
+      if(nbRunning==0) break;
+      this->ReportProgress(mBestCost,mBestCost,-1);
+      if(needUpdateDisplay&&(lastUpdateDisplayTime<(chrono.seconds()-1)))
+      {
+         this->UpdateDisplay();
+         needUpdateDisplay=false;
+         lastUpdateDisplayTime=chrono.seconds();
+      }
+      #ifdef __WX__CRYST__
+      mMutexStopAfterCycle.Lock();
+      #endif
+      if(mStopAfterCycle) header->mStop.store(1);
+      #ifdef __WX__CRYST__
+      mMutexStopAfterCycle.Unlock();
+      #endif
+      std::this_thread::sleep_for(std::chrono::milliseconds(50));
+   }
+   nbCycle=nbCycle0-nbResult;
+   VFN_DEBUG_EXIT("MonteCarloObj::MultiRunOptimizeFork()",5)
+   return true;
+   #endif
+}
+
 void MonteCarloObj::RunSimulatedAnnealing(long &nbStep,const bool silent,
                                           const REAL finalcost,const REAL maxTime)
 {
    //Keep a copy of the total number of steps, and decrement nbStep
-   const long nbSteps=nbStep;
+   const long nbSteps=(mpCheckpoint!=0)?(long)mpCheckpoint->GetValue("nbStepTotal"):nbStep;
    unsigned int accept;// 1 if last trial was accepted? 2 if new best config ? else 0
    mNbTrial=0;
    // time (in seconds) when last autoSave was made (if enabled)
@@ -948,6 +2337,8 @@ void MonteCarloObj::RunSimulatedAnnealing(long &nbStep,const bool silent,
    // Keep record of the number of accepted moves
       long nbAcceptedMoves=0;//since last report
       long nbAcceptedMovesTemp=0;//since last temperature/mutation rate change
+      // Fraction of accepted moves during the last report interval, for progress reports
+      REAL lastAcceptRate=-1;
    // Number of tries since best configuration found
       long nbTriesSinceBest=0;
    // Change temperature (and mutation) every...
@@ -956,11 +2347,32 @@ void MonteCarloObj::RunSimulatedAnnealing(long &nbStep,const bool silent,
    mTemperature=sqrt(mTemperatureMin*mTemperatureMax);
    mMutationAmplitude=sqrt(mMutationAmplitudeMin*mMutationAmplitudeMax);
 
+   this->InitAdaptiveMove();
+   unique_ptr<DelayedAcceptance> pDelayed(this->CreateDelayedAcceptance(1,silent));
+   // Resume from a checkpoint ?
+   long firstTrial=1;
+   unique_ptr<Checkpoint> pResume(this->ResumeCheckpoint(nbStep));
+   if(pResume.get()!=0)
+   {
+      firstTrial=mNbTrial;
+      runBestCost=pResume->GetValue("runBestCost");
+      nbAcceptedMoves=(long)pResume->GetValue("nbAcceptedMoves");
+      nbAcceptedMovesTemp=(long)pResume->GetValue("nbAcceptedMovesTemp");
+      nbTriesSinceBest=(long)pResume->GetValue("nbTriesSinceBest");
+      pResume->Get("lastPar",mRefParList.GetParamSet(lastParSavedSetIndex),mRefParList.GetNbPar());
+      pResume->Get("runBestPar",mRefParList.GetParamSet(runBestIndex),mRefParList.GetNbPar());
+      mRefParList.RestoreParamSet(lastParSavedSetIndex);
+      pResume.reset();
+      if(!silent) cout << "Resuming Simulated Annealing from checkpoint, trial "<<mNbTrial<<endl;
+   }
    // Do we need to update the display ?
    bool needUpdateDisplay=false;
    Chronometer chrono;
    chrono.start();
-   for(mNbTrial=1;mNbTrial<=nbSteps;)
+   // Time and trial of the last checkpoint
+   REAL lastCheckpointTime=0;
+   long lastCheckpointTrial=firstTrial;
+   for(mNbTrial=firstTrial;mNbTrial<=nbSteps;)
    {
       if((mNbTrial % nbTryPerTemp) == 1)
       {
@@ -1025,8 +2437,11 @@ void MonteCarloObj::RunSimulatedAnnealing(long &nbStep,const bool silent,
 
       this->NewConfiguration();
       accept=0;
-      REAL cost=this->GetLogLikelihood();
-      if(cost<mCurrentCost)
+      REAL cost,testCost;
+      if(pDelayed.get()!=0)
+         cost=pDelayed->GetTrialCost(0,lastParSavedSetIndex,mCurrentCost,mTemperature,testCost);
+      else testCost=cost=this->GetLogLikelihood();
+      if(testCost<mCurrentCost)
       {
          accept=1;
          mCurrentCost=cost;
@@ -1058,7 +2473,7 @@ void MonteCarloObj::RunSimulatedAnnealing(long &nbStep,const bool silent,
       }
       else
       {
-         if( log((rand()+1)/(REAL)RAND_MAX) < (-(cost-mCurrentCost)/mTemperature) )
+         if( log(RandomUniform()) < (-(testCost-mCurrentCost)/mTemperature) )
          {
             accept=1;
             mCurrentCost=cost;
@@ -1068,6 +2483,11 @@ void MonteCarloObj::RunSimulatedAnnealing(long &nbStep,const bool silent,
          }
       }
       if(accept==0) mRefParList.RestoreParamSet(lastParSavedSetIndex);
+      else
+      {
+         this->AdaptiveMoveAccepted();
+         if(pDelayed.get()!=0) pDelayed->Accepted(0,mCurrentCost);
+      }
 
       if( (mNbTrial % nbTryReport) == 0)
       {
@@ -1076,12 +2496,14 @@ void MonteCarloObj::RunSimulatedAnnealing(long &nbStep,const bool silent,
                           <<" Current Cost=" << mCurrentCost
                           <<" Accepting "<<(int)((REAL)nbAcceptedMoves/nbTryReport*100)
                           <<"% moves" << endl;
+         lastAcceptRate=(REAL)nbAcceptedMoves/nbTryReport;
          nbAcceptedMoves=0;
          #ifdef __WX__CRYST__
          if(0!=mpWXCrystObj) mpWXCrystObj->UpdateDisplayNbTrial();
          #endif
       }
       mNbTrial++;nbStep--;
+      this->ReportProgress(runBestCost,mCurrentCost,lastAcceptRate);
 
       #ifdef __WX__CRYST__
       mMutexStopAfterCycle.Lock();
@@ -1121,7 +2543,20 @@ void MonteCarloObj::RunSimulatedAnnealing(long &nbStep,const bool silent,
          needUpdateDisplay=false;
          mRefParList.RestoreParamSet(lastParSavedSetIndex);
       }
-
+      if(this->IsCheckpointDue(chrono.seconds(),lastCheckpointTime,lastCheckpointTrial))
+      {
+         lastCheckpointTime=chrono.seconds();
+         lastCheckpointTrial=mNbTrial;
+         Checkpoint c;
+         c.Set("nbStepTotal",nbSteps);
+         c.Set("runBestCost",runBestCost);
+         c.Set("nbAcceptedMoves",nbAcceptedMoves);
+         c.Set("nbAcceptedMovesTemp",nbAcceptedMovesTemp);
+         c.Set("nbTriesSinceBest",nbTriesSinceBest);
+         c.Set("lastPar",mRefParList.GetParamSet(lastParSavedSetIndex));
+         c.Set("runBestPar",mRefParList.GetParamSet(runBestIndex));
+         this->WriteCheckpoint(c,nbStep);
+      }
    }
    //cout<<"Beginning final LSQ refinement? ... ";
    if(mAutoLSQ.GetChoice()>0)
@@ -1159,6 +2594,9 @@ void MonteCarloObj::RunSimulatedAnnealing(long &nbStep,const bool silent,
    }
 
 
+   if((!silent)&&(pDelayed.get()!=0))
+      cout<<"Delayed acceptance: "<<pDelayed->mNbRejected<<" trials out of "<<pDelayed->mNbScreened
+          <<" rejected at low resolution"<<endl;
    mLastOptimTime=chrono.seconds();
    //Restore Best values
    mRefParList.RestoreParamSet(runBestIndex);
@@ -1365,7 +2803,7 @@ void MonteCarloObj::RunParticleSwarmOptimization(long &nbSteps, bool silent, dou
     TAU_PROFILE_TIMER(timerN, "MonteCarloObj::RunParticleSwarmOptimization() Finish", "", TAU_FIELD);
 
     // Keep a copy of the total number of steps,and decrement nbStep and number of free parameters
-    int nbStep = nbSteps;
+    int nbStep = (mpCheckpoint != 0) ? (int)mpCheckpoint->GetValue("nbStepTotal") : nbSteps;
     mNbTrial = 0;
     int NbFreePar = mRefParList.GetNbParNotFixed();
 
@@ -1402,7 +2840,7 @@ void MonteCarloObj::RunParticleSwarmOptimization(long &nbSteps, bool silent, dou
     double *v = new double[nbPart * NbFreePar];
     double *M = new double[NbFreePar];
     double *m = new double[nbPart * NbFreePar];
-    double runBestCost;
+    double runBestCost = __DBL_MAX__;
 
     // Communication variables
     int nbTrialsFromLastReport = 0;
@@ -1444,25 +2882,125 @@ void MonteCarloObj::RunParticleSwarmOptimization(long &nbSteps, bool silent, dou
 
     // Initialize arrays x (positions), v (velocities), M (current global minimum position), and m (particle's minima positions)
 
+    // Copies of the refined objects & optimization object used by each thread
+    unsigned int nbThread = mNbThread;
+    if (nbThread == 0)
+        nbThread = std::thread::hardware_concurrency();
+    if (nbThread > (unsigned int)nbPart)
+        nbThread = nbPart;
+    vector<unique_ptr<ThreadCopy> > vThread;
+    if (nbThread > 1)
+    {
+        try
+        {
+            for (unsigned int t = 0; t < nbThread; ++t)
+            {
+                vThread.push_back(unique_ptr<ThreadCopy>(new ThreadCopy));
+                ThreadCopy *pThread = vThread.back().get();
+                pThread->Init(*this);
+                MonteCarloObj *pOpt = pThread->mpOptObj;
+                pOpt->BeginOptimization(true);
+                pThread->mOptimizationBegun = true;
+                pOpt->PrepareRefParList();
+                if (!SameParList(pOpt->mRefParList, mRefParList))
+                    throw ObjCrystException("MonteCarloObj::RunParticleSwarmOptimization(): parameters differ in copied objects");
+                for (int i = 0; i < NbFreePar; i++)
+                    pOpt->mRefParList.GetParNotFixed(i).SetGlobalOptimStep(mRefParList.GetParNotFixed(i).GetGlobalOptimStep());
+                pThread->mParSetIndex = pOpt->mRefParList.CreateParamSet("Current particle parameters (PSO thread)");
+            }
+        }
+        catch (const ObjCrystException &except)
+        {
+            if (!silent)
+                cout << "Particle Swarm: cannot use " << nbThread << " threads, using only one" << endl;
+            vThread.clear();
+            nbThread = 1;
+        }
+        if (!silent && (nbThread > 1))
+            cout << "Particle Swarm: using " << nbThread << " threads" << endl;
+    }
+
+    // Move particle S from the configuration stored in parameter set idx of opt, using
+    // the steps dx, and compute its cost function
+    auto moveParticle = [&](MonteCarloObj &opt, const long idx, const int S, const double *dx)
+    {
+        opt.mRefParList.RestoreParamSet(idx);
+        for (int i = 0; i < NbFreePar; i++)
+            x[S * NbFreePar + i] = opt.move(x[S * NbFreePar + i], dx[S * NbFreePar + i], i);
+        costFunctionArray[S] = opt.GetLogLikelihood();
+        opt.mRefParList.SaveParamSet(idx);
+    };
+    // Parameters of each particle, exchanged with the threads
+    vector<CrystVector_REAL> vParticlePar(nbThread > 1 ? nbPart : 0);
+    // Move all particles using the steps dx, and compute their cost function. Only the
+    // parameters and the cost are exchanged with the threads, so the result does not
+    // depend on the number of threads.
+    auto moveAllParticles = [&](const double *dx)
+    {
+        TAU_PROFILE_START(timer1);
+        if (nbThread > 1)
+        {
+            for (int S = 0; S < nbPart; S++)
+                vParticlePar[S] = mRefParList.GetParamSet(lastParSetIndex(S));
+            auto runThreadParticles = [&](const unsigned int t)
+            {
+                try
+                {
+                    MonteCarloObj &opt = *(vThread[t]->mpOptObj);
+                    const long idx = vThread[t]->mParSetIndex;
+                    for (int S = t; S < nbPart; S += nbThread)
+                    {
+                        opt.mRefParList.GetParamSet(idx) = vParticlePar[S];
+                        moveParticle(opt, idx, S, dx);
+                        vParticlePar[S] = opt.mRefParList.GetParamSet(idx);
+                    }
+                }
+                catch (...)
+                {
+                    vThread[t]->mException = std::current_exception();
+                }
+            };
+            vector<std::thread> vStdThread;
+            for (unsigned int t = 1; t < nbThread; ++t)
+                vStdThread.push_back(std::thread(runThreadParticles, t));
+            runThreadParticles(0);
+            for (unsigned int t = 0; t < vStdThread.size(); ++t)
+                vStdThread[t].join();
+            for (unsigned int t = 0; t < nbThread; ++t)
+                if (vThread[t]->mException)
+                    std::rethrow_exception(vThread[t]->mException);
+            for (int S = 0; S < nbPart; S++)
+                mRefParList.GetParamSet(lastParSetIndex(S)) = vParticlePar[S];
+        }
+        else
+            for (int S = 0; S < nbPart; S++)
+                moveParticle(*this, lastParSetIndex(S), S, dx);
+        mCurrentCost = costFunctionArray[nbPart - 1];
+        TAU_PROFILE_STOP(timer1);
+    };
+
     // Initialize the particle's positions and velocities and calculate the cost function
+    // (all random numbers are drawn first, in the same order whatever the number of threads)
+    double *r = new double[nbPart * NbFreePar];
+    mRefParList.RestoreParamSet(paramSetAtBegining);
     for (int S = 0; S < nbPart; S++)
     {
-        mRefParList.RestoreParamSet(paramSetAtBegining);
         for (int i = 0; i < NbFreePar; i++)
         {
-            double r_number1 = ((double)rand() / RAND_MAX - 0.5);
-            double r_number2 = ((double)rand() / RAND_MAX - 0.5);
-            double parValue = mRefParList.GetParNotFixed(i).GetValue();
-            x[S * NbFreePar + i] = move(parValue, r_number1, i);
-            v[S * NbFreePar + i] = r_number2;
-            m[S * NbFreePar + i] = x[S * NbFreePar + i];
+            r[S * NbFreePar + i] = (RandomUniform() - 0.5);
+            v[S * NbFreePar + i] = (RandomUniform() - 0.5);
+            x[S * NbFreePar + i] = mRefParList.GetParNotFixed(i).GetValue();
         }
-
         lastParSetIndex(S) = mRefParList.CreateParamSet();
         mRefParList.SaveParamSet(lastParSetIndex(S));
-        costFunctionArray[S] = this->GetLogLikelihood();
+    }
+    moveAllParticles(r);
+    delete[] r;
+    for (int S = 0; S < nbPart; S++)
+    {
+        for (int i = 0; i < NbFreePar; i++)
+            m[S * NbFreePar + i] = x[S * NbFreePar + i];
         localMinimaCost[S] = costFunctionArray[S];
-        mCurrentCost = costFunctionArray[S];
         if (costFunctionArray[S] < costFunctionArray[bestParticle] || S == 0)
         {
             mRefParList.RestoreParamSet(lastParSetIndex(S));
@@ -1492,8 +3030,44 @@ void MonteCarloObj::RunParticleSwarmOptimization(long &nbSteps, bool silent, dou
    double c2i = 1.193;
    double c2f = 1.193;
 
+    // Resume from a checkpoint ?
+    int firstIteration = 0;
+    unique_ptr<Checkpoint> pResume(this->ResumeCheckpoint(nbSteps));
+    if (pResume.get() != 0)
+    {
+        firstIteration = (int)pResume->GetValue("iteration");
+        bestParticle = (int)pResume->GetValue("bestParticle");
+        runBestCost = pResume->GetValue("runBestCost");
+        prevBestCost = pResume->GetValue("prevBestCost");
+        changeOfGlobalMinimum = pResume->GetValue("changeOfGlobalMinimum") != 0;
+        currentIdenticalIterations = (int)pResume->GetValue("currentIdenticalIterations");
+        nbTrialsFromLastReport = (int)pResume->GetValue("nbTrialsFromLastReport");
+        pResume->Get("x", x, nbPart * NbFreePar);
+        pResume->Get("v", v, nbPart * NbFreePar);
+        pResume->Get("m", m, nbPart * NbFreePar);
+        pResume->Get("M", M, NbFreePar);
+        pResume->Get("cost", costFunctionArray, nbPart);
+        pResume->Get("localMinimaCost", localMinimaCost, nbPart);
+        pResume->Get("neighbourhoods", neighbourhoods, nbPart * K);
+        const vector<double> *pPar = &(pResume->Get("particlePar", nbPart * mRefParList.GetNbPar()));
+        for (int S = 0; S < nbPart; S++)
+        {
+            CrystVector_REAL *pSet = &(mRefParList.GetParamSet(lastParSetIndex(S)));
+            for (long j = 0; j < pSet->numElements(); j++)
+                (*pSet)(j) = (*pPar)[S * pSet->numElements() + j];
+        }
+        pResume->Get("runBestPar", mRefParList.GetParamSet(runBestIndex), mRefParList.GetNbPar());
+        mRefParList.RestoreParamSet(runBestIndex);
+        pResume.reset();
+        if (!silent)
+            cout << "Resuming Particle Swarm Optimization from checkpoint, trial " << mNbTrial << endl;
+    }
+    // Time and trial of the last checkpoint
+    REAL lastCheckpointTime = chrono.seconds();
+    long lastCheckpointTrial = mNbTrial;
+
     // Particle Swarm Optimization iteration cycle
-    for (int iteration = 0; iteration < nbStep; iteration = iteration + nbPart)
+    for (int iteration = firstIteration; iteration < nbStep; iteration = iteration + nbPart)
     {
         int accept = 0;
         // Select neighbours
@@ -1501,18 +3075,16 @@ void MonteCarloObj::RunParticleSwarmOptimization(long &nbSteps, bool silent, dou
         {
             for (int S = 0; S < nbPart; S++)
                 for (int k = 0; k < K; k++)
-                    neighbourhoods[S * K + k] = rand() % nbPart;
+                    neighbourhoods[S * K + k] = RandomInteger(nbPart);
         }
       double w = (w1-w2)*(nbStep-iteration)/nbStep + w2;
       double c1 = (c1f-c1i)*(iteration)/nbStep + c1i;
       double c2 = (c2f-c2i)*(iteration)/nbStep + c2i;
         changeOfGlobalMinimum = false;
 
-        // Move with all particles
+        // Compute the new velocities of all particles, then move them
         for (int S = 0; S < nbPart; S++)
         {
-            mRefParList.RestoreParamSet(lastParSetIndex(S));
-
             double neighbourhoodMinimum = localMinimaCost[S];
             int bestInHood = S;
             for (int k = 0; k < K; k++)
@@ -1526,25 +3098,16 @@ void MonteCarloObj::RunParticleSwarmOptimization(long &nbSteps, bool silent, dou
             if (S == bestInHood) // If the particle is the best in its neighbourhood the speed is calculated with the personal minimum only
             {
                 for (int i = 0; i < NbFreePar; i++)
-                {
-                    v[S * NbFreePar + i] = w * v[S * NbFreePar + i] + c1 * (double)rand() / RAND_MAX * (m[S * NbFreePar + i] - x[S * NbFreePar + i]);
-                    x[S * NbFreePar + i] = move(x[S * NbFreePar + i], v[S * NbFreePar + i], i);
-                }
+                    v[S * NbFreePar + i] = w * v[S * NbFreePar + i] + c1 * RandomUniform() * (m[S * NbFreePar + i] - x[S * NbFreePar + i]);
             }
             else // If the particle is not the best in its neighbourhood the speed is calculated with the personal and global minimum
             {
                 for (int i = 0; i < NbFreePar; i++)
-                {
-                    v[S * NbFreePar + i] = w * v[S * NbFreePar + i] + c1 * (double)rand() / RAND_MAX * (m[bestInHood * NbFreePar + i] - x[S * NbFreePar + i]) + c2 * (double)rand() / RAND_MAX * (m[S * NbFreePar + i] - x[S * NbFreePar + i]);
-                    x[S * NbFreePar + i] = move(x[S * NbFreePar + i], v[S * NbFreePar + i], i);
-                }
+                    v[S * NbFreePar + i] = w * v[S * NbFreePar + i] + c1 * RandomUniform() * (m[bestInHood * NbFreePar + i] - x[S * NbFreePar + i]) + c2 * RandomUniform() * (m[S * NbFreePar + i] - x[S * NbFreePar + i]);
             }
-
-            // Calculate the cost function
-            costFunctionArray[S] = this->GetLogLikelihood();
-            mCurrentCost = costFunctionArray[S];
-            mRefParList.SaveParamSet(lastParSetIndex(S));
         }
+        // Move the particles and calculate the cost function
+        moveAllParticles(v);
 
         // Check for changes of minima
         for (int S = 0; S < mParticles; S++)
@@ -1769,6 +3332,8 @@ if(S==26){
             lastUpdateDisplayTime = chrono.seconds();
         }
 
+        this->ReportProgress(mBestCost, mCurrentCost, -1);
+
 #ifdef __WX__CRYST__
         mMutexStopAfterCycle.Lock();
 #endif
@@ -1801,6 +3366,38 @@ if(S==26){
             break;
         }
         prevBestCost = runBestCost;
+
+        if (this->IsCheckpointDue(chrono.seconds(), lastCheckpointTime, lastCheckpointTrial))
+        {
+            lastCheckpointTime = chrono.seconds();
+            lastCheckpointTrial = mNbTrial;
+            Checkpoint c;
+            c.Set("nbStepTotal", nbStep);
+            c.Set("nbParticle", nbPart);
+            c.Set("iteration", iteration + nbPart);
+            c.Set("bestParticle", bestParticle);
+            c.Set("runBestCost", runBestCost);
+            c.Set("prevBestCost", prevBestCost);
+            c.Set("changeOfGlobalMinimum", changeOfGlobalMinimum);
+            c.Set("currentIdenticalIterations", currentIdenticalIterations);
+            c.Set("nbTrialsFromLastReport", nbTrialsFromLastReport);
+            c.Set("x", x, nbPart * NbFreePar);
+            c.Set("v", v, nbPart * NbFreePar);
+            c.Set("m", m, nbPart * NbFreePar);
+            c.Set("M", M, NbFreePar);
+            c.Set("cost", costFunctionArray, nbPart);
+            c.Set("localMinimaCost", localMinimaCost, nbPart);
+            c.Set("neighbourhoods", neighbourhoods, nbPart * K);
+            vector<double> *pPar = &(c.mData["particlePar"]);
+            for (int S = 0; S < nbPart; S++)
+            {
+                const CrystVector_REAL *pSet = &(mRefParList.GetParamSet(lastParSetIndex(S)));
+                for (long j = 0; j < pSet->numElements(); j++)
+                    pPar->push_back((*pSet)(j));
+            }
+            c.Set("runBestPar", mRefParList.GetParamSet(runBestIndex));
+            this->WriteCheckpoint(c, nbSteps);
+        }
 // #ifdef 0
 // string name = "res/loglikelyhood_" + to_string((int)mRun) + ".txt";
 //         ofstream file(name, std::ios::app);
@@ -2017,6 +3614,103 @@ double MonteCarloObj::move(double x, double v, int i)
     return x; // Return the updated particle's position
 }
 
+void MonteCarloObj::InitParallelTemperingSchedule(const long nbWorld,CrystVector_REAL &simAnnealTemp,
+                                                  CrystVector_REAL &mutationAmplitude)const
+{
+   // Init the different temperatures
+   for(int i=0;i<nbWorld;i++)
+   {
+      switch(mAnnealingScheduleTemp.GetChoice())
+      {
+         case ANNEALING_BOLTZMANN:
+            simAnnealTemp(i)=
+               mTemperatureMin*log((REAL)nbWorld)/log((REAL)(i+2));break;
+         case ANNEALING_CAUCHY:
+            simAnnealTemp(i)=mTemperatureMin*nbWorld/(i+1);break;
+         //case ANNEALING_QUENCHING:
+         case ANNEALING_EXPONENTIAL:
+            simAnnealTemp(i)=mTemperatureMax
+                           *pow(mTemperatureMin/mTemperatureMax,
+                                 i/(REAL)(nbWorld-1));break;
+         case ANNEALING_GAMMA:
+            simAnnealTemp(i)=mTemperatureMax+(mTemperatureMin-mTemperatureMax)
+                           *pow(i/(REAL)(nbWorld-1),mTemperatureGamma);break;
+         case ANNEALING_SMART:
+            simAnnealTemp(i)=mCurrentCost/(100.+(REAL)i/(REAL)nbWorld*900.);break;
+         default:
+            simAnnealTemp(i)=mCurrentCost/(100.+(REAL)i/(REAL)nbWorld*900.);break;
+      }
+   }
+   //Init the different mutation rate parameters
+   for(int i=0;i<nbWorld;i++)
+   {
+      switch(mAnnealingScheduleMutation.GetChoice())
+      {
+         case ANNEALING_BOLTZMANN:
+            mutationAmplitude(i)=
+               mMutationAmplitudeMin*log((REAL)(nbWorld-1))/log((REAL)(i+2));
+            break;
+         case ANNEALING_CAUCHY:
+            mutationAmplitude(i)=mMutationAmplitudeMin*(REAL)(nbWorld-1)/(i+1);break;
+         //case ANNEALING_QUENCHING:
+         case ANNEALING_EXPONENTIAL:
+            mutationAmplitude(i)=mMutationAmplitudeMax
+                           *pow(mMutationAmplitudeMin/mMutationAmplitudeMax,
+                                 i/(REAL)(nbWorld-1));break;
+         case ANNEALING_GAMMA:
+            mutationAmplitude(i)=mMutationAmplitudeMax+(mMutationAmplitudeMin-mMutationAmplitudeMax)
+                           *pow(i/(REAL)(nbWorld-1),mMutationAmplitudeGamma);break;
+         case ANNEALING_SMART:
+            mutationAmplitude(i)=sqrt(mMutationAmplitudeMin*mMutationAmplitudeMax);break;
+         default:
+            mutationAmplitude(i)=sqrt(mMutationAmplitudeMin*mMutationAmplitudeMax);break;
+      }
+   }
+}
+
+void MonteCarloObj::AdaptParallelTemperingSchedule(const CrystVector_REAL &acceptRate,
+                                                   CrystVector_REAL &simAnnealTemp,
+                                                   CrystVector_REAL &mutationAmplitude)const
+{
+   const long nbWorld=acceptRate.numElements();
+   if(ANNEALING_SMART==mAnnealingScheduleMutation.GetChoice())
+   {
+      for(int i=0;i<nbWorld;i++)
+      {
+         if(acceptRate(i)>0.30)
+            mutationAmplitude(i)*=2.;
+         if(acceptRate(i)<0.10)
+            mutationAmplitude(i)/=2.;
+         if(mutationAmplitude(i)>mMutationAmplitudeMax)
+            mutationAmplitude(i)=mMutationAmplitudeMax;
+         if(mutationAmplitude(i)<mMutationAmplitudeMin)
+            mutationAmplitude(i)=mMutationAmplitudeMin;
+      }
+   }
+   if(ANNEALING_SMART==mAnnealingScheduleTemp.GetChoice())
+   {
+      for(int i=0;i<nbWorld;i++)
+      {
+         if(acceptRate(i)>0.30)
+            simAnnealTemp(i)/=1.5;
+         if(acceptRate(i)>0.80)
+            simAnnealTemp(i)/=1.5;
+         if(acceptRate(i)>0.95)
+            simAnnealTemp(i)/=1.5;
+
+         if(acceptRate(i)<0.10)
+            simAnnealTemp(i)*=1.5;
+         if(acceptRate(i)<0.04)
+             simAnnealTemp(i)*=1.5;
+         //if(acceptRate(i)<0.01)
+         //   simAnnealTemp(i)*=1.5;
+         //cout<<"World#"<<i<<":"<<worldNbAcceptedMoves(i)<<":"<<nbTrialsReport<<endl;
+         //if(simAnnealTemp(i)>mTemperatureMax) simAnnealTemp(i)=mTemperatureMax;
+         //if(simAnnealTemp(i)<mTemperatureMin) simAnnealTemp(i)=mTemperatureMin;
+      }
+   }
+}
+
 void MonteCarloObj::RunParallelTempering(long &nbStep,const bool silent,
                                          const REAL finalcost,const REAL maxTime)
 {
@@ -2027,7 +3721,7 @@ void MonteCarloObj::RunParallelTempering(long &nbStep,const bool silent,
    TAU_PROFILE_TIMER(timerN,"MonteCarloObj::RunParallelTempering() Finish","", TAU_FIELD);
    TAU_PROFILE_START(timer0a);
    //Keep a copy of the total number of steps, and decrement nbStep
-   const long nbSteps=nbStep;
+   const long nbSteps=(mpCheckpoint!=0)?(long)mpCheckpoint->GetValue("nbStepTotal"):nbStep;
    unsigned int accept;// 1 if last trial was accepted? 2 if new best config ? else 0
    mNbTrial=0;
    // time (in seconds) when last autoSave was made (if enabled)
@@ -2037,72 +3731,28 @@ void MonteCarloObj::RunParallelTempering(long &nbStep,const bool silent,
    const unsigned int autoLSQPeriod=150000;
 
    if(!silent) cout << "Starting Parallel Tempering Optimization"<<endl;
+   // Number of threads, each working on its own copy of the refined objects
+      unsigned int nbThread=mNbThread;
+      if(nbThread==0) nbThread=std::thread::hardware_concurrency();
+      if(nbThread>mNbWorld) nbThread=mNbWorld;
    //Total number of parallel refinements,each is a 'World'. The most stable
    // world must be i=nbWorld-1, and the most changing World (high mutation,
    // high temperature) is i=0.
-      const long nbWorld=30;
+      const long nbWorld=mNbWorld;
       CrystVector_long worldSwapIndex(nbWorld);
       for(int i=0;i<nbWorld;++i) worldSwapIndex(i)=i;
    // Number of successive trials for each World. At the end of these trials
    // a swap is tried with the upper World (eg i-1). This number effectvely sets
    // the rate of swapping.
-      const int nbTryPerWorld=10;
+      const int nbTryPerWorld=mNbTrialPerWorld;
    // Initialize the costs
       mCurrentCost=this->GetLogLikelihood();
       REAL runBestCost=mCurrentCost;
       CrystVector_REAL currentCost(nbWorld);
       currentCost=mCurrentCost;
-   // Init the different temperatures
-      CrystVector_REAL simAnnealTemp(nbWorld);
-      for(int i=0;i<nbWorld;i++)
-      {
-         switch(mAnnealingScheduleTemp.GetChoice())
-         {
-            case ANNEALING_BOLTZMANN:
-               simAnnealTemp(i)=
-                  mTemperatureMin*log((REAL)nbWorld)/log((REAL)(i+2));break;
-            case ANNEALING_CAUCHY:
-               simAnnealTemp(i)=mTemperatureMin*nbWorld/(i+1);break;
-            //case ANNEALING_QUENCHING:
-            case ANNEALING_EXPONENTIAL:
-               simAnnealTemp(i)=mTemperatureMax
-                              *pow(mTemperatureMin/mTemperatureMax,
-                                    i/(REAL)(nbWorld-1));break;
-            case ANNEALING_GAMMA:
-               simAnnealTemp(i)=mTemperatureMax+(mTemperatureMin-mTemperatureMax)
-                              *pow(i/(REAL)(nbWorld-1),mTemperatureGamma);break;
-            case ANNEALING_SMART:
-               simAnnealTemp(i)=mCurrentCost/(100.+(REAL)i/(REAL)nbWorld*900.);break;
-            default:
-               simAnnealTemp(i)=mCurrentCost/(100.+(REAL)i/(REAL)nbWorld*900.);break;
-         }
-      }
-   //Init the different mutation rate parameters
-      CrystVector_REAL mutationAmplitude(nbWorld);
-      for(int i=0;i<nbWorld;i++)
-      {
-         switch(mAnnealingScheduleMutation.GetChoice())
-         {
-            case ANNEALING_BOLTZMANN:
-               mutationAmplitude(i)=
-                  mMutationAmplitudeMin*log((REAL)(nbWorld-1))/log((REAL)(i+2));
-               break;
-            case ANNEALING_CAUCHY:
-               mutationAmplitude(i)=mMutationAmplitudeMin*(REAL)(nbWorld-1)/(i+1);break;
-            //case ANNEALING_QUENCHING:
-            case ANNEALING_EXPONENTIAL:
-               mutationAmplitude(i)=mMutationAmplitudeMax
-                              *pow(mMutationAmplitudeMin/mMutationAmplitudeMax,
-                                    i/(REAL)(nbWorld-1));break;
-            case ANNEALING_GAMMA:
-               mutationAmplitude(i)=mMutationAmplitudeMax+(mMutationAmplitudeMin-mMutationAmplitudeMax)
-                              *pow(i/(REAL)(nbWorld-1),mMutationAmplitudeGamma);break;
-            case ANNEALING_SMART:
-               mutationAmplitude(i)=sqrt(mMutationAmplitudeMin*mMutationAmplitudeMax);break;
-            default:
-               mutationAmplitude(i)=sqrt(mMutationAmplitudeMin*mMutationAmplitudeMax);break;
-         }
-      }
+   // Init the different temperatures and mutation rate parameters
+      CrystVector_REAL simAnnealTemp(nbWorld),mutationAmplitude(nbWorld);
+      this->InitParallelTemperingSchedule(nbWorld,simAnnealTemp,mutationAmplitude);
    // Init the parameter sets for each World
    // All Worlds start from the same (current) configuration.
       CrystVector_long worldCurrentSetIndex(nbWorld);
@@ -2149,103 +3799,285 @@ void MonteCarloObj::RunParallelTempering(long &nbStep,const bool silent,
       //CrystMatrix_REAL trialsDensity(100,nbWorld+1);
       //trialsDensity=0;
       //for(int i=0;i<100;i++) trialsDensity(i,0)=i/(float)100;
+   // Copies of the refined objects & optimization object used by each thread
+      vector<unique_ptr<ThreadCopy> > vThread;
+      if(nbThread>1)
+      {
+         try
+         {
+            for(unsigned int t=0;t<nbThread;++t)
+            {
+               vThread.push_back(unique_ptr<ThreadCopy>(new ThreadCopy));
+               ThreadCopy *pThread=vThread.back().get();
+               pThread->Init(*this);
+               MonteCarloObj *pOpt=pThread->mpOptObj;
+               pOpt->BeginOptimization(true);
+               pThread->mOptimizationBegun=true;
+               pOpt->PrepareRefParList();
+               if(!SameParList(pOpt->mRefParList,mRefParList))
+                  throw ObjCrystException("MonteCarloObj::RunParallelTempering(): parameters differ in copied objects");
+               pOpt->InitAdaptiveMove();
+               pThread->mParSetIndex=pOpt->mRefParList.CreateParamSet("Current world parameters (PT thread)");
+            }
+         }
+         catch(const ObjCrystException &except)
+         {
+            if(!silent) cout<<"Parallel Tempering: cannot use "<<nbThread<<" threads, using only one"<<endl;
+            vThread.clear();
+            nbThread=1;
+         }
+         if(!silent && (nbThread>1)) cout<<"Parallel Tempering: using "<<nbThread<<" threads"<<endl;
+      }
+      // Independent streams of random numbers for the worlds computed by the threads
+      vector<RandomGenerator> vWorldRandom;
+      if(nbThread>1)
+         for(int i=0;i<nbWorld;i++) vWorldRandom.push_back(mRandom.Split());
+      // Parameters and best cost & configuration reached during the last cycle, for each World
+      vector<CrystVector_REAL> vWorldPar(nbWorld),vWorldBestPar(nbWorld);
+      CrystVector_REAL worldBestCost(nbWorld);
+      // Run nbTryPerWorld trials for the Worlds handled by one thread
+      auto runThreadWorlds=[&](const unsigned int t)
+      {
+         try
+         {
+            MonteCarloObj &opt=*(vThread[t]->mpOptObj);
+            const long idx=vThread[t]->mParSetIndex;
+            for(long i=t;i<nbWorld;i+=nbThread)
+            {
+               RandomGenerator::Scope randomScope(vWorldRandom[i]);
+               opt.mContext=i;
+               opt.mMutationAmplitude=mutationAmplitude(i);
+               opt.mTemperature=simAnnealTemp(i);
+               opt.mRefParList.GetParamSet(idx)=vWorldPar[i];
+               for(int j=0;j<nbTryPerWorld;j++)
+               {
+                  opt.mRefParList.RestoreParamSet(idx);
+                  opt.NewConfiguration();
+                  const REAL cost=opt.GetLogLikelihood();
+                  if(  (cost<currentCost(i))
+                     ||(log(RandomUniform())<(-(cost-currentCost(i))/opt.mTemperature)))
+                  {
+                     currentCost(i)=cost;
+                     opt.mRefParList.SaveParamSet(idx);
+                     opt.AdaptiveMoveAccepted();
+                     worldNbAcceptedMoves(i)++;
+                     if(cost<worldBestCost(i))
+                     {
+                        worldBestCost(i)=cost;
+                        vWorldBestPar[i]=opt.mRefParList.GetParamSet(idx);
+                     }
+                  }
+               }
+               vWorldPar[i]=opt.mRefParList.GetParamSet(idx);
+            }
+         }
+         catch(...)
+         {
+            vThread[t]->mException=std::current_exception();
+         }
+      };
+      this->InitAdaptiveMove();
+   // Screen trials at low resolution (only when the worlds are computed by this object)
+      unique_ptr<DelayedAcceptance> pDelayed;
+      if(nbThread==1) pDelayed.reset(this->CreateDelayedAcceptance(nbWorld,silent));
+   // Resume from a checkpoint ?
+      unique_ptr<Checkpoint> pResume(this->ResumeCheckpoint(nbStep));
+      if(pResume.get()!=0)
+      {
+         runBestCost=pResume->GetValue("runBestCost");
+         pResume->Get("worldSwapIndex",worldSwapIndex,nbWorld);
+         pResume->Get("worldCost",currentCost,nbWorld);
+         pResume->Get("worldTemperature",simAnnealTemp,nbWorld);
+         pResume->Get("worldMutationAmplitude",mutationAmplitude,nbWorld);
+         pResume->Get("worldNbAcceptedMoves",worldNbAcceptedMoves,nbWorld);
+         const vector<double> *pPar=&(pResume->Get("worldPar",nbWorld*mRefParList.GetNbPar()));
+         for(int i=0;i<nbWorld;i++)
+         {
+            CrystVector_REAL *pSet=&(mRefParList.GetParamSet(worldCurrentSetIndex(i)));
+            for(long j=0;j<pSet->numElements();j++) (*pSet)(j)=(*pPar)[i*pSet->numElements()+j];
+         }
+         pResume->Get("runBestPar",mRefParList.GetParamSet(runBestIndex),mRefParList.GetNbPar());
+         if(pResume->mData.count("worldRandomState")>0)
+            for(unsigned int i=0;i<vWorldRandom.size();i++)
+               pResume->GetRandomState("worldRandomState",vWorldRandom[i],i);
+         mRefParList.RestoreParamSet(worldCurrentSetIndex(nbWorld-1));
+         pResume.reset();
+         if(!silent) cout << "Resuming Parallel Tempering from checkpoint, trial "<<mNbTrial<<endl;
+      }
+   // Time and trial of the last checkpoint
+      REAL lastCheckpointTime=0;
+      long lastCheckpointTrial=mNbTrial;
    // Do we need to update the display ?
    bool needUpdateDisplay=false;
    //Do the refinement
    bool makeReport=false;
+   // Fraction of accepted moves (all worlds) during the last report interval, for progress reports
+   REAL lastAcceptRate=-1;
    Chronometer chrono;
    chrono.start();
    float lastUpdateDisplayTime=chrono.seconds();
    TAU_PROFILE_STOP(timer0b);
    for(;mNbTrial<nbSteps;)
    {
-      for(int i=0;i<nbWorld;i++)
-      {
-         mContext=i;
-         //mRefParList.RestoreParamSet(worldCurrentSetIndex(i));
-         mMutationAmplitude=mutationAmplitude(i);
-         mTemperature=simAnnealTemp(i);
-         for(int j=0;j<nbTryPerWorld;j++)
+      if(nbThread>1)
+      {// Trials for all Worlds, computed in parallel with the copied objects
+         TAU_PROFILE_START(timer1);
+         for(int i=0;i<nbWorld;i++) vWorldPar[i]=mRefParList.GetParamSet(worldCurrentSetIndex(i));
+         worldBestCost=runBestCost;
+         vector<std::thread> vStdThread;
+         for(unsigned int t=1;t<nbThread;++t) vStdThread.push_back(std::thread(runThreadWorlds,t));
+         runThreadWorlds(0);
+         for(unsigned int t=0;t<vStdThread.size();++t) vStdThread[t].join();
+         TAU_PROFILE_STOP(timer1);
+         for(unsigned int t=0;t<nbThread;++t)
+            if(vThread[t]->mException) std::rethrow_exception(vThread[t]->mException);
+         for(int i=0;i<nbWorld;i++) mRefParList.GetParamSet(worldCurrentSetIndex(i))=vWorldPar[i];
+         const long nbTrialCycle=nbTryPerWorld*nbWorld;
+         if(((mNbTrial+nbTrialCycle)/nbTrialsReport)>(mNbTrial/nbTrialsReport)) makeReport=true;
+         mNbTrial+=nbTrialCycle;nbStep-=nbTrialCycle;
+         // Best configuration found during this cycle ?
+         long iBest=-1;
+         for(int i=0;i<nbWorld;i++)
+            if(worldBestCost(i)<runBestCost)
+            {
+               runBestCost=worldBestCost(i);
+               iBest=i;
+            }
+         if(iBest>=0)
          {
-            //mRefParList.SaveParamSet(lastParSavedSetIndex);
-            TAU_PROFILE_START(timer1);
-            mRefParList.RestoreParamSet(worldCurrentSetIndex(i));
-            this->NewConfiguration();
-            accept=0;
-            REAL cost=this->GetLogLikelihood();
-            TAU_PROFILE_STOP(timer1);
-            //trialsDensity((long)(cost*100.),i+1)+=1;
-            if(cost<currentCost(i))
+            mRefParList.GetParamSet(runBestIndex)=vWorldBestPar[iBest];
+            mRefParList.RestoreParamSet(runBestIndex);
+            this->TagNewBestConfig();
+            needUpdateDisplay=true;
+            if(runBestCost<mBestCost)
             {
-               accept=1;
-               currentCost(i)=cost;
-               mRefParList.SaveParamSet(worldCurrentSetIndex(i));
-               if(cost<runBestCost)
-               {
-                  accept=2;
-                  runBestCost=currentCost(i);
-                  this->TagNewBestConfig();
-                  needUpdateDisplay=true;
-
-                  mRefParList.SaveParamSet(runBestIndex);
-                  if(runBestCost<mBestCost)
-                  {
-                     mBestCost=currentCost(i);
-                     mRefParList.SaveParamSet(mBestParSavedSetIndex);
-                     if(!silent) cout << "->Trial :" << mNbTrial
-                                   << " World="<< worldSwapIndex(i)
-                                   << " Temp="<< mTemperature
-                                   << " Mutation Ampl.: "<<mMutationAmplitude
-                                   << " NEW OVERALL Best Cost="<<mBestCost<< endl;
-                  }
-                  else if(!silent) cout << "->Trial :" << mNbTrial
-                                   << " World="<< worldSwapIndex(i)
-                                   << " Temp="<< mTemperature
-                                   << " Mutation Ampl.: "<<mMutationAmplitude
-                                   << " NEW RUN Best Cost="<<runBestCost<< endl;
-                  if(!silent) this->DisplayReport();
-               }
-               worldNbAcceptedMoves(i)++;
+               mBestCost=runBestCost;
+               mRefParList.SaveParamSet(mBestParSavedSetIndex);
+               if(!silent) cout << "->Trial :" << mNbTrial
+                             << " World="<< worldSwapIndex(iBest)
+                             << " Temp="<< simAnnealTemp(iBest)
+                             << " Mutation Ampl.: "<<mutationAmplitude(iBest)
+                             << " NEW OVERALL Best Cost="<<mBestCost<< endl;
             }
-            else
+            else if(!silent) cout << "->Trial :" << mNbTrial
+                             << " World="<< worldSwapIndex(iBest)
+                             << " Temp="<< simAnnealTemp(iBest)
+                             << " Mutation Ampl.: "<<mutationAmplitude(iBest)
+                             << " NEW RUN Best Cost="<<runBestCost<< endl;
+            if(!silent) this->DisplayReport();
+         }
+         if(  ((mXMLAutoSave.GetChoice()==1)&&((chrono.seconds()-secondsWhenAutoSave)>86400))
+            ||((mXMLAutoSave.GetChoice()==2)&&((chrono.seconds()-secondsWhenAutoSave)>3600))
+            ||((mXMLAutoSave.GetChoice()==3)&&((chrono.seconds()-secondsWhenAutoSave)> 600))
+            ||((mXMLAutoSave.GetChoice()==4)&&(iBest>=0)) )
+         {
+            secondsWhenAutoSave=(unsigned long)chrono.seconds();
+            string saveFileName=this->GetName();
+            time_t date=time(0);
+            char strDate[40];
+            strftime(strDate,sizeof(strDate),"%Y-%m-%d_%H-%M-%S",localtime(&date));//%Y-%m-%dT%H:%M:%S%Z
+            char costAsChar[30];
+            mRefParList.RestoreParamSet(mBestParSavedSetIndex);
+            sprintf(costAsChar,"-Cost-%f",this->GetLogLikelihood());
+            saveFileName=saveFileName+(string)strDate+(string)costAsChar+(string)".xml";
+            XMLCrystFileSaveGlobal(saveFileName);
+         }
+      }
+      else
+         for(int i=0;i<nbWorld;i++)
+         {
+            mContext=i;
+            //mRefParList.RestoreParamSet(worldCurrentSetIndex(i));
+            mMutationAmplitude=mutationAmplitude(i);
+            mTemperature=simAnnealTemp(i);
+            for(int j=0;j<nbTryPerWorld;j++)
             {
-               if(log((rand()+1)/(REAL)RAND_MAX)<(-(cost-currentCost(i))/mTemperature) )
+               //mRefParList.SaveParamSet(lastParSavedSetIndex);
+               TAU_PROFILE_START(timer1);
+               mRefParList.RestoreParamSet(worldCurrentSetIndex(i));
+               this->NewConfiguration();
+               accept=0;
+               REAL cost,testCost;
+               if(pDelayed.get()!=0)
+                  cost=pDelayed->GetTrialCost(i,worldCurrentSetIndex(i),currentCost(i),mTemperature,testCost);
+               else testCost=cost=this->GetLogLikelihood();
+               TAU_PROFILE_STOP(timer1);
+               //trialsDensity((long)(cost*100.),i+1)+=1;
+               if(testCost<currentCost(i))
                {
                   accept=1;
                   currentCost(i)=cost;
                   mRefParList.SaveParamSet(worldCurrentSetIndex(i));
+                  if(cost<runBestCost)
+                  {
+                     accept=2;
+                     runBestCost=currentCost(i);
+                     this->TagNewBestConfig();
+                     needUpdateDisplay=true;
+
+                     mRefParList.SaveParamSet(runBestIndex);
+                     if(runBestCost<mBestCost)
+                     {
+                        mBestCost=currentCost(i);
+                        mRefParList.SaveParamSet(mBestParSavedSetIndex);
+                        if(!silent) cout << "->Trial :" << mNbTrial
+                                      << " World="<< worldSwapIndex(i)
+                                      << " Temp="<< mTemperature
+                                      << " Mutation Ampl.: "<<mMutationAmplitude
+                                      << " NEW OVERALL Best Cost="<<mBestCost<< endl;
+                     }
+                     else if(!silent) cout << "->Trial :" << mNbTrial
+                                      << " World="<< worldSwapIndex(i)
+                                      << " Temp="<< mTemperature
+                                      << " Mutation Ampl.: "<<mMutationAmplitude
+                                      << " NEW RUN Best Cost="<<runBestCost<< endl;
+                     if(!silent) this->DisplayReport();
+                  }
+                  this->AdaptiveMoveAccepted();
+                  if(pDelayed.get()!=0) pDelayed->Accepted(i,cost);
                   worldNbAcceptedMoves(i)++;
                }
-            }
-            //if(accept==1 && i==(nbWorld-1)){this->UpdateDisplay();}
-            if(  ((mXMLAutoSave.GetChoice()==1)&&((chrono.seconds()-secondsWhenAutoSave)>86400))
-               ||((mXMLAutoSave.GetChoice()==2)&&((chrono.seconds()-secondsWhenAutoSave)>3600))
-               ||((mXMLAutoSave.GetChoice()==3)&&((chrono.seconds()-secondsWhenAutoSave)> 600))
-               ||((mXMLAutoSave.GetChoice()==4)&&(accept==2)) )
-            {
-               secondsWhenAutoSave=(unsigned long)chrono.seconds();
-               string saveFileName=this->GetName();
-               time_t date=time(0);
-               char strDate[40];
-               strftime(strDate,sizeof(strDate),"%Y-%m-%d_%H-%M-%S",localtime(&date));//%Y-%m-%dT%H:%M:%S%Z
-               char costAsChar[30];
-               if(accept!=2) mRefParList.RestoreParamSet(mBestParSavedSetIndex);
-               sprintf(costAsChar,"-Cost-%f",this->GetLogLikelihood());
-               saveFileName=saveFileName+(string)strDate+(string)costAsChar+(string)".xml";
-               XMLCrystFileSaveGlobal(saveFileName);
-               //if(accept!=2) mRefParList.RestoreParamSet(lastParSavedSetIndex);
-            }
-            //if(accept==0) mRefParList.RestoreParamSet(lastParSavedSetIndex);
-            mNbTrial++;nbStep--;
-            if((mNbTrial%nbTrialsReport)==0) makeReport=true;
-         }//nbTryPerWorld trials
-      }//For each World
+               else
+               {
+                  if(log(RandomUniform())<(-(testCost-currentCost(i))/mTemperature) )
+                  {
+                     accept=1;
+                     currentCost(i)=cost;
+                     mRefParList.SaveParamSet(worldCurrentSetIndex(i));
+                     this->AdaptiveMoveAccepted();
+                     if(pDelayed.get()!=0) pDelayed->Accepted(i,cost);
+                     worldNbAcceptedMoves(i)++;
+                  }
+               }
+               //if(accept==1 && i==(nbWorld-1)){this->UpdateDisplay();}
+               if(  ((mXMLAutoSave.GetChoice()==1)&&((chrono.seconds()-secondsWhenAutoSave)>86400))
+                  ||((mXMLAutoSave.GetChoice()==2)&&((chrono.seconds()-secondsWhenAutoSave)>3600))
+                  ||((mXMLAutoSave.GetChoice()==3)&&((chrono.seconds()-secondsWhenAutoSave)> 600))
+                  ||((mXMLAutoSave.GetChoice()==4)&&(accept==2)) )
+               {
+                  secondsWhenAutoSave=(unsigned long)chrono.seconds();
+                  string saveFileName=this->GetName();
+                  time_t date=time(0);
+                  char strDate[40];
+                  strftime(strDate,sizeof(strDate),"%Y-%m-%d_%H-%M-%S",localtime(&date));//%Y-%m-%dT%H:%M:%S%Z
+                  char costAsChar[30];
+                  if(accept!=2) mRefParList.RestoreParamSet(mBestParSavedSetIndex);
+                  sprintf(costAsChar,"-Cost-%f",this->GetLogLikelihood());
+                  saveFileName=saveFileName+(string)strDate+(string)costAsChar+(string)".xml";
+                  XMLCrystFileSaveGlobal(saveFileName);
+                  //if(accept!=2) mRefParList.RestoreParamSet(lastParSavedSetIndex);
+               }
+               //if(accept==0) mRefParList.RestoreParamSet(lastParSavedSetIndex);
+               mNbTrial++;nbStep--;
+               if((mNbTrial%nbTrialsReport)==0) makeReport=true;
+            }//nbTryPerWorld trials
+         }//For each World
 
       if(mAutoLSQ.GetChoice()==2)
          if((mNbTrial%autoLSQPeriod)<(nbTryPerWorld*nbWorld))
          {// Try a quick LSQ ?
             for(int i=0;i<mRefinedObjList.GetNb();i++) mRefinedObjList.GetObj(i).SetApproximationFlag(false);
-            for(int i=nbWorld-5;i<nbWorld;i++)
+            for(int i=(nbWorld>5?nbWorld-5:0);i<nbWorld;i++)
             {
                #ifdef __WX__CRYST__
                mMutexStopAfterCycle.Lock();
@@ -2299,7 +4131,7 @@ void MonteCarloObj::RunParallelTempering(long &nbStep,const bool silent,
             //  Need to go back to optimization with approximations allowed (they are not during LSQ)
             for(int i=0;i<mRefinedObjList.GetNb();i++) mRefinedObjList.GetObj(i).SetApproximationFlag(true);
             // And recompute LLK - since they will be lower
-            for(int i=nbWorld-5;i<nbWorld;i++)
+            for(int i=(nbWorld>5?nbWorld-5:0);i<nbWorld;i++)
             {
                mRefParList.RestoreParamSet(worldCurrentSetIndex(i));
                const REAL cost=this->GetLogLikelihood();
@@ -2357,14 +4189,14 @@ void MonteCarloObj::RunParallelTempering(long &nbStep,const bool silent,
          cout<<i<<":"<<currentCost(i)<<":"<<this->GetLogLikelihood()<<endl;
          #endif
          #if 1
-         if( log((rand()+1)/(REAL)RAND_MAX)
+         if( log(RandomUniform())
                 < (-(currentCost(i-1)-currentCost(i))/simAnnealTemp(i)))
          #else
          // Compare World (i-1) and World (i) with the same amplitude,
          // hence the same max likelihood error
          mRefParList.RestoreParamSet(worldCurrentSetIndex(i-1));
          mMutationAmplitude=mutationAmplitude(i);
-         if( log((rand()+1)/(REAL)RAND_MAX)
+         if( log(RandomUniform())
                 < (-(this->GetLogLikelihood()-currentCost(i))/simAnnealTemp(i)))
          #endif
          {
@@ -2403,14 +4235,14 @@ void MonteCarloObj::RunParallelTempering(long &nbStep,const bool silent,
                "MonteCarloObj::Optimize (Try mating Worlds)"\
                ,"", TAU_FIELD);
       TAU_PROFILE_START(timer1);
-      if( (rand()/(REAL)RAND_MAX)<.1)
+      if( RandomUniform()<.1)
       for(int k=nbWorld-1;k>nbWorld/2;k--)
          for(int i=k-nbWorld/3;i<k;i++)
          {
             #if 0
             // Random switching of gene groups
             for(unsigned int j=0;j<nbGeneGroup;j++)
-               crossoverGroupIndex(j)= (int) floor(rand()/((REAL)RAND_MAX-1)*2);
+               crossoverGroupIndex(j)= (int) RandomInteger(2);
             for(int j=0;j<mRefParList.GetNbPar();j++)
             {
                if(0==crossoverGroupIndex(refParGeneGroupIndex(j)-1))
@@ -2432,9 +4264,9 @@ void MonteCarloObj::RunParallelTempering(long &nbStep,const bool silent,
             #if 1
             // Switch gene groups in two parts
             unsigned int crossoverPoint1=
-               (int)(1+floor(rand()/((REAL)RAND_MAX-1)*(nbGeneGroup)));
+               (int)(1+RandomInteger(nbGeneGroup));
             unsigned int crossoverPoint2=
-               (int)(1+floor(rand()/((REAL)RAND_MAX-1)*(nbGeneGroup)));
+               (int)(1+RandomInteger(nbGeneGroup));
             if(crossoverPoint2<crossoverPoint1)
             {
                int tmp=crossoverPoint1;
@@ -2466,7 +4298,7 @@ void MonteCarloObj::RunParallelTempering(long &nbStep,const bool silent,
                if(junk==0) mRefParList.RestoreParamSet(parSetOffspringA);
                else mRefParList.RestoreParamSet(parSetOffspringB);
                REAL cost=this->GetLogLikelihood();
-               //if(log((rand()+1)/(REAL)RAND_MAX)
+               //if(log(RandomUniform())
                //    < (-(cost-currentCost(k))/simAnnealTemp(k)))
                if(cost<currentCost(k))
                {
@@ -2613,43 +4445,11 @@ void MonteCarloObj::RunParallelTempering(long &nbStep,const bool silent,
          }
          if(!silent) cout <<"Trial :" << mNbTrial << " Best Cost=" << runBestCost<< " ";
          if(!silent) chrono.print();
-         //Change the mutation rate if necessary for each world
-         if(ANNEALING_SMART==mAnnealingScheduleMutation.GetChoice())
-         {
-            for(int i=0;i<nbWorld;i++)
-            {
-               if((worldNbAcceptedMoves(i)/(REAL)nbTrialsReport)>0.30)
-                  mutationAmplitude(i)*=2.;
-               if((worldNbAcceptedMoves(i)/(REAL)nbTrialsReport)<0.10)
-                  mutationAmplitude(i)/=2.;
-               if(mutationAmplitude(i)>mMutationAmplitudeMax)
-                  mutationAmplitude(i)=mMutationAmplitudeMax;
-               if(mutationAmplitude(i)<mMutationAmplitudeMin)
-                  mutationAmplitude(i)=mMutationAmplitudeMin;
-            }
-         }
-         if(ANNEALING_SMART==mAnnealingScheduleTemp.GetChoice())
-         {
-            for(int i=0;i<nbWorld;i++)
-            {
-               if((worldNbAcceptedMoves(i)/(REAL)nbTrialsReport)>0.30)
-                  simAnnealTemp(i)/=1.5;
-               if((worldNbAcceptedMoves(i)/(REAL)nbTrialsReport)>0.80)
-                  simAnnealTemp(i)/=1.5;
-               if((worldNbAcceptedMoves(i)/(REAL)nbTrialsReport)>0.95)
-                  simAnnealTemp(i)/=1.5;
-
-               if((worldNbAcceptedMoves(i)/(REAL)nbTrialsReport)<0.10)
-                  simAnnealTemp(i)*=1.5;
-               if((worldNbAcceptedMoves(i)/(REAL)nbTrialsReport)<0.04)
-                   simAnnealTemp(i)*=1.5;
-               //if((worldNbAcceptedMoves(i)/(REAL)nbTrialsReport)<0.01)
-               //   simAnnealTemp(i)*=1.5;
-               //cout<<"World#"<<i<<":"<<worldNbAcceptedMoves(i)<<":"<<nbTrialsReport<<endl;
-               //if(simAnnealTemp(i)>mTemperatureMax) simAnnealTemp(i)=mTemperatureMax;
-               //if(simAnnealTemp(i)<mTemperatureMin) simAnnealTemp(i)=mTemperatureMin;
-            }
-         }
+         //Change the mutation rate and temperature if necessary for each world
+         CrystVector_REAL acceptRate(nbWorld);
+         for(int i=0;i<nbWorld;i++) acceptRate(i)=worldNbAcceptedMoves(i)/(REAL)nbTrialsReport;
+         lastAcceptRate=acceptRate.sum()/nbWorld;
+         this->AdaptParallelTemperingSchedule(acceptRate,simAnnealTemp,mutationAmplitude);
          worldNbAcceptedMoves=0;
          //this->DisplayReport();
 
@@ -2664,6 +4464,31 @@ void MonteCarloObj::RunParallelTempering(long &nbStep,const bool silent,
          needUpdateDisplay=false;
          lastUpdateDisplayTime=chrono.seconds();
       }
+      if(this->IsCheckpointDue(chrono.seconds(),lastCheckpointTime,lastCheckpointTrial))
+      {
+         lastCheckpointTime=chrono.seconds();
+         lastCheckpointTrial=mNbTrial;
+         Checkpoint c;
+         c.Set("nbStepTotal",nbSteps);
+         c.Set("nbWorld",nbWorld);
+         c.Set("runBestCost",runBestCost);
+         c.Set("worldSwapIndex",worldSwapIndex);
+         c.Set("worldCost",currentCost);
+         c.Set("worldTemperature",simAnnealTemp);
+         c.Set("worldMutationAmplitude",mutationAmplitude);
+         c.Set("worldNbAcceptedMoves",worldNbAcceptedMoves);
+         vector<double> *pPar=&(c.mData["worldPar"]);
+         for(int i=0;i<nbWorld;i++)
+         {
+            const CrystVector_REAL *pSet=&(mRefParList.GetParamSet(worldCurrentSetIndex(i)));
+            for(long j=0;j<pSet->numElements();j++) pPar->push_back((*pSet)(j));
+         }
+         c.Set("runBestPar",mRefParList.GetParamSet(runBestIndex));
+         for(unsigned int i=0;i<vWorldRandom.size();i++)
+            c.SetRandomState("worldRandomState",vWorldRandom[i],i>0);
+         this->WriteCheckpoint(c,nbStep);
+      }
+      this->ReportProgress(runBestCost,currentCost(nbWorld-1),lastAcceptRate);
       #ifdef __WX__CRYST__
       mMutexStopAfterCycle.Lock();
       #endif
@@ -2719,6 +4544,9 @@ void MonteCarloObj::RunParallelTempering(long &nbStep,const bool silent,
    //Restore Best values
       //mRefParList.Print();
       if(!silent) this->DisplayReport();
+      if((!silent)&&(pDelayed.get()!=0))
+         cout<<"Delayed acceptance: "<<pDelayed->mNbRejected<<" trials out of "<<pDelayed->mNbScreened
+             <<" rejected at low resolution"<<endl;
       mRefParList.RestoreParamSet(runBestIndex);
       //for(int i=0;i<mRefinedObjList.GetNb();i++) mRefinedObjList.GetObj(i).Print();
       mCurrentCost=this->GetLogLikelihood();
@@ -2736,6 +4564,8 @@ void MonteCarloObj::RunParallelTempering(long &nbStep,const bool silent,
       }
       mRefParList.ClearParamSet(lastParSavedSetIndex);
       mRefParList.ClearParamSet(runBestIndex);
+   // Delete the copies of the refined objects used by each thread
+      vThread.clear();
    TAU_PROFILE_STOP(timerN);
 }
 
@@ -2746,6 +4576,7 @@ void MonteCarloObj::XMLOutput(ostream &os,int indent)const
    XMLCrystTag tag("GlobalOptimObj");
    tag.AddAttribute("Name",this->GetName());
    tag.AddAttribute("NbTrialPerRun",(boost::format("%d")%(this->NbTrialPerRun())).str());
+   if(mRandomIsSeeded) tag.AddAttribute("Seed",(boost::format("%lu")%(this->GetSeed())).str());
 
    os <<tag<<endl;
    indent++;
@@ -2784,6 +4615,15 @@ void MonteCarloObj::XMLOutput(ostream &os,int indent)const
       os<<tag2<<endl;
    }
 
+   {
+      XMLCrystTag tag2("ParallelTempering",false,true);
+      tag2.AddAttribute("NbWorld",(boost::format("%d")%mNbWorld).str());
+      tag2.AddAttribute("NbTrialPerWorld",(boost::format("%d")%mNbTrialPerWorld).str());
+      tag2.AddAttribute("NbThread",(boost::format("%d")%mNbThread).str());
+      for(int i=0;i<indent;i++) os << "  " ;
+      os<<tag2<<endl;
+   }
+
    for(int j=0;j<mRefinedObjList.GetNb();j++)
    {
       XMLCrystTag tag2("RefinedObject",false,true);
@@ -2813,6 +4653,13 @@ void MonteCarloObj::XMLInput(istream &is,const XMLCrystTag &tagg)
          ss>>v;
          this->NbTrialPerRun()=v;
       }
+      if("Seed"==tagg.GetAttributeName(i))
+      {
+         stringstream ss(tagg.GetAttributeValue(i));
+         unsigned long v;
+         ss>>v;
+         this->SetSeed(v);
+      }
    }
    while(true)
    {
@@ -2873,6 +4720,19 @@ void MonteCarloObj::XMLInput(istream &is,const XMLCrystTag &tagg)
          if(false==tag.IsEmptyTag()) XMLCrystTag junk(is);//:KLUDGE: for first release
          continue;
       }
+      if("ParallelTempering"==tag.GetName())
+      {
+         for(unsigned int i=0;i<tag.GetNbAttribute();i++)
+         {
+            stringstream ss(tag.GetAttributeValue(i));
+            unsigned int v;
+            ss>>v;
+            if("NbWorld"==tag.GetAttributeName(i)) this->SetNbWorld(v);
+            if("NbTrialPerWorld"==tag.GetAttributeName(i)) this->SetNbTrialPerWorld(v);
+            if("NbThread"==tag.GetAttributeName(i)) this->SetNbThread(v);
+         }
+         continue;
+      }
       if("NbOfParticles"==tag.GetName())
       {
          is>>mParticles;
@@ -2904,13 +4764,192 @@ void MonteCarloObj::NewConfiguration(const RefParType *type)
 {
    TAU_PROFILE("MonteCarloObj::NewConfiguration()","void ()",TAU_DEFAULT);
    VFN_DEBUG_ENTRY("MonteCarloObj::NewConfiguration()",4)
+   const bool adaptive=(mvAdaptiveMoveBlock.size()>0)&&(type==gpRefParTypeObjCryst);
+   if(adaptive)
+      for(long i=0;i<mRefParList.GetNbParNotFixed();i++)
+         mOldAdaptiveMoveValue(i)=mRefParList.GetParNotFixed(i).GetValue();
    for(int i=0;i<mRefinedObjList.GetNb();i++)
       mRefinedObjList.GetObj(i).BeginGlobalOptRandomMove();
+   static const unsigned int profileRegion=Profiler::RegisterRegion("GlobalOptRandomMove");
    for(int i=0;i<mRefinedObjList.GetNb();i++)
+   {
+      ProfileScope profileScope(profileRegion,&(mRefinedObjList.GetObj(i)));
       mRefinedObjList.GetObj(i).GlobalOptRandomMove(mMutationAmplitude,type);
+   }
+   if(adaptive) this->AdaptiveMove();
+   else mLastAdaptiveMove=0;
    VFN_DEBUG_EXIT("MonteCarloObj::NewConfiguration()",4)
 }
 
+/// Minimum number of accepted moves for a block of parameters of size d,
+/// before its covariance is used to propose new moves
+static long AdaptiveMoveMinNbAccepted(const long d){return 100>(20*d)?100:20*d;}
+/// Fraction of the moves for which the independent moves of the objects are kept,
+/// even when the covariance has been learnt
+static const REAL sAdaptiveMoveIndependentFraction=0.05;
+/// Number of new accepted moves before the Cholesky factor is updated
+static const long sAdaptiveMoveCholUpdate=20;
+/// Normal random number (Box-Muller)
+static REAL GaussianRandom()
+{
+   const REAL u1=RandomUniform();
+   const REAL u2=RandomUniform();
+   return sqrt(-2*log(u1))*cos(2*M_PI*u2);
+}
+
+MonteCarloObj::AdaptiveMoveBlock::AdaptiveMoveBlock():
+mNbAccepted(0),mNbAcceptedChol(0)
+{}
+
+void MonteCarloObj::InitAdaptiveMove()
+{
+   mvAdaptiveMoveBlock.clear();
+   if(mAdaptiveMove.GetChoice()==0) return;
+   VFN_DEBUG_ENTRY("MonteCarloObj::InitAdaptiveMove()",5)
+   // mRefParList holds copies of the objects' parameters, so get the gene groups
+   // from each object and match the parameters using the address of their value.
+   map<const REAL*,unsigned int> vGeneGroup;
+   unsigned int first=1;
+   for(int i=0;i<mRecursiveRefinedObjList.GetNb();i++)
+   {
+      const RefinableObj *obj=&(mRecursiveRefinedObjList.GetObj(i));
+      CrystVector_uint geneGroup(obj->GetNbPar());
+      geneGroup=0;
+      obj->GetGeneGroup(*obj,geneGroup,first);
+      for(long j=0;j<obj->GetNbPar();j++)
+         if(geneGroup(j)>0) vGeneGroup[obj->GetPar(j).GetPointer()]=geneGroup(j);
+   }
+   map<unsigned int,vector<long> > vGroupPar;
+   const long nbFree=mRefParList.GetNbParNotFixed();
+   for(long i=0;i<nbFree;i++)
+   {
+      const RefinablePar *par=&(mRefParList.GetParNotFixed(i));
+      // Orientation & conformation moves are handled by the objects
+      if(  par->GetType()->IsDescendantFromOrSameAs(gpRefParTypeScattOrient)
+         ||par->GetType()->IsDescendantFromOrSameAs(gpRefParTypeScattConform)
+         ||(par->GetGlobalOptimStep()<=0)) continue;
+      map<const REAL*,unsigned int>::const_iterator pos=vGeneGroup.find(par->GetPointer());
+      if(pos!=vGeneGroup.end()) vGroupPar[pos->second].push_back(i);
+   }
+   for(map<unsigned int,vector<long> >::const_iterator pos=vGroupPar.begin();pos!=vGroupPar.end();++pos)
+   {
+      const long d=pos->second.size();
+      if(d<2) continue;// No correlation to learn
+      mvAdaptiveMoveBlock.push_back(AdaptiveMoveBlock());
+      AdaptiveMoveBlock *b=&(mvAdaptiveMoveBlock.back());
+      b->mvParIndex=pos->second;
+      b->mMean.resize(d);
+      b->mMean=0;
+      b->mCovar.resize(d,d);
+      b->mCovar=0;
+      b->mChol.resize(d,d);
+      b->mChol=0;
+   }
+   mOldAdaptiveMoveValue.resize(nbFree);
+   mLastAdaptiveMove.resize(nbFree);
+   mLastAdaptiveMove=0;
+   VFN_DEBUG_EXIT("MonteCarloObj::InitAdaptiveMove():"<<mvAdaptiveMoveBlock.size()<<" blocks",5)
+}
+
+void MonteCarloObj::AdaptiveMove()
+{
+   TAU_PROFILE("MonteCarloObj::AdaptiveMove()","void ()",TAU_DEFAULT);
+   for(vector<AdaptiveMoveBlock>::iterator b=mvAdaptiveMoveBlock.begin();b!=mvAdaptiveMoveBlock.end();++b)
+   {
+      const long d=b->mvParIndex.size();
+      // Move made by the objects, in units of the (step*amplitude)
+      bool moved=false,independent=true;
+      for(long k=0;k<d;k++)
+      {
+         const long i=b->mvParIndex[k];
+         const RefinablePar *par=&(mRefParList.GetParNotFixed(i));
+         REAL delta=par->GetValue()-mOldAdaptiveMoveValue(i);
+         if(par->IsPeriodic())
+         {
+            if(delta> par->GetPeriod()/2) delta-=par->GetPeriod();
+            if(delta<-par->GetPeriod()/2) delta+=par->GetPeriod();
+         }
+         mLastAdaptiveMove(i)=delta/(par->GetGlobalOptimStep()*mMutationAmplitude);
+         if(mLastAdaptiveMove(i)!=0) moved=true;
+         if(abs(mLastAdaptiveMove(i))>(1+1e-4)) independent=false;
+      }
+      // Only replace ordinary independent moves - keep permutations, flips,...
+      if((!moved)||(!independent)) continue;
+      if(b->mNbAccepted<AdaptiveMoveMinNbAccepted(d)) continue;
+      if(RandomUniform()<sAdaptiveMoveIndependentFraction) continue;
+      if((b->mNbAcceptedChol==0)||((b->mNbAccepted-b->mNbAcceptedChol)>=sAdaptiveMoveCholUpdate))
+      {// Proposal covariance: the learnt covariance, regularized, with the same total variance
+       // as the independent moves (uniform in [-1;1] for each parameter)
+         b->mNbAcceptedChol=b->mNbAccepted;
+         REAL trace=0;
+         for(long k=0;k<d;k++) trace+=b->mCovar(k,k);
+         b->mChol=0;
+         if(trace<=0) continue;
+         const REAL scale=d/3./trace;
+         CrystMatrix_REAL cov(d,d);
+         for(long k=0;k<d;k++)
+            for(long l=0;l<d;l++)
+               cov(k,l)=scale*(0.95*b->mCovar(k,l)+((k==l)?0.05*trace/d:0));
+         for(long k=0;k<d;k++)
+         {
+            REAL s=cov(k,k);
+            for(long l=0;l<k;l++) s-=b->mChol(k,l)*b->mChol(k,l);
+            if(s<=0) {b->mChol=0;break;}
+            b->mChol(k,k)=sqrt(s);
+            for(long m=k+1;m<d;m++)
+            {
+               REAL t=cov(m,k);
+               for(long l=0;l<k;l++) t-=b->mChol(m,l)*b->mChol(k,l);
+               b->mChol(m,k)=t/b->mChol(k,k);
+            }
+         }
+      }
+      if(b->mChol(0,0)<=0) continue;
+      CrystVector_REAL z(d);
+      for(long k=0;k<d;k++) z(k)=GaussianRandom();
+      for(long k=0;k<d;k++)
+      {
+         REAL u=0;
+         for(long l=0;l<=k;l++) u+=b->mChol(k,l)*z(l);
+         const long i=b->mvParIndex[k];
+         RefinablePar *par=&(mRefParList.GetParNotFixed(i));
+         const REAL step=par->GetGlobalOptimStep()*mMutationAmplitude;
+         par->MutateTo(mOldAdaptiveMoveValue(i)+u*step);
+         REAL delta=par->GetValue()-mOldAdaptiveMoveValue(i);
+         if(par->IsPeriodic())
+         {
+            if(delta> par->GetPeriod()/2) delta-=par->GetPeriod();
+            if(delta<-par->GetPeriod()/2) delta+=par->GetPeriod();
+         }
+         mLastAdaptiveMove(i)=delta/step;
+      }
+   }
+}
+
+void MonteCarloObj::AdaptiveMoveAccepted()
+{
+   for(vector<AdaptiveMoveBlock>::iterator b=mvAdaptiveMoveBlock.begin();b!=mvAdaptiveMoveBlock.end();++b)
+   {
+      const long d=b->mvParIndex.size();
+      bool moved=false;
+      for(long k=0;k<d;k++) if(mLastAdaptiveMove(b->mvParIndex[k])!=0) moved=true;
+      if(!moved) continue;
+      // Running mean and covariance - the 1/n weight makes the adaptation diminish
+      b->mNbAccepted++;
+      const REAL w=1./b->mNbAccepted;
+      CrystVector_REAL delta(d);
+      for(long k=0;k<d;k++)
+      {
+         delta(k)=mLastAdaptiveMove(b->mvParIndex[k])-b->mMean(k);
+         b->mMean(k)+=w*delta(k);
+      }
+      for(long k=0;k<d;k++)
+         for(long l=0;l<d;l++)
+            b->mCovar(k,l)+=w*(delta(k)*(mLastAdaptiveMove(b->mvParIndex[l])-b->mMean(l))-b->mCovar(k,l));
+   }
+}
+
+
 void MonteCarloObj::InitOptions()
 {
    VFN_DEBUG_MESSAGE("MonteCarloObj::InitOptions()",5)
@@ -2929,9 +4968,15 @@ void MonteCarloObj::InitOptions()
    static string saveTrackedDataName;
    static string saveTrackedDataChoices[2];
 
-   static bool needInitNames=true;
-   if(true==needInitNames)
-   {
+   static string adaptiveMoveName;
+   static string adaptiveMoveChoices[2];
+
+   static string delayedAcceptanceName;
+   static string delayedAcceptanceChoices[2];
+
+   static std::once_flag needInitNames;
+   std::call_once(needInitNames,[]()
+   {// Only once for the class
       GlobalOptimTypeName="Algorithm";
       GlobalOptimTypeChoices[0]="Simulated Annealing";
       GlobalOptimTypeChoices[1]="Parallel Tempering";
@@ -2956,18 +5001,28 @@ void MonteCarloObj::InitOptions()
       saveTrackedDataChoices[0]="No (recommended!)";
       saveTrackedDataChoices[1]="Yes (for tests ONLY)";
 
-      needInitNames=false;//Only once for the class
-   }
+      adaptiveMoveName="Adaptive Move Proposals";
+      adaptiveMoveChoices[0]="No";
+      adaptiveMoveChoices[1]="Yes (learn correlations in each group of parameters)";
+
+      delayedAcceptanceName="Delayed Acceptance";
+      delayedAcceptanceChoices[0]="No";
+      delayedAcceptanceChoices[1]="Yes (screen trials at low resolution)";
+   });
    mGlobalOptimType.Init(3,&GlobalOptimTypeName,GlobalOptimTypeChoices);
    mAnnealingScheduleTemp.Init(6,&AnnealingScheduleTempName,AnnealingScheduleChoices);
    mAnnealingScheduleMutation.Init(6,&AnnealingScheduleMutationName,AnnealingScheduleChoices);
    mSaveTrackedData.Init(2,&saveTrackedDataName,saveTrackedDataChoices);
    mAutoLSQ.Init(3,&runAutoLSQName,runAutoLSQChoices);
+   mAdaptiveMove.Init(2,&adaptiveMoveName,adaptiveMoveChoices);
+   mDelayedAcceptance.Init(2,&delayedAcceptanceName,delayedAcceptanceChoices);
    this->AddOption(&mGlobalOptimType);
    this->AddOption(&mAnnealingScheduleTemp);
    this->AddOption(&mAnnealingScheduleMutation);
    this->AddOption(&mSaveTrackedData);
    this->AddOption(&mAutoLSQ);
+   this->AddOption(&mAdaptiveMove);
+   this->AddOption(&mDelayedAcceptance);
    VFN_DEBUG_MESSAGE("MonteCarloObj::InitOptions():End",5)
 }
 
@@ -36,8 +36,17 @@ namespace ObjCryst
 #include "ObjCryst/RefinableObj/LSQNumObj.h"
 #include "ObjCryst/RefinableObj/IO.h"
 #include "ObjCryst/RefinableObj/Tracker.h"
+#include "ObjCryst/RefinableObj/Random.h"
+#include "ObjCryst/RefinableObj/Profiler.h"
 #include <string>
 #include <iostream>
+#include <functional>
+#include <future>
+#include <thread>
+#include <mutex>
+#include <atomic>
+#include <chrono>
+#include <memory>
 #ifdef __WX__CRYST__
    //#undef GetClassName // Conflict from wxMSW headers ? (cygwin)
 #include "ObjCryst/wxCryst/wxGlobalOptimObj.h"
@@ -89,6 +98,32 @@ enum GlobalOptimType
    GLOBAL_OPTIM_PARALLEL_TEMPERING_MULTI,
 };
 
+/// Progress of an optimization, reported by OptimizationObj::SetProgressCallback()
+struct OptimizationProgress
+{
+   OptimizationProgress();
+   /// Current run number (MultiRunOptimize())
+   long mRun;
+   /// Current trial number in the run
+   long mNbTrial;
+   /// Overall best cost
+   REAL mBestCost;
+   /// Best cost in the current run
+   REAL mRunBestCost;
+   /// Current cost (for parallel tempering, the cost of the coldest world)
+   REAL mCurrentCost;
+   /// Fraction of accepted moves during the last report interval of the algorithm
+   /// (a few thousand trials), or -1 if it is not available
+   REAL mAcceptRate;
+   /// Time elapsed since the beginning of the optimization (seconds)
+   REAL mElapsedTime;
+};
+
+/// Function called with the progress of an optimization
+typedef std::function<void(const OptimizationProgress&)> OptimizationProgressCallback;
+
+class AsyncOptimization;
+
 /** \brief Base object for Optimization methods.
 *
 * This is an abstract base class, derived for Monte-Cralo type algorithms
@@ -137,6 +172,31 @@ class OptimizationObj
       */
       virtual void MultiRunOptimize(long &nbCycle,long &nbSteps,const bool silent=false,const REAL finalcost=0,
                                     const REAL maxTime=-1)=0;
+      /** Launch Optimize() in a new thread, and return immediately.
+      *
+      * The refined objects must not be used by the caller until the optimization is
+      * finished, and must outlive it.
+      * \param callback: if set, this is called with the progress of the optimization,
+      * from the optimization thread, at most every \e interval seconds.
+      * \return the handle of the optimization, which can be used to follow its progress,
+      * cancel it and get its result. Its destructor cancels the optimization and waits for it.
+      * \throw ObjCrystException if an optimization is already running for this object.
+      */
+      std::unique_ptr<AsyncOptimization> OptimizeAsync(const long nbSteps,const bool silent=true,
+                                                       const REAL finalcost=0,const REAL maxTime=-1,
+                                                       const OptimizationProgressCallback &callback=OptimizationProgressCallback(),
+                                                       const REAL interval=1);
+      /// Launch MultiRunOptimize() in a new thread, and return immediately (see OptimizeAsync())
+      std::unique_ptr<AsyncOptimization> MultiRunOptimizeAsync(const long nbCycle,const long nbSteps,
+                                                               const bool silent=true,const REAL finalcost=0,
+                                                               const REAL maxTime=-1,
+                                                               const OptimizationProgressCallback &callback=OptimizationProgressCallback(),
+                                                               const REAL interval=1);
+      /** Set a function called with the progress of the optimizations, from the optimization
+      * thread, at most every \e interval seconds (if interval<=0, after each trial or
+      * cycle of trials). Use an empty function to disable progress reports.
+      */
+      void SetProgressCallback(const OptimizationProgressCallback &callback,const REAL interval=1);
    //Set Refinable parameters status
       /// Fix all parameters
       void FixAllPar();
@@ -260,7 +320,32 @@ class OptimizationObj
       /// This is equivalent to GetRefinedObjList().RestoreParamSet(GetSavedParamSetIndex(i))
       /// \param i: the order of the saved parameter set
       void RestoreParamSet(const unsigned int i, const bool update_display=true);
+      /** Set the seed of the random number generator used for all random moves
+      * made by this object. The same seed and options give the same optimization.
+      * If no seed is set, one is drawn using RandomSeed() when the first optimization begins.
+      */
+      void SetSeed(const unsigned long seed);
+      /// Seed of the random number generator (0 if it has not been seeded yet)
+      unsigned long GetSeed()const;
+      /// The random number generator used for all random moves made by this object
+      RandomGenerator& GetRandomGenerator();
+      /** Profiling statistics (number of calls, total and exclusive time per region
+      * and per object) recorded during the last optimization, if the "Profiling"
+      * option was enabled. See Profiler.
+      */
+      const std::vector<ProfileStats>& GetProfileStats()const;
+      /// Write the profiling statistics of the last optimization in JSON format
+      void ProfileJSONOutput(ostream &os)const;
    protected:
+      /// \internal Seed the random number generator, unless SetSeed() has been called
+      void InitRandomGenerator();
+      /// \internal Record the beginning of an optimization, for progress reports
+      void InitProgress();
+      /** \internal Call the progress callback, if there is one and if the progress
+      * interval has elapsed since the last call. This is called by the algorithms after
+      * each trial (or cycle of trials).
+      */
+      void ReportProgress(const REAL runBestCost,const REAL currentCost,const REAL acceptRate);
       /// \internal Prepare mRefParList for the refinement
       void PrepareRefParList();
 
@@ -328,9 +413,9 @@ class OptimizationObj
          std::vector<pair<long,REAL> > mvSavedParamSet;
 
       /// True if a refinement is being done. For multi-threaded environment
-      bool mIsOptimizing;
+      std::atomic<bool> mIsOptimizing;
       /// If true, then stop at the end of the cycle. Used in multi-threaded environment
-      bool mStopAfterCycle;
+      std::atomic<bool> mStopAfterCycle;
 
       // Refined objects
          /// The refined objects. This is mutable to allow a copy constructor for
@@ -346,6 +431,24 @@ class OptimizationObj
 
       /// The time elapsed after the last optimization, in seconds
          REAL mLastOptimTime;
+      /// Random number generator, installed as the current generator
+      /// (RandomGenerator::Scope) during the optimization
+         RandomGenerator mRandom;
+      /// True if mRandom has been seeded
+         bool mRandomIsSeeded;
+      /// Option to record profiling statistics during optimizations (not saved in XML)
+         RefObjOpt mProfiling;
+      /// Profiling statistics recorded during the last optimization
+         std::vector<ProfileStats> mvProfileStats;
+      /// Function called with the progress of the optimization
+         OptimizationProgressCallback mProgressCallback;
+      /// Minimum interval between calls to mProgressCallback (seconds)
+         REAL mProgressInterval;
+      /// Beginning of the optimization, and time of the last progress report
+         std::chrono::steady_clock::time_point mProgressStart,mLastProgressTime;
+      /// The asynchronous optimization running for this object, if any
+         AsyncOptimization *mpAsyncOptimization;
+      friend class AsyncOptimization;
       /// MainTracker object to track the evolution of cost functions, likelihood,
       /// and individual parameters.
       MainTracker mMainTracker;
@@ -371,6 +474,77 @@ class OptimizationObj
    #endif
 };
 
+/// Result of an asynchronous optimization (see OptimizationObj::OptimizeAsync())
+struct OptimizationResult
+{
+   OptimizationResult();
+   /// Overall best cost
+   REAL mBestCost;
+   /// Number of trials performed (for a single run), or in the last run
+   long mNbTrial;
+   /// Number of runs performed
+   long mNbRun;
+   /// Duration of the optimization (seconds)
+   REAL mElapsedTime;
+   /// True if the optimization was cancelled
+   bool mCancelled;
+};
+
+/** \brief Handle of an optimization running in its own thread, created by
+* OptimizationObj::OptimizeAsync() or OptimizationObj::MultiRunOptimizeAsync().
+*
+* The progress can be polled (GetProgress()) or reported by a callback, the
+* optimization can be cancelled at any time (it then stops within a trial or cycle
+* of trials), and the result is available from a future. Exceptions thrown
+* during the optimization are passed to the future.
+*
+* The destructor cancels the optimization if it is still running, and waits for it.
+*/
+class AsyncOptimization
+{
+   public:
+      ~AsyncOptimization();
+      /// Ask the optimization to stop as soon as possible. This returns immediately.
+      void Cancel();
+      /// Has Cancel() been called ?
+      bool IsCancelled()const;
+      /// Is the optimization finished ?
+      bool IsFinished()const;
+      /// Latest progress of the optimization
+      OptimizationProgress GetProgress()const;
+      /// Future for the result of the optimization
+      std::shared_future<OptimizationResult> GetFuture()const;
+      /// Wait for the end of the optimization, and get its result
+      /// (this rethrows any exception thrown by the optimization)
+      OptimizationResult Wait();
+      /// The optimization object
+      OptimizationObj& GetOptimizationObj();
+   private:
+      friend class OptimizationObj;
+      AsyncOptimization(OptimizationObj &opt,const OptimizationProgressCallback &callback,
+                        const REAL interval);
+      AsyncOptimization(const AsyncOptimization&);
+      AsyncOptimization& operator=(const AsyncOptimization&);
+      /// Run the optimization in a new thread
+      void Start(const std::function<OptimizationResult()> &f);
+      /// Progress callback installed in the optimization object
+      void OnProgress(const OptimizationProgress &p);
+      OptimizationObj *mpOptObj;
+      /// Callback given by the user
+      OptimizationProgressCallback mCallback;
+      /// Progress callback of the optimization object before this optimization
+      OptimizationProgressCallback mPreviousCallback;
+      REAL mPreviousInterval;
+      std::atomic<bool> mCancelled;
+      std::atomic<bool> mFinished;
+      /// Protects mProgress
+      mutable std::mutex mMutex;
+      OptimizationProgress mProgress;
+      std::promise<OptimizationResult> mPromise;
+      std::shared_future<OptimizationResult> mFuture;
+      std::thread mThread;
+};
+
 /** \brief Base object for Monte-Carlo Global Optimization methods.
 *
 * The algorithm is quite simple, whith two type of optimizations, either
@@ -448,6 +622,164 @@ class MonteCarloObj:public OptimizationObj
                                  const REAL tMax, const REAL tMin,
                                  const AnnealingSchedule scheduleMutation=ANNEALING_CONSTANT,
                                  const REAL mutMax=16., const REAL mutMin=.125);
+      /// Set the number of parallel 'worlds' (replicas) used for parallel tempering
+      /// (default: 30). The coldest (most stable) world is the last one.
+      void SetNbWorld(const unsigned int nb);
+      /// Number of parallel 'worlds' used for parallel tempering
+      unsigned int GetNbWorld()const;
+      /// Set the number of successive trials made in each world between two attempts
+      /// at swapping configurations between worlds (default: 10). This sets the swap rate.
+      void SetNbTrialPerWorld(const unsigned int nb);
+      /// Number of successive trials made in each world between two swap attempts
+      unsigned int GetNbTrialPerWorld()const;
+      /** Set the number of threads used for parallel tempering and particle swarm
+      * optimizations.
+      *
+      * With 1 thread (the default), all worlds are computed sequentially using the
+      * refined objects. With n>1 threads, each thread works on its own copy of the
+      * refined objects, and computes the trials for one or several worlds. Each world
+      * then uses its own stream of random numbers (see RandomGenerator::Split()), so
+      * that the result for a given seed does not depend on the scheduling of the threads.
+      * Configurations are only exchanged between worlds (and with the refined objects)
+      * between swap attempts, i.e. every GetNbTrialPerWorld() trials.
+      *
+      * For particle swarm optimizations, each thread moves a subset of the particles
+      * and computes their cost using its own copy of the refined objects. The random
+      * numbers are all drawn by the main thread, so the result for a given seed
+      * does not depend on the number of threads.
+      * If nb=0, the number of available cores is used.
+      */
+      void SetNbThread(const unsigned int nb);
+      /// Number of threads used for parallel tempering (0=number of available cores)
+      unsigned int GetNbThread()const;
+      /** Set the number of independent runs performed concurrently by MultiRunOptimize(),
+      * for the simulated annealing and parallel tempering algorithms.
+      *
+      * Each concurrent run uses its own copy of the refined objects, and is given its
+      * own random seed (recorded in RunStats). The best configuration of each run is added to the saved
+      * parameter sets (see GetSavedParamSetIndex()), and the refined objects are left
+      * in the overall best configuration. If nb=0, the number of available cores is used.
+      * The default is 1, i.e. runs are performed one after the other.
+      */
+      void SetNbParallelRun(const unsigned int nb);
+      /// Number of independent runs performed concurrently by MultiRunOptimize()
+      unsigned int GetNbParallelRun()const;
+      /** Set the number of worker processes used by MultiRunOptimize(), for the simulated
+      * annealing and parallel tempering algorithms (POSIX systems only).
+      *
+      * If nb>1, the workers are created with fork() once the optimization has been
+      * prepared, so that they share the refined objects (copy-on-write) without copying
+      * or reloading them. Each worker performs runs one after the other, with a seed derived
+      * from the run number, and publishes the statistics and best configuration of each run
+      * on a board in shared memory. These are added to the saved parameter sets as for
+      * SetNbParallelRun(). Once a run reaches finalcost, all workers stop.
+      *
+      * This takes precedence over SetNbParallelRun(). Since only the calling thread
+      * exists in the worker processes, no worker process is created if other threads
+      * are running (e.g. with MultiRunOptimizeAsync(), or in a graphical interface):
+      * the runs are then performed as with SetNbParallelRun().
+      * If nb=0, the number of available cores is used. The default is 1 (no worker process).
+      */
+      void SetNbProcess(const unsigned int nb);
+      /// Number of worker processes used by MultiRunOptimize()
+      unsigned int GetNbProcess()const;
+      /// Statistics for one run of MultiRunOptimize()
+      struct RunStats
+      {
+         RunStats();
+         /// Run number (starting from 0)
+         long mRun;
+         /// Random seed used for this run (the random number generator is seeded with it when the run begins)
+         unsigned int mSeed;
+         /// Best cost reached during this run
+         REAL mBestCost;
+         /// Number of trials made during this run
+         long mNbTrial;
+         /// Duration of this run (seconds)
+         REAL mTime;
+         /// Index of the saved parameter set with the best configuration for this run
+         long mParamSetIndex;
+      };
+      /// Statistics for each run of the last MultiRunOptimize(), in the order
+      /// the runs were completed
+      const std::vector<RunStats>& GetRunStats()const;
+      /** \brief Create an independent copy of this optimization object, and of all the
+      * objects it refines.
+      *
+      * The Crystal (with its scatterers and scattering powers), DiffractionDataSingleCrystal
+      * and PowderPattern (with its components) objects are duplicated using their Clone()
+      * methods, and all pointers between them (e.g. the Crystal used by a
+      * PowderPatternDiffraction) point to the copies. The observed data and the
+      * reflections are shared with the originals, copy-on-write (see
+      * PowderPattern::ShareObservedData(), DiffractionDataSingleCrystal::ShareObservedData()
+      * and ScatteringData::ShareHKL()). The copies and the originals can be modified or
+      * destroyed independently.
+      *
+      * The new optimization object has the same options and parameters, and owns the
+      * copies, which are deleted with it. Neither the optimization object nor the copies
+      * are registered in the global registries (gOptimizationObjRegistry, gCrystalRegistry,...),
+      * so they are not displayed nor saved with all other objects.
+      *
+      * \param pCopyMap: if not null, this will be filled with the copy of each original
+      * object, including sub-objects (scatterers, scattering powers, powder pattern
+      * components).
+      * \throw ObjCrystException if one of the refined objects cannot be copied (only
+      * Crystal, DiffractionDataSingleCrystal and PowderPattern objects can be copied).
+      * \warning Since the copies are registered in the global registries when created, this must not
+      * be called concurrently from several threads, unless each of them uses its own
+      * RegistryScope (e.g. jobs of an LSQJobQueue).
+      */
+      MonteCarloObj* CloneGraph(std::map<const RefinableObj*,RefinableObj*> *pCopyMap=0)const;
+      /** \brief Regularly write a binary checkpoint of the running optimization, which
+      * can be used to resume it if it is interrupted (see LoadCheckpoint()).
+      *
+      * The checkpoint holds everything needed to continue a simulated annealing, parallel
+      * tempering or particle swarm run where it stopped: number of trials, parameters and
+      * cost of each world or particle, best configurations, temperatures and mutation
+      * amplitudes, statistics on accepted moves, tracked values and the state of the
+      * random number generators (see SetSeed()).
+      * It is much smaller and faster to write than the XML autosave, as only parameter
+      * values are stored. The file is written under a temporary name and then renamed,
+      * so that an interruption never leaves an incomplete checkpoint.
+      *
+      * Checkpoints are written at the end of a trial (simulated annealing), of a cycle
+      * of trials in all worlds (parallel tempering) or of an iteration (particle swarm).
+      * \param fileName: the checkpoint file name. If empty, no checkpoint is written.
+      * \param interval: write a checkpoint every 'interval' seconds (ignored if <=0)
+      * \param nbTrial: write a checkpoint every nbTrial trials (ignored if <=0)
+      *
+      * Copies of this object keep the interval and number of trials, but not the
+      * file name, so that they do not overwrite the same checkpoint.
+      */
+      void SetCheckpoint(const string &fileName,const REAL interval=600,const long nbTrial=0);
+      /// Name of the checkpoint file (empty if no checkpoint is written)
+      const string& GetCheckpointFileName()const;
+      /** \brief Load a checkpoint written during a previous optimization, so that the next
+      * call to Optimize() resumes it instead of starting a new run.
+      *
+      * The same objects must be refined, with the same parameters, and the same algorithm
+      * must be selected. The total number of trials of the interrupted run is used, whatever
+      * the number of trials given to Optimize(). Checkpoints are not used by MultiRunOptimize().
+      * \throw ObjCrystException if the file cannot be read or is not a checkpoint. If the
+      * refined parameters or the algorithm do not match, the exception is thrown by Optimize().
+      */
+      void LoadCheckpoint(const string &fileName);
+      /** \brief Set the resolution used to screen the trials when the "Delayed Acceptance"
+      * option is set.
+      *
+      * In this mode, each trial is first evaluated using a copy of the refined objects,
+      * in which the diffraction data is limited to sin(theta)/lambda<max, and it is
+      * rejected at once with the usual Metropolis probability computed from this cheap
+      * low resolution cost. Only the trials which pass this first test are evaluated with
+      * the full cost, and accepted with a probability corrected for the first test, so
+      * that the configurations are sampled exactly as without screening.
+      *
+      * This is used for simulated annealing and single-threaded parallel tempering, but
+      * not by concurrent runs of MultiRunOptimize(). The default is 0.25 (d=2 Angstroems).
+      */
+      void SetDelayedAcceptanceMaxSinThetaOvLambda(const REAL max);
+      /// Resolution used to screen trials in the delayed acceptance mode
+      REAL GetDelayedAcceptanceMaxSinThetaOvLambda()const;
 
       virtual void Optimize(long &nbSteps,const bool silent=false,const REAL finalcost=0,
                             const REAL maxTime=-1);
@@ -511,11 +843,108 @@ class MonteCarloObj:public OptimizationObj
       * because the new configuration can be specific
       * (like, for example, permutations between some of the parameters (atoms)).
       *
+      * If the "Adaptive Move Proposals" option is set, the moves of each group of
+      * parameters (see RefinableObj::GetGeneGroup()) which are ordinary independent
+      * random moves are then replaced by correlated moves, drawn using the covariance
+      * of the accepted moves (adaptive Metropolis). Orientation and conformation
+      * parameters, and special moves (e.g. permutations), are left to the objects.
+      *
       * \param type: can be used to restrict the move to a given category of parameters.
       */
       virtual void NewConfiguration(const RefParType *type=gpRefParTypeObjCryst);
 
       virtual void InitOptions();
+      /** \internal Perform the runs of MultiRunOptimize() concurrently, using nbThread
+      * copies of the refined objects.
+      *
+      * \return false if the objects could not be copied, in which case no run was made.
+      */
+      bool MultiRunOptimizeThread(long &nbCycle,const long nbStep,const bool silent,
+                                  const REAL finalcost,const REAL maxTime,
+                                  const unsigned int nbThread,long &nbTrialCumul);
+      /// \internal Copies of refined objects and optimization object used by one thread
+      struct ThreadCopy;
+      /** \internal Perform the runs of MultiRunOptimize() in nbProcess worker processes,
+      * created with fork().
+      *
+      * \return false if the worker processes could not be created (or other threads are
+      * running in this process), in which case no run was made.
+      */
+      bool MultiRunOptimizeFork(long &nbCycle,const long nbStep,const bool silent,
+                                const REAL finalcost,const REAL maxTime,
+                                const unsigned int nbProcess,long &nbTrialCumul);
+      /// \internal Board in shared memory used to collect the results of the worker processes
+      struct ForkBoard;
+      /** \internal Record the result of a run made by a thread or worker process: add its
+      * best configuration to the saved parameter sets and its statistics to mvRunStats, and
+      * update the overall best configuration.
+      */
+      void AddRunResult(RunStats &stats,const CrystVector_REAL &par,const long nbCycle0,
+                        const bool silent,bool &needUpdateDisplay,long &nbTrialCumul);
+      /** \internal Prepare the adaptive move proposals (if the corresponding option is set):
+      * build the blocks of correlated parameters from the gene groups, and reset their
+      * statistics. This must be called after PrepareRefParList().
+      */
+      void InitAdaptiveMove();
+      /** \internal Replace the independent random moves made by the refined objects by
+      * correlated moves, for the blocks of parameters which have learnt their covariance.
+      * Called by NewConfiguration(), mOldAdaptiveMoveValue holding the parameters before
+      * the objects' moves.
+      */
+      void AdaptiveMove();
+      /// \internal The last configuration has been accepted: update the statistics of the
+      /// moves for each block of parameters in the adaptive move mode.
+      void AdaptiveMoveAccepted();
+      /// \internal Statistics of the accepted moves, for one block of parameters (one gene
+      /// group), used for the adaptive move proposals.
+      struct AdaptiveMoveBlock
+      {
+         AdaptiveMoveBlock();
+         /// Index of the parameters in the list of not-fixed parameters
+         std::vector<long> mvParIndex;
+         /// Number of accepted moves used to learn the covariance
+         long mNbAccepted;
+         /// Mean of the accepted moves (in units of the global optimization step
+         /// multiplied by the mutation amplitude)
+         CrystVector_REAL mMean;
+         /// Covariance of the accepted moves
+         CrystMatrix_REAL mCovar;
+         /// Cholesky factor of the proposal covariance
+         CrystMatrix_REAL mChol;
+         /// Number of accepted moves when mChol was computed (0 if it has not been computed)
+         long mNbAcceptedChol;
+      };
+      /// \internal Content of a binary checkpoint
+      struct Checkpoint;
+      /// \internal Low resolution copy of the refined objects, used to screen the trials
+      /// in the delayed acceptance mode
+      struct DelayedAcceptance;
+      /** \internal Create the low resolution copy used for delayed acceptance, for nbChain
+      * independent chains (e.g. worlds in parallel tempering).
+      *
+      * \return null if the "Delayed Acceptance" option is not set, or if the refined
+      * objects cannot be copied.
+      */
+      DelayedAcceptance* CreateDelayedAcceptance(const unsigned int nbChain,const bool silent);
+      /// \internal Is a checkpoint due, given the time (in seconds) and trial
+      /// number of the last one ?
+      bool IsCheckpointDue(const REAL time,const REAL lastTime,const long lastTrial)const;
+      /// \internal Add the state common to all algorithms (number of trials, best configuration,
+      /// tracked values, random number generator) to a checkpoint, and write it.
+      void WriteCheckpoint(Checkpoint &c,const long nbStep);
+      /// \internal If a checkpoint has been loaded, restore the state common to all algorithms
+      /// and return it (the caller then owns it). Otherwise return null.
+      Checkpoint* ResumeCheckpoint(long &nbStep);
+      /// \internal Initial temperatures and mutation amplitudes for each world
+      /// in parallel tempering
+      void InitParallelTemperingSchedule(const long nbWorld,CrystVector_REAL &simAnnealTemp,
+                                         CrystVector_REAL &mutationAmplitude)const;
+      /// \internal Adapt the temperatures and mutation amplitudes for each world in
+      /// parallel tempering (for the 'smart' schedules), given the fraction of
+      /// accepted moves in each world.
+      void AdaptParallelTemperingSchedule(const CrystVector_REAL &acceptRate,
+                                          CrystVector_REAL &simAnnealTemp,
+                                          CrystVector_REAL &mutationAmplitude)const;
 
       /// Method used for the global optimization. Should be removed when we switch
       /// to using several classes for different algorithms.
@@ -561,6 +990,45 @@ class MonteCarloObj:public OptimizationObj
          long mNbTrialRetry;
          /// Cost to reach unless an automatic randomization and retry is done
          REAL mMinCostRetry;
+      //Parallel tempering
+         /// Number of worlds
+         unsigned int mNbWorld;
+         /// Number of successive trials for each world, between swap attempts
+         unsigned int mNbTrialPerWorld;
+         /// Number of threads (0=number of available cores)
+         unsigned int mNbThread;
+      /// Number of concurrent runs for MultiRunOptimize() (0=number of available cores)
+      unsigned int mNbParallelRun;
+      /// Number of worker processes for MultiRunOptimize() (0=number of available cores)
+      unsigned int mNbProcess;
+      /// Statistics for each run of the last MultiRunOptimize()
+      std::vector<RunStats> mvRunStats;
+      /// Objects owned by this optimization object, which are deleted in its destructor.
+      /// These are the copies created by CloneGraph(), in the order they were created.
+      std::vector<RefinableObj*> mvClonedObj;
+      /// Option to use adaptive move proposals, learning the covariance of accepted moves
+      /// for each gene group
+      RefObjOpt mAdaptiveMove;
+      /// Blocks of parameters for the adaptive move proposals
+      std::vector<AdaptiveMoveBlock> mvAdaptiveMoveBlock;
+      /// Values of the not-fixed parameters before the last move (adaptive move mode)
+      CrystVector_REAL mOldAdaptiveMoveValue;
+      /// Last move of the not-fixed parameters (adaptive move mode), in units of the
+      /// global optimization step multiplied by the mutation amplitude
+      CrystVector_REAL mLastAdaptiveMove;
+      /// Option to screen the trials using a low resolution copy of the refined objects
+      RefObjOpt mDelayedAcceptance;
+      /// Maximum sin(theta)/lambda for the low resolution copy used in the delayed
+      /// acceptance mode
+      REAL mDelayedAcceptanceMaxSinThetaOvLambda;
+      /// Name of the checkpoint file (empty if no checkpoint is written)
+      string mCheckpointFileName;
+      /// Interval (in seconds) between checkpoints (ignored if <=0)
+      REAL mCheckpointInterval;
+      /// Number of trials between checkpoints (ignored if <=0)
+      long mCheckpointNbTrial;
+      /// Checkpoint loaded by LoadCheckpoint(), used to resume the next optimization
+      Checkpoint *mpCheckpoint;
       /// Least squares object
       LSQNumObj mLSQ;
       /// Option to run automatic least-squares refinements
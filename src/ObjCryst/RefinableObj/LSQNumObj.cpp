@@ -19,20 +19,20 @@
 #include "ObjCryst/Quirks/VFNStreamFormat.h"
 
 #include "ObjCryst/RefinableObj/LSQNumObj.h"
+#include "ObjCryst/RefinableObj/GlobalOptimObj.h"
 
 #ifdef __WX__CRYST__
    #include "ObjCryst/wxCryst/wxLSQ.h"
 #endif
 
-#include "newmat/newmatap.h" //for SVD decomposition
-#include "newmat/newmatio.h"
-
-#ifdef use_namespace
-using namespace NEWMAT;
-#endif
 using namespace std;
 
 #include <iomanip>
+#include <limits>
+#include <thread>
+#include <atomic>
+#include <mutex>
+#include <set>
 
 #define POSSIBLY_UNUSED(expr) (void)(expr)
 
@@ -52,6 +52,8 @@ LSQNumObj::LSQNumObj(string objName)
    mRw=0;
    mChiSq=0;
    mStopAfterCycle=false;
+   mNbThread=1;
+   mAutoDerivStep=true;
 }
 
 LSQNumObj::~LSQNumObj()
@@ -103,6 +105,154 @@ void LSQNumObj::SetParIsUsed(const RefParType *type,const bool use)
    mRefParList.SetParIsUsed(type,use);
 }
 
+/** \internal Match the sub-objects of an object and of its copy, if they have the same
+* class and name, for LSQNumObj::ThreadCopy. This finds the copies of objects which are
+* not individually copied by MonteCarloObj::CloneGraph() (e.g. radiation, profiles).
+*/
+static void MatchSubObjects(const RefinableObj &orig,RefinableObj &copy,
+                            map<const RefinableObj*,RefinableObj*> &vCopy,
+                            std::set<const RefinableObj*> &vDone)
+{
+   if(!vDone.insert(&orig).second) return;
+   const ObjRegistry<RefinableObj> *pOrig=&(orig.GetSubObjRegistry());
+   ObjRegistry<RefinableObj> *pCopy=&(copy.GetSubObjRegistry());
+   if(pOrig->GetNb()!=pCopy->GetNb()) return;
+   for(int i=0;i<pOrig->GetNb();i++)
+   {
+      const RefinableObj *o=&(pOrig->GetObj(i));
+      RefinableObj *c=&(pCopy->GetObj(i));
+      if((o->GetClassName()!=c->GetClassName())||(o->GetName()!=c->GetName())) continue;
+      if(vCopy.find(o)==vCopy.end()) vCopy[o]=c;
+      MatchSubObjects(*o,*vCopy[o],vCopy,vDone);
+   }
+}
+
+/** \internal Copy of the objects refined by a LSQNumObj, used by one thread to
+* compute numerical derivatives.
+*/
+struct LSQNumObj::ThreadCopy
+{
+   ThreadCopy():mpOptObj(0){}
+   ~ThreadCopy()
+   {
+      for(vector<RefinableObj*>::iterator pos=mvOptimizationBegun.begin();pos!=mvOptimizationBegun.end();++pos)
+         (*pos)->EndOptimization();
+      delete mpOptObj;
+   }
+   /** Copy the objects refined by the LSQ object, using MonteCarloObj::CloneGraph().
+   *
+   * \return false if the objects with an LSQ function, or the not-fixed parameters,
+   * cannot all be copied.
+   */
+   bool Init(const LSQNumObj &lsq)
+   {
+      VFN_DEBUG_ENTRY("LSQNumObj::ThreadCopy::Init()",5)
+      map<const RefinableObj*,RefinableObj*> vCopy;
+      {
+         MonteCarloObj opt(true);
+         for(map<RefinableObj*,unsigned int>::const_iterator pos=lsq.mvRefinedObjMap.begin();
+             pos!=lsq.mvRefinedObjMap.end();++pos)
+         {
+            const string className=pos->first->GetClassName();
+            if(  (className=="Crystal")||(className=="PowderPattern")
+               ||(className=="DiffractionDataSingleCrystal")) opt.AddRefinableObj(*(pos->first));
+         }
+         try
+         {
+            mpOptObj=opt.CloneGraph(&vCopy);
+         }
+         catch(const ObjCrystException &except)
+         {
+            VFN_DEBUG_EXIT("LSQNumObj::ThreadCopy::Init():cannot copy objects",5)
+            return false;
+         }
+      }
+      std::set<const RefinableObj*> vDone;
+      const map<const RefinableObj*,RefinableObj*> vCopy0=vCopy;
+      for(map<const RefinableObj*,RefinableObj*>::const_iterator pos=vCopy0.begin();pos!=vCopy0.end();++pos)
+         MatchSubObjects(*(pos->first),*(pos->second),vCopy,vDone);
+      long nbObs=0;
+      for(map<RefinableObj*,unsigned int>::const_iterator pos=lsq.mvRefinedObjMap.begin();
+          pos!=lsq.mvRefinedObjMap.end();++pos)
+      {
+         map<const RefinableObj*,RefinableObj*>::const_iterator c=vCopy.find(pos->first);
+         if(c==vCopy.end())
+         {
+            if(pos->first->GetNbLSQFunction()==0) continue;
+            VFN_DEBUG_EXIT("LSQNumObj::ThreadCopy::Init():no copy for "<<pos->first->GetName(),5)
+            return false;
+         }
+         if(c->second->GetNbPar()!=pos->first->GetNbPar())
+         {
+            VFN_DEBUG_EXIT("LSQNumObj::ThreadCopy::Init():parameters differ for "<<pos->first->GetName(),5)
+            return false;
+         }
+         for(long i=0;i<pos->first->GetNbPar();i++)
+         {
+            if(c->second->GetPar(i).GetName()!=pos->first->GetPar(i).GetName())
+            {
+               VFN_DEBUG_EXIT("LSQNumObj::ThreadCopy::Init():parameters differ for "<<pos->first->GetName(),5)
+               return false;
+            }
+            mvPar[pos->first->GetPar(i).GetPointer()]=&(c->second->GetPar(i));
+         }
+         c->second->BeginOptimization();
+         mvOptimizationBegun.push_back(c->second);
+         if(pos->first->GetNbLSQFunction()==0) continue;
+         mvObj.push_back(make_pair(c->second,pos->second));
+         nbObs+=c->second->GetLSQObs(pos->second).numElements();
+      }
+      if(nbObs!=lsq.mObs.numElements())
+      {
+         VFN_DEBUG_EXIT("LSQNumObj::ThreadCopy::Init():number of observations differ",5)
+         return false;
+      }
+      for(long i=0;i<lsq.mRefParList.GetNbParNotFixed();i++)
+         if(mvPar.find(lsq.mRefParList.GetParNotFixed(i).GetPointer())==mvPar.end())
+         {
+            VFN_DEBUG_EXIT("LSQNumObj::ThreadCopy::Init():no copy for parameter "
+                           <<lsq.mRefParList.GetParNotFixed(i).GetName(),5)
+            return false;
+         }
+      VFN_DEBUG_EXIT("LSQNumObj::ThreadCopy::Init()",5)
+      return true;
+   }
+   /// Copy the values and attributes (fixed, limits, derivative step) of the parameters
+   void SyncParameters(const RefinableObj &refParList)
+   {
+      for(long i=0;i<refParList.GetNbPar();i++)
+      {
+         const RefinablePar *p=&(refParList.GetPar(i));
+         map<const REAL*,RefinablePar*>::iterator pos=mvPar.find(p->GetPointer());
+         if(pos==mvPar.end()) continue;
+         pos->second->CopyAttributes(*p);
+         pos->second->SetValue(p->GetValue());
+      }
+   }
+   /// Compute the derivative of the LSQ functions of the copies for one (original) parameter
+   void CalcLSQDeriv(const RefinablePar &par,REAL *p)
+   {
+      RefinablePar *pPar=mvPar[par.GetPointer()];
+      const REAL v0=pPar->GetValue();
+      for(vector<pair<RefinableObj*,unsigned int> >::iterator pos=mvObj.begin();pos!=mvObj.end();++pos)
+      {
+         const CrystVector_REAL *pV=&(pos->first->GetLSQDeriv(pos->second,*pPar));
+         const REAL *p1=pV->data();
+         for(long j=0;j<pV->numElements();++j) *p++ = *p1++;
+      }
+      pPar->SetValue(v0);
+   }
+   /// Optimization object owning the copies
+   MonteCarloObj *mpOptObj;
+   /// Copies of the objects with an LSQ function, and the index of the LSQ function,
+   /// in the same order as the original objects
+   vector<pair<RefinableObj*,unsigned int> > mvObj;
+   /// Copies for which BeginOptimization() has been called
+   vector<RefinableObj*> mvOptimizationBegun;
+   /// Copy of each parameter, from the pointer to the original value
+   map<const REAL*,RefinablePar*> mvPar;
+};
+
 void LSQNumObj::Refine (int nbCycle,bool useLevenbergMarquardt,
                         const bool silent, const bool callBeginEndOptimization,
                         const float minChi2var)
@@ -112,7 +262,7 @@ void LSQNumObj::Refine (int nbCycle,bool useLevenbergMarquardt,
    TAU_PROFILE_TIMER(timer2,"LSQNumObj::Refine() 2 - LSQ Deriv","", TAU_FIELD);
    TAU_PROFILE_TIMER(timer3,"LSQNumObj::Refine() 3 - LSQ MB","", TAU_FIELD);
    TAU_PROFILE_TIMER(timer4,"LSQNumObj::Refine() 4 - LSQ Singular Values","", TAU_FIELD);
-   TAU_PROFILE_TIMER(timer5,"LSQNumObj::Refine() 5 - LSQ Newmat, eigenvalues...","", TAU_FIELD);
+   TAU_PROFILE_TIMER(timer5,"LSQNumObj::Refine() 5 - LSQ eigenvalues...","", TAU_FIELD);
    TAU_PROFILE_TIMER(timer6,"LSQNumObj::Refine() 6 - LSQ Apply","", TAU_FIELD);
    TAU_PROFILE_TIMER(timer7,"LSQNumObj::Refine() 7 - LSQ Finish","", TAU_FIELD);
    TAU_PROFILE_START(timer1);
@@ -133,6 +283,7 @@ void LSQNumObj::Refine (int nbCycle,bool useLevenbergMarquardt,
       mRefParList.PrepareForRefinement();
       //if(!silent) mRefParList.Print();
       if(mRefParList.GetNbPar()==0) throw ObjCrystException("LSQNumObj::Refine():no parameter to refine !");
+      if(mAutoDerivStep) this->OptimizeDerivativeSteps(true,silent);
 
    //variables
       long nbVar=mRefParList.GetNbParNotFixed();
@@ -143,14 +294,19 @@ void LSQNumObj::Refine (int nbCycle,bool useLevenbergMarquardt,
       CrystVector_REAL B(nbVar);
       CrystMatrix_REAL designMatrix(nbVar,nbObs);
       CrystVector_REAL deltaVar(nbVar);
-      long i,j,k;
+      //block structure of the normal matrix, see CalcNormalMatrixBlocks()
+      CrystVector_long vBlock;
+      long nbBlock=0;
+      long i,j;
       REAL R_ini,Rw_ini;  POSSIBLY_UNUSED(R_ini);
-      REAL *pTmp1,*pTmp2;
 
       REAL marquardt=1e-2;
       const REAL marquardtMult=4.;
    //initial Chi^2, needed for Levenberg-Marquardt
    this->CalcChiSquare();
+   //copies of the refined objects, to compute the derivatives in several threads
+   vector<unique_ptr<ThreadCopy> > vCopy;
+   this->PrepareThreadCopies(vCopy,silent);
    //store old values
    mIndexValuesSetInitial=mRefParList.CreateParamSet("LSQ Refinement-Initial Values");
    mIndexValuesSetLast=mRefParList.CreateParamSet("LSQ Refinement-Last Cycle Values");
@@ -177,23 +333,16 @@ void LSQNumObj::Refine (int nbCycle,bool useLevenbergMarquardt,
             Rw_ini=sqrt(tmpV1.sum()/tmpV2.sum());
       //derivatives
       //designMatrix=0.;
-      pTmp2=designMatrix.data();
+      designMatrix.resize(nbVar,nbObs);
       //cout <<"obs:"<<FormatHorizVector<REAL>(calc0,10,8);
       //cout <<"calc:"<<FormatHorizVector<REAL>(mObs,10,8);
       //cout <<"weight:"<<FormatHorizVector<REAL>(mWeight,10,8);
       #if 1
-      for(i=0;i<nbVar;i++)
-      {
-         //:NOTE: Real design matrix is the transposed of the one computed here
-         //if(!silent) cout << "........." << mRefParList.GetParNotFixed(i).GetName() <<endl;
-
-         tmpV1=this->GetLSQDeriv(mRefParList.GetParNotFixed(i));
-         pTmp1=tmpV1.data();
-         //cout <<"deriv#"<<i<<":"<<FormatHorizVector<REAL>(tmpV1,10,8);
-         for(j=0;j<nbObs;j++) *pTmp2++ = *pTmp1++;
-      }
+      //:NOTE: Real design matrix is the transposed of the one computed here
+      this->CalcDesignMatrix(designMatrix,vCopy);
       #else
       this->GetLSQ_FullDeriv();
+      REAL *pTmp1,*pTmp2=designMatrix.data();
       for(i=0;i<nbVar;i++)
       {
          pTmp1=mLSQ_FullDeriv[&(mRefParList.GetParNotFixed(i))].data();
@@ -204,52 +353,10 @@ void LSQNumObj::Refine (int nbCycle,bool useLevenbergMarquardt,
          //cout << designMatrix;
 
       TAU_PROFILE_STOP(timer2);
-      LSQNumObj_Refine_Restart: //Used in case of singular matrix
       TAU_PROFILE_START(timer3);
-
       //Calculate M and B matrices
-         tmpV1.resize(nbObs);
-         tmpV2.resize(nbObs);
-         for(i=0;i<nbVar;i++)
-         {
-            #if 1
-            {
-               const REAL * RESTRICT pD=designMatrix.data()+i*designMatrix.cols();
-               const REAL * RESTRICT pW=mWeight.data();
-               REAL * RESTRICT p=tmpV1.data();
-               for(k=0;k<nbObs;k++) *p++ = *pD++ * *pW++;
-            }
-            const REAL * pD=designMatrix.data();
-            for(j=0;j<nbVar;j++)
-            {
-               const REAL * p1=tmpV1.data();
-               REAL v2=0;
-               for(k=0;k<nbObs;k++) v2+= *pD++ * *p1++;
-               M(j,i)=v2;
-            }
-            REAL b=0;
-            const REAL * pObs=mObs.data();
-            const REAL * pCalc=calc0.data();
-            const REAL * p1=tmpV1.data();
-            for(k=0;k<nbObs;k++) b+= (*pObs++ - *pCalc++)* *p1++;
-            B(i)=b;
-            #else
-            for(k=0;k<nbObs;k++) tmpV1(k)=designMatrix(i,k);
-            tmpV1 *= mWeight;
-            for(j=0;j<nbVar;j++)
-            {
-               for(k=0;k<nbObs;k++) tmpV2(k)=designMatrix(j,k);
-               tmpV2 *= tmpV1;
-               M(j,i)= tmpV2.sum();
-                  //M(i,j)=total(designMatrix.row(i)*designMatrix.row(j)*weight);
-            }
-            tmpV2=mObs;
-            tmpV2 -= calc0;
-            tmpV2 *= tmpV1;
-            B(i)=tmpV2.sum();//total((obs-calc0)*weight*designMatrix.row(i))
-            #endif
-
-         }
+      this->CalcNormalMatrix(designMatrix,calc0,M,B);
+      nbBlock=this->CalcNormalMatrixBlocks(designMatrix,vBlock);
       TAU_PROFILE_STOP(timer3);
       bool increaseMarquardt=false;
       LSQNumObj_Refine_RestartMarquardt: //Used in case of singular matrix or for Marquardt
@@ -282,9 +389,7 @@ void LSQNumObj::Refine (int nbCycle,bool useLevenbergMarquardt,
                   }
                }
                */
-               if(!silent) cout << "LSQNumObj::Refine(): Automatically fixing parameter";
-               if(!silent) cout << " and re-start cycle..";
-               if(!silent) cout << endl;
+               if(!silent) cout << "LSQNumObj::Refine(): Automatically fixing parameter" << endl;
                mRefParList.GetParNotFixed(i).SetIsFixed(true);
                mRefParList.PrepareForRefinement();
                nbVar=mRefParList.GetNbParNotFixed();
@@ -298,22 +403,16 @@ void LSQNumObj::Refine (int nbCycle,bool useLevenbergMarquardt,
                N.resize(nbVar,nbVar);
                deltaVar.resize(nbVar);
 
-               //Just remove the ith line in the design matrix
-                        REAL *p1=designMatrix.data();
-                  const REAL *p2=designMatrix.data();
-                  p1 += i*nbObs;
-                  p2 += i*nbObs+nbObs;
-                  for(long j=i*nbObs+nbObs;j<nbObs*nbVar;j++) *p1++ = *p2++;
-               designMatrix.resizeAndPreserve(nbVar,nbObs);
-
-               //:TODO: Make this work...
-               /*
                //Remove ith line &Column in M & ith element in B
-                  p1=M.data();
-                  p2=M.data();
+                        REAL *p1=M.data();
+                  const REAL *p2=M.data();
                   for(long j=0;j<=nbVar;j++)
                   {
-                     if( (j>=i) && (j<nbVar) ) B(j)=B(j+1);
+                     if( (j>=i) && (j<nbVar) )
+                     {
+                        B(j)=B(j+1);
+                        vBlock(j)=vBlock(j+1);
+                     }
                      for(long k=0;k<=nbVar;k++)
                      {
                         if((j==i) || (k==i)) p2++;
@@ -322,11 +421,9 @@ void LSQNumObj::Refine (int nbCycle,bool useLevenbergMarquardt,
                   }
                M.resizeAndPreserve(nbVar,nbVar);
                B.resizeAndPreserve(nbVar);
-               */
-               M.resize(nbVar,nbVar);
-               B.resize(nbVar);
-               TAU_PROFILE_STOP(timer4);
-               goto LSQNumObj_Refine_Restart;
+               vBlock.resizeAndPreserve(nbVar);
+               // The next parameter is now the ith one
+               i--;
             }
          }
       TAU_PROFILE_STOP(timer4);
@@ -375,44 +472,56 @@ void LSQNumObj::Refine (int nbCycle,bool useLevenbergMarquardt,
       }
 */
       TAU_PROFILE_START(timer5);
-      //Perform "Eigenvalue Filtering" on normal matrix (using newmat library)
+      //Perform "Eigenvalue Filtering" on normal matrix
       {
-         //if(!silent) cout << "LSQNumObj::Refine():Eigenvalue Filtering..." <<endl;
-         CrystMatrix_REAL V(nbVar,nbVar);
-         CrystVector_REAL invW(nbVar);//diagonal matrix, in fact
-         //if(!silent) cout << "LSQNumObj::Refine():Eigenvalue Filtering...1" <<endl;
+         // Eigenvalues smaller than this fraction of the largest one are filtered
+         const REAL minEigenRatio=1e-5;
+         //'Derivative scaling'
+         CrystVector_REAL dscale(nbVar);
+         for(long i=0;i<nbVar;i++) dscale(i)=1./sqrt(M(i,i));
+         CrystMatrix_REAL A(nbVar,nbVar);
+         for(long i=0;i<nbVar;i++)
+            for(long j=0;j<nbVar;j++) A(i,j)=M(i,j)*dscale(i)*dscale(j);
+         // First try a Cholesky decomposition, by blocks if parameters only affect
+         // one of the data sets. If the condition number estimated from the inverse
+         // is small enough, no eigenvalue would be filtered and the inverse is used directly.
+         bool filter=true;
          {
-            SymmetricMatrix newmatA(nbVar);
-            Matrix   newmatV(nbVar,nbVar),
-                     newmatN(nbVar,nbVar);
-            DiagonalMatrix newmatW(nbVar);
-            ColumnVector newmatB(nbVar);
-            //'Derivative scaling' matrix
-               DiagonalMatrix newmatDscale(nbVar);
-               for(long i=0;i<nbVar;i++)
-                  newmatDscale(i+1,i+1) = 1./sqrt(M(i,i));
-            for(long i=0;i<nbVar;i++)
+            bool ok;
+            if(nbBlock>1) ok=BlockCholeskyInverse(A,vBlock,N);
+            else
             {
-               newmatB(i+1)=B(i);//NOT scaled
-               for(long j=0;j<nbVar;j++)
-                  newmatA(i+1,j+1) = M(i,j) * newmatDscale(i+1,i+1) * newmatDscale(j+1,j+1);
+               CrystMatrix_REAL L=A;
+               ok=CholeskyDecomposition(L);
+               if(ok) CholeskyInverse(L,N);
             }
-         //if(!silent) cout << "LSQNumObj::Refine():Eigenvalue Filtering...2" <<endl;
-
-            //cout << newmatA.SubMatrix(1,3,1,3) <<endl;
-         //if(!silent) cout << "LSQNumObj::Refine():Eigenvalue Filtering...3" <<endl;
-
-            //Jacobi(newmatA,newmatW,newmatV);
-            try
+            if(ok)
             {
-               EigenValues(newmatA,newmatW,newmatV);
+               REAL normA=0,normN=0;
+               for(long i=0;i<nbVar;i++)
+               {
+                  REAL sa=0,sn=0;
+                  for(long j=0;j<nbVar;j++)
+                  {
+                     sa+=fabs(A(i,j));
+                     sn+=fabs(N(i,j));
+                  }
+                  if(sa>normA) normA=sa;
+                  if(sn>normN) normN=sn;
+               }
+               // ||A||*||A^-1|| is larger than the ratio of extreme eigenvalues
+               if((normA*normN*minEigenRatio)<1) filter=false;
             }
-            catch(...)
+         }
+         if(filter)
+         {
+            CrystVector_REAL W;
+            CrystMatrix_REAL V;
+            if(false==SymmetricEigen(A,W,V))
             {
                if(!silent)
                {
-                  cout<<"Caught a Newmat exception :"<<BaseException::what()<<endl;
-                  cout<<"A:"<<endl<<newmatA<<endl<<"W:"<<endl<<newmatW<<endl<<"V:"<<endl<<newmatV<<endl<<"Dscale:"<<newmatDscale*1e6<<endl;
+                  cout<<"LSQNumObj::Refine():no convergence of the eigenvalues computation"<<endl;
                   cout<<setw(5)<<"B:"<<endl;
                   for(unsigned int i=0;i<B.size();i++) cout<<B(i)<<" ";
                   cout<<endl<<endl<<"M:"<<endl;
@@ -421,87 +530,40 @@ void LSQNumObj::Refine (int nbCycle,bool useLevenbergMarquardt,
                      for(unsigned int j=0;j<M.cols();j++) cout<<M(i,j)<<" ";
                      cout<<endl;
                   }
-                  cout<<endl<<endl<<"D("<<designMatrix.rows()<<"x"<<designMatrix.cols()<<"):"<<endl;
-                  for(unsigned int i=0;i<designMatrix.rows();i++)
-                  {
-                     for(unsigned int j=0;j<designMatrix.cols();j++) cout<<designMatrix(i,j)<<" ";
-                     cout<<endl;
-                  }
                }
-               throw ObjCrystException("LSQNumObj::Refine():caught a newmat exception during Eigenvalues computing !");
+               throw ObjCrystException("LSQNumObj::Refine():no convergence during Eigenvalues computing !");
             }
-               ColumnVector newmatDelta(nbVar);
-               DiagonalMatrix newmatInvW(nbVar);
-        //if(!silent) cout << "LSQNumObj::Refine():Eigenvalue Filtering...4" <<endl;
             //Avoid singular values
-            {
-               REAL max=newmatW.MaximumAbsoluteValue();
-               REAL minAllowedValue=1e-5*max;// :TODO: Check if reasonable !
-               for(long i=0;i<nbVar;i++)
-                  if(newmatW(i+1,i+1) > minAllowedValue)
-                     newmatInvW(i+1,i+1)= 1./newmatW(i+1,i+1);
-                  else
-                  {
-                     if(!silent) cout << "LSQNumObj::Refine():fixing ill-cond EigenValue "<< i <<endl;
-                     newmatInvW(i+1,i+1) = 0.;
-                  }
-
-               /*
-               REAL max;
-               int maxIndex;
-               const REAL minRatio=1e-6;
-               for(long i=0;i<nbVar;i++)
+            CrystVector_REAL invW(nbVar);//diagonal matrix, in fact
+            const REAL minAllowedValue=minEigenRatio*MaxAbs(W);// :TODO: Check if reasonable !
+            for(long i=0;i<nbVar;i++)
+               if(W(i) > minAllowedValue) invW(i)= 1./W(i);
+               else
                {
-                  max=fabs(newmatW(1)*newmatV(1,i+1)*newmatV(1,i+1));
-                  maxIndex=0;
-                  for(long j=1;j<nbVar;j++)
-                     if( fabs(newmatW(j+1)*newmatV(j+1,i+1)*newmatV(j+1,i+1)) > max )
-                     {
-                        max = fabs(newmatW(j+1)*newmatV(j+1,i+1)*newmatV(j+1,i+1));
-                        maxIndex=j;
-                     }
-
-                  cout << FormatFloat(newmatW(i+1,i+1),36,2) << " " ;
-                  cout << FormatFloat(max,36,2);
-                  cout << FormatFloat(newmatW(maxIndex+1,maxIndex+1),36,2) << " " ;
-                  cout << FormatFloat(newmatV(i+1,maxIndex+1)*100,8,2) ;
-                  //cout << endl;
-
-                  if(newmatW(i+1,i+1) > (max*minRatio))
-                  {
-                     newmatInvW(i+1,i+1) = 1./newmatW(i+1,i+1);
-                     cout << endl;
-                  }
-                  else
-                  {
-                     cout << "LSQNumObj::Refine():fixing ill-cond EigenValue "<< i <<endl;
-                     newmatInvW(i+1,i+1) = 0.;
-                  }
+                  if(!silent) cout << "LSQNumObj::Refine():fixing ill-cond EigenValue "<< i <<endl;
+                  invW(i) = 0.;
                }
-               */
-            }
-            newmatN=newmatV * newmatInvW * newmatV.t();
-
-            //Back 'Derivative Scaling' :TODO:
-               newmatN = newmatDscale * newmatN * newmatDscale;
-            newmatDelta = newmatN * newmatB;
-
+            // N=V*invW*V^T
+            N.resize(nbVar,nbVar);
             for(long i=0;i<nbVar;i++)
-            {
-               invW(i)=newmatInvW(i+1,i+1);
-               deltaVar(i)=newmatDelta(i+1);
-               for(long j=0;j<nbVar;j++)
+               for(long j=0;j<=i;j++)
                {
-                  N(i,j) = newmatN(i+1,j+1);
-                  V(i,j) = newmatV(i+1,j+1);
+                  REAL n=0;
+                  for(long k=0;k<nbVar;k++) n+=V(i,k)*invW(k)*V(j,k);
+                  N(i,j)=n;
+                  N(j,i)=n;
                }
+         }
+         //Back 'Derivative Scaling'
+         for(long i=0;i<nbVar;i++)
+         {
+            REAL d=0;
+            for(long j=0;j<nbVar;j++)
+            {
+               N(i,j)*=dscale(i)*dscale(j);
+               d+=N(i,j)*B(j);
             }
-            //cout << invW <<endl << U << endl << V << endl << B << endl << deltaVar << endl;
-            //cout<<setw(10)<<setprecision(4)<< newmatV*100. << endl;
-            //cout << newmatA/1e15 << endl;
-            //cout << newmatW << endl;
-            //cout << newmatDscale*1e20 << endl;
-            //cout << newmatB <<endl;
+            deltaVar(i)=d;
          }
       }//End EigenValue filtering
       TAU_PROFILE_STOP(timer5);
@@ -703,6 +765,187 @@ void LSQNumObj::Refine (int nbCycle,bool useLevenbergMarquardt,
    if(callBeginEndOptimization) this->EndOptimization();
 }
 
+void LSQNumObj::RefineLBFGS(int nbIteration,const bool silent,
+                            const bool callBeginEndOptimization,
+                            const float minChi2var,const unsigned int nbCorrection)
+{
+   TAU_PROFILE("LSQNumObj::RefineLBFGS()","void ()",TAU_USER);
+   if(callBeginEndOptimization) this->BeginOptimization();
+   mObs=this->GetLSQObs();
+   mWeight=this->GetLSQWeight();
+   if(!silent) cout << "LSQNumObj::RefineLBFGS():Beginning "<<endl;
+   if(mRefParList.GetNbPar()==0) this->PrepareRefParList();
+   mRefParList.PrepareForRefinement();
+   const long nbVar=mRefParList.GetNbParNotFixed();
+   if(nbVar==0) throw ObjCrystException("LSQNumObj::RefineLBFGS():no parameter to refine !");
+   mIndexValuesSetInitial=mRefParList.CreateParamSet("LSQ Refinement-Initial Values");
+   mIndexValuesSetLast=mRefParList.CreateParamSet("LSQ Refinement-Last Cycle Values");
+   // Current values and limits. The values are kept here without being brought back
+   // within the period for periodic parameters.
+   CrystVector_REAL x(nbVar),xmin(nbVar),xmax(nbVar),xt(nbVar);
+   for(long i=0;i<nbVar;i++)
+   {
+      const RefinablePar *par=&(mRefParList.GetParNotFixed(i));
+      x(i)=par->GetValue();
+      if(par->IsLimited())
+      {
+         xmin(i)=par->GetMin();
+         xmax(i)=par->GetMax();
+      }
+      else
+      {
+         xmin(i)=-std::numeric_limits<REAL>::max();
+         xmax(i)=std::numeric_limits<REAL>::max();
+      }
+   }
+   this->CalcChiSquare();
+   REAL chi2=mChiSq;
+   const REAL chi2Initial=chi2;
+   CrystVector_REAL g,gt,diag;
+   this->CalcChiSquareGradient(g,diag);
+   // Scaled parameters u=x*scale, for which the Hessian of Chi^2 (approximated
+   // by 2*diag(normal matrix)) has a unit diagonal
+   CrystVector_REAL scale(nbVar);
+   for(long i=0;i<nbVar;i++) scale(i)=(diag(i)>0) ? sqrt(2*diag(i)) : 1;
+   // Previous steps (s) and changes of the gradient (y), in scaled coordinates
+   const long nbPairMax=(nbCorrection==0) ? 1 : nbCorrection;
+   CrystMatrix_REAL vS(nbPairMax,nbVar),vY(nbPairMax,nbVar);
+   CrystVector_REAL alpha(nbPairMax),rho(nbPairMax);
+   long nbPair=0,lastPair=-1;
+   REAL gamma=1;
+   CrystVector_REAL gu(nbVar),d(nbVar);
+   vector<bool> vFree(nbVar);
+   for(int iter=1;iter<=nbIteration;iter++)
+   {
+      mRefParList.SaveParamSet(mIndexValuesSetLast);
+      // Parameters at a limit, with the gradient pushing beyond, are not moved
+      for(long i=0;i<nbVar;i++)
+      {
+         gu(i)=g(i)/scale(i);
+         vFree[i]=!(((x(i)<=xmin(i))&&(gu(i)>0))||((x(i)>=xmax(i))&&(gu(i)<0)));
+         d(i)=vFree[i] ? gu(i) : 0;
+      }
+      // Two-loop recursion, restricted to the free parameters
+      for(long k=0;k<nbPair;k++)
+      {
+         const long j=(lastPair-k+nbPairMax)%nbPairMax;
+         REAL sy=0,sd=0;
+         for(long i=0;i<nbVar;i++)
+            if(vFree[i])
+            {
+               sy+=vS(j,i)*vY(j,i);
+               sd+=vS(j,i)*d(i);
+            }
+         rho(j)=(sy>0) ? 1/sy : 0;
+         alpha(j)=rho(j)*sd;
+         for(long i=0;i<nbVar;i++) if(vFree[i]) d(i)-=alpha(j)*vY(j,i);
+      }
+      d*=gamma;
+      for(long k=nbPair-1;k>=0;k--)
+      {
+         const long j=(lastPair-k+nbPairMax)%nbPairMax;
+         REAL yd=0;
+         for(long i=0;i<nbVar;i++) if(vFree[i]) yd+=vY(j,i)*d(i);
+         const REAL beta=rho(j)*yd;
+         for(long i=0;i<nbVar;i++) if(vFree[i]) d(i)+=vS(j,i)*(alpha(j)-beta);
+      }
+      // Descent direction
+      REAL gd=0;
+      for(long i=0;i<nbVar;i++)
+      {
+         d(i)=-d(i);
+         gd+=gu(i)*d(i);
+      }
+      if(gd>=0)
+      {// Not a descent direction: forget the previous steps
+         if(!silent) cout << "LSQNumObj::RefineLBFGS(): resetting the quasi-Newton approximation"<<endl;
+         nbPair=0;
+         gamma=1;
+         for(long i=0;i<nbVar;i++) d(i)=vFree[i] ? -gu(i) : 0;
+      }
+      // Backtracking line search along the projection of x+a*d within the limits,
+      // until the Chi^2 decrease is large enough (Armijo condition)
+      REAL a=1,chi2t=chi2;
+      bool accepted=false;
+      for(int ls=0;ls<30;ls++)
+      {
+         REAL gdx=0;
+         for(long i=0;i<nbVar;i++)
+         {
+            REAL v=x(i)+a*d(i)/scale(i);
+            if(v<xmin(i)) v=xmin(i);
+            if(v>xmax(i)) v=xmax(i);
+            xt(i)=v;
+            gdx+=g(i)*(v-x(i));
+            mRefParList.GetParNotFixed(i).SetValue(v);
+         }
+         this->CalcChiSquare();
+         chi2t=mChiSq;
+         if((chi2t<=(chi2+1e-4*gdx))&&(!ISNAN_OR_INF(chi2t)))
+         {
+            accepted=true;
+            break;
+         }
+         a*=0.5;
+      }
+      if(!accepted)
+      {
+         mRefParList.RestoreParamSet(mIndexValuesSetLast);
+         mChiSq=chi2;
+         if(nbPair>0)
+         {// Try again with the steepest descent
+            if(!silent) cout << "LSQNumObj::RefineLBFGS(): line search failed, resetting the quasi-Newton approximation"<<endl;
+            nbPair=0;
+            gamma=1;
+            continue;
+         }
+         if(!silent) cout << "LSQNumObj::RefineLBFGS(): line search failed, stopping"<<endl;
+         break;
+      }
+      this->CalcChiSquareGradient(gt,diag);
+      // Store the new step, if the curvature is positive
+      {
+         const long j=(lastPair+1)%nbPairMax;
+         REAL sy=0,yy=0;
+         for(long i=0;i<nbVar;i++)
+         {
+            vS(j,i)=(xt(i)-x(i))*scale(i);
+            vY(j,i)=(gt(i)-g(i))/scale(i);
+            sy+=vS(j,i)*vY(j,i);
+            yy+=vY(j,i)*vY(j,i);
+         }
+         if(sy>(1e-10*yy))
+         {
+            lastPair=j;
+            if(nbPair<nbPairMax) nbPair++;
+            gamma=sy/yy;
+         }
+      }
+      const REAL var=(chi2-chi2t)/(chi2+1e-6);
+      x=xt;
+      g=gt;
+      chi2=chi2t;
+      if(!silent) cout << "LSQNumObj::RefineLBFGS():iteration #"<<iter<<"/"<<nbIteration
+                       <<", Chi^2="<<chi2<<endl;
+      if(var<minChi2var) break;
+   }
+   //R-factor
+   {
+      CrystVector_REAL tmpV1,tmpV2;
+      tmpV1 = mObs;
+      tmpV1 -= this->GetLSQCalc();
+      tmpV1 *= tmpV1;
+      tmpV2 = mObs;
+      tmpV2 *= tmpV2;
+      mR=sqrt(tmpV1.sum()/tmpV2.sum());
+      tmpV1 *= mWeight;
+      tmpV2 *= mWeight;
+      mRw=sqrt(tmpV1.sum()/tmpV2.sum());
+   }
+   if(!silent) cout << "LSQNumObj::RefineLBFGS():finished, Rw="<<mRw<<", Chi^2="<<chi2Initial<<"->"<<mChiSq<<endl;
+   if(callBeginEndOptimization) this->EndOptimization();
+}
+
 bool LSQNumObj::SafeRefine(std::list<RefinablePar*> vnewpar, std::list<const RefParType*> vnewpartype,
                                  REAL maxChi2factor,
                                  int nbCycle, bool useLevenbergMarquardt,
@@ -902,11 +1145,136 @@ void LSQNumObj::WriteReportToFile() const
    //:TODO:
 }
 
-void LSQNumObj::OptimizeDerivativeSteps()
+/// Derivative steps found by LSQNumObj::OptimizeDerivativeSteps(), for each parameter
+/// type, class of the object holding the parameter, and parameter name
+static map<pair<const RefParType*,pair<string,string> >,REAL> sDerivStepCache;
+/// Protects sDerivStepCache
+static std::mutex sDerivStepCacheMutex;
+
+/// The derivative step of a parameter, as given to RefinablePar::SetDerivStep()
+/// (i.e. relative to the value for REFPAR_DERIV_STEP_RELATIVE parameters), or 0 if
+/// it cannot be determined
+static REAL GetDerivStepSetting(const RefinablePar &par)
 {
-   //:TODO:
+   if(REFPAR_DERIV_STEP_ABSOLUTE==par.GetDerivStepModel()) return par.GetDerivStep();
+   if(par.GetValue()==0) return 0;
+   return par.GetDerivStep()/par.GetValue();
 }
 
+void LSQNumObj::OptimizeDerivativeSteps(const bool useCache,const bool silent)
+{
+   TAU_PROFILE("LSQNumObj::OptimizeDerivativeSteps()","void ()",TAU_DEFAULT);
+   OBJCRYST_PROFILE("LSQNumObj::OptimizeDerivativeSteps()");
+   VFN_DEBUG_ENTRY("LSQNumObj::OptimizeDerivativeSteps()",5)
+   if(mRefParList.GetNbPar()==0) this->PrepareRefParList();
+   mRefParList.PrepareForRefinement();
+   // Class of the object holding each parameter, and the parameter name in this object
+   // (parameters may be copies, which share the pointer to the value with the original)
+   map<const REAL*,pair<string,string> > vOwner;
+   for(map<RefinableObj*,unsigned int>::const_iterator pos=mvRefinedObjMap.begin();pos!=mvRefinedObjMap.end();++pos)
+      for(long i=0;i<pos->first->GetNbPar();i++)
+         vOwner[pos->first->GetPar(i).GetPointer()]=make_pair(pos->first->GetClassName(),
+                                                              pos->first->GetPar(i).GetName());
+   const CrystVector_REAL weight=this->GetLSQWeight();
+   const long nbObs=weight.numElements();
+   // The steps tried are the current step multiplied by 4^k, with -kMax<=k<=kMax
+   const int kMax=3;
+   for(long i=0;i<mRefParList.GetNbParNotFixed();i++)
+   {
+      RefinablePar *pPar=&(mRefParList.GetParNotFixed(i));
+      // Skip parameters for which the derivatives do not depend on the step
+      bool stepIndependent=false;
+      for(map<RefinableObj*,unsigned int>::const_iterator pos=mvRefinedObjMap.begin();pos!=mvRefinedObjMap.end();++pos)
+         if((pos->first->GetNbLSQFunction()>0)&&pos->first->IsLSQDerivStepIndependent(pos->second,*pPar))
+         {
+            stepIndependent=true;
+            break;
+         }
+      if(stepIndependent) continue;
+      map<const REAL*,pair<string,string> >::const_iterator posOwner=vOwner.find(pPar->GetPointer());
+      const pair<const RefParType*,pair<string,string> >
+         key(pPar->GetType(),(posOwner!=vOwner.end())?posOwner->second:make_pair(string(),pPar->GetName()));
+      if(useCache)
+      {
+         std::lock_guard<std::mutex> lock(sDerivStepCacheMutex);
+         map<pair<const RefParType*,pair<string,string> >,REAL>::const_iterator pos=sDerivStepCache.find(key);
+         if(pos!=sDerivStepCache.end())
+         {
+            if(GetDerivStepSetting(*pPar)!=pos->second) pPar->SetDerivStep(pos->second);
+            continue;
+         }
+      }
+      const REAL v0=pPar->GetValue();
+      const REAL step0=GetDerivStepSetting(*pPar);
+      if(step0==0) continue;
+      // Derivatives for each tried step (empty if the step cannot be used)
+      map<int,CrystVector_REAL> vDeriv;
+      auto computeDeriv=[&](const int k)
+      {
+         CrystVector_REAL *pD=&(vDeriv[k]);
+         pPar->SetDerivStep(step0*pow((REAL)4,(REAL)k));
+         const REAL h=abs(pPar->GetDerivStep());
+         // Limited parameters would be clamped by Mutate()
+         if(pPar->IsLimited() && (((v0-h)<pPar->GetMin())||((v0+h)>pPar->GetMax()))) return;
+         *pD=this->GetLSQDeriv(*pPar);
+         pPar->SetValue(v0);
+         for(long j=0;j<nbObs;j++)
+            if(ISNAN_OR_INF((*pD)(j))) {pD->resize(0);return;}
+      };
+      for(int k=-kMax;k<=kMax;k++) computeDeriv(k);
+      // Choose the pair of successive steps with the smallest Richardson error estimate
+      int best=-kMax-1;
+      REAL bestDiff=0;
+      // Largest relative difference between the derivatives for successive steps
+      REAL maxRelDiff=0;
+      for(int l=-kMax+1;l<=kMax;l++)
+      {
+         const CrystVector_REAL *pD0=&(vDeriv[l-1]),*pD1=&(vDeriv[l]);
+         if((pD0->numElements()==0)||(pD1->numElements()==0)) continue;
+         const REAL *p0=pD0->data(),*p1=pD1->data(),*w=weight.data();
+         REAL diff=0,norm=0;
+         for(long j=0;j<nbObs;j++)
+         {
+            diff+= *w * (*p1-*p0)*(*p1-*p0);
+            norm+= *w * *p1 * *p1;
+            p0++;p1++;w++;
+         }
+         if(norm==0) continue;// Null derivative (e.g. unused parameter)
+         if(diff/norm>maxRelDiff) maxRelDiff=diff/norm;
+         if((best<-kMax)||(diff<bestDiff))
+         {
+            best=l;
+            bestDiff=diff;
+         }
+      }
+      // The derivatives do not depend on the step (within rounding errors): keep it
+      if((best>=-kMax)&&(maxRelDiff<1e-20)) best=0;
+      if(best<-kMax)
+      {// No usable step: keep the original one
+         pPar->SetDerivStep(step0);
+         continue;
+      }
+      const REAL step=step0*pow((REAL)4,(REAL)best);
+      pPar->SetDerivStep(step);
+      if(!silent)
+         cout<<"LSQNumObj::OptimizeDerivativeSteps(): "<<pPar->GetName()<<": step "
+             <<step0<<" -> "<<step<<endl;
+      std::lock_guard<std::mutex> lock(sDerivStepCacheMutex);
+      sDerivStepCache[key]=step;
+   }
+   VFN_DEBUG_EXIT("LSQNumObj::OptimizeDerivativeSteps()",5)
+}
+
+void LSQNumObj::ClearDerivativeStepCache()
+{
+   std::lock_guard<std::mutex> lock(sDerivStepCacheMutex);
+   sDerivStepCache.clear();
+}
+
+void LSQNumObj::SetAutoDerivativeSteps(const bool b) {mAutoDerivStep=b;}
+
+bool LSQNumObj::GetAutoDerivativeSteps()const {return mAutoDerivStep;}
+
 const std::map<pair<const RefinablePar*,const RefinablePar*>,REAL > & LSQNumObj::GetVarianceCovarianceMap()const
 { return mvVarCovar;}
 
@@ -1037,6 +1405,375 @@ const std::map<RefinablePar*,CrystVector_REAL>& LSQNumObj::GetLSQ_FullDeriv()
    return mLSQ_FullDeriv;
 }
 
+void LSQNumObj::SetNbThread(const unsigned int nb) {mNbThread=nb;}
+
+unsigned int LSQNumObj::GetNbThread()const {return mNbThread;}
+
+void LSQNumObj::PrepareThreadCopies(vector<unique_ptr<ThreadCopy> > &vCopy,const bool silent)
+{
+   VFN_DEBUG_ENTRY("LSQNumObj::PrepareThreadCopies()",5)
+   vCopy.clear();
+   long nbThread=mNbThread;
+   if(nbThread==0) nbThread=std::thread::hardware_concurrency();
+   if(nbThread>mRefParList.GetNbParNotFixed()) nbThread=mRefParList.GetNbParNotFixed();
+   if(nbThread<2)
+   {
+      VFN_DEBUG_EXIT("LSQNumObj::PrepareThreadCopies():single thread",5)
+      return;
+   }
+   for(long t=1;t<nbThread;t++)
+   {
+      unique_ptr<ThreadCopy> pCopy(new ThreadCopy);
+      if(!pCopy->Init(*this))
+      {
+         if(!silent) cout<<"LSQNumObj::Refine(): cannot copy the refined objects, "
+                         <<"derivatives will be computed in a single thread"<<endl;
+         vCopy.clear();
+         VFN_DEBUG_EXIT("LSQNumObj::PrepareThreadCopies():cannot copy objects",5)
+         return;
+      }
+      vCopy.push_back(std::move(pCopy));
+   }
+   if(!silent) cout<<"LSQNumObj::Refine(): computing derivatives in "<<nbThread<<" threads"<<endl;
+   VFN_DEBUG_EXIT("LSQNumObj::PrepareThreadCopies()",5)
+}
+
+void LSQNumObj::CalcDesignMatrix(CrystMatrix_REAL &designMatrix,vector<unique_ptr<ThreadCopy> > &vCopy)
+{
+   TAU_PROFILE("LSQNumObj::CalcDesignMatrix()","void ()",TAU_DEFAULT);
+   OBJCRYST_PROFILE("LSQNumObj::CalcDesignMatrix()");
+   const long nbVar=mRefParList.GetNbParNotFixed();
+   const long nbObs=designMatrix.cols();
+   for(vector<unique_ptr<ThreadCopy> >::iterator pos=vCopy.begin();pos!=vCopy.end();++pos)
+      (*pos)->SyncParameters(mRefParList);
+   // Each thread takes the next parameter, and stores its derivative in the
+   // corresponding row. The exact value of the parameter is restored after its
+   // derivative is computed (+step-2*step+step may differ by rounding), so the
+   // result does not depend on the number of threads.
+   std::atomic<long> next(0);
+   auto calcDeriv=[&](ThreadCopy *pCopy)
+   {
+      while(true)
+      {
+         const long i=next++;
+         if(i>=nbVar) break;
+         REAL *p=designMatrix.data()+i*nbObs;
+         if(pCopy!=0) pCopy->CalcLSQDeriv(mRefParList.GetParNotFixed(i),p);
+         else
+         {
+            RefinablePar *pPar=&(mRefParList.GetParNotFixed(i));
+            const REAL v0=pPar->GetValue();
+            const CrystVector_REAL *pDeriv=&(this->GetLSQDeriv(*pPar));
+            const REAL *p1=pDeriv->data();
+            for(long j=0;j<nbObs;j++) *p++ = *p1++;
+            pPar->SetValue(v0);
+         }
+      }
+   };
+   vector<std::exception_ptr> vException(vCopy.size()+1);
+   vector<std::thread> vThread;
+   for(unsigned int t=0;t<vCopy.size();t++)
+      vThread.push_back(std::thread([&,t]()
+      {
+         try {calcDeriv(vCopy[t].get());}
+         catch(...)
+         {
+            vException[t+1]=std::current_exception();
+            next=nbVar;
+         }
+      }));
+   try {calcDeriv(0);}
+   catch(...)
+   {
+      vException[0]=std::current_exception();
+      next=nbVar;
+   }
+   for(vector<std::thread>::iterator pos=vThread.begin();pos!=vThread.end();++pos) pos->join();
+   for(vector<std::exception_ptr>::iterator pos=vException.begin();pos!=vException.end();++pos)
+      if(*pos) std::rethrow_exception(*pos);
+}
+
+/** \internal Add the products of 4 rows of a (weighted derivatives) by 4 rows of b
+* (derivatives) to a 4x4 block of the normal matrix. Each element is summed in the
+* order of the observations.
+*
+* \param a,b: the first row of each block, with lda and ldb elements between rows
+* \param nb: the number of observations
+* \param c: the first element of the block in the normal matrix, with ldc elements between rows
+*/
+static inline void NormalMatrixBlock4x4(const REAL * RESTRICT a,const long lda,
+                                        const REAL * RESTRICT b,const long ldb,
+                                        const long nb,REAL * RESTRICT c,const long ldc)
+{
+   const REAL * RESTRICT a0=a;
+   const REAL * RESTRICT a1=a+lda;
+   const REAL * RESTRICT a2=a+2*lda;
+   const REAL * RESTRICT a3=a+3*lda;
+   const REAL * RESTRICT b0=b;
+   const REAL * RESTRICT b1=b+ldb;
+   const REAL * RESTRICT b2=b+2*ldb;
+   const REAL * RESTRICT b3=b+3*ldb;
+   REAL c00=c[0],      c01=c[1],      c02=c[2],      c03=c[3];
+   REAL c10=c[ldc],    c11=c[ldc+1],  c12=c[ldc+2],  c13=c[ldc+3];
+   REAL c20=c[2*ldc],  c21=c[2*ldc+1],c22=c[2*ldc+2],c23=c[2*ldc+3];
+   REAL c30=c[3*ldc],  c31=c[3*ldc+1],c32=c[3*ldc+2],c33=c[3*ldc+3];
+   for(long k=0;k<nb;k++)
+   {
+      const REAL x0=a0[k],x1=a1[k],x2=a2[k],x3=a3[k];
+      const REAL y0=b0[k],y1=b1[k],y2=b2[k],y3=b3[k];
+      c00+=x0*y0;c01+=x0*y1;c02+=x0*y2;c03+=x0*y3;
+      c10+=x1*y0;c11+=x1*y1;c12+=x1*y2;c13+=x1*y3;
+      c20+=x2*y0;c21+=x2*y1;c22+=x2*y2;c23+=x2*y3;
+      c30+=x3*y0;c31+=x3*y1;c32+=x3*y2;c33+=x3*y3;
+   }
+   c[0]=c00;      c[1]=c01;      c[2]=c02;      c[3]=c03;
+   c[ldc]=c10;    c[ldc+1]=c11;  c[ldc+2]=c12;  c[ldc+3]=c13;
+   c[2*ldc]=c20;  c[2*ldc+1]=c21;c[2*ldc+2]=c22;c[2*ldc+3]=c23;
+   c[3*ldc]=c30;  c[3*ldc+1]=c31;c[3*ldc+2]=c32;c[3*ldc+3]=c33;
+}
+
+void LSQNumObj::CalcNormalMatrix(const CrystMatrix_REAL &designMatrix,const CrystVector_REAL &calc,
+                                 CrystMatrix_REAL &M,CrystVector_REAL &B)const
+{
+   TAU_PROFILE("LSQNumObj::CalcNormalMatrix()","void ()",TAU_DEFAULT);
+   OBJCRYST_PROFILE("LSQNumObj::CalcNormalMatrix()");
+   const long nbVar=designMatrix.rows();
+   const long nbObs=designMatrix.cols();
+   // Number of observations and of parameters in each block. The weighted derivatives
+   // for one block (32kB) stay in the L1/L2 cache while all the derivatives for the
+   // same observations are multiplied by them.
+   const long nbObsBlock=256;
+   const long nbParBlock=16;
+   M.resize(nbVar,nbVar);
+   B.resize(nbVar);
+   CrystVector_REAL residual(nbObs);
+   {
+      const REAL * RESTRICT pObs=mObs.data();
+      const REAL * RESTRICT pCalc=calc.data();
+      REAL * RESTRICT p=residual.data();
+      for(long k=0;k<nbObs;k++) *p++ = *pObs++ - *pCalc++;
+   }
+   // Range of observations [begin;end[ where the derivative of each parameter is not null
+   // (begin=nbObs and end=0 if all derivatives are null)
+   vector<long> vObsBegin(nbVar,nbObs),vObsEnd(nbVar,0);
+   for(long i=0;i<nbVar;i++)
+   {
+      const REAL *pD=designMatrix.data()+i*nbObs;
+      long k=0;
+      while((k<nbObs)&&(pD[k]==0)) k++;
+      if(k==nbObs) continue;
+      vObsBegin[i]=k;
+      k=nbObs;
+      while(pD[k-1]==0) k--;
+      vObsEnd[i]=k;
+   }
+   // Range of observations for a group of parameters
+   auto obsRange=[&](const long i0,const long nb,long &begin,long &end)
+   {
+      begin=nbObs;
+      end=0;
+      for(long i=i0;(i<(i0+nb))&&(i<nbVar);i++)
+      {
+         if(vObsBegin[i]<begin) begin=vObsBegin[i];
+         if(vObsEnd[i]>end) end=vObsEnd[i];
+      }
+   };
+   const long nbTask=(nbVar+nbParBlock-1)/nbParBlock;
+   long nbThread=mNbThread;
+   if(nbThread==0) nbThread=std::thread::hardware_concurrency();
+   if(nbThread>nbTask) nbThread=nbTask;
+   std::atomic<long> next(0);
+   auto calcBlocks=[&]()
+   {
+      // Weighted derivatives for one block of parameters and observations (the rows
+      // beyond the last parameter are left to zero)
+      CrystVector_REAL wd(nbParBlock*nbObsBlock);
+      // Elements of M for one block of parameters (rows), for all columns
+      CrystVector_REAL m(nbParBlock*nbVar),b(nbParBlock);
+      while(true)
+      {
+         const long task=next++;
+         if(task>=nbTask) break;
+         const long i0=task*nbParBlock;
+         const long ni=(nbVar-i0)<nbParBlock ? nbVar-i0 : nbParBlock;
+         wd=0;
+         m=0;
+         b=0;
+         long obsBegin,obsEnd;
+         obsRange(i0,ni,obsBegin,obsEnd);
+         for(long k0=(obsBegin/nbObsBlock)*nbObsBlock;k0<obsEnd;k0+=nbObsBlock)
+         {
+            const long nk=(nbObs-k0)<nbObsBlock ? nbObs-k0 : nbObsBlock;
+            for(long i=0;i<ni;i++)
+            {
+               const REAL * RESTRICT pD=designMatrix.data()+(i0+i)*nbObs+k0;
+               const REAL * RESTRICT pW=mWeight.data()+k0;
+               const REAL * RESTRICT pR=residual.data()+k0;
+               REAL * RESTRICT p=wd.data()+i*nbObsBlock;
+               REAL v=b(i);
+               for(long k=0;k<nk;k++)
+               {
+                  p[k]=pD[k]*pW[k];
+                  v+=pR[k]*p[k];
+               }
+               b(i)=v;
+            }
+            // Only the columns j>=i0 are needed (upper half of M)
+            for(long j0=i0;j0<nbVar;j0+=4)
+            {
+               const long nj=(nbVar-j0)<4 ? nbVar-j0 : 4;
+               long jBegin,jEnd;
+               obsRange(j0,nj,jBegin,jEnd);
+               if(jBegin<k0) jBegin=k0;
+               if(jEnd>(k0+nk)) jEnd=k0+nk;
+               for(long i=0;i<ni;i+=4)
+               {
+                  // Skip the observations where the derivatives are null
+                  long kBegin,kEnd;
+                  obsRange(i0+i,4,kBegin,kEnd);
+                  if(kBegin<jBegin) kBegin=jBegin;
+                  if(kEnd>jEnd) kEnd=jEnd;
+                  if(kBegin>=kEnd) continue;
+                  const REAL *pD=designMatrix.data()+j0*nbObs+kBegin;
+                  const REAL *pWD=wd.data()+i*nbObsBlock+kBegin-k0;
+                  if(nj==4)
+                     NormalMatrixBlock4x4(pWD,nbObsBlock,pD,nbObs,kEnd-kBegin,
+                                          m.data()+i*nbVar+j0,nbVar);
+                  else
+                     for(long i1=0;i1<4;i1++)
+                        for(long j=0;j<nj;j++)
+                        {
+                           const REAL * RESTRICT p1=pWD+i1*nbObsBlock;
+                           const REAL * RESTRICT p2=pD+j*nbObs;
+                           REAL v=m((i+i1)*nbVar+j0+j);
+                           for(long k=0;k<(kEnd-kBegin);k++) v+=p1[k]*p2[k];
+                           m((i+i1)*nbVar+j0+j)=v;
+                        }
+               }
+            }
+         }
+         // Each element of M is only written by the task of the smallest of its indices
+         for(long i=0;i<ni;i++)
+         {
+            for(long j=i0+i;j<nbVar;j++)
+            {
+               M(i0+i,j)=m(i*nbVar+j);
+               M(j,i0+i)=m(i*nbVar+j);
+            }
+            B(i0+i)=b(i);
+         }
+      }
+   };
+   vector<std::thread> vThread;
+   for(long t=1;t<nbThread;t++) vThread.push_back(std::thread(calcBlocks));
+   calcBlocks();
+   for(vector<std::thread>::iterator pos=vThread.begin();pos!=vThread.end();++pos) pos->join();
+}
+
+long LSQNumObj::CalcNormalMatrixBlocks(const CrystMatrix_REAL &designMatrix,
+                                       CrystVector_long &vBlock)const
+{
+   const long nbVar=designMatrix.rows();
+   const long nbObs=designMatrix.cols();
+   // First observation of the LSQ function of each object, in the same order as GetLSQObs()
+   vector<long> vObjBegin;
+   long nb=0;
+   for(map<RefinableObj*,unsigned int>::const_iterator pos=mvRefinedObjMap.begin();pos!=mvRefinedObjMap.end();++pos)
+   {
+      if(pos->first->GetNbLSQFunction()==0) continue;
+      map<RefinableObj*,unsigned int>::const_iterator posSize=mvRefinedObjLSQSize.find(pos->first);
+      if((posSize==mvRefinedObjLSQSize.end())||(posSize->second==0)) continue;
+      vObjBegin.push_back(nb);
+      nb+=posSize->second;
+   }
+   vBlock.resize(nbVar);
+   vBlock=-1;
+   if((nb!=nbObs)||(vObjBegin.size()<2)) return 0;
+   vObjBegin.push_back(nbObs);
+   vector<bool> vUsed(vObjBegin.size()-1,false);
+   for(long i=0;i<nbVar;i++)
+   {
+      const REAL *pD=designMatrix.data()+i*nbObs;
+      long block=-1;
+      for(unsigned long j=0;(j+1)<vObjBegin.size();j++)
+      {
+         long k=vObjBegin[j];
+         while((k<vObjBegin[j+1])&&(pD[k]==0)) k++;
+         if(k==vObjBegin[j+1]) continue;
+         if(block>=0)
+         {// Several data sets
+            block=-1;
+            break;
+         }
+         block=j;
+      }
+      vBlock(i)=block;
+      if(block>=0) vUsed[block]=true;
+   }
+   // Number the blocks which are actually used
+   vector<long> vIndex(vUsed.size(),-1);
+   long nbBlock=0;
+   for(unsigned long j=0;j<vUsed.size();j++) if(vUsed[j]) vIndex[j]=nbBlock++;
+   for(long i=0;i<nbVar;i++) if(vBlock(i)>=0) vBlock(i)=vIndex[vBlock(i)];
+   return nbBlock;
+}
+
+void LSQNumObj::CalcChiSquareGradient(CrystVector_REAL &grad,CrystVector_REAL &diag)
+{
+   TAU_PROFILE("LSQNumObj::CalcChiSquareGradient()","void ()",TAU_DEFAULT);
+   OBJCRYST_PROFILE("LSQNumObj::CalcChiSquareGradient()");
+   const long nbVar=mRefParList.GetNbParNotFixed();
+   // Number of parameters for which the derivatives are computed at once
+   const long nbParChunk=32;
+   grad.resize(nbVar);
+   diag.resize(nbVar);
+   grad=0;
+   diag=0;
+   long first=0;// first observation of the object's LSQ function
+   CrystVector_REAL wr,w;
+   for(map<RefinableObj*,unsigned int>::iterator pos=mvRefinedObjMap.begin();pos!=mvRefinedObjMap.end();++pos)
+   {
+      if(pos->first->GetNbLSQFunction()==0) continue;
+      RefinableObj *pObj=pos->first;
+      const unsigned int idx=pos->second;
+      const CrystVector_REAL *pCalc=&(pObj->GetLSQCalc(idx));
+      const long nb=pCalc->numElements();
+      if(nb==0) continue;
+      // Weighted residuals
+      wr.resize(nb);
+      w.resize(nb);
+      for(long k=0;k<nb;k++)
+      {
+         w(k)=mWeight(first+k);
+         wr(k)=w(k)*(mObs(first+k)-(*pCalc)(k));
+      }
+      for(long i0=0;i0<nbVar;i0+=nbParChunk)
+      {
+         const long i1=(i0+nbParChunk)<nbVar ? i0+nbParChunk : nbVar;
+         std::set<RefinablePar*> vPar;
+         for(long i=i0;i<i1;i++) vPar.insert(&(mRefParList.GetParNotFixed(i)));
+         const std::map<RefinablePar*,CrystVector_REAL> *pvDeriv=&(pObj->GetLSQ_FullDeriv(idx,vPar));
+         for(long i=i0;i<i1;i++)
+         {
+            RefinablePar *par=&(mRefParList.GetParNotFixed(i));
+            std::map<RefinablePar*,CrystVector_REAL>::const_iterator posD=pvDeriv->find(par);
+            const REAL *pD;
+            if((posD!=pvDeriv->end())&&(posD->second.numElements()>=nb)) pD=posD->second.data();
+            else pD=pObj->GetLSQDeriv(idx,*par).data();// no analytical derivative
+            REAL g=0,dd=0;
+            for(long k=0;k<nb;k++)
+            {
+               g+=wr(k)*pD[k];
+               dd+=w(k)*pD[k]*pD[k];
+            }
+            grad(i)-=2*g;
+            diag(i)+=dd;
+         }
+      }
+      first+=nb;
+   }
+}
+
 void LSQNumObj::BeginOptimization(const bool allowApproximations, const bool enableRestraints)
 {
    for(map<RefinableObj*,unsigned int>::iterator pos=mvRefinedObjMap.begin();pos!=mvRefinedObjMap.end();++pos)
@@ -1076,4 +1813,82 @@ void LSQNumObj::WXNotifyDelete()
 }
 #endif
 
+////////////////////////////////////////////////////////////////////////
+//
+//    LSQJobQueue
+//
+////////////////////////////////////////////////////////////////////////
+LSQJobQueue::LSQJobQueue(const unsigned int nbThread):
+mNbJob(0),mStop(false)
+{
+   unsigned int nb=nbThread;
+   if(nb==0) nb=std::thread::hardware_concurrency();
+   if(nb==0) nb=1;
+   for(unsigned int t=0;t<nb;t++) mvThread.push_back(std::thread(&LSQJobQueue::RunWorker,this));
+}
+
+LSQJobQueue::~LSQJobQueue()
+{
+   {
+      std::lock_guard<std::mutex> lock(mMutex);
+      mStop=true;
+   }
+   mNewJob.notify_all();
+   for(vector<std::thread>::iterator pos=mvThread.begin();pos!=mvThread.end();++pos) pos->join();
+}
+
+std::future<void> LSQJobQueue::Submit(const std::function<void()> &job)
+{
+   std::packaged_task<void()> task(job);
+   std::future<void> f=task.get_future();
+   {
+      std::lock_guard<std::mutex> lock(mMutex);
+      mvJob.push_back(std::move(task));
+      mNbJob++;
+   }
+   mNewJob.notify_one();
+   return f;
+}
+
+void LSQJobQueue::Wait()
+{
+   std::unique_lock<std::mutex> lock(mMutex);
+   mJobDone.wait(lock,[this](){return mNbJob==0;});
+}
+
+unsigned long LSQJobQueue::GetNbJob()const
+{
+   std::lock_guard<std::mutex> lock(mMutex);
+   return mNbJob;
+}
+
+unsigned int LSQJobQueue::GetNbThread()const {return mvThread.size();}
+
+void LSQJobQueue::RunWorker()
+{
+   while(true)
+   {
+      std::packaged_task<void()> task;
+      {
+         std::unique_lock<std::mutex> lock(mMutex);
+         mNewJob.wait(lock,[this](){return mStop||(mvJob.size()>0);});
+         // Remaining jobs are run before stopping
+         if(mvJob.size()==0) return;
+         task=std::move(mvJob.front());
+         mvJob.pop_front();
+      }
+      {
+         // Objects created by the job are only registered in the scope's registries,
+         // which are destroyed (empty) at the end of the job
+         RegistryScope scope;
+         task();
+      }
+      {
+         std::lock_guard<std::mutex> lock(mMutex);
+         mNbJob--;
+      }
+      mJobDone.notify_all();
+   }
+}
+
 }//namespace
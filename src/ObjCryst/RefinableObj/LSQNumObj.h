@@ -28,6 +28,14 @@
 #include <string>
 #include <map>
 #include <list>
+#include <vector>
+#include <memory>
+#include <deque>
+#include <functional>
+#include <future>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
 
 namespace ObjCryst
 {
@@ -96,6 +104,31 @@ class LSQNumObj
       void Refine (int nbCycle=1,bool useLevenbergMarquardt=false,
                    const bool silent=false, const bool callBeginEndOptimization=true,
                    const float minChi2var=0.01);
+      /** Do the refinement with a limited-memory quasi-Newton algorithm (L-BFGS-B),
+      * which only requires the gradient of Chi^2 instead of the normal matrix.
+      * This is better suited than Refine() for large numbers of parameters or
+      * observations, with many cheap iterations.
+      *
+      * The derivatives are obtained with RefinableObj::GetLSQ_FullDeriv() (analytical
+      * where implemented), or numerically for the parameters not supplied, for a few
+      * parameters at a time. The parameters are scaled using the diagonal of the
+      * normal matrix at the beginning of the refinement. The limits of the parameters
+      * are enforced: a parameter at a limit stays there as long as the gradient
+      * pushes it beyond.
+      *
+      * Since the normal matrix is not computed, the sigmas and correlations of the
+      * parameters are not updated.
+      *
+      * \param nbIteration: maximum number of iterations
+      * \param minChi2var: the refinement stops when the relative decrease of Chi^2
+      * in one iteration is less than minChi2var
+      * \param nbCorrection: number of previous steps used to approximate the inverse
+      * of the Hessian
+      * See Refine() for the other parameters.
+      */
+      void RefineLBFGS(int nbIteration=100,const bool silent=false,
+                       const bool callBeginEndOptimization=true,
+                       const float minChi2var=1e-6,const unsigned int nbCorrection=8);
       /** Run a refinement in a 'safe' way: if the Chi2 value increases by more that a given factor
       * the parameters are reverted to their initial values. Moreover, the listed 'new' parameters
       * or parameter types are then fixed.
@@ -174,7 +207,43 @@ class LSQNumObj
       void PurgeSaveFile();
       void WriteReportToFile()const;
 
-      void OptimizeDerivativeSteps();
+      /** Choose the step used to compute the numerical derivative of each refined
+      * (not fixed) parameter.
+      *
+      * Central differences are computed for a series of steps (the current step
+      * multiplied by powers of 4). Since the truncation error of a central difference
+      * decreases as the square of the step, the difference between the derivatives
+      * obtained with two successive steps (Richardson error estimate) is small only
+      * when both truncation and rounding errors are small: the largest step of the
+      * pair with the smallest (weighted) difference is used.
+      *
+      * The chosen steps are cached for each parameter type, class of the object
+      * holding the parameter and parameter name (e.g. the 'x' coordinate of an
+      * Atom), so that further refinements of this or similar models, with any
+      * LSQNumObj, reuse them without any calculation. The cache is shared by all
+      * threads.
+      *
+      * Parameters for which the derivatives do not depend on the step (see
+      * RefinableObj::IsLSQDerivStepIndependent(), e.g. scale factors and background
+      * intensities) are skipped, and the step is not changed if the derivatives
+      * computed with all tried steps are identical within rounding errors.
+      *
+      * \param useCache: if false, the steps are searched even if they are already
+      * in the cache (which is then updated).
+      */
+      void OptimizeDerivativeSteps(const bool useCache=true,const bool silent=true);
+      /// Forget all the derivative steps found by OptimizeDerivativeSteps()
+      static void ClearDerivativeStepCache();
+      /** If true (the default), OptimizeDerivativeSteps() is called at the beginning
+      * of Refine(), so that the derivative steps of new types of parameters are
+      * optimized before the first cycle.
+      *
+      * Note that if the parameters are not copied (see PrepareRefParList()),
+      * the derivative steps of the refined parameters are modified.
+      */
+      void SetAutoDerivativeSteps(const bool b);
+      /// Are derivative steps optimized at the beginning of Refine() ?
+      bool GetAutoDerivativeSteps()const;
       const std::map<pair<const RefinablePar*,const RefinablePar*>,REAL > &GetVarianceCovarianceMap()const;
       /** Prepare the full parameter list for the refinement
       * \param copy_param: if false (the default), then the lsq algorithm will work directly
@@ -201,6 +270,20 @@ class LSQNumObj
       /// Get the LSQ deriv vector (using either only the top or the hierarchy of object)
       const CrystVector_REAL& GetLSQDeriv(RefinablePar&par);
       const std::map<RefinablePar*,CrystVector_REAL>& GetLSQ_FullDeriv();
+      /** Set the number of threads used to compute the numerical derivatives
+      * (0=number of available cores, the default is 1).
+      *
+      * With several threads, each thread but the calling one uses its own copy of the
+      * refined objects (see MonteCarloObj::CloneGraph()), and computes the derivatives for
+      * a share of the refined parameters. Each derivative is computed exactly as with
+      * a single thread, so the results do not depend on the number of threads.
+      * The copies are created at the beginning of Refine(): if the refined objects
+      * cannot be copied (only Crystal, DiffractionDataSingleCrystal and PowderPattern
+      * objects, with their sub-objects, can be copied), a single thread is used.
+      */
+      void SetNbThread(const unsigned int nb);
+      /// Number of threads used to compute the numerical derivatives (0=number of available cores)
+      unsigned int GetNbThread()const;
       /** Tell all refined object that the refinement is beginning
       */
       void BeginOptimization(const bool allowApproximations=false, const bool enableRestraints=false);
@@ -209,6 +292,48 @@ class LSQNumObj
       void EndOptimization();
    protected:
    private:
+      /// \internal Copy of the refined objects, used by one thread to compute derivatives
+      struct ThreadCopy;
+      /** Create the copies of the refined objects used by the threads computing
+      * the derivatives. No copy is created if only one thread is used, or if the
+      * objects cannot be copied.
+      */
+      void PrepareThreadCopies(std::vector<std::unique_ptr<ThreadCopy> > &vCopy,const bool silent);
+      /** Compute the derivatives of the LSQ functions for all the not-fixed parameters,
+      * which are stored as the rows of the design matrix. The main thread uses the
+      * original objects, and each other thread one of the copies.
+      */
+      void CalcDesignMatrix(CrystMatrix_REAL &designMatrix,
+                            std::vector<std::unique_ptr<ThreadCopy> > &vCopy);
+      /** Compute the normal matrix M=D.W.D^T and the vector B=D.W.(obs-calc), from the
+      * design matrix D (one row per parameter).
+      *
+      * The design matrix is processed in blocks of parameters and observations which
+      * stay in cache, and only half of the symmetric matrix is computed. Blocks of
+      * parameters are distributed between threads (see SetNbThread()), but each
+      * element is always summed in the same order, so the result does not depend
+      * on the number of threads. Only the range of observations where the derivatives
+      * of both parameters are not null is used, so that parameters affecting different
+      * data sets (e.g. background or scale factors) are not multiplied by zeros.
+      */
+      void CalcNormalMatrix(const CrystMatrix_REAL &designMatrix,const CrystVector_REAL &calc,
+                            CrystMatrix_REAL &M,CrystVector_REAL &B)const;
+      /** Find the block structure of the normal matrix, from the objects in
+      * GetRefinedObjMap(): a parameter whose derivatives are only non-null for the
+      * LSQ function of one object belongs to the block of this object, otherwise
+      * (e.g. atomic positions used by several data sets) it is coupled to all the others.
+      *
+      * \param vBlock: for each not-fixed parameter, the index of its block, or -1
+      * \return the number of blocks
+      */
+      long CalcNormalMatrixBlocks(const CrystMatrix_REAL &designMatrix,
+                                  CrystVector_long &vBlock)const;
+      /** Compute the gradient of Chi^2 for all the not-fixed parameters, without
+      * storing the derivatives for all parameters at once.
+      *
+      * \param diag: the diagonal of the normal matrix, sum(weight*deriv^2)
+      */
+      void CalcChiSquareGradient(CrystVector_REAL &grad,CrystVector_REAL &diag);
       // Refined object
          /// The recursive list of all refined sub-objects
          ObjRegistry<RefinableObj> mRecursiveRefinedObjList;
@@ -243,6 +368,10 @@ class LSQNumObj
       int mIndexValuesSetInitial, mIndexValuesSetLast;
       /// If true, then stop at the end of the cycle. Used in multi-threading environment
       bool mStopAfterCycle;
+      /// Number of threads used to compute the derivatives (0=number of available cores)
+      unsigned int mNbThread;
+      /// Call OptimizeDerivativeSteps() at the beginning of Refine() ?
+      bool mAutoDerivStep;
       // The optimized object
       //RefinableObj *mpRefinedObj;
       // The index of the LSQ function in the refined object (if there are several...)
@@ -276,5 +405,79 @@ class LSQNumObj
 #endif
 };
 
+/** \brief Queue of independent refinement jobs, run concurrently by a pool of threads.
+*
+* Each job is a function which creates its own objects (e.g. loads a Crystal and a
+* PowderPattern from an XML file), refines them using an LSQNumObj, and stores the
+* results. Each job is run inside a RegistryScope, so the objects it creates are
+* not registered in the global registries (gRefinableObjRegistry, gCrystalRegistry,...),
+* and objects are found by name (e.g. when reading an XML file) only among those
+* of the job. Different jobs can therefore use the same names, and do not interfere
+* with each other, nor with the objects of other threads.
+*
+* Jobs must not share any RefinableObj, and all the objects created by a job must
+* be destroyed before it returns (e.g. using local variables or std::unique_ptr).
+*
+* \code
+* LSQJobQueue queue(8);
+* std::vector<std::future<void> > vFuture;
+* for(unsigned int i=0;i<vFileName.size();i++)
+*    vFuture.push_back(queue.Submit([&,i]()
+*    {
+*       XMLCrystFileLoadAllObject(vFileName[i]);
+*       ...
+*       LSQNumObj lsq;
+*       ...
+*       lsq.Refine(10,true,false);
+*       vChi2[i]=lsq.ChiSquare();
+*       ...
+*    }));
+* for(unsigned int i=0;i<vFuture.size();i++) vFuture[i].get();// Rethrows the job exceptions
+* \endcode
+*/
+class LSQJobQueue
+{
+   public:
+      /** Create the queue and start the worker threads.
+      *
+      * \param nbThread: number of jobs run concurrently (0=number of available cores).
+      * Each LSQNumObj uses a single thread by default (see LSQNumObj::SetNbThread()).
+      */
+      LSQJobQueue(const unsigned int nbThread=0);
+      /// Run all the jobs remaining in the queue, and stop the worker threads.
+      ~LSQJobQueue();
+      /** Add a job to the queue.
+      *
+      * \return a future which is ready when the job is finished. Any exception thrown
+      * by the job is passed to the future.
+      */
+      std::future<void> Submit(const std::function<void()> &job);
+      /// Wait until all the submitted jobs are finished.
+      void Wait();
+      /// Number of jobs waiting in the queue or running
+      unsigned long GetNbJob()const;
+      /// Number of worker threads
+      unsigned int GetNbThread()const;
+   private:
+      LSQJobQueue(const LSQJobQueue&);
+      LSQJobQueue& operator=(const LSQJobQueue&);
+      /// Function run by each worker thread
+      void RunWorker();
+      /// Jobs waiting to be run
+      std::deque<std::packaged_task<void()> > mvJob;
+      /// Number of jobs waiting or running
+      unsigned long mNbJob;
+      /// Set to true by the destructor, to stop the worker threads
+      bool mStop;
+      /// Protects the list of jobs
+      mutable std::mutex mMutex;
+      /// Signaled when a new job is available, or when the threads must stop
+      std::condition_variable mNewJob;
+      /// Signaled when a job is finished
+      std::condition_variable mJobDone;
+      /// The worker threads
+      std::vector<std::thread> mvThread;
+};
+
 }//namespace
 #endif //_LSQOBJNUM_H
@@ -0,0 +1,286 @@
+/*  ObjCryst++ Object-Oriented Crystallographic Library
+    (c) 2000- Vincent Favre-Nicolin vincefn@users.sourceforge.net
+
+    This program is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program; if not, write to the Free Software
+    Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+*/
+/*
+*  source file for the built-in profiler (time spent per region and per object)
+*
+*/
+#include <algorithm>
+#include <chrono>
+#include <deque>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <cstdio>
+#include "ObjCryst/RefinableObj/Profiler.h"
+#include "ObjCryst/RefinableObj/RefinableObj.h"
+
+namespace ObjCryst
+{
+ProfileStats::ProfileStats():
+mNbCall(0),mTotalTime(0),mExclusiveTime(0)
+{}
+
+struct ProfileScope::Stats
+{
+   Stats():mNbCall(0),mTotalTime(0),mExclusiveTime(0),mDepth(0){}
+   void Clear(){mNbCall=0;mTotalTime=0;mExclusiveTime=0;}
+   unsigned long mNbCall;
+   /// Total and exclusive time, in nanoseconds
+   long long mTotalTime,mExclusiveTime;
+   /// Number of active (nested) scopes for this region
+   int mDepth;
+   /// Class and name of the object, for per-object statistics
+   std::string mObjectClass,mObjectName;
+};
+
+/// Statistics recorded by one thread
+struct ProfilerThreadData
+{
+   ProfilerThreadData():mGeneration(0),mpCurrent(0){}
+   /// Generation of the statistics, compared to sProfilerGeneration to know
+   /// when they must be reset
+   unsigned long mGeneration;
+   /// Statistics for each region without object (a deque, so that pointers
+   /// to existing elements remain valid when it grows)
+   std::deque<ProfileScope::Stats> mvRegion;
+   /// Statistics for each region and object
+   std::map<std::pair<unsigned int,const RefinableObj*>,ProfileScope::Stats> mvObject;
+   /// Innermost active scope
+   ProfileScope *mpCurrent;
+};
+
+std::atomic<int> Profiler::smNbBegin(0);
+
+/// Incremented each time the statistics are reset
+static std::atomic<unsigned long> sProfilerGeneration(1);
+/// Protects the list of regions and of thread statistics
+static std::mutex sProfilerMutex;
+/// Names of the registered regions
+static std::vector<std::string> svProfilerRegion;
+/// Statistics of all threads. Those of finished threads are removed when the
+/// statistics are reset.
+static std::vector<std::shared_ptr<ProfilerThreadData> > svProfilerThreadData;
+/// Statistics of this thread
+static thread_local ProfilerThreadData *spProfilerThreadData=0;
+
+static inline long long ProfilerNow()
+{
+   return std::chrono::duration_cast<std::chrono::nanoseconds>
+            (std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+static ProfilerThreadData* GetProfilerThreadData()
+{
+   if(spProfilerThreadData==0)
+   {
+      static thread_local std::shared_ptr<ProfilerThreadData> pData(new ProfilerThreadData);
+      std::lock_guard<std::mutex> lock(sProfilerMutex);
+      svProfilerThreadData.push_back(pData);
+      spProfilerThreadData=pData.get();
+   }
+   return spProfilerThreadData;
+}
+
+void Profiler::Begin()
+{
+   std::lock_guard<std::mutex> lock(sProfilerMutex);
+   if(smNbBegin.load()==0)
+   {
+      sProfilerGeneration++;
+      // Forget the threads which have finished
+      std::vector<std::shared_ptr<ProfilerThreadData> >::iterator pos=svProfilerThreadData.begin();
+      while(pos!=svProfilerThreadData.end())
+      {
+         if(pos->use_count()==1) pos=svProfilerThreadData.erase(pos);
+         else ++pos;
+      }
+   }
+   smNbBegin++;
+}
+
+void Profiler::End()
+{
+   std::lock_guard<std::mutex> lock(sProfilerMutex);
+   if(smNbBegin.load()>0) smNbBegin--;
+}
+
+void Profiler::Reset()
+{
+   sProfilerGeneration++;
+}
+
+std::vector<ProfileStats> Profiler::GetStats()
+{
+   std::lock_guard<std::mutex> lock(sProfilerMutex);
+   const unsigned long generation=sProfilerGeneration.load();
+   std::map<std::pair<unsigned int,std::pair<std::string,std::string> >,ProfileStats> vSum;
+   for(std::vector<std::shared_ptr<ProfilerThreadData> >::const_iterator pos=svProfilerThreadData.begin();
+       pos!=svProfilerThreadData.end();++pos)
+   {
+      const ProfilerThreadData *d=pos->get();
+      if(d->mGeneration!=generation) continue;
+      for(unsigned int i=0;i<d->mvRegion.size();i++)
+      {
+         const ProfileScope::Stats *s=&(d->mvRegion[i]);
+         if(s->mNbCall==0) continue;
+         ProfileStats *p=&(vSum[std::make_pair(i,std::make_pair(std::string(),std::string()))]);
+         p->mNbCall+=s->mNbCall;
+         p->mTotalTime+=s->mTotalTime*1e-9;
+         p->mExclusiveTime+=s->mExclusiveTime*1e-9;
+      }
+      for(std::map<std::pair<unsigned int,const RefinableObj*>,ProfileScope::Stats>::const_iterator
+          p0=d->mvObject.begin();p0!=d->mvObject.end();++p0)
+      {
+         const ProfileScope::Stats *s=&(p0->second);
+         if(s->mNbCall==0) continue;
+         ProfileStats *p=&(vSum[std::make_pair(p0->first.first,
+                                               std::make_pair(s->mObjectClass,s->mObjectName))]);
+         p->mNbCall+=s->mNbCall;
+         p->mTotalTime+=s->mTotalTime*1e-9;
+         p->mExclusiveTime+=s->mExclusiveTime*1e-9;
+      }
+   }
+   std::vector<ProfileStats> vStats;
+   vStats.reserve(vSum.size());
+   for(std::map<std::pair<unsigned int,std::pair<std::string,std::string> >,ProfileStats>::iterator
+       pos=vSum.begin();pos!=vSum.end();++pos)
+   {
+      pos->second.mRegion=svProfilerRegion[pos->first.first];
+      pos->second.mObjectClass=pos->first.second.first;
+      pos->second.mObjectName=pos->first.second.second;
+      vStats.push_back(pos->second);
+   }
+   std::stable_sort(vStats.begin(),vStats.end(),
+                    [](const ProfileStats &a,const ProfileStats &b)
+                    {return a.mExclusiveTime>b.mExclusiveTime;});
+   return vStats;
+}
+
+unsigned int Profiler::RegisterRegion(const std::string &name)
+{
+   std::lock_guard<std::mutex> lock(sProfilerMutex);
+   for(unsigned int i=0;i<svProfilerRegion.size();i++)
+      if(svProfilerRegion[i]==name) return i;
+   svProfilerRegion.push_back(name);
+   return svProfilerRegion.size()-1;
+}
+
+/// Write a string in JSON format
+static void JSONOutputString(std::ostream &os,const std::string &s)
+{
+   os<<'"';
+   for(std::string::const_iterator c=s.begin();c!=s.end();++c)
+   {
+      switch(*c)
+      {
+         case '"': os<<"\\\"";break;
+         case '\\': os<<"\\\\";break;
+         case '\n': os<<"\\n";break;
+         case '\t': os<<"\\t";break;
+         default:
+            if((unsigned char)(*c)<0x20)
+            {
+               char buf[8];
+               sprintf(buf,"\\u%04x",(unsigned int)(unsigned char)(*c));
+               os<<buf;
+            }
+            else os<<*c;
+      }
+   }
+   os<<'"';
+}
+
+void ProfileStatsJSONOutput(std::ostream &os,const std::vector<ProfileStats> &vStats,
+                            const REAL elapsed)
+{
+   const std::streamsize precision=os.precision(9);
+   os<<"{"<<std::endl
+     <<"  \"elapsed\": "<<elapsed<<","<<std::endl
+     <<"  \"regions\": ["<<std::endl;
+   for(std::vector<ProfileStats>::const_iterator pos=vStats.begin();pos!=vStats.end();++pos)
+   {
+      os<<"    {\"region\": ";
+      JSONOutputString(os,pos->mRegion);
+      if(pos->mObjectName!="" || pos->mObjectClass!="")
+      {
+         os<<", \"class\": ";
+         JSONOutputString(os,pos->mObjectClass);
+         os<<", \"object\": ";
+         JSONOutputString(os,pos->mObjectName);
+      }
+      os<<", \"calls\": "<<pos->mNbCall
+        <<", \"total\": "<<pos->mTotalTime
+        <<", \"exclusive\": "<<pos->mExclusiveTime<<"}";
+      if((pos+1)!=vStats.end()) os<<",";
+      os<<std::endl;
+   }
+   os<<"  ]"<<std::endl<<"}"<<std::endl;
+   os.precision(precision);
+}
+
+void ProfileScope::Begin(const unsigned int region,const RefinableObj *pObj)
+{
+   ProfilerThreadData *d=GetProfilerThreadData();
+   const unsigned long generation=sProfilerGeneration.load(std::memory_order_relaxed);
+   if(d->mGeneration!=generation)
+   {
+      for(std::deque<Stats>::iterator pos=d->mvRegion.begin();pos!=d->mvRegion.end();++pos)
+         pos->Clear();
+      // Active scopes keep pointers to their statistics
+      if(d->mpCurrent==0) d->mvObject.clear();
+      else
+         for(std::map<std::pair<unsigned int,const RefinableObj*>,Stats>::iterator
+             pos=d->mvObject.begin();pos!=d->mvObject.end();++pos) pos->second.Clear();
+      d->mGeneration=generation;
+   }
+   if(pObj==0)
+   {
+      if(region>=d->mvRegion.size()) d->mvRegion.resize(region+1);
+      mpStats=&(d->mvRegion[region]);
+   }
+   else
+   {
+      const std::pair<unsigned int,const RefinableObj*> key(region,pObj);
+      std::map<std::pair<unsigned int,const RefinableObj*>,Stats>::iterator pos=d->mvObject.find(key);
+      if(pos==d->mvObject.end())
+      {
+         mpStats=&(d->mvObject[key]);
+         mpStats->mObjectClass=pObj->GetClassName();
+         mpStats->mObjectName=pObj->GetName();
+      }
+      else mpStats=&(pos->second);
+   }
+   mpStats->mDepth++;
+   mpParent=d->mpCurrent;
+   d->mpCurrent=this;
+   mChildTime=0;
+   mStart=ProfilerNow();
+}
+
+void ProfileScope::End()
+{
+   const long long t=ProfilerNow()-mStart;
+   mpStats->mNbCall++;
+   mpStats->mDepth--;
+   if(mpStats->mDepth==0) mpStats->mTotalTime+=t;
+   mpStats->mExclusiveTime+=t-mChildTime;
+   if(mpParent!=0) mpParent->mChildTime+=t;
+   spProfilerThreadData->mpCurrent=mpParent;
+}
+
+}//namespace
@@ -0,0 +1,142 @@
+/*  ObjCryst++ Object-Oriented Crystallographic Library
+    (c) 2000- Vincent Favre-Nicolin vincefn@users.sourceforge.net
+
+    This program is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program; if not, write to the Free Software
+    Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+*/
+/*
+*  header file for the built-in profiler (time spent per region and per object)
+*
+*/
+
+#ifndef _REFINABLEOBJ_PROFILER_H_
+#define _REFINABLEOBJ_PROFILER_H_
+
+#include <atomic>
+#include <string>
+#include <vector>
+#include <iostream>
+#include "ObjCryst/ObjCryst/General.h"
+
+namespace ObjCryst
+{
+class RefinableObj;
+
+/// Statistics collected by the Profiler for one region (and optionally one object)
+struct ProfileStats
+{
+   ProfileStats();
+   /// Name of the region
+   std::string mRegion;
+   /// Class and name of the object, if the region was timed for a given object
+   std::string mObjectClass,mObjectName;
+   /// Number of calls
+   unsigned long mNbCall;
+   /// Total time spent in the region (seconds)
+   REAL mTotalTime;
+   /// Time spent in the region, excluding the time spent in profiled sub-regions (seconds)
+   REAL mExclusiveTime;
+};
+
+/** \brief Built-in profiler, recording the number of calls, total and exclusive time
+* spent in named regions of the code (see the OBJCRYST_PROFILE() macro and ProfileScope),
+* optionally for each RefinableObj.
+*
+* The profiler is disabled by default, and then only costs an atomic load per region.
+* It is enabled by the optimization objects during a run if their "Profiling" option
+* is set, and the statistics can then be obtained with OptimizationObj::GetProfileStats().
+*
+* Each thread records its own statistics, which are summed by GetStats(). Since the
+* profiler is global, optimizations running concurrently in different threads
+* would all be recorded together.
+*/
+class Profiler
+{
+   public:
+      /** Enable the profiler. The statistics are reset if the profiler was not already
+      * enabled. Calls can be nested: the profiler is only disabled by the matching
+      * (last) call to End().
+      */
+      static void Begin();
+      /// Disable the profiler (after as many calls as to Begin())
+      static void End();
+      /// Is the profiler enabled ?
+      static bool IsEnabled() {return smNbBegin.load(std::memory_order_relaxed)>0;}
+      /// Reset all statistics
+      static void Reset();
+      /** Get the statistics for all regions, summed over all threads, sorted by
+      * decreasing exclusive time. This should only be called when no other thread
+      * is recording.
+      */
+      static std::vector<ProfileStats> GetStats();
+      /// Register a named region, and return its index
+      static unsigned int RegisterRegion(const std::string &name);
+   private:
+      /// Number of calls to Begin() not yet matched by End()
+      static std::atomic<int> smNbBegin;
+};
+
+/** Write profiling statistics in JSON format
+*
+* \param elapsed: the total elapsed time (seconds) corresponding to the statistics
+*/
+void ProfileStatsJSONOutput(std::ostream &os,const std::vector<ProfileStats> &vStats,
+                            const REAL elapsed);
+
+/** \brief Measure the time spent in a region, from the construction of this object to
+* its destruction, if the Profiler is enabled.
+*
+* Nested ProfileScope objects in the same thread are used to compute the exclusive
+* time of each region. Recursive calls to the same region are only counted once
+* in the total time.
+*/
+class ProfileScope
+{
+   public:
+      /** Constructor
+      * \param region: the index of the region, from Profiler::RegisterRegion()
+      * \param pObj: if not null, the time is recorded separately for this object
+      */
+      ProfileScope(const unsigned int region,const RefinableObj *pObj=0):
+      mpStats(0)
+      {
+         if(Profiler::IsEnabled()) this->Begin(region,pObj);
+      }
+      ~ProfileScope() {if(mpStats!=0) this->End();}
+      /// \internal Statistics being recorded for a region in a given thread
+      struct Stats;
+   private:
+      ProfileScope(const ProfileScope&);
+      ProfileScope& operator=(const ProfileScope&);
+      void Begin(const unsigned int region,const RefinableObj *pObj);
+      void End();
+      /// Statistics for this region (null if the profiler was disabled)
+      Stats *mpStats;
+      /// Enclosing scope in the same thread
+      ProfileScope *mpParent;
+      /// Start time (nanoseconds)
+      long long mStart;
+      /// Time spent in enclosed scopes (nanoseconds)
+      long long mChildTime;
+};
+
+}//namespace
+
+/// Profile the time spent from this point to the end of the enclosing scope,
+/// under the given region name (see Profiler).
+#define OBJCRYST_PROFILE(name) \
+   static const unsigned int objcryst_profile_region=ObjCryst::Profiler::RegisterRegion(name); \
+   ObjCryst::ProfileScope objcryst_profile_scope(objcryst_profile_region);
+
+#endif
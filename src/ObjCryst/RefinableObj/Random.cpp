@@ -0,0 +1,156 @@
+/*  ObjCryst++ Object-Oriented Crystallographic Library
+    (c) 2000- Vincent Favre-Nicolin vincefn@users.sourceforge.net
+
+    This program is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program; if not, write to the Free Software
+    Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+*/
+/*
+*  source file for the random number generator used by random moves
+*
+*/
+#include <atomic>
+#include <chrono>
+#include <random>
+#include "ObjCryst/RefinableObj/Random.h"
+
+namespace ObjCryst
+{
+static inline uint64_t RotateLeft(const uint64_t x,const int k)
+{
+   return (x<<k)|(x>>(64-k));
+}
+
+/// Generator installed for this thread by RandomGenerator::Scope (0 if none)
+static thread_local RandomGenerator *spCurrentRandomGenerator=0;
+
+RandomGenerator::RandomGenerator(const unsigned long seed)
+{
+   this->Seed(seed);
+}
+
+void RandomGenerator::Seed(const unsigned long seed)
+{
+   mSeed=seed;
+   // SplitMix64, so that close seeds give unrelated states
+   uint64_t x=seed;
+   for(int i=0;i<4;i++)
+   {
+      uint64_t z=(x+=0x9e3779b97f4a7c15ULL);
+      z=(z^(z>>30))*0xbf58476d1ce4e5b9ULL;
+      z=(z^(z>>27))*0x94d049bb133111ebULL;
+      mState[i]=z^(z>>31);
+   }
+}
+
+unsigned long RandomGenerator::GetSeed()const {return mSeed;}
+
+uint64_t RandomGenerator::Next()
+{
+   const uint64_t result=RotateLeft(mState[1]*5,7)*9;
+   const uint64_t t=mState[1]<<17;
+   mState[2]^=mState[0];
+   mState[3]^=mState[1];
+   mState[1]^=mState[2];
+   mState[0]^=mState[3];
+   mState[2]^=t;
+   mState[3]=RotateLeft(mState[3],45);
+   return result;
+}
+
+REAL RandomGenerator::Uniform()
+{
+   return ((this->Next()>>11)+1)*(1.0/9007199254740992.0);
+}
+
+unsigned long RandomGenerator::Integer(const unsigned long n)
+{
+   if(n<=1) return 0;
+   return (unsigned long)((this->Next()>>11)*(1.0/9007199254740992.0)*n);
+}
+
+void RandomGenerator::Jump()
+{
+   static const uint64_t jump[]={0x180ec6d33cfd0abaULL,0xd5a61266f0c9392cULL,
+                                 0xa9582618e03fc9aaULL,0x39abdc4529b1661cULL};
+   uint64_t s[4]={0,0,0,0};
+   for(int i=0;i<4;i++)
+      for(int b=0;b<64;b++)
+      {
+         if(jump[i]&(((uint64_t)1)<<b))
+            for(int k=0;k<4;k++) s[k]^=mState[k];
+         this->Next();
+      }
+   for(int k=0;k<4;k++) mState[k]=s[k];
+}
+
+RandomGenerator RandomGenerator::Split()
+{
+   const RandomGenerator gen(*this);
+   this->Jump();
+   return gen;
+}
+
+void RandomGenerator::GetState(uint64_t state[4])const
+{
+   for(int k=0;k<4;k++) state[k]=mState[k];
+}
+
+void RandomGenerator::SetState(const uint64_t state[4])
+{
+   for(int k=0;k<4;k++) mState[k]=state[k];
+}
+
+unsigned long RandomSeed()
+{
+   // Some std::random_device implementations are deterministic, so also mix in the clock
+   // and a counter, so that seeds drawn at the same time in several threads differ.
+   static std::atomic<unsigned long> counter(0);
+   unsigned long seed=0;
+   try
+   {
+      std::random_device rd;
+      seed=((unsigned long)rd()<<16)^(unsigned long)rd();
+   }
+   catch(const std::exception&){}
+   seed^=(unsigned long)std::chrono::high_resolution_clock::now().time_since_epoch().count();
+   seed+=0x9e3779b9UL*(++counter);
+   return seed;
+}
+
+RandomGenerator& RandomGenerator::GetCurrent()
+{
+   if(spCurrentRandomGenerator==0)
+   {
+      static thread_local RandomGenerator defaultGenerator(RandomSeed());
+      return defaultGenerator;
+   }
+   return *spCurrentRandomGenerator;
+}
+
+RandomGenerator::Scope::Scope(RandomGenerator &gen):
+mpPrevious(spCurrentRandomGenerator)
+{
+   spCurrentRandomGenerator=&gen;
+}
+
+RandomGenerator::Scope::~Scope()
+{
+   spCurrentRandomGenerator=mpPrevious;
+}
+
+REAL RandomUniform() {return RandomGenerator::GetCurrent().Uniform();}
+
+unsigned long RandomInteger(const unsigned long n) {return RandomGenerator::GetCurrent().Integer(n);}
+
+}//namespace
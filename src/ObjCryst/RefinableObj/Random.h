@@ -0,0 +1,101 @@
+/*  ObjCryst++ Object-Oriented Crystallographic Library
+    (c) 2000- Vincent Favre-Nicolin vincefn@users.sourceforge.net
+
+    This program is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program; if not, write to the Free Software
+    Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+*/
+/*
+*  header file for the random number generator used by random moves
+*
+*/
+
+#ifndef _REFINABLEOBJ_RANDOM_H_
+#define _REFINABLEOBJ_RANDOM_H_
+
+#include <stdint.h>
+#include "ObjCryst/ObjCryst/General.h"
+
+namespace ObjCryst
+{
+/** \brief Pseudo-random number generator (xoshiro256**) used for all random moves.
+*
+* Each optimization object owns one generator, which is installed as the \e current
+* generator of the thread (see RandomGenerator::Scope) while it optimizes. All random
+* moves (RefinableObj::GlobalOptRandomMove() and derived functions, indexing, ...)
+* draw from the current generator using RandomUniform() and RandomInteger(), so that
+* a run is reproducible from its seed, and concurrent threads use independent streams.
+*
+* Independent streams are obtained with Split(), which returns a copy of the generator
+* and advances this one by 2^128 draws (Jump()).
+*
+* If no generator has been installed in a thread, a default one is used, seeded
+* from RandomSeed() the first time it is used.
+*/
+class RandomGenerator
+{
+   public:
+      /// Constructor, with a given seed
+      RandomGenerator(const unsigned long seed=0);
+      /// Re-initialize the generator from a seed
+      void Seed(const unsigned long seed);
+      /// The seed used for the last (re)initialization
+      unsigned long GetSeed()const;
+      /// Next 64-bit random integer
+      uint64_t Next();
+      /// Uniform random number in ]0,1]
+      REAL Uniform();
+      /// Uniform random integer in [0,n[
+      unsigned long Integer(const unsigned long n);
+      /// Advance the generator by 2^128 draws
+      void Jump();
+      /// Get an independent stream: returns a copy of this generator,
+      /// and advances this one with Jump().
+      RandomGenerator Split();
+      /// Get the full state of the generator
+      void GetState(uint64_t state[4])const;
+      /// Restore the full state of the generator
+      void SetState(const uint64_t state[4]);
+      /// The generator currently used by this thread for random moves
+      static RandomGenerator& GetCurrent();
+      /** Install a generator as the current one for this thread, during the
+      * lifetime of this object. The previous generator is restored by the destructor.
+      */
+      class Scope
+      {
+         public:
+            Scope(RandomGenerator &gen);
+            ~Scope();
+         private:
+            Scope(const Scope&);
+            Scope& operator=(const Scope&);
+            RandomGenerator *mpPrevious;
+      };
+   private:
+      /// Generator state
+      uint64_t mState[4];
+      /// Seed used for the last (re)initialization
+      unsigned long mSeed;
+};
+
+/// A new, non-reproducible seed (from std::random_device and the clock),
+/// used when no seed has been given
+unsigned long RandomSeed();
+/// Uniform random number in ]0,1], drawn from the current generator of this thread
+REAL RandomUniform();
+/// Uniform random integer in [0,n[, drawn from the current generator of this thread
+unsigned long RandomInteger(const unsigned long n);
+
+}//namespace
+
+#endif
@@ -23,6 +23,7 @@
 #include <ctime>
 #include <boost/format.hpp>
 #include "ObjCryst/RefinableObj/RefinableObj.h"
+#include "ObjCryst/RefinableObj/Random.h"
 #include "ObjCryst/Quirks/VFNStreamFormat.h"
 #include "ObjCryst/Quirks/VFNDebug.h"
 #ifdef __WX__CRYST__
@@ -71,7 +72,7 @@ const string& RefParType::GetName() const{ return mName;}
 
 void RefParType::InitId()
 {
-   static unsigned long nbRefParType=0;
+   static std::atomic<unsigned long> nbRefParType(0);
    mId=nbRefParType++;
 }
 
@@ -83,13 +84,12 @@ long NiftyStaticGlobalObjectsInitializer_RefinableObj::mCount=0;
 //
 //######################################################################
 
-unsigned long RefinableObjClock::msTick0=0;
-unsigned long RefinableObjClock::msTick1=0;
+alignas(64) std::atomic<unsigned long long> RefinableObjClock::msTick(0);
 RefinableObjClock::RefinableObjClock()
 {
    //this->Click();
-   mTick0=0;
-   mTick1=0;
+   mTick=0;
+   mNbClick=1;
 }
 RefinableObjClock::~RefinableObjClock()
 {
@@ -105,54 +105,48 @@ RefinableObjClock::~RefinableObjClock()
 }
 
 bool RefinableObjClock::operator< (const RefinableObjClock &rhs)const
-{
-   if(mTick1<rhs.mTick1) return true;
-   if(mTick1==rhs.mTick1) {if(mTick0<rhs.mTick0) return true;}
-   return false;
-}
+{return mTick<rhs.mTick;}
 bool RefinableObjClock::operator<=(const RefinableObjClock &rhs)const
-{
-   if(mTick1<rhs.mTick1) return true;
-   if(mTick1==rhs.mTick1) if(mTick0<=rhs.mTick0) return true;
-   return false;
-}
+{return mTick<=rhs.mTick;}
 bool RefinableObjClock::operator> (const RefinableObjClock &rhs)const
-{
-   if(mTick1>rhs.mTick1) return true;
-   if(mTick1==rhs.mTick1) if(mTick0>rhs.mTick0) return true;
-   return false;
-}
+{return mTick>rhs.mTick;}
 bool RefinableObjClock::operator>=(const RefinableObjClock &rhs)const
-{
-   if(mTick1>rhs.mTick1) return true;
-   if(mTick1==rhs.mTick1) if(mTick0>=rhs.mTick0) return true;
-   return false;
-}
+{return mTick>=rhs.mTick;}
 void RefinableObjClock::Click()
 {
    //return;
-   if(++msTick0==0) ++msTick1;//Update ObjCryst++ static event counter
-   mTick0=msTick0;
-   mTick1=msTick1;
-   for(std::set<RefinableObjClock*>::iterator pos=mvParent.begin();
-       pos!=mvParent.end();++pos) (*pos)->Click();
-   VFN_DEBUG_MESSAGE("RefinableObjClock::Click():"<<mTick1<<":"<<mTick0<<"(at "<<this<<")",0)
+   unsigned long long tick=msTick.fetch_add(mNbClick,std::memory_order_relaxed);
+   this->Click(tick);
+   VFN_DEBUG_MESSAGE("RefinableObjClock::Click():"<<mTick<<"(at "<<this<<")",0)
    //this->Print();
 }
+void RefinableObjClock::Click(unsigned long long &tick)
+{
+   mTick=++tick;
+   for(std::set<RefinableObjClock*>::iterator pos=mvParent.begin();
+       pos!=mvParent.end();++pos) (*pos)->Click(tick);
+}
+void RefinableObjClock::UpdateNbClick()const
+{
+   mNbClick=1;
+   for(std::set<RefinableObjClock*>::const_iterator pos=mvParent.begin();
+       pos!=mvParent.end();++pos) mNbClick+=(*pos)->mNbClick;
+   for(std::set<const RefinableObjClock*>::const_iterator pos=mvChild.begin();
+       pos!=mvChild.end();++pos) (*pos)->UpdateNbClick();
+}
 void RefinableObjClock::Reset()
 {
-   mTick0=0;
-   mTick1=0;
+   mTick=0;
 }
 void RefinableObjClock::Print()const
 {
-   cout <<"Clock():"<<mTick1<<":"<<mTick0;
+   cout <<"Clock():"<<mTick;
    VFN_DEBUG_MESSAGE_SHORT(" (at "<<this<<")",4)
    cout <<endl;
 }
 void RefinableObjClock::PrintStatic()const
 {
-   cout <<"RefinableObj class Clock():"<<msTick1<<":"<<msTick0<<endl;
+   cout <<"RefinableObj class Clock():"<<msTick.load()<<endl;
 }
 void RefinableObjClock::AddChild(const RefinableObjClock &clock)
 {mvChild.insert(&clock);clock.AddParent(*this);this->Click();}
@@ -171,18 +165,19 @@ void RefinableObjClock::AddParent(RefinableObjClock &clock)const
    if(clock.HasParent(*this)==true)
       throw ObjCrystException("RefinableObjClock::AddParent(..) Loop in clock tree !!");
    mvParent.insert(&clock);
+   this->UpdateNbClick();
 }
 void RefinableObjClock::RemoveParent(RefinableObjClock &clock)const
 {
    // avoid warnings about unused i when not debugging.
    const unsigned int i = mvParent.erase(&clock);  POSSIBLY_UNUSED(i);
    VFN_DEBUG_MESSAGE("RefinableObjClock::RemoveParent():"<<i,5)
+   this->UpdateNbClick();
 }
 
 void RefinableObjClock::operator=(const RefinableObjClock &rhs)
 {
-   mTick0=rhs.mTick0;
-   mTick1=rhs.mTick1;
+   mTick=rhs.mTick;
    for(std::set<RefinableObjClock*>::iterator pos=mvParent.begin();
        pos!=mvParent.end();++pos) if( (*this) > (**pos) ) **pos = *this;
 }
@@ -357,8 +352,12 @@ const REAL* RefinablePar::GetPointer()const
 
 void RefinablePar::SetValue(const REAL value)
 {
-   if(*mpValue == value) return;
-   this->Click();
+   if(this->SetValueNoClick(value)) this->Click();
+}
+
+bool RefinablePar::SetValueNoClick(const REAL value)
+{
+   if(*mpValue == value) return false;
    VFN_DEBUG_MESSAGE("RefinablePar::SetValue()",2)
    #if 0
    if(true==mUseEquation)
@@ -393,11 +392,12 @@ void RefinablePar::SetValue(const REAL value)
       if(*mpValue > mPeriod) *mpValue -= mPeriod;
       if(*mpValue < 0) *mpValue += mPeriod;
    }
+   return true;
 }
 
 const REAL& RefinablePar::GetHumanValue() const
 {
-   static REAL val;
+   static thread_local REAL val;
    val = *mpValue * mHumanScale;
    return val;
 }
@@ -593,6 +593,8 @@ void RefinablePar::SetDerivStep(const REAL step)
    mDerivStep = step;
 }
 
+RefParDerivStepModel RefinablePar::GetDerivStepModel()const {return mRefParDerivStepModel;}
+
 REAL RefinablePar::GetGlobalOptimStep()const {return mGlobalOptimStep;}
 void  RefinablePar::SetGlobalOptimStep(const REAL step) {mGlobalOptimStep=step;}
 
@@ -863,8 +865,42 @@ bool operator==(const string&str,const wxString&wx)
 }
 #endif
 
+//######################################################################
+//    RegistryScope
+//######################################################################
+/// Active RegistryScope in the current thread
+static thread_local RegistryScope *spCurrentRegistryScope=0;
+
+RegistryScope::RegistryScope():
+mpPrevious(spCurrentRegistryScope)
+{
+   spCurrentRegistryScope=this;
+}
+
+RegistryScope::~RegistryScope()
+{
+   spCurrentRegistryScope=mpPrevious;
+   for(std::map<const void*,std::pair<void*,void (*)(void*)> >::iterator pos=mvRegistry.begin();
+       pos!=mvRegistry.end();++pos)
+      (*(pos->second.second))(pos->second.first);
+}
+
+RegistryScope* RegistryScope::GetCurrent() {return spCurrentRegistryScope;}
+
+void* RegistryScope::GetRegistry(const void *global,void* (*create)(),void (*destroy)(void*))
+{
+   std::map<const void*,std::pair<void*,void (*)(void*)> >::iterator pos=mvRegistry.find(global);
+   if(pos!=mvRegistry.end()) return pos->second.first;
+   void *p=(*create)();
+   mvRegistry[global]=std::make_pair(p,destroy);
+   return p;
+}
+
+//######################################################################
+//    ObjRegistry
+//######################################################################
 template<class T> ObjRegistry<T>::ObjRegistry():
-mName(""),mAutoUpdateUI(true)
+mIsGlobal(false),mName(""),mAutoUpdateUI(true)
 #ifdef __WX__CRYST__
 ,mpWXRegistry(0)
 #endif
@@ -873,7 +909,7 @@ mName(""),mAutoUpdateUI(true)
 }
 
 template<class T> ObjRegistry<T>::ObjRegistry(const string &name):
-mName(name),mAutoUpdateUI(true)
+mIsGlobal(false),mName(name),mAutoUpdateUI(true)
 #ifdef __WX__CRYST__
 ,mpWXRegistry(0)
 #endif
@@ -881,6 +917,15 @@ mName(name),mAutoUpdateUI(true)
    VFN_DEBUG_MESSAGE("ObjRegistry::ObjRegistry(name):"<<mName,5)
 }
 
+template<class T> ObjRegistry<T>::ObjRegistry(const string &name,const bool global):
+mIsGlobal(global),mName(name),mAutoUpdateUI(true)
+#ifdef __WX__CRYST__
+,mpWXRegistry(0)
+#endif
+{
+   VFN_DEBUG_MESSAGE("ObjRegistry::ObjRegistry(name,global):"<<mName,5)
+}
+
 //:TODO: a copy constructor
 template<class T> ObjRegistry<T>::~ObjRegistry()
 {
@@ -892,6 +937,8 @@ template<class T> ObjRegistry<T>::~ObjRegistry()
 
 template<class T> void ObjRegistry<T>::Register(T &obj)
 {
+   ObjRegistry<T> *pScope=this->GetScopeRegistry();
+   if(0!=pScope) {pScope->Register(obj);return;}
    VFN_DEBUG_ENTRY("ObjRegistry("<<mName<<")::Register():"<<obj.GetName(),2)
    typename vector<T*>::iterator pos=find(mvpRegistry.begin(),mvpRegistry.end(),&obj);
    if(pos!=mvpRegistry.end())
@@ -912,6 +959,13 @@ template<class T> void ObjRegistry<T>::Register(T &obj)
 
 template<class T> void ObjRegistry<T>::DeRegister(T &obj)
 {
+   ObjRegistry<T> *pScope=this->GetScopeRegistry();
+   if(0!=pScope)
+   {
+      if(pScope->Find(obj)>=0) {pScope->DeRegister(obj);return;}
+      // The object was registered outside the scope, so remove it from this
+      // global registry rather than leaving a dangling pointer in it.
+   }
    VFN_DEBUG_ENTRY("ObjRegistry("<<mName<<")::Deregister(&obj)"<<mvpRegistry.size(),2)
    if (mvpRegistry.size() == 0)
    {// This may happen if an object is deleted several times due to inherited destructors
@@ -941,6 +995,8 @@ template<class T> void ObjRegistry<T>::DeRegister(T &obj)
 
 template<class T> void ObjRegistry<T>::DeRegister(const string &objName)
 {
+   ObjRegistry<T> *pScope=this->GetScopeRegistry();
+   if(0!=pScope) {pScope->DeRegister(objName);return;}
    VFN_DEBUG_ENTRY("ObjRegistry("<<mName<<")::Deregister(name):"<<objName,2)
 
    const long i=this->Find(objName);
@@ -966,6 +1022,8 @@ template<class T> void ObjRegistry<T>::DeRegister(const string &objName)
 
 template<class T> void ObjRegistry<T>::DeRegisterAll()
 {
+   ObjRegistry<T> *pScope=this->GetScopeRegistry();
+   if(0!=pScope) {pScope->DeRegisterAll();return;}
    VFN_DEBUG_ENTRY("ObjRegistry("<<mName<<")::DeRegisterAll():",5)
    #ifdef __WX__CRYST__
    if(0!=mpWXRegistry)
@@ -983,6 +1041,8 @@ template<class T> void ObjRegistry<T>::DeRegisterAll()
 
 template<class T> void ObjRegistry<T>::DeleteAll()
 {
+   ObjRegistry<T> *pScope=this->GetScopeRegistry();
+   if(0!=pScope) {pScope->DeleteAll();return;}
    VFN_DEBUG_ENTRY("ObjRegistry("<<mName<<")::DeleteAll():",5)
    vector<T*> reg=mvpRegistry;//mvpRegistry will be modified as objects are deleted, so use a copy
    typename vector<T*>::iterator pos;
@@ -995,24 +1055,32 @@ template<class T> void ObjRegistry<T>::DeleteAll()
 
 template<class T> T& ObjRegistry<T>::GetObj(const unsigned int i)
 {
+   ObjRegistry<T> *pScope=this->GetScopeRegistry();
+   if(0!=pScope) return pScope->GetObj(i);
    if(i>=this->GetNb()) throw ObjCrystException("ObjRegistry<T>::GetObj(i): i >= nb!");
    return *(mvpRegistry[i]);
 }
 
 template<class T> const T& ObjRegistry<T>::GetObj(const unsigned int i) const
 {
+   ObjRegistry<T> *pScope=this->GetScopeRegistry();
+   if(0!=pScope) return pScope->GetObj(i);
    if(i>=this->GetNb()) throw ObjCrystException("ObjRegistry<T>::GetObj(i): i >= nb!");
    return *(mvpRegistry[i]);
 }
 
 template<class T> T& ObjRegistry<T>::GetObj(const string &objName)
 {
+   ObjRegistry<T> *pScope=this->GetScopeRegistry();
+   if(0!=pScope) return pScope->GetObj(objName);
    const long i=this->Find(objName);
    return *(mvpRegistry[i]);
 }
 
 template<class T> const T& ObjRegistry<T>::GetObj(const string &objName) const
 {
+   ObjRegistry<T> *pScope=this->GetScopeRegistry();
+   if(0!=pScope) return pScope->GetObj(objName);
    const long i=this->Find(objName);
    return *(mvpRegistry[i]);
 }
@@ -1020,6 +1088,8 @@ template<class T> const T& ObjRegistry<T>::GetObj(const string &objName) const
 template<class T> T& ObjRegistry<T>::GetObj(const string &objName,
                                                   const string& className)
 {
+   ObjRegistry<T> *pScope=this->GetScopeRegistry();
+   if(0!=pScope) return pScope->GetObj(objName,className);
    const long i=this->Find(objName,className);
    return *(mvpRegistry[i]);
 }
@@ -1027,14 +1097,23 @@ template<class T> T& ObjRegistry<T>::GetObj(const string &objName,
 template<class T> const T& ObjRegistry<T>::GetObj(const string &objName,
                                                         const string& className) const
 {
+   ObjRegistry<T> *pScope=this->GetScopeRegistry();
+   if(0!=pScope) return pScope->GetObj(objName,className);
    const long i=this->Find(objName,className);
    return *(mvpRegistry[i]);
 }
 
-template<class T> long ObjRegistry<T>::GetNb()const{return (long)mvpRegistry.size();}
+template<class T> long ObjRegistry<T>::GetNb()const
+{
+   ObjRegistry<T> *pScope=this->GetScopeRegistry();
+   if(0!=pScope) return pScope->GetNb();
+   return (long)mvpRegistry.size();
+}
 
 template<class T> void ObjRegistry<T>::Print()const
 {
+   ObjRegistry<T> *pScope=this->GetScopeRegistry();
+   if(0!=pScope) {pScope->Print();return;}
    VFN_DEBUG_MESSAGE("ObjRegistry::Print():",2)
    cout <<mName<<" :"<<this->GetNb()<<" object registered:" <<endl;
 
@@ -1048,6 +1127,8 @@ template<class T> const string& ObjRegistry<T>::GetName()const { return mName;}
 
 template<class T> long ObjRegistry<T>::Find(const string &objName) const
 {
+   ObjRegistry<T> *pScope=this->GetScopeRegistry();
+   if(0!=pScope) return pScope->Find(objName);
    VFN_DEBUG_MESSAGE("ObjRegistry::Find(objName)",2)
    long index=-1;
    //bool error=false;
@@ -1072,6 +1153,8 @@ template<class T> long ObjRegistry<T>::Find(const string &objName,
                                             const string &className,
                                              const bool nothrow) const
 {
+   ObjRegistry<T> *pScope=this->GetScopeRegistry();
+   if(0!=pScope) return pScope->Find(objName,className,nothrow);
    VFN_DEBUG_MESSAGE("ObjRegistry::Find(objName,className)",2)
    long index=-1;
    //bool error=false;
@@ -1096,6 +1179,8 @@ template<class T> long ObjRegistry<T>::Find(const string &objName,
 
 template<class T> long ObjRegistry<T>::Find(const T &obj) const
 {
+   ObjRegistry<T> *pScope=this->GetScopeRegistry();
+   if(0!=pScope) return pScope->Find(obj);
    VFN_DEBUG_MESSAGE("ObjRegistry::Find(&obj)",2)
    for(long i=this->GetNb()-1;i>=0;i--)
       if( mvpRegistry[i]== &obj)  return i;
@@ -1105,6 +1190,8 @@ template<class T> long ObjRegistry<T>::Find(const T &obj) const
 
 template<class T> long ObjRegistry<T>::Find(const T *pobj) const
 {
+   ObjRegistry<T> *pScope=this->GetScopeRegistry();
+   if(0!=pScope) return pScope->Find(pobj);
    VFN_DEBUG_MESSAGE("ObjRegistry::Find(&obj)",2)
    for(long i=this->GetNb()-1;i>=0;i--)
       if( mvpRegistry[i]== pobj)  return i;
@@ -1112,7 +1199,12 @@ template<class T> long ObjRegistry<T>::Find(const T *pobj) const
    return -1;
 }
 
-template<class T> const RefinableObjClock& ObjRegistry<T>::GetRegistryClock()const{return mListClock;}
+template<class T> const RefinableObjClock& ObjRegistry<T>::GetRegistryClock()const
+{
+   ObjRegistry<T> *pScope=this->GetScopeRegistry();
+   if(0!=pScope) return pScope->GetRegistryClock();
+   return mListClock;
+}
 
 template<class T> void ObjRegistry<T>::AutoUpdateUI(const bool autoup)
 {
@@ -1121,6 +1213,8 @@ template<class T> void ObjRegistry<T>::AutoUpdateUI(const bool autoup)
 
 template<class T> void ObjRegistry<T>::UpdateUI()
 {
+   ObjRegistry<T> *pScope=this->GetScopeRegistry();
+   if(0!=pScope) {pScope->UpdateUI();return;}
    #ifdef __WX__CRYST__
    for(unsigned int i=0;i<this->GetNb();i++)
    {
@@ -1132,29 +1226,59 @@ template<class T> void ObjRegistry<T>::UpdateUI()
 
 template<class T> std::size_t ObjRegistry<T>::size() const
 {
+   ObjRegistry<T> *pScope=this->GetScopeRegistry();
+   if(0!=pScope) return pScope->size();
    return (std::size_t) mvpRegistry.size();
 }
 
 template<class T> typename vector<T*>::const_iterator ObjRegistry<T>::begin() const
 {
+   ObjRegistry<T> *pScope=this->GetScopeRegistry();
+   if(0!=pScope) return pScope->begin();
    return mvpRegistry.begin();
 }
 
 template<class T> typename vector<T*>::const_iterator ObjRegistry<T>::end() const
 {
+   ObjRegistry<T> *pScope=this->GetScopeRegistry();
+   if(0!=pScope) return pScope->end();
    return mvpRegistry.end();
 }
 
 template<class T> typename list<T*>::const_iterator ObjRegistry<T>::list_begin() const
 {
+   ObjRegistry<T> *pScope=this->GetScopeRegistry();
+   if(0!=pScope) return pScope->list_begin();
    return mvpRegistryList.begin();
 }
 
 template<class T> typename list<T*>::const_iterator ObjRegistry<T>::list_end() const
 {
+   ObjRegistry<T> *pScope=this->GetScopeRegistry();
+   if(0!=pScope) return pScope->list_end();
    return mvpRegistryList.end();
 }
 
+/// Create a registry, to replace a global one in a RegistryScope
+template<class T> static void* NewScopeRegistry()
+{
+   return new ObjRegistry<T>("Thread scope registry");
+}
+
+/// Destroy a registry created by NewScopeRegistry()
+template<class T> static void DeleteScopeRegistry(void *p)
+{
+   delete (ObjRegistry<T>*)p;
+}
+
+template<class T> ObjRegistry<T>* ObjRegistry<T>::GetScopeRegistry() const
+{
+   if(!mIsGlobal) return 0;
+   RegistryScope *pScope=RegistryScope::GetCurrent();
+   if(0==pScope) return 0;
+   return (ObjRegistry<T>*)pScope->GetRegistry(this,&NewScopeRegistry<T>,&DeleteScopeRegistry<T>);
+}
+
 #ifdef __WX__CRYST__
 template<class T> WXRegistry<T>* ObjRegistry<T>::WXCreate(wxWindow *parent)
 {
@@ -1207,11 +1331,11 @@ void GetSubRefObjListClockRecursive(ObjRegistry<RefinableObj> &reg,RefinableObjC
 //    RefinableObj
 //######################################################################
 
-ObjRegistry<RefinableObj> gRefinableObjRegistry("Global RefinableObj registry");
-ObjRegistry<RefinableObj> gTopRefinableObjRegistry("Global Top RefinableObj registry");
+ObjRegistry<RefinableObj> gRefinableObjRegistry("Global RefinableObj registry",true);
+ObjRegistry<RefinableObj> gTopRefinableObjRegistry("Global Top RefinableObj registry",true);
 
 RefinableObj::RefinableObj():
-mName(""),
+mName(""),mParamSetStride(0),
 mNbRefParNotFixed(-1),mOptimizationDepth(0),mDeleteRefParInDestructor(true)
 #ifdef __WX__CRYST__
 ,mpWXCrystObj(0)
@@ -1225,7 +1349,7 @@ mNbRefParNotFixed(-1),mOptimizationDepth(0),mDeleteRefParInDestructor(true)
    VFN_DEBUG_MESSAGE("RefinableObj::RefinableObj():End",2)
 }
 RefinableObj::RefinableObj(const bool internalUseOnly):
-mName(""),
+mName(""),mParamSetStride(0),
 mNbRefParNotFixed(-1),mOptimizationDepth(0),mDeleteRefParInDestructor(true)
 #ifdef __WX__CRYST__
 ,mpWXCrystObj(0)
@@ -1239,7 +1363,7 @@ mNbRefParNotFixed(-1),mOptimizationDepth(0),mDeleteRefParInDestructor(true)
    VFN_DEBUG_MESSAGE("RefinableObj::RefinableObj(bool):End",2)
 }
 
-RefinableObj::RefinableObj(const RefinableObj &old) {}
+RefinableObj::RefinableObj(const RefinableObj &old):mParamSetStride(0) {}
 /*
 RefinableObj::RefinableObj(const RefinableObj &old):
 mName(old.mName),mMaxNbRefPar(old.mMaxNbRefPar),mSavedValuesSetIsUsed(mMaxNbSavedSets),
@@ -1543,12 +1667,21 @@ unsigned long RefinableObj::CreateParamSet(const string name) const
 {
    VFN_DEBUG_ENTRY("RefinableObj::CreateParamSet()",3)
    unsigned long id;
-   for(id=0;id<=mvpSavedValuesSet.size();id++)
-      if(mvpSavedValuesSet.end()==mvpSavedValuesSet.find(id)) break;
-
-   pair< CrystVector_REAL ,string> p;
-   p.second=name;
-   mvpSavedValuesSet.insert(make_pair(id,p));
+   for(id=0;id<mvParamSetIsUsed.size();id++)
+      if(!mvParamSetIsUsed[id]) break;
+   if(id==mvParamSetIsUsed.size())
+   {
+      mvParamSet.push_back(CrystVector_REAL());
+      mvParamSetName.push_back(name);
+      mvParamSetIsUsed.push_back(true);
+   }
+   else
+   {
+      mvParamSetName[id]=name;
+      mvParamSetIsUsed[id]=true;
+   }
+   mvParamSet[id].resize(mvpRefPar.size());
+   this->LayoutParamSetArena(mvParamSet.size(),mvpRefPar.size());
 
    this->SaveParamSet(id);
    VFN_DEBUG_MESSAGE("RefinableObj::CreateParamSet(): new parameter set with id="<<id<<" and name:"<<name,2)
@@ -1559,65 +1692,84 @@ unsigned long RefinableObj::CreateParamSet(const string name) const
 void RefinableObj::ClearParamSet(const unsigned long id)const
 {
    VFN_DEBUG_ENTRY("RefinableObj::ClearParamSet()",2)
-   mvpSavedValuesSet.erase(this->FindParamSet(id));
+   this->FindParamSet(id).resize(0);
+   mvParamSetName[id]="";
+   mvParamSetIsUsed[id]=false;
    VFN_DEBUG_EXIT("RefinableObj::ClearParamSet()",2)
 }
 
 void RefinableObj::SaveParamSet(const unsigned long id)const
 {
    VFN_DEBUG_MESSAGE("RefinableObj::SaveRefParSet()",2)
-   map<unsigned long,pair<CrystVector_REAL,string> >::iterator pos=this->FindParamSet(id);
-   pos->second.first.resize(mvpRefPar.size());
-   REAL *p=pos->second.first.data();
-   for(long i=0;i<this->GetNbPar();i++) *p++ = this->GetPar(i).GetValue();
+   CrystVector_REAL *pSet=&(this->FindParamSet(id));
+   if(pSet->numElements()!=(long)mvpRefPar.size())
+   {
+      pSet->resize(mvpRefPar.size());
+      this->LayoutParamSetArena(mvParamSet.size(),mvpRefPar.size());
+   }
+   REAL *p=pSet->data();
+   for(vector<RefinablePar*>::const_iterator pos=mvpRefPar.begin();pos!=mvpRefPar.end();++pos)
+      *p++ = *((*pos)->mpValue);
 }
 
 void RefinableObj::RestoreParamSet(const unsigned long id)
 {
    VFN_DEBUG_MESSAGE("RefinableObj::RestoreRefParSet()",2)
-   map<unsigned long,pair<CrystVector_REAL,string> >::iterator pos=this->FindParamSet(id);
-   REAL *p=pos->second.first.data();
-   for(long i=0;i<this->GetNbPar();i++)
+   const REAL *p=this->FindParamSet(id).data();
+   // Change all values first, and then click each modified clock only once,
+   // in the order of the last modified parameter using it.
+   static thread_local vector<RefinableObjClock*> vClock;
+   vClock.clear();
+   for(vector<RefinablePar*>::iterator pos=mvpRefPar.begin();pos!=mvpRefPar.end();++pos,++p)
    {
       //if( !this->GetPar(i).IsFixed() && this->GetPar(i).IsUsed())
-      if(this->GetPar(i).IsUsed())
-         this->GetPar(i).SetValue(*p);
-      p++;
+      if(!(*pos)->IsUsed()) continue;
+      if(!(*pos)->SetValueNoClick(*p)) continue;
+      if(!(*pos)->mHasAssignedClock) continue;
+      if((vClock.size()==0)||(vClock.back()!=(*pos)->mpClock)) vClock.push_back((*pos)->mpClock);
    }
+   if(vClock.size()==0) return;
+   static thread_local vector<RefinableObjClock*> vClick;
+   vClick.clear();
+   for(vector<RefinableObjClock*>::reverse_iterator pos=vClock.rbegin();pos!=vClock.rend();++pos)
+      if(find(vClick.begin(),vClick.end(),*pos)==vClick.end()) vClick.push_back(*pos);
+   for(vector<RefinableObjClock*>::reverse_iterator pos=vClick.rbegin();pos!=vClick.rend();++pos)
+      (*pos)->Click();
 }
 
 const CrystVector_REAL & RefinableObj::GetParamSet(const unsigned long id)const
 {
    VFN_DEBUG_MESSAGE("RefinableObj::GetParamSet() const",2)
-   map<unsigned long,pair<CrystVector_REAL,string> >::const_iterator pos=this->FindParamSet(id);
-   return pos->second.first;
+   return this->FindParamSet(id);
 }
 
 CrystVector_REAL & RefinableObj::GetParamSet(const unsigned long id)
 {
    VFN_DEBUG_MESSAGE("RefinableObj::GetParamSet()",2)
-   map<unsigned long,pair<CrystVector_REAL,string> >::iterator pos=this->FindParamSet(id);
-   return pos->second.first;
+   return this->FindParamSet(id);
 }
 
 REAL RefinableObj::GetParamSet_ParNotFixedHumanValue(const unsigned long id,
                                                       const long par)const
 {
    VFN_DEBUG_MESSAGE("RefinableObj::RefParSetNotFixedHumanValue()",0)
-   map<unsigned long,pair<CrystVector_REAL,string> >::iterator pos=this->FindParamSet(id);
-   return pos->second.first(mRefparNotFixedIndex(par));
+   return this->FindParamSet(id)(mRefparNotFixedIndex(par));
 }
 
 const void RefinableObj::EraseAllParamSet()
 {
-   mvpSavedValuesSet.clear();
+   mvParamSet.clear();
+   mvParamSetName.clear();
+   mvParamSetIsUsed.clear();
+   mParamSetArena.resize(0);
+   mParamSetStride=0;
 }
 
 const string& RefinableObj::GetParamSetName(const unsigned long id)const
 {
    VFN_DEBUG_MESSAGE("RefinableObj::GetParamSetName()",2)
-   map<unsigned long,pair<CrystVector_REAL,string> >::const_iterator pos=this->FindParamSet(id);
-   return pos->second.second;
+   this->FindParamSet(id);
+   return mvParamSetName[id];
 }
 
 void RefinableObj::SetLimitsAbsolute(const string &name,const REAL min,const REAL max)
@@ -1755,13 +1907,13 @@ void RefinableObj::RandomizeConfiguration()
       {
          const REAL min=this->GetParNotFixed(j).GetMin();
          const REAL max=this->GetParNotFixed(j).GetMax();
-         this->GetParNotFixed(j).MutateTo(min+(max-min)*(rand()/(REAL)RAND_MAX) );
+         this->GetParNotFixed(j).MutateTo(min+(max-min)*RandomUniform() );
       }
       else
          if(true==this->GetParNotFixed(j).IsPeriodic())
          {
 
-            this->GetParNotFixed(j).MutateTo((rand()/(REAL)RAND_MAX)
+            this->GetParNotFixed(j).MutateTo(RandomUniform()
                   * this->GetParNotFixed(j).GetPeriod());
          }
    }
@@ -1779,7 +1931,7 @@ void RefinableObj::GlobalOptRandomMove(const REAL mutationAmplitude,
    {
       if(this->GetParNotFixed(j).GetType()->IsDescendantFromOrSameAs(type))
          this->GetParNotFixed(j).Mutate( this->GetParNotFixed(j).GetGlobalOptimStep()
-                     *2*(rand()/(REAL)RAND_MAX-0.5)*mutationAmplitude);
+                     *2*(RandomUniform()-0.5)*mutationAmplitude);
    }
    for(int i=0;i<mSubObjRegistry.GetNb();i++)
       mSubObjRegistry.GetObj(i).GlobalOptRandomMove(mutationAmplitude,type);
@@ -1865,6 +2017,11 @@ std::map<RefinablePar*, CrystVector_REAL> & RefinableObj::GetLSQ_FullDeriv(const
    return mLSQ_FullDeriv[n];
 }
 
+bool RefinableObj::IsLSQDerivStepIndependent(const unsigned int,const RefinablePar &)const
+{
+   return false;
+}
+
 void RefinableObj::ResetParList()
 {
    VFN_DEBUG_MESSAGE("RefinableObj::ResetParList()",3)
@@ -1945,6 +2102,28 @@ void RefinableObj::SetDeleteRefParInDestructor(const bool b) {mDeleteRefParInDes
 
 const RefinableObjClock& RefinableObj::GetRefParListClock()const{return mRefParListClock;}
 
+void RefinableObj::CopyParAndOptions(const RefinableObj &old)
+{
+   VFN_DEBUG_ENTRY("RefinableObj::CopyParAndOptions():"<<old.GetName()<<"->"<<this->GetName(),5)
+   for(unsigned int i=0;i<old.GetNbOption();i++)
+   {
+      const long j=mOptionRegistry.Find(old.GetOption(i).GetName());
+      if(j>=0) mOptionRegistry.GetObj(j).SetChoice(old.GetOption(i).GetChoice());
+   }
+   for(long i=0;i<old.GetNbPar();i++)
+   {
+      const RefinablePar *pOld=&(old.GetPar(i));
+      long j=i;// Most of the time parameters are in the same order
+      if((j>=this->GetNbPar())||(this->GetPar(j).GetName()!=pOld->GetName()))
+         j=this->FindPar(pOld->GetName());
+      if(j<0) continue;
+      RefinablePar *pNew=&(this->GetPar(j));
+      pNew->CopyAttributes(*pOld);
+      pNew->SetValue(pOld->GetValue());
+   }
+   VFN_DEBUG_EXIT("RefinableObj::CopyParAndOptions()",5)
+}
+
 REAL  RefinableObj::GetRestraintCost()const
 {
    vector<Restraint*>::const_iterator pos;
@@ -2055,18 +2234,56 @@ void RefinableObj::Prepare()
       this->GetSubObjRegistry().GetObj(i).Prepare();
 }
 
-map<unsigned long,pair<CrystVector_REAL,string> >::iterator
-   RefinableObj:: FindParamSet(const unsigned long id)const
+CrystVector_REAL& RefinableObj::FindParamSet(const unsigned long id)const
 {
-   VFN_DEBUG_ENTRY("RefinableObj::FindParamSet()",2)
-   map<unsigned long,pair<CrystVector_REAL,string> >::iterator pos;
-   pos=mvpSavedValuesSet.find(id);
-   if(mvpSavedValuesSet.end() == pos)
+   VFN_DEBUG_MESSAGE("RefinableObj::FindParamSet()",2)
+   if((id>=mvParamSetIsUsed.size())||(!mvParamSetIsUsed[id]))
    {//throw up
       throw ObjCrystException("RefinableObj::FindParamSet(long): Unknown saved set ! In object:"+this->GetName());
    }
-   VFN_DEBUG_EXIT("RefinableObj::FindParamSet()",2)
-   return pos;
+   return mvParamSet[id];
+}
+
+void RefinableObj::LayoutParamSetArena(const unsigned long nbSlot,const long minStride)const
+{
+   long stride=(mParamSetStride>minStride)?mParamSetStride:minStride;
+   for(unsigned long i=0;i<mvParamSet.size();i++)
+      if(mvParamSet[i].numElements()>stride) stride=mvParamSet[i].numElements();
+   // Are all sets already in place ?
+   if(  (stride==mParamSetStride)
+      &&(mParamSetArena.numElements()>=(long)(nbSlot*stride)))
+   {
+      bool inPlace=true;
+      for(unsigned long i=0;i<mvParamSet.size();i++)
+         if(  (mvParamSet[i].numElements()>0)
+            &&(mvParamSet[i].data()!=(mParamSetArena.data()+i*stride)))
+         {
+            inPlace=false;
+            break;
+         }
+      if(inPlace) return;
+   }
+   VFN_DEBUG_MESSAGE("RefinableObj::LayoutParamSetArena():"<<nbSlot<<"x"<<stride,2)
+   // Keep a copy of the values, since sets may reference the current arena
+   const vector<CrystVector_REAL> vOld(mvParamSet.begin(),mvParamSet.end());
+   // Leave room for more sets, to avoid moving all sets each time one is created
+   unsigned long nbAlloc=(mParamSetStride>0)?mParamSetArena.numElements()/mParamSetStride:0;
+   if(nbAlloc<nbSlot) nbAlloc=(2*nbSlot>8)?2*nbSlot:8;
+   mParamSetStride=stride;
+   mParamSetArena.resize(nbAlloc*stride);
+   for(unsigned long i=0;i<mvParamSet.size();i++)
+   {
+      const long nb=vOld[i].numElements();
+      if(nb==0)
+      {
+         mvParamSet[i].resize(0);
+         continue;
+      }
+      mvParamSet[i].reference(mParamSetArena,i*stride,i*stride+nb);
+      const REAL *p0=vOld[i].data();
+      REAL *p1=mvParamSet[i].data();
+      for(long j=0;j<nb;j++) *p1++ = *p0++;
+   }
 }
 
 #ifdef __WX__CRYST__
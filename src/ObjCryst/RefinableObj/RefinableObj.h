@@ -30,7 +30,9 @@
 #include <vector>
 #include <list>
 #include <map>
+#include <deque>
 #include <set>
+#include <atomic>
 
 #include "ObjCryst/CrystVector/CrystVector.h"
 #include "ObjCryst/ObjCryst/General.h"
@@ -136,6 +138,10 @@ static NiftyStaticGlobalObjectsInitializer_RefinableObj NiftyStaticGlobalObjects
 /// This is purely internal, so don't worry about it...
 ///
 /// The clock values have nothing to do with 'time' as any normal person undertands it.
+///
+/// The event counter is atomic, so that independent objects (which do not share
+/// any clock) can be modified and computed in different threads. A given clock
+/// and all its parents must only be used by one thread at a time.
 class RefinableObjClock
 {
    public:
@@ -170,8 +176,21 @@ class RefinableObjClock
       void operator=(const RefinableObjClock &rhs);
    private:
       bool HasParent(const RefinableObjClock &) const;
-      unsigned long mTick0, mTick1;
-      static unsigned long msTick0,msTick1;
+      /// Update mNbClick for this clock and (recursively) all its children, after
+      /// the list of parents changed.
+      void UpdateNbClick()const;
+      /// Set the clock to ++tick, and then click all parents with the following values.
+      void Click(unsigned long long &tick);
+      /// The value of this clock
+      unsigned long long mTick;
+      /// Number of clocks clicked by Click(), i.e. this clock and (recursively) all its
+      /// parents - a parent reached through several children is counted several times.
+      /// It is updated when parents are added or removed, so that Click() only needs
+      /// to go once through the parents.
+      mutable unsigned long mNbClick;
+      /// The global event counter. Click() reserves at once the values needed
+      /// for this clock and its parents, so only one atomic operation is needed.
+      alignas(64) static std::atomic<unsigned long long> msTick;
       /// List of 'child' clocks, which will click this clock whenever they are clicked.
       std::set<const RefinableObjClock*> mvChild;
       /// List of parent clocks, which will be clicked whenever this one is. This
@@ -421,6 +440,8 @@ class RefinablePar:public Restraint
          REAL GetDerivStep()const;
          ///Fixed step to use to compute numerical derivative
          void  SetDerivStep(const REAL);
+         ///Is the derivative step absolute, or relative to the parameter value ?
+         RefParDerivStepModel GetDerivStepModel()const;
 
          ///Maximum step to use during Global Optimization algorithms
          REAL GetGlobalOptimStep()const;
@@ -485,6 +506,12 @@ class RefinablePar:public Restraint
    private:
       /// Click the Clock ! to telle the RefinableObj it has been modified.
       void Click();
+      /** \internal Change the value (within limits), without clicking the clock.
+      * Used by SetValue(), and by RefinableObj::RestoreParamSet() to click each clock
+      * only once.
+      * \return true if the value has changed
+      */
+      bool SetValueNoClick(const REAL value);
       ///name of the refinable parameter
       string mName;
       /// Pointer to the refinable value
@@ -626,6 +653,51 @@ template<class T> class RefObjOption:public RefObjOpt
       void (T::*mfpSetNewValue)(const int);
 };
 
+/** \brief Thread-local replacement for the global object registries
+*
+* Objects derived from RefinableObj register themselves at construction in global
+* registries (gRefinableObjRegistry, gCrystalRegistry, gPowderPatternRegistry,...),
+* which are used e.g. to find objects by name when loading an XML file.
+*
+* While a RegistryScope exists in a thread, all global registries used from this
+* thread are replaced by (initially empty) registries owned by the scope: objects
+* created in this thread are only registered there, and searches by name or
+* XMLCrystFileSaveGlobal() only see these objects. This allows independent jobs
+* (e.g. refinements of different datasets, see LSQJobQueue) to run concurrently
+* in different threads of the same process, without sharing any global registry.
+*
+* Objects created in a scope must be destroyed (in the same thread) before the end
+* of the scope. Scopes can be nested, the innermost one being used.
+*
+* An object created outside a scope and destroyed inside one is not found in the
+* scope registry, and is then de-registered from the global registry. This accesses
+* the global registry, so it must not happen while other threads use it.
+*/
+class RegistryScope
+{
+   public:
+      /// Create the scope, which becomes the active one for the current thread.
+      RegistryScope();
+      /// End the scope. The previous scope of this thread (if any) becomes active.
+      ~RegistryScope();
+      /// The scope active in the current thread, or 0 if global registries are used.
+      static RegistryScope* GetCurrent();
+      /** Get the registry replacing a global one in this scope.
+      *
+      * \internal this is used by ObjRegistry. The replacement registry is created
+      * using create() the first time it is requested, and destroyed using destroy()
+      * at the end of the scope.
+      */
+      void* GetRegistry(const void *global,void* (*create)(),void (*destroy)(void*));
+   private:
+      RegistryScope(const RegistryScope&);
+      RegistryScope& operator=(const RegistryScope&);
+      /// Replacement registries, and the function to destroy them
+      std::map<const void*,std::pair<void*,void (*)(void*)> > mvRegistry;
+      /// Scope active in this thread before this one
+      RegistryScope *mpPrevious;
+};
+
 /** Object Registry
 *
 *  This class is used to keep a list of all object of a given class at the global
@@ -637,6 +709,9 @@ template<class T> class RefObjOption:public RefObjOpt
 *  \warning the order of the objects in the registry can change (every time an object
 *  is de-registered).
 *
+*  Global registries (created with global=true) are replaced by another registry
+*  in threads where a RegistryScope is active.
+*
 * \todo (?) create two derived classes with the same interface, one which is a const
 * registry (the 'client' registry for RefinableObj), and one which has a non-const
 * access to the registered objects (the 'sub-objects' in RefinableObj).
@@ -646,10 +721,14 @@ template<class T> class ObjRegistry
    public:
       ObjRegistry();
       ObjRegistry(const string &name);
+      /// Constructor. If global=true, this registry is replaced by a thread-local
+      /// one when a RegistryScope is active in the calling thread.
+      ObjRegistry(const string &name,const bool global);
       ~ObjRegistry();
       /// Register a new object. Already registered objects are skipped.
       void Register(T &obj);
-      /// De-register an object.
+      /// De-register an object. If a RegistryScope is active and the object is not
+      /// in the scope registry, it is de-registered from this (global) registry.
       void DeRegister(T &obj);
       /// De-register an object from its name.
       void DeRegister(const string &objName);
@@ -744,6 +823,11 @@ template<class T> class ObjRegistry
        */
       typename std::list<T*>::const_iterator list_end() const;
    private:
+      /// The registry replacing this one in the current thread (see RegistryScope),
+      /// or 0 if this one should be used.
+      ObjRegistry<T>* GetScopeRegistry()const;
+      /// Is this a global registry, replaced in a RegistryScope ?
+      bool mIsGlobal;
       /// The registry of objects
       vector<T*> mvpRegistry;
       /// Another view of the registry of objects - this time as a std::list, which
@@ -1135,6 +1219,13 @@ class RefinableObj
          * \todo
          */
          virtual std::map<RefinablePar*, CrystVector_REAL> & GetLSQ_FullDeriv(const unsigned int,std::set<RefinablePar *> &vPar);
+         /** Are the derivatives of the LSQ function for this parameter independent of the
+         * derivative step of the parameter, i.e. computed analytically and exact for any
+         * step with numerical derivatives (e.g. for parameters on which the function
+         * depends linearly) ? This is used by LSQNumObj::OptimizeDerivativeSteps()
+         * to skip these parameters. Returns false by default.
+         */
+         virtual bool IsLSQDerivStepIndependent(const unsigned int,const RefinablePar &par)const;
 
       /// Re-init the list of refinable parameters, removing all parameters.
       /// This does \e not delete the RefinablePar if
@@ -1210,6 +1301,14 @@ class RefinableObj
       *
       */
       const RefinableObjClock& GetRefParListClock()const;
+      /** Copy the value and attributes (limits, fixed, step,...) of all parameters,
+      * and the choice for all options, from another object.
+      *
+      * Parameters and options are matched by name, and those which do not exist in
+      * this object are ignored. This is used to finish the copy of an object, after
+      * its structure (atoms, components,...) has been re-created.
+      */
+      void CopyParAndOptions(const RefinableObj &old);
       // Restraints
          /** Get the restraint cost (overall penalty of all restraints)
          *
@@ -1257,7 +1356,11 @@ class RefinableObj
       virtual void Prepare();
 
       /// Find a parameter set with a given id (and check if it is there)
-      map<unsigned long,pair<CrystVector_REAL,string> >::iterator FindParamSet(unsigned long id)const;
+      CrystVector_REAL& FindParamSet(unsigned long id)const;
+      /** \internal Place all parameter sets in mParamSetArena, if they are not already
+      * there, with room for at least nbSlot sets of minStride values.
+      */
+      void LayoutParamSetArena(const unsigned long nbSlot,const long minStride)const;
 
       ///Name for this RefinableObject. Should be unique, at least in the same scope.+
       string mName;
@@ -1271,12 +1374,22 @@ class RefinableObj
          vector<Restraint*> mvpRestraint;
 
       //Saved sets of parameters
-         /// Map of (index,pointers to arrays) used to save sets of values for all parameters.
+         /// Saved sets of values for all parameters, indexed by their id. Each set
+         /// references a slice of mParamSetArena, so that all sets are stored contiguously.
+         /// A deque is used so that references to a set remain valid when sets are added.
          /// Currently there is no limit to the number of saved sets.
          ///
-         /// This is mutable since creating/storing a param set does not affect the
+         /// These are mutable since creating/storing a param set does not affect the
          /// 'real' part of the object.
-         mutable map<unsigned long,pair<CrystVector_REAL,string> >  mvpSavedValuesSet;
+         mutable std::deque<CrystVector_REAL> mvParamSet;
+         /// Name of each saved set
+         mutable vector<string> mvParamSetName;
+         /// Is the slot for each id used by a saved set ?
+         mutable vector<bool> mvParamSetIsUsed;
+         /// Storage for all saved sets, with mParamSetStride values for each id
+         mutable CrystVector_REAL mParamSetArena;
+         /// Number of values stored for each id in mParamSetArena
+         mutable long mParamSetStride;
 
       // Used during refinements, initialized by PrepareForRefinement()
          /// Total of not-fixed parameters
@@ -1346,6 +1459,17 @@ void GetRefParListClockRecursive(ObjRegistry<RefinableObj> &reg,RefinableObjCloc
 template<class T> void RefObjRegisterRecursive(T &obj,ObjRegistry<T> &reg);
 /// Get the last time any object was added in the recursive list of objects.
 void GetSubRefObjListClockRecursive(ObjRegistry<RefinableObj> &reg,RefinableObjClock &clock);
+/** Get the copy of an object, from a map of (original, copy) objects as filled
+* by the Clone() functions (e.g. Crystal::Clone()).
+*
+* \return the copy of \e obj, or 0 if it has not been copied.
+*/
+template<class T> T* FindCopy(const T &obj,const std::map<const RefinableObj*,RefinableObj*> &vCopy)
+{
+   std::map<const RefinableObj*,RefinableObj*>::const_iterator pos=vCopy.find(&obj);
+   if(pos==vCopy.end()) return 0;
+   return dynamic_cast<T*>(pos->second);
+}
 
 /// Global Registry for all RefinableObj
 extern ObjRegistry<RefinableObj> gRefinableObjRegistry;
@@ -19,6 +19,7 @@
 *  source file ObjCryst++ Tracker class
 *
 */
+#include <algorithm>
 #include "ObjCryst/RefinableObj/Tracker.h"
 
 using namespace std;
@@ -30,26 +31,114 @@ namespace ObjCryst
 //    Tracker
 //
 ////////////////////////////////////////////////////////////////////////
+/// Default number of values stored by each tracker
+static const unsigned long sTrackerDefaultCapacity=16384;
+
 Tracker::Tracker(const string &name)
-:mName(name)
+:mName(name),mpSample(new Sample[sTrackerDefaultCapacity]),mCapacity(sTrackerDefaultCapacity),
+mNbStored(0),mNbWriting(0),mFirst(0),mDecimation(1),mNbAppend(0)
 {}
 
 Tracker::~Tracker()
 {}
 
 const string& Tracker::GetName()const{return mName;}
+
 void Tracker::AppendValue(const long n)
-{mvValues[n]=this->ReadValue();}
+{
+   if((mNbAppend++%mDecimation)!=0) return;
+   this->AppendValue(n,this->ReadValue());
+}
+
+void Tracker::AppendValue(const long trial,const REAL value)
+{
+   const uint64_t i=mNbStored.load(std::memory_order_relaxed);
+   if(i>mFirst.load(std::memory_order_relaxed))
+   {// Same trial as the last value: replace it
+      Sample *s=&(mpSample[(i-1)%mCapacity]);
+      if(s->mTrial.load(std::memory_order_relaxed)==trial)
+      {
+         s->mValue.store(value,std::memory_order_release);
+         return;
+      }
+   }
+   // Tell readers this sample is being overwritten, before writing it
+   mNbWriting.store(i+1,std::memory_order_relaxed);
+   std::atomic_thread_fence(std::memory_order_release);
+   Sample *s=&(mpSample[i%mCapacity]);
+   s->mTrial.store(trial,std::memory_order_relaxed);
+   s->mValue.store(value,std::memory_order_relaxed);
+   mNbStored.store(i+1,std::memory_order_release);
+}
 
 void Tracker::Clear()
 {
-   mvValues.clear();
+   mFirst.store(mNbStored.load(std::memory_order_relaxed),std::memory_order_release);
+   mNbAppend=0;
 }
 
-const std::map<long,REAL>& Tracker::GetValues()const{return mvValues;}
-std::map<long,REAL>& Tracker::GetValues(){return mvValues;}
+std::map<long,REAL> Tracker::GetValues()const
+{
+   std::vector<std::pair<long,REAL> > v;
+   this->GetLatestValues(v,mCapacity);
+   std::map<long,REAL> m;
+   for(std::vector<std::pair<long,REAL> >::const_iterator pos=v.begin();pos!=v.end();++pos)
+      m[pos->first]=pos->second;
+   return m;
+}
 
+unsigned long Tracker::GetLatestValues(std::vector<std::pair<long,REAL> > &v,
+                                       const unsigned long nb)const
+{
+   const uint64_t end=mNbStored.load(std::memory_order_acquire);
+   uint64_t first=mFirst.load(std::memory_order_acquire);
+   if(first>end) first=end;
+   if((end-first)>mCapacity) first=end-mCapacity;
+   if((end-first)>nb) first=end-nb;
+   v.resize(end-first);
+   for(uint64_t i=first;i<end;i++)
+   {
+      const Sample *s=&(mpSample[i%mCapacity]);
+      v[i-first]=std::make_pair(s->mTrial.load(std::memory_order_relaxed),
+                                s->mValue.load(std::memory_order_relaxed));
+   }
+   // Discard the values which may have been overwritten during the copy
+   std::atomic_thread_fence(std::memory_order_acquire);
+   const uint64_t writing=mNbWriting.load(std::memory_order_relaxed);
+   if(writing>(first+mCapacity))
+   {
+      const uint64_t nbLost=std::min((uint64_t)v.size(),writing-first-mCapacity);
+      v.erase(v.begin(),v.begin()+nbLost);
+   }
+   return v.size();
+}
 
+uint64_t Tracker::GetNbValueStored()const
+{return mNbStored.load(std::memory_order_acquire);}
+
+void Tracker::SetCapacity(const unsigned long nb)
+{
+   if((nb==mCapacity)||(nb==0)) return;
+   std::vector<std::pair<long,REAL> > v;
+   this->GetLatestValues(v,nb);
+   mpSample.reset(new Sample[nb]);
+   mCapacity=nb;
+   mNbStored.store(0);
+   mNbWriting.store(0);
+   mFirst.store(0);
+   for(std::vector<std::pair<long,REAL> >::const_iterator pos=v.begin();pos!=v.end();++pos)
+      this->AppendValue(pos->first,pos->second);
+}
+
+unsigned long Tracker::GetCapacity()const{return mCapacity;}
+
+void Tracker::SetDecimation(const unsigned long nb)
+{
+   mDecimation=(nb==0)?1:nb;
+   mNbAppend=0;
+}
+
+unsigned long Tracker::GetDecimation()const{return mDecimation;}
 
 ////////////////////////////////////////////////////////////////////////
 //
@@ -57,7 +146,8 @@ std::map<long,REAL>& Tracker::GetValues(){return mvValues;}
 //
 ////////////////////////////////////////////////////////////////////////
 
-MainTracker::MainTracker()
+MainTracker::MainTracker():
+mCapacity(sTrackerDefaultCapacity),mDecimation(1)
 {
    #ifdef __WX__CRYST__
    mpWXTrackerGraph=0;
@@ -73,6 +163,8 @@ MainTracker::~MainTracker()
 }
 void MainTracker::AddTracker(Tracker *t)
 {
+   t->SetCapacity(mCapacity);
+   t->SetDecimation(mDecimation);
    mvpTracker.insert(t);
    mClockTrackerList.Click();
    this->UpdateDisplay();
@@ -80,11 +172,33 @@ void MainTracker::AddTracker(Tracker *t)
 
 void MainTracker::AppendValues(const long nb)
 {
+   if(mvpTracker.size()==0) return;
+   const uint64_t nbStored=(*mvpTracker.begin())->GetNbValueStored();
    for(std::set<Tracker*>::iterator pos=mvpTracker.begin(); pos!=mvpTracker.end();++pos)
       (*pos)->AppendValue(nb);
-   mClockValues.Click();
+   // Only record a change if values were stored (and not skipped by decimation)
+   if((*mvpTracker.begin())->GetNbValueStored()!=nbStored) mClockValues.Click();
+}
+
+void MainTracker::SetCapacity(const unsigned long nb)
+{
+   if(nb==0) return;
+   mCapacity=nb;
+   for(std::set<Tracker*>::iterator pos=mvpTracker.begin(); pos!=mvpTracker.end();++pos)
+      (*pos)->SetCapacity(nb);
 }
 
+unsigned long MainTracker::GetCapacity()const{return mCapacity;}
+
+void MainTracker::SetDecimation(const unsigned long nb)
+{
+   mDecimation=(nb==0)?1:nb;
+   for(std::set<Tracker*>::iterator pos=mvpTracker.begin(); pos!=mvpTracker.end();++pos)
+      (*pos)->SetDecimation(mDecimation);
+}
+
+unsigned long MainTracker::GetDecimation()const{return mDecimation;}
+
 void MainTracker::ClearTrackers()
 {
    std::set<Tracker*>::iterator pos;
@@ -104,21 +218,24 @@ void MainTracker::ClearValues()
 
 void MainTracker::SaveAll(std::ostream &os)const
 {
-   std::set<Tracker*>::const_iterator posT,posT0;
+   std::set<Tracker*>::const_iterator posT;
    os<<"#Trial ";
    for(posT=mvpTracker.begin();posT!=mvpTracker.end();++posT) os<<(*posT)->GetName()<<" ";
    os<<endl;
 
-   posT0=mvpTracker.begin();
+   if(mvpTracker.size()==0) return;
+   std::vector<std::map<long,REAL> > vValues;
+   for(posT=mvpTracker.begin();posT!=mvpTracker.end();++posT)
+      vValues.push_back((*posT)->GetValues());
    std::map<long,REAL>::const_iterator pos0,pos;
-   for(pos0=(*posT0)->GetValues().begin();pos0!=(*posT0)->GetValues().end();++pos0)
+   for(pos0=vValues[0].begin();pos0!=vValues[0].end();++pos0)
    {
       const long k=pos0->first;
       os<<k<<" ";
-      for(posT=mvpTracker.begin();posT!=mvpTracker.end();posT++)
+      for(unsigned int i=0;i<vValues.size();i++)
       {
-         pos=(*posT)->GetValues().find(k);
-         if(pos==(*posT)->GetValues().end()) os << -1.0 <<" ";
+         pos=vValues[i].find(k);
+         if(pos==vValues[i].end()) os << -1.0 <<" ";
          else os << pos->second <<" ";
       }
       os<<endl;
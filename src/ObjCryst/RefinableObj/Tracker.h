@@ -24,8 +24,12 @@
 #define _REFINABLEOBJ_TRACKER_H_
 
 #include <set>
+#include <map>
 #include <vector>
 #include <utility>
+#include <atomic>
+#include <memory>
+#include <stdint.h>
 #include "ObjCryst/RefinableObj/RefinableObj.h"
 
 #ifdef __WX__CRYST__
@@ -42,6 +46,14 @@ namespace ObjCryst
 /** A class to track the variation of parameters as a function
 * of a number of cycles/trials.
 *
+* The values are stored in a preallocated ring buffer: once it is full, the oldest
+* values are overwritten, so that the memory used remains bounded for long
+* optimizations. Optionally only one value out of n is stored (SetDecimation()).
+*
+* Values are appended by a single thread (the optimization), and can be read
+* concurrently from another thread without locks (GetLatestValues(), GetValues()).
+* Only SetCapacity() must not be called while the values are read.
+*
 * This is an abstract base class.
 */
 class Tracker
@@ -50,15 +62,58 @@ class Tracker
       Tracker(const std::string &name);
       virtual ~Tracker();
       const std::string& GetName()const;
+      /// Record the current value (unless it is skipped because of decimation)
       void AppendValue(const long trial);
+      /// Record a given value, ignoring decimation (e.g. to restore saved values)
+      void AppendValue(const long trial,const REAL value);
       /// Removes all stored values
       void Clear();
-      const std::map<long,REAL>& GetValues() const;
-      std::map<long,REAL>& GetValues();
+      /// Copy of all the stored values, as (trial,value) pairs
+      std::map<long,REAL> GetValues() const;
+      /** Copy the latest stored values, in chronological order, as (trial,value)
+      * pairs. This can be called from another thread while values are appended.
+      * \param nb: maximum number of values to copy
+      * \return the number of values copied
+      */
+      unsigned long GetLatestValues(std::vector<std::pair<long,REAL> > &v,
+                                    const unsigned long nb)const;
+      /// Total number of values stored since the creation of the tracker
+      /// (including those which have been overwritten)
+      uint64_t GetNbValueStored()const;
+      /// Maximum number of values stored, before the oldest ones are overwritten.
+      /// The latest values are kept when the capacity is changed.
+      void SetCapacity(const unsigned long nb);
+      unsigned long GetCapacity()const;
+      /// Only store one value out of nb (1 to store all values)
+      void SetDecimation(const unsigned long nb);
+      unsigned long GetDecimation()const;
    protected:
       virtual REAL ReadValue()=0;
-      std::map<long,REAL> mvValues;
       std::string mName;
+   private:
+      /// A (trial,value) pair in the ring buffer. The members are atomic, so that
+      /// they can be read while being overwritten (see GetLatestValues()).
+      struct Sample
+      {
+         std::atomic<long> mTrial;
+         std::atomic<REAL> mValue;
+      };
+      /// The ring buffer
+      std::unique_ptr<Sample[]> mpSample;
+      /// Size of the ring buffer
+      unsigned long mCapacity;
+      /// Number of values stored since the creation of the tracker (the next one
+      /// goes in mpSample[mNbStored%mCapacity])
+      std::atomic<uint64_t> mNbStored;
+      /// Number of values which are being or have been written (mNbStored, or
+      /// mNbStored+1 while a value is being written)
+      std::atomic<uint64_t> mNbWriting;
+      /// Index (in the mNbStored count) of the first value since the last Clear()
+      std::atomic<uint64_t> mFirst;
+      /// Only one value out of mDecimation is stored
+      unsigned long mDecimation;
+      /// Number of calls to AppendValue(trial), for decimation
+      unsigned long mNbAppend;
 };
 
 /** A class to hold all trackers
@@ -70,8 +125,15 @@ class MainTracker
    public:
       MainTracker();
       ~MainTracker();
+      /// Add a tracker, which will use the capacity and decimation of this MainTracker
       void AddTracker(Tracker *t);
       void AppendValues(const long trial);
+      /// Set the maximum number of values stored by each tracker (see Tracker::SetCapacity())
+      void SetCapacity(const unsigned long nb);
+      unsigned long GetCapacity()const;
+      /// Only store one value out of nb for all trackers (see Tracker::SetDecimation())
+      void SetDecimation(const unsigned long nb);
+      unsigned long GetDecimation()const;
       /// Removes all Trackers
       void ClearTrackers();
       /// Removes all stored values
@@ -88,6 +150,10 @@ class MainTracker
       const RefinableObjClock& GetClockValues()const;
    private:
       std::set<Tracker*> mvpTracker;
+      /// Capacity of the trackers
+      unsigned long mCapacity;
+      /// Decimation of the trackers
+      unsigned long mDecimation;
       /// Last time a tracker was added
       RefinableObjClock mClockTrackerList;
       /// Last time values were whanged